@@ -52,6 +52,22 @@ namespace X265_NS {
         m_queueSize = (numEncodes > 1) ? X265_INPUT_QUEUE_SIZE : 1;
         m_passEnc = X265_MALLOC(PassEncoder*, m_numEncodes);
 
+        /* let the encodes of the ladder share one set of worker thread pools,
+         * weighted by --pool-weight, rather than each one sizing its own pools
+         * for the whole machine. This requires all encodes to use the same
+         * libx265 */
+        m_api = cliopt[0].api;
+        m_threadPools = NULL;
+        bool bSameApi = true;
+        for (uint8_t i = 1; i < m_numEncodes; i++)
+            bSameApi &= cliopt[i].api == m_api;
+        if (m_numEncodes > 1 && bSameApi)
+        {
+            m_threadPools = m_api->thread_pools_alloc(cliopt[0].param);
+            for (uint8_t i = 0; i < m_numEncodes; i++)
+                cliopt[i].param->threadPools = m_threadPools;
+        }
+
         for (uint8_t i = 0; i < m_numEncodes; i++)
         {
             m_passEnc[i] = new PassEncoder(i, cliopt[i], this);
@@ -87,6 +103,7 @@ namespace X265_NS {
         m_picIdxReadCnt = X265_MALLOC(ThreadSafeInteger*, m_numEncodes);
         m_analysisWrite = X265_MALLOC(ThreadSafeInteger*, m_numEncodes);
         m_analysisRead = X265_MALLOC(ThreadSafeInteger*, m_numEncodes);
+        m_analysisRefs = X265_MALLOC(int*, m_numEncodes);
         m_readFlag = X265_MALLOC(int*, m_numEncodes);
 
         for (uint8_t pass = 0; pass < m_numEncodes; pass++)
@@ -102,6 +119,7 @@ namespace X265_NS {
             m_picIdxReadCnt[pass] = new ThreadSafeInteger[m_queueSize];
             m_analysisWrite[pass] = new ThreadSafeInteger[m_queueSize];
             m_analysisRead[pass] = new ThreadSafeInteger[m_queueSize];
+            CHECKED_MALLOC_ZERO(m_analysisRefs[pass], int, m_queueSize);
             m_readFlag[pass] = X265_MALLOC(int, m_queueSize);
         }
         return true;
@@ -109,8 +127,26 @@ namespace X265_NS {
         return false;
     }
 
+    /* Called by each encode reading the analysis data at index of the queue
+     * of pass once it is done with it, the last one frees its buffers */
+    void AbrEncoder::releaseAnalysis(uint32_t pass, uint32_t index)
+    {
+        if (!ATOMIC_DEC(&m_analysisRefs[pass][index]))
+            x265_free_analysis_data(m_passEnc[pass]->m_param, &m_analysisBuffer[pass][index]);
+    }
+
     void AbrEncoder::destroy()
     {
+        for (uint8_t pass = 0; pass < m_numEncodes; pass++)
+        {
+            /* analysis data not read by all its encodes, after an abort */
+            for (uint32_t index = 0; index < m_queueSize; index++)
+            {
+                if (m_analysisRefs[pass][index] > 0)
+                    x265_free_analysis_data(m_passEnc[pass]->m_param, &m_analysisBuffer[pass][index]);
+            }
+        }
+
         x265_cleanup(); /* Free library singletons */
         for (uint8_t pass = 0; pass < m_numEncodes; pass++)
         {
@@ -122,6 +158,7 @@ namespace X265_NS {
 
             X265_FREE(m_inputPicBuffer[pass]);
             X265_FREE(m_analysisBuffer[pass]);
+            X265_FREE(m_analysisRefs[pass]);
             X265_FREE(m_readFlag[pass]);
             delete[] m_picIdxReadCnt[pass];
             delete[] m_analysisWrite[pass];
@@ -131,6 +168,7 @@ namespace X265_NS {
         }
         X265_FREE(m_inputPicBuffer);
         X265_FREE(m_analysisBuffer);
+        X265_FREE(m_analysisRefs);
         X265_FREE(m_readFlag);
 
         delete[] m_picWriteCnt;
@@ -143,6 +181,10 @@ namespace X265_NS {
         X265_FREE(m_analysisRead);
 
         X265_FREE(m_passEnc);
+
+        /* all encoders are closed by now */
+        if (m_threadPools)
+            m_api->thread_pools_free(m_threadPools);
     }
 
     PassEncoder::PassEncoder(uint32_t id, CLIOptions cliopt, AbrEncoder *parent)
@@ -216,6 +258,8 @@ namespace X265_NS {
         m_param->analysisSave = m_cliopt.saveLevel ? "save.dat" : NULL;
         m_param->analysisLoad = m_cliopt.loadLevel ? "load.dat" : NULL;
         m_param->bUseAnalysisFile = 0;
+        /* the analysis saved is shared with the encodes reusing it, see shareInfo() */
+        m_param->bAnalysisSaveDetach = m_cliopt.saveLevel && m_parent->m_numEncodes > 1;
 
         if (m_cliopt.loadLevel)
         {
@@ -286,7 +330,7 @@ namespace X265_NS {
         }
     }
 
-    void PassEncoder::copyInfo(x265_analysis_data * src)
+    void PassEncoder::shareInfo(x265_analysis_data * src)
     {
 
         uint32_t written = m_parent->m_analysisWriteCnt[m_id].get();
@@ -315,76 +359,16 @@ namespace X265_NS {
             }
         }
 
-        x265_analysis_data *m_analysisInfo = &m_parent->m_analysisBuffer[m_id][index];
-
-        x265_free_analysis_data(m_param, m_analysisInfo);
-        memcpy(m_analysisInfo, src, sizeof(x265_analysis_data));
-        x265_alloc_analysis_data(m_param, m_analysisInfo);
-
-        bool isVbv = m_param->rc.vbvBufferSize && m_param->rc.vbvMaxBitrate;
-        if (m_param->bDisableLookahead && isVbv)
-        {
-            memcpy(m_analysisInfo->lookahead.intraSatdForVbv, src->lookahead.intraSatdForVbv, src->numCuInHeight * sizeof(uint32_t));
-            memcpy(m_analysisInfo->lookahead.satdForVbv, src->lookahead.satdForVbv, src->numCuInHeight * sizeof(uint32_t));
-            memcpy(m_analysisInfo->lookahead.intraVbvCost, src->lookahead.intraVbvCost, src->numCUsInFrame * sizeof(uint32_t));
-            memcpy(m_analysisInfo->lookahead.vbvCost, src->lookahead.vbvCost, src->numCUsInFrame * sizeof(uint32_t));
-        }
-
-        if (src->sliceType == X265_TYPE_IDR || src->sliceType == X265_TYPE_I)
-        {
-            if (m_param->analysisSaveReuseLevel < 2)
-                goto ret;
-            x265_analysis_intra_data *intraDst, *intraSrc;
-            intraDst = (x265_analysis_intra_data*)m_analysisInfo->intraData;
-            intraSrc = (x265_analysis_intra_data*)src->intraData;
-            memcpy(intraDst->depth, intraSrc->depth, sizeof(uint8_t) * src->depthBytes);
-            memcpy(intraDst->modes, intraSrc->modes, sizeof(uint8_t) * src->numCUsInFrame * src->numPartitions);
-            memcpy(intraDst->partSizes, intraSrc->partSizes, sizeof(char) * src->depthBytes);
-            memcpy(intraDst->chromaModes, intraSrc->chromaModes, sizeof(uint8_t) * src->depthBytes);
-            if (m_param->rc.cuTree)
-                memcpy(intraDst->cuQPOff, intraSrc->cuQPOff, sizeof(int8_t) * src->depthBytes);
-        }
+        /* The buffers of the analysis data are handed over by the encoder
+         * (bAnalysisSaveDetach), the encodes reusing them read them in place,
+         * scaling them to their resolution as they load them, and the last
+         * of them frees them */
+        m_parent->m_analysisBuffer[m_id][index] = *src;
+        if (m_cliopt.numRefs)
+            m_parent->m_analysisRefs[m_id][index] = m_cliopt.numRefs;
         else
-        {
-            bool bIntraInInter = (src->sliceType == X265_TYPE_P || m_param->bIntraInBFrames);
-            int numDir = src->sliceType == X265_TYPE_P ? 1 : 2;
-            memcpy(m_analysisInfo->wt, src->wt, sizeof(WeightParam) * 3 * numDir);
-            if (m_param->analysisSaveReuseLevel < 2)
-                goto ret;
-            x265_analysis_inter_data *interDst, *interSrc;
-            interDst = (x265_analysis_inter_data*)m_analysisInfo->interData;
-            interSrc = (x265_analysis_inter_data*)src->interData;
-            memcpy(interDst->depth, interSrc->depth, sizeof(uint8_t) * src->depthBytes);
-            memcpy(interDst->modes, interSrc->modes, sizeof(uint8_t) * src->depthBytes);
-            if (m_param->rc.cuTree)
-                memcpy(interDst->cuQPOff, interSrc->cuQPOff, sizeof(int8_t) * src->depthBytes);
-            if (m_param->analysisSaveReuseLevel > 4)
-            {
-                memcpy(interDst->partSize, interSrc->partSize, sizeof(uint8_t) * src->depthBytes);
-                memcpy(interDst->mergeFlag, interSrc->mergeFlag, sizeof(uint8_t) * src->depthBytes);
-                if (m_param->analysisSaveReuseLevel == 10)
-                {
-                    memcpy(interDst->interDir, interSrc->interDir, sizeof(uint8_t) * src->depthBytes);
-                    for (int dir = 0; dir < numDir; dir++)
-                    {
-                        memcpy(interDst->mvpIdx[dir], interSrc->mvpIdx[dir], sizeof(uint8_t) * src->depthBytes);
-                        memcpy(interDst->refIdx[dir], interSrc->refIdx[dir], sizeof(int8_t) * src->depthBytes);
-                        memcpy(interDst->mv[dir], interSrc->mv[dir], sizeof(MV) * src->depthBytes);
-                    }
-                    if (bIntraInInter)
-                    {
-                        x265_analysis_intra_data *intraDst = (x265_analysis_intra_data*)m_analysisInfo->intraData;
-                        x265_analysis_intra_data *intraSrc = (x265_analysis_intra_data*)src->intraData;
-                        memcpy(intraDst->modes, intraSrc->modes, sizeof(uint8_t) * src->numPartitions * src->numCUsInFrame);
-                        memcpy(intraDst->chromaModes, intraSrc->chromaModes, sizeof(uint8_t) * src->depthBytes);
-                    }
-               }
-            }
-            if (m_param->analysisSaveReuseLevel != 10)
-                memcpy(interDst->ref, interSrc->ref, sizeof(int32_t) * src->numCUsInFrame * X265_MAX_PRED_MODE_PER_CTU * numDir);
-        }
+            x265_free_analysis_data(m_param, &m_parent->m_analysisBuffer[m_id][index]);
 
-ret:
         //increment analysis Write counter 
         m_parent->m_analysisWriteCnt[m_id].incr();
         m_parent->m_analysisWrite[m_id][index].incr();
@@ -722,6 +706,7 @@ ret:
                     m_parent->m_picReadCnt[m_id].incr();
                     if (m_cliopt.loadLevel && picInput)
                     {
+                        m_parent->releaseAnalysis(m_cliopt.refId, m_lastIdx);
                         m_parent->m_analysisReadCnt[m_cliopt.refId].incr();
                         m_parent->m_analysisRead[m_cliopt.refId][m_lastIdx].incr();
                     }
@@ -740,7 +725,7 @@ ret:
 
                     if (isAbrSave && numEncoded)
                     {
-                        copyInfo(analysisInfo);
+                        shareInfo(analysisInfo);
                     }
 
                     if (numEncoded && pic_recon && m_cliopt.recon)
@@ -775,7 +760,7 @@ ret:
                 outFrameCount += numEncoded;
                 if (isAbrSave && numEncoded)
                 {
-                    copyInfo(analysisInfo);
+                    shareInfo(analysisInfo);
                 }
 
                 if (numEncoded && pic_recon && m_cliopt.recon)
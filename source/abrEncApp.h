@@ -43,6 +43,8 @@ namespace X265_NS {
     public:
         uint8_t           m_numEncodes;
         PassEncoder        **m_passEnc;
+        const x265_api     *m_api;
+        x265_thread_pools  *m_threadPools; // worker pools shared by all the encodes
         uint32_t           m_queueSize;
         ThreadSafeInteger  m_numActiveEncodes;
 
@@ -57,9 +59,11 @@ namespace X265_NS {
         ThreadSafeInteger  *m_analysisReadCnt; //[numEncodes][queueSize]
         ThreadSafeInteger  **m_analysisWrite; //[numEncodes][queueSize]
         ThreadSafeInteger  **m_analysisRead; //[numEncodes][queueSize]
+        int                **m_analysisRefs; //[numEncodes][queueSize] encodes yet to read the analysis data
 
         AbrEncoder(CLIOptions cliopt[], uint8_t numEncodes, int& ret);
         bool allocBuffers();
+        void releaseAnalysis(uint32_t pass, uint32_t index);
         void destroy();
 
     };
@@ -99,7 +103,7 @@ namespace X265_NS {
         void setReuseLevel();
 
         void startThreads();
-        void copyInfo(x265_analysis_data *src);
+        void shareInfo(x265_analysis_data *src);
 
         bool readPicture(x265_picture*);
         void destroy();
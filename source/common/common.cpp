@@ -33,6 +33,14 @@
 #include <fcntl.h>
 #else
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if __linux__
+#include <sys/mman.h>
 #endif
 
 namespace X265_NS {
@@ -91,6 +99,107 @@ void x265_free(void *ptr)
 
 #endif // if _WIN32
 
+/* Each buffer returned by x265_malloc_pages() is preceded by this header,
+ * padded to X265_ALIGNBYTES so the buffer keeps the alignment of x265_malloc() */
+struct PageAllocHeader
+{
+    void*  base;     // start of the heap allocation or of the mapping
+    size_t mapSize;  // size of the mapping, 0 for heap allocations
+    size_t size;     // requested size
+    bool   bHuge;    // backed by MAP_HUGETLB pages, or advised for transparent huge pages
+};
+
+void *x265_malloc_pages(size_t size, bool bHugePages)
+{
+    size_t total = size + X265_ALIGNBYTES;
+    uint8_t *base = NULL;
+    size_t mapSize = 0;
+    bool bHuge = false;
+
+#if __linux__
+    /* buffers smaller than half a huge page would mostly waste it */
+    if (bHugePages && size >= X265_HUGE_PAGE_SIZE / 2)
+    {
+        size_t hugeSize = (total + X265_HUGE_PAGE_SIZE - 1) & ~(size_t)(X265_HUGE_PAGE_SIZE - 1);
+        void *map = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        /* explicit huge pages, only available if the administrator reserved them */
+        map = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (map != MAP_FAILED)
+        {
+            base = (uint8_t*)map;
+            mapSize = hugeSize;
+            bHuge = true;
+        }
+#endif
+#ifdef MADV_HUGEPAGE
+        if (!base)
+        {
+            /* transparent huge pages can only back 2MB aligned ranges, so map
+             * one extra huge page and trim the unaligned head and tail */
+            map = mmap(NULL, hugeSize + X265_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (map != MAP_FAILED)
+            {
+                uint8_t *aligned = (uint8_t*)(((uintptr_t)map + X265_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(X265_HUGE_PAGE_SIZE - 1));
+                size_t head = aligned - (uint8_t*)map;
+                if (head)
+                    munmap(map, head);
+                if (X265_HUGE_PAGE_SIZE - head)
+                    munmap(aligned + hugeSize, X265_HUGE_PAGE_SIZE - head);
+                base = aligned;
+                mapSize = hugeSize;
+                bHuge = !madvise(aligned, hugeSize, MADV_HUGEPAGE);
+            }
+        }
+#endif
+    }
+#else
+    (void)bHugePages;
+#endif
+
+    if (!base)
+    {
+        base = (uint8_t*)x265_malloc(total);
+        if (!base)
+            return NULL;
+    }
+
+    PageAllocHeader *header = (PageAllocHeader*)base;
+    header->base = base;
+    header->mapSize = mapSize;
+    header->size = size;
+    header->bHuge = bHuge;
+    return base + X265_ALIGNBYTES;
+}
+
+void x265_free_pages(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    PageAllocHeader *header = (PageAllocHeader*)((uint8_t*)ptr - X265_ALIGNBYTES);
+#if __linux__
+    if (header->mapSize)
+    {
+        munmap(header->base, header->mapSize);
+        return;
+    }
+#endif
+    x265_free(header->base);
+}
+
+/* bytes of a buffer from x265_malloc_pages() which were placed on explicit huge
+ * pages or advised for transparent huge pages. Whether the kernel backs an
+ * advised range with huge pages depends on its THP settings and is not checked */
+size_t x265_huge_page_advised_bytes(const void *ptr)
+{
+    if (!ptr)
+        return 0;
+
+    const PageAllocHeader *header = (const PageAllocHeader*)((const uint8_t*)ptr - X265_ALIGNBYTES);
+    return header->bHuge ? header->size : 0;
+}
+
 /* Not a general-purpose function; multiplies input by -1/6 to convert
  * qp to qscale. */
 int x265_exp2fix8(double x)
@@ -306,4 +415,72 @@ error:
     return NULL;
 }
 
+/* map a whole file read-only, returns NULL (and logs) on failure or if the
+ * file is empty. The mapping is released with x265_unmap_file() */
+void* x265_map_file(const char *filename, size_t* size)
+{
+    void *map = NULL;
+    *size = 0;
+    if (!filename)
+        return NULL;
+
+#if _WIN32
+    wchar_t buf_utf16[MAX_PATH * 2];
+    HANDLE fh = INVALID_HANDLE_VALUE;
+    if (MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, filename, -1, buf_utf16, sizeof(buf_utf16)/sizeof(wchar_t)))
+        fh = CreateFileW(buf_utf16, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE)
+    {
+        x265_log_file(NULL, X265_LOG_ERROR, "unable to open file %s\n", filename);
+        return NULL;
+    }
+    LARGE_INTEGER fSize;
+    if (GetFileSizeEx(fh, &fSize) && fSize.QuadPart > 0 && (uint64_t)fSize.QuadPart <= (size_t)-1)
+    {
+        HANDLE mh = CreateFileMapping(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mh)
+        {
+            map = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mh);
+        }
+        if (map)
+            *size = (size_t)fSize.QuadPart;
+    }
+    CloseHandle(fh);
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        x265_log_file(NULL, X265_LOG_ERROR, "unable to open file %s\n", filename);
+        return NULL;
+    }
+    struct stat st;
+    if (!fstat(fd, &st) && st.st_size > 0 && (uint64_t)st.st_size <= (size_t)-1)
+    {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+            map = NULL;
+        else
+            *size = (size_t)st.st_size;
+    }
+    close(fd);
+#endif
+
+    if (!map)
+        x265_log_file(NULL, X265_LOG_ERROR, "unable to map the file %s\n", filename);
+    return map;
+}
+
+void x265_unmap_file(void* map, size_t size)
+{
+    if (!map)
+        return;
+#if _WIN32
+    (void)size;
+    UnmapViewOfFile(map);
+#else
+    munmap(map, size);
+#endif
+}
+
 }
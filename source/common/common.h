@@ -176,6 +176,14 @@ inline T x265_clip3(T minVal, T maxVal, T a) { return x265_min(x265_max(minVal,
 template<typename T> /* clip to pixel range, 0..255 or 0..1023 */
 inline pixel x265_clip(T x) { return (pixel)x265_min<T>(T((1 << X265_DEPTH) - 1), x265_max<T>(T(0), x)); }
 
+/* bit depth of a sample type; the 8-bit lowres planes of --lowres-8bit are
+ * uint8_t in HIGH_BIT_DEPTH builds, every other plane is pixel */
+template<typename S>
+struct SampleDepth { enum { value = sizeof(S) == 1 ? 8 : X265_DEPTH }; };
+
+template<typename S, typename T> /* clip to the range of sample type S */
+inline S x265_clipSample(T x) { return (S)x265_min<T>(T((1 << SampleDepth<S>::value) - 1), x265_max<T>(T(0), x)); }
+
 typedef int16_t  coeff_t;      // transform coefficient
 
 #define X265_MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -241,6 +249,32 @@ typedef int16_t  coeff_t;      // transform coefficient
         } \
     }
 
+
+/* Large pixel buffers, backed by 2MB pages when huge is true (--huge-pages).
+ * These must be released with X265_FREE_PAGES */
+#define X265_HUGE_PAGE_SIZE         (2 * 1024 * 1024)
+#define X265_FREE_PAGES(ptr)        x265_free_pages(ptr)
+#define CHECKED_MALLOC_PAGES(var, type, count, huge) \
+    { \
+        var = (type*)x265_malloc_pages(sizeof(type) * (count), huge); \
+        if (!var) \
+        { \
+            x265_log(NULL, X265_LOG_ERROR, "malloc of size %d failed\n", sizeof(type) * (count)); \
+            goto fail; \
+        } \
+    }
+#define CHECKED_MALLOC_PAGES_ZERO(var, type, count, huge) \
+    { \
+        var = (type*)x265_malloc_pages(sizeof(type) * (count), huge); \
+        if (var) \
+            memset((void*)var, 0, sizeof(type) * (count)); \
+        else \
+        { \
+            x265_log(NULL, X265_LOG_ERROR, "malloc of size %d failed\n", sizeof(type) * (count)); \
+            goto fail; \
+        } \
+    }
+
 #if defined(_MSC_VER)
 #define X265_LOG2F(x) (logf((float)(x)) * 1.44269504088896405f)
 #define X265_LOG2(x) (log((double)(x)) * 1.4426950408889640513713538072172)
@@ -417,6 +451,9 @@ enum SignificanceMapContextType
 
 /* located in pixel.cpp */
 void extendPicBorder(pixel* recon, intptr_t stride, int width, int height, int marginX, int marginY);
+#if HIGH_BIT_DEPTH
+void extendPicBorder(uint8_t* recon, intptr_t stride, int width, int height, int marginX, int marginY);
+#endif
 
 /* located in common.cpp */
 int64_t  x265_mdate(void);
@@ -443,7 +480,12 @@ uint32_t x265_picturePlaneSize(int csp, int width, int height, int plane);
 
 void*    x265_malloc(size_t size);
 void     x265_free(void *ptr);
+void*    x265_malloc_pages(size_t size, bool bHugePages);
+void     x265_free_pages(void *ptr);
+size_t   x265_huge_page_advised_bytes(const void *ptr);
 char*    x265_slurp_file(const char *filename);
+void*    x265_map_file(const char *filename, size_t* size);
+void     x265_unmap_file(void* map, size_t size);
 
 /* located in primitives.cpp */
 void     x265_setup_primitives(x265_param* param);
@@ -39,6 +39,7 @@ Frame::Frame()
     m_encData = NULL;
     m_reconPic = NULL;
     m_quantOffsets = NULL;
+    m_loadedCuTreeOffsets = NULL;
     m_next = NULL;
     m_prev = NULL;
     m_param = NULL;
@@ -135,7 +136,7 @@ bool Frame::create(x265_param *param, float* quantOffsets)
     {
         X265_CHECK((m_reconColCount == NULL), "m_reconColCount was initialized");
         m_numRows = (m_fencPic->m_picHeight + param->maxCUSize - 1)  / param->maxCUSize;
-        m_reconRowFlag = new ThreadSafeInteger[m_numRows];
+        m_reconRowFlag = new SpinWaitInteger[m_numRows];
         m_reconColCount = new ThreadSafeInteger[m_numRows];
 
         if (quantOffsets)
@@ -96,13 +96,18 @@ public:
     bool                   m_bChromaExtended;    // orig chroma planes motion extended for weight analysis
     bool                   m_reconfigureRc;
 
+    /* --hist-scenecut histograms, when computed by the pre-lookahead */
+    int32_t                m_edgeHist[EDGE_BINS];
+    int32_t                m_yuvHist[3][HISTOGRAM_BINS];
+
     float*                 m_quantOffsets;       // points to quantOffsets in x265_picture
+    const uint16_t*        m_loadedCuTreeOffsets; // fix8 cuTree QP offsets read from --lookahead-load, or NULL
     x265_sei               m_userSEI;
     uint32_t               m_picStruct;          // picture structure SEI message
     x265_dolby_vision_rpu  m_rpu;
 
     /* Frame Parallelism - notification between FrameEncoders of available motion reference rows */
-    ThreadSafeInteger*     m_reconRowFlag;       // flag of CTU rows completely reconstructed and extended for motion reference
+    SpinWaitInteger*       m_reconRowFlag;       // flag of CTU rows completely reconstructed and extended for motion reference
     ThreadSafeInteger*     m_reconColCount;      // count of CTU cols completely reconstructed and extended for motion reference
     int32_t                m_numRows;
     volatile uint32_t      m_countRefEncoders;   // count of FrameEncoder threads monitoring m_reconRowCount
@@ -29,6 +29,7 @@ using namespace X265_NS;
 FrameData::FrameData()
 {
     memset(this, 0, sizeof(*this));
+    m_numaNode = -1;
 }
 
 bool FrameData::create(const x265_param& param, const SPS& sps, int csp)
@@ -27,6 +27,7 @@
 #include "common.h"
 #include "slice.h"
 #include "cudata.h"
+#include "threading.h"
 
 namespace X265_NS {
 // private namespace
@@ -118,6 +119,7 @@ public:
     PicYuv*        m_reconPic;
     bool           m_bHasReferences;   /* used during DPB/RPS updates */
     int            m_frameEncoderID;   /* the ID of the FrameEncoder encoding this frame */
+    int            m_numaNode;         /* NUMA node this instance was allocated on, or -1 */
     JobProvider*   m_jobProvider;
 
     CUDataMemPool  m_cuMemPool;
@@ -149,6 +151,16 @@ public:
         double   rowQpScale;
         double   sumQpRc;
         double   sumQpAq;
+        uint32_t refSatdLeft;   /* lowres costs of the CTUs of this row of the L0 reference after numEncodedCUs */
+        uint32_t refBitsLeft;   /* bits of the same CTUs of the L0 reference */
+        volatile uint32_t seq;  /* odd while the accumulators are being updated */
+
+        /* The VBV accumulators of a row are updated by one thread at a time and
+         * read by the row VBV rate control of the other rows. Updates are made
+         * between beginUpdate() and endUpdate(); a reader which sees seq odd,
+         * or changed across its read, reads the row again. No lock is taken */
+        void beginUpdate() { seq++; MEMORY_BARRIER(); }
+        void endUpdate()   { MEMORY_BARRIER(); seq++; }
     };
 
     RCStatCU*      m_cuStat;
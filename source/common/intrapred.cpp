@@ -28,12 +28,12 @@ using namespace X265_NS;
 
 namespace {
 
-template<int tuSize>
-void intraFilter(const pixel* samples, pixel* filtered) /* 1:2:1 filtering of left and top reference samples */
+template<int tuSize, typename T>
+void intraFilter(const T* samples, T* filtered) /* 1:2:1 filtering of left and top reference samples */
 {
     const int tuSize2 = tuSize << 1;
 
-    pixel topLeft = samples[0], topLast = samples[tuSize2], leftLast = samples[tuSize2 + tuSize2];
+    T topLeft = samples[0], topLast = samples[tuSize2], leftLast = samples[tuSize2 + tuSize2];
 
     // filtering top
     for (int i = 1; i < tuSize2; i++)
@@ -50,24 +50,25 @@ void intraFilter(const pixel* samples, pixel* filtered) /* 1:2:1 filtering of le
     filtered[tuSize2 + tuSize2] = leftLast;
 }
 
-static void dcPredFilter(const pixel* above, const pixel* left, pixel* dst, intptr_t dststride, int size)
+template<typename T>
+static void dcPredFilter(const T* above, const T* left, T* dst, intptr_t dststride, int size)
 {
     // boundary pixels processing
-    dst[0] = (pixel)((above[0] + left[0] + 2 * dst[0] + 2) >> 2);
+    dst[0] = (T)((above[0] + left[0] + 2 * dst[0] + 2) >> 2);
 
     for (int x = 1; x < size; x++)
-        dst[x] = (pixel)((above[x] +  3 * dst[x] + 2) >> 2);
+        dst[x] = (T)((above[x] +  3 * dst[x] + 2) >> 2);
 
     dst += dststride;
     for (int y = 1; y < size; y++)
     {
-        *dst = (pixel)((left[y] + 3 * *dst + 2) >> 2);
+        *dst = (T)((left[y] + 3 * *dst + 2) >> 2);
         dst += dststride;
     }
 }
 
-template<int width>
-void intra_pred_dc_c(pixel* dst, intptr_t dstStride, const pixel* srcPix, int /*dirMode*/, int bFilter)
+template<int width, typename T>
+void intra_pred_dc_c(T* dst, intptr_t dstStride, const T* srcPix, int /*dirMode*/, int bFilter)
 {
     int k, l;
 
@@ -78,35 +79,35 @@ void intra_pred_dc_c(pixel* dst, intptr_t dstStride, const pixel* srcPix, int /*
     dcVal = dcVal / (width + width);
     for (k = 0; k < width; k++)
         for (l = 0; l < width; l++)
-            dst[k * dstStride + l] = (pixel)dcVal;
+            dst[k * dstStride + l] = (T)dcVal;
 
     if (bFilter)
         dcPredFilter(srcPix + 1, srcPix + (2 * width + 1), dst, dstStride, width);
 }
 
-template<int log2Size>
-void planar_pred_c(pixel* dst, intptr_t dstStride, const pixel* srcPix, int /*dirMode*/, int /*bFilter*/)
+template<int log2Size, typename T>
+void planar_pred_c(T* dst, intptr_t dstStride, const T* srcPix, int /*dirMode*/, int /*bFilter*/)
 {
     const int blkSize = 1 << log2Size;
 
-    const pixel* above = srcPix + 1;
-    const pixel* left  = srcPix + (2 * blkSize + 1);
+    const T* above = srcPix + 1;
+    const T* left  = srcPix + (2 * blkSize + 1);
 
-    pixel topRight = above[blkSize];
-    pixel bottomLeft = left[blkSize];
+    T topRight = above[blkSize];
+    T bottomLeft = left[blkSize];
     for (int y = 0; y < blkSize; y++)
         for (int x = 0; x < blkSize; x++)
-            dst[y * dstStride + x] = (pixel) (((blkSize - 1 - x) * left[y] + (blkSize - 1 -y) * above[x] + (x + 1) * topRight + (y + 1) * bottomLeft + blkSize) >> (log2Size + 1));
+            dst[y * dstStride + x] = (T) (((blkSize - 1 - x) * left[y] + (blkSize - 1 -y) * above[x] + (x + 1) * topRight + (y + 1) * bottomLeft + blkSize) >> (log2Size + 1));
 }
 
-template<int width>
-void intra_pred_ang_c(pixel* dst, intptr_t dstStride, const pixel *srcPix0, int dirMode, int bFilter)
+template<int width, typename T>
+void intra_pred_ang_c(T* dst, intptr_t dstStride, const T *srcPix0, int dirMode, int bFilter)
 {
     int width2 = width << 1;
     // Flip the neighbours in the horizontal case.
     int horMode = dirMode < 18;
-    pixel neighbourBuf[129];
-    const pixel *srcPix = srcPix0;
+    T neighbourBuf[129];
+    const T *srcPix = srcPix0;
 
     if (horMode)
     {
@@ -138,21 +139,21 @@ void intra_pred_ang_c(pixel* dst, intptr_t dstStride, const pixel *srcPix0, int
         {
             int topLeft = srcPix[0], top = srcPix[1];
             for (int y = 0; y < width; y++)
-                dst[y * dstStride] = x265_clip((int16_t)(top + ((srcPix[width2 + 1 + y] - topLeft) >> 1)));
+                dst[y * dstStride] = x265_clipSample<T>((int16_t)(top + ((srcPix[width2 + 1 + y] - topLeft) >> 1)));
         }
     }
     else // Angular prediction.
     {
         // Get the reference pixels. The reference base is the first pixel to the top (neighbourBuf[1]).
-        pixel refBuf[64];
-        const pixel *ref;
+        T refBuf[64];
+        const T *ref;
 
         // Use the projected left neighbours and the top neighbours.
         if (angle < 0)
         {
             // Number of neighbours projected. 
             int nbProjected = -((width * angle) >> 5) - 1;
-            pixel *ref_pix = refBuf + nbProjected + 1;
+            T *ref_pix = refBuf + nbProjected + 1;
 
             // Project the neighbours.
             int invAngle = invAngleTable[- angleOffset - 1];
@@ -181,7 +182,7 @@ void intra_pred_ang_c(pixel* dst, intptr_t dstStride, const pixel *srcPix0, int
 
             if (fraction) // Interpolate
                 for (int x = 0; x < width; x++)
-                    dst[y * dstStride + x] = (pixel)(((32 - fraction) * ref[offset + x] + fraction * ref[offset + x + 1] + 16) >> 5);
+                    dst[y * dstStride + x] = (T)(((32 - fraction) * ref[offset + x] + fraction * ref[offset + x + 1] + 16) >> 5);
             else // Copy.
                 for (int x = 0; x < width; x++)
                     dst[y * dstStride + x] = ref[offset + x];
@@ -195,7 +196,7 @@ void intra_pred_ang_c(pixel* dst, intptr_t dstStride, const pixel *srcPix0, int
         {
             for (int x = y + 1; x < width; x++)
             {
-                pixel tmp              = dst[y * dstStride + x];
+                T tmp                  = dst[y * dstStride + x];
                 dst[y * dstStride + x] = dst[x * dstStride + y];
                 dst[x * dstStride + y] = tmp;
             }
@@ -267,4 +268,15 @@ void setupIntraPrimitives_c(EncoderPrimitives& p)
     p.cu[BLOCK_16x16].intra_pred_allangs = all_angs_pred_c<4>;
     p.cu[BLOCK_32x32].intra_pred_allangs = all_angs_pred_c<5>;
 }
+
+#if HIGH_BIT_DEPTH
+void setupLowresIntraPrimitives8_c(LowresPrimitives<uint8_t>& lp)
+{
+    lp.intra_filter = intraFilter<8>;
+    lp.intra_pred[PLANAR_IDX] = planar_pred_c<3>;
+    lp.intra_pred[DC_IDX] = intra_pred_dc_c<8>;
+    for (int i = 2; i < NUM_INTRA_MODE; i++)
+        lp.intra_pred[i] = intra_pred_ang_c<8>;
+}
+#endif
 }
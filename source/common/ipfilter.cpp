@@ -56,21 +56,24 @@ void filterPixelToShort_c(const pixel* src, intptr_t srcStride, int16_t* dst, in
     }
 }
 
-static void extendCURowColBorder(pixel* txt, intptr_t stride, int width, int height, int marginX)
+template<typename T>
+static void extendCURowColBorder(T* txt, intptr_t stride, int width, int height, int marginX)
 {
     for (int y = 0; y < height; y++)
     {
-#if HIGH_BIT_DEPTH
-        for (int x = 0; x < marginX; x++)
+        if (sizeof(T) == 1)
         {
-            txt[-marginX + x] = txt[0];
-            txt[width + x] = txt[width - 1];
+            memset(txt - marginX, txt[0], marginX);
+            memset(txt + width, txt[width - 1], marginX);
+        }
+        else
+        {
+            for (int x = 0; x < marginX; x++)
+            {
+                txt[-marginX + x] = txt[0];
+                txt[width + x] = txt[width - 1];
+            }
         }
-
-#else
-        memset(txt - marginX, txt[0], marginX);
-        memset(txt + width, txt[width - 1], marginX);
-#endif
 
         txt += stride;
     }
@@ -519,4 +522,11 @@ void setupFilterPrimitives_c(EncoderPrimitives& p)
 
     p.extendRowBorder = extendCURowColBorder;
 }
+
+#if HIGH_BIT_DEPTH
+void setupLowresFilterPrimitives8_c(LowresPrimitives<uint8_t>& lp)
+{
+    lp.extendRowBorder = extendCURowColBorder;
+}
+#endif
 }
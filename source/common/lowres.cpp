@@ -28,6 +28,88 @@
 
 using namespace X265_NS;
 
+/* pool blocks and the arrays within them are padded to a cache line */
+#define POOL_ALIGN(size) (((size) + 63) & ~(size_t)63)
+
+MV Lowres::s_unsearchedMvs(0x7FFF, 0);
+
+LowresPool::LowresPool()
+{
+    m_bytesInUse = m_peakBytes = m_bytesReserved = 0;
+    m_numBlockSizes = 0;
+    m_slabs = NULL;
+}
+
+LowresPool::~LowresPool()
+{
+    while (m_slabs)
+    {
+        Slab* next = m_slabs->next;
+        X265_FREE(m_slabs);
+        m_slabs = next;
+    }
+}
+
+void* LowresPool::alloc(uint32_t blockSize)
+{
+    ScopedLock lock(m_lock);
+
+    int i;
+    for (i = 0; i < m_numBlockSizes; i++)
+        if (m_blockSize[i] == blockSize)
+            break;
+    if (i == m_numBlockSizes)
+    {
+        if (i == MAX_BLOCK_SIZES)
+            return NULL;
+        m_blockSize[i] = blockSize;
+        m_freeList[i] = NULL;
+        m_numBlockSizes++;
+    }
+
+    if (!m_freeList[i])
+    {
+        uint8_t* mem = X265_MALLOC(uint8_t, SLAB_HEADER + (size_t)SLAB_BLOCKS * blockSize);
+        if (!mem)
+            return NULL;
+        Slab* slab = (Slab*)mem;
+        slab->next = m_slabs;
+        m_slabs = slab;
+        m_bytesReserved += (uint64_t)SLAB_BLOCKS * blockSize;
+
+        for (int j = SLAB_BLOCKS - 1; j >= 0; j--)
+        {
+            FreeBlock* block = (FreeBlock*)(mem + SLAB_HEADER + (size_t)j * blockSize);
+            block->next = m_freeList[i];
+            m_freeList[i] = block;
+        }
+    }
+
+    FreeBlock* block = m_freeList[i];
+    m_freeList[i] = block->next;
+    m_bytesInUse += blockSize;
+    m_peakBytes = X265_MAX(m_peakBytes, m_bytesInUse);
+    return block;
+}
+
+void LowresPool::release(void* block, uint32_t blockSize)
+{
+    ScopedLock lock(m_lock);
+
+    for (int i = 0; i < m_numBlockSizes; i++)
+    {
+        if (m_blockSize[i] == blockSize)
+        {
+            FreeBlock* freeBlock = (FreeBlock*)block;
+            freeBlock->next = m_freeList[i];
+            m_freeList[i] = freeBlock;
+            m_bytesInUse -= blockSize;
+            return;
+        }
+    }
+    X265_CHECK(0, "lowres pool block of unknown size released\n");
+}
+
 bool PicQPAdaptationLayer::create(uint32_t width, uint32_t height, uint32_t partWidth, uint32_t partHeight, uint32_t numAQPartInWidthExt, uint32_t numAQPartInHeightExt)
 {
     aqPartWidth = partWidth;
@@ -47,6 +129,61 @@ fail:
     return false;
 }
 
+/* allocate four planes of planesize samples in one buffer */
+template<typename T>
+static bool allocPlanes(T* buffer[4], T* plane[4], size_t planesize, size_t padoffset, bool bHugePages)
+{
+    CHECKED_MALLOC_PAGES_ZERO(buffer[0], T, 4 * planesize, bHugePages);
+    for (int i = 1; i < 4; i++)
+        buffer[i] = buffer[i - 1] + planesize;
+    for (int i = 0; i < 4; i++)
+        plane[i] = buffer[i] + padoffset;
+    return true;
+
+fail:
+    return false;
+}
+
+template<typename T>
+static void initPlaneRows(T* plane[4], intptr_t lumaStride, int width, PicYuv *origPic, int firstRow, int numRows)
+{
+    const LowresPrimitives<T>& lp = getLowresPrimitives<T>();
+    intptr_t srcOffset = 2 * firstRow * origPic->m_stride;
+    intptr_t dstOffset = firstRow * lumaStride;
+
+    lp.frameInitLowres(origPic->m_picOrg[0] + srcOffset,
+                       plane[0] + dstOffset, plane[1] + dstOffset, plane[2] + dstOffset, plane[3] + dstOffset,
+                       origPic->m_stride, lumaStride, width, numRows);
+
+    for (int i = 0; i < 4; i++)
+        lp.extendRowBorder(plane[i] + dstOffset, lumaStride, width, numRows, origPic->m_lumaMarginX);
+}
+
+template<typename T>
+static void finishPlanes(T* plane[4], T* lowerResPlane[4], intptr_t lumaStride, int width, int lines, PicYuv *origPic)
+{
+    /* copy the top and bottom rows into the margins, as extendPicBorder() */
+    for (int i = 0; i < 4; i++)
+    {
+        T* top = plane[i] - origPic->m_lumaMarginX;
+        T* bot = top + (lines - 1) * lumaStride;
+        for (uint32_t y = 0; y < origPic->m_lumaMarginY; y++)
+        {
+            memcpy(top - (y + 1) * lumaStride, top, lumaStride * sizeof(T));
+            memcpy(bot + (y + 1) * lumaStride, bot, lumaStride * sizeof(T));
+        }
+    }
+
+    if (origPic->m_param->bEnableHME)
+    {
+        getLowresPrimitives<T>().frameInitLowerRes(plane[0],
+            lowerResPlane[0], lowerResPlane[1], lowerResPlane[2], lowerResPlane[3],
+            lumaStride, lumaStride/2, (width / 2), (lines / 2));
+        for (int i = 0; i < 4; i++)
+            extendPicBorder(lowerResPlane[i], lumaStride/2, width/2, lines/2, origPic->m_lumaMarginX/2, origPic->m_lumaMarginY/2);
+    }
+}
+
 bool Lowres::create(x265_param* param, PicYuv *origPic, uint32_t qgSize)
 {
     isLowres = true;
@@ -129,66 +266,40 @@ bool Lowres::create(x265_param* param, PicYuv *origPic, uint32_t qgSize)
     CHECKED_MALLOC(propagateCost, uint16_t, cuCount);
 
     /* allocate lowres buffers */
-    CHECKED_MALLOC_ZERO(buffer[0], pixel, 4 * planesize);
-
-    buffer[1] = buffer[0] + planesize;
-    buffer[2] = buffer[1] + planesize;
-    buffer[3] = buffer[2] + planesize;
-
-    lowresPlane[0] = buffer[0] + padoffset;
-    lowresPlane[1] = buffer[1] + padoffset;
-    lowresPlane[2] = buffer[2] + padoffset;
-    lowresPlane[3] = buffer[3] + padoffset;
-
-    if (bEnableHME)
+#if HIGH_BIT_DEPTH
+    bLowres8bit = !!param->bLowres8bit;
+    if (bLowres8bit)
     {
-        intptr_t lumaStrideHalf = lumaStride / 2;
-        if (lumaStrideHalf & 31)
-            lumaStrideHalf += 32 - (lumaStrideHalf & 31);
-        size_t planesizeHalf = planesize / 2;
-        size_t padoffsetHalf = padoffset / 2;
-        /* allocate lower-res buffers */
-        CHECKED_MALLOC_ZERO(lowerResBuffer[0], pixel, 4 * planesizeHalf);
-
-        lowerResBuffer[1] = lowerResBuffer[0] + planesizeHalf;
-        lowerResBuffer[2] = lowerResBuffer[1] + planesizeHalf;
-        lowerResBuffer[3] = lowerResBuffer[2] + planesizeHalf;
-
-        lowerResPlane[0] = lowerResBuffer[0] + padoffsetHalf;
-        lowerResPlane[1] = lowerResBuffer[1] + padoffsetHalf;
-        lowerResPlane[2] = lowerResBuffer[2] + padoffsetHalf;
-        lowerResPlane[3] = lowerResBuffer[3] + padoffsetHalf;
+        if (!allocPlanes(buffer8, lowresPlane8, planesize, padoffset, !!param->bHugePages))
+            goto fail;
+        if (bEnableHME && !allocPlanes(lowerResBuffer8, lowerResPlane8, planesize / 2, padoffset / 2, !!param->bHugePages))
+            goto fail;
+    }
+    else
+#endif
+    {
+        if (!allocPlanes(buffer, lowresPlane, planesize, padoffset, !!param->bHugePages))
+            goto fail;
+        if (bEnableHME && !allocPlanes(lowerResBuffer, lowerResPlane, planesize / 2, padoffset / 2, !!param->bHugePages))
+            goto fail;
     }
 
     CHECKED_MALLOC(intraCost, int32_t, cuCount);
     CHECKED_MALLOC(intraMode, uint8_t, cuCount);
 
-    for (int i = 0; i < bframes + 2; i++)
-    {
-        for (int j = 0; j < bframes + 2; j++)
-        {
-            CHECKED_MALLOC(rowSatds[i][j], int32_t, maxBlocksInCol);
-            CHECKED_MALLOC(lowresCosts[i][j], uint16_t, cuCount);
-        }
-    }
+    /* the motion vector and cost arrays are allocated on first use, each
+     * pool block holds all of the arrays of one reference distance (or pair
+     * of distances), every sub-array starting on a 64 byte boundary */
+    if (bEnableHME)
+        lowerResCuCount = (((width / 2) + X265_LOWRES_CU_SIZE - 1) >> X265_LOWRES_CU_BITS) *
+                          (((lines / 2) + X265_LOWRES_CU_SIZE - 1) >> X265_LOWRES_CU_BITS);
+    costBlockSize = POOL_ALIGN(cuCount * sizeof(uint16_t)) + POOL_ALIGN(maxBlocksInCol * sizeof(int32_t));
+    mvBlockSize = POOL_ALIGN(cuCount * sizeof(MV)) + POOL_ALIGN(cuCount * sizeof(int32_t));
+    if (bEnableHME)
+        mvBlockSize += POOL_ALIGN(lowerResCuCount * sizeof(MV)) + POOL_ALIGN(lowerResCuCount * sizeof(int32_t));
 
-    for (int i = 0; i < bframes + 2; i++)
-    {
-        CHECKED_MALLOC(lowresMvs[0][i], MV, cuCount);
-        CHECKED_MALLOC(lowresMvs[1][i], MV, cuCount);
-        CHECKED_MALLOC(lowresMvCosts[0][i], int32_t, cuCount);
-        CHECKED_MALLOC(lowresMvCosts[1][i], int32_t, cuCount);
-        if (bEnableHME)
-        {
-            int maxBlocksInRowLowerRes = ((width/2) + X265_LOWRES_CU_SIZE - 1) >> X265_LOWRES_CU_BITS;
-            int maxBlocksInColLowerRes = ((lines/2) + X265_LOWRES_CU_SIZE - 1) >> X265_LOWRES_CU_BITS;
-            int cuCountLowerRes = maxBlocksInRowLowerRes * maxBlocksInColLowerRes;
-            CHECKED_MALLOC(lowerResMvs[0][i], MV, cuCountLowerRes);
-            CHECKED_MALLOC(lowerResMvs[1][i], MV, cuCountLowerRes);
-            CHECKED_MALLOC(lowerResMvCosts[0][i], int32_t, cuCountLowerRes);
-            CHECKED_MALLOC(lowerResMvCosts[1][i], int32_t, cuCountLowerRes);
-        }
-    }
+    for (int i = 0; i < X265_BFRAME_MAX + 2; i++)
+        lowresMvs[0][i] = lowresMvs[1][i] = &s_unsearchedMvs;
 
     return true;
 
@@ -198,35 +309,21 @@ fail:
 
 void Lowres::destroy()
 {
-    X265_FREE(buffer[0]);
+    X265_FREE_PAGES(buffer[0]);
     if(bEnableHME)
-        X265_FREE(lowerResBuffer[0]);
+        X265_FREE_PAGES(lowerResBuffer[0]);
+#if HIGH_BIT_DEPTH
+    X265_FREE_PAGES(buffer8[0]);
+    if (bEnableHME)
+        X265_FREE_PAGES(lowerResBuffer8[0]);
+#endif
     X265_FREE(intraCost);
     X265_FREE(intraMode);
 
-    for (int i = 0; i < bframes + 2; i++)
-    {
-        for (int j = 0; j < bframes + 2; j++)
-        {
-            X265_FREE(rowSatds[i][j]);
-            X265_FREE(lowresCosts[i][j]);
-        }
-    }
+    /* the motion vector and cost arrays belong to the pool, which may
+     * already have been destroyed along with the lookahead */
+    pool = NULL;
 
-    for (int i = 0; i < bframes + 2; i++)
-    {
-        X265_FREE(lowresMvs[0][i]);
-        X265_FREE(lowresMvs[1][i]);
-        X265_FREE(lowresMvCosts[0][i]);
-        X265_FREE(lowresMvCosts[1][i]);
-        if (bEnableHME)
-        {
-            X265_FREE(lowerResMvs[0][i]);
-            X265_FREE(lowerResMvs[1][i]);
-            X265_FREE(lowerResMvCosts[0][i]);
-            X265_FREE(lowerResMvCosts[1][i]);
-        }
-    }
     X265_FREE(qpAqOffset);
     X265_FREE(invQscaleFactor);
     X265_FREE(qpCuTreeOffset);
@@ -257,6 +354,13 @@ void Lowres::destroy()
 }
 // (re) initialize lowres state
 void Lowres::init(PicYuv *origPic, int poc)
+{
+    initState(origPic, poc);
+    initRows(origPic, 0, lines);
+    finishInit(origPic);
+}
+
+void Lowres::initState(PicYuv *origPic, int poc)
 {
     bLastMiniGopBFrame = false;
     bKeyframe = false; // Not a keyframe unless identified by lookahead
@@ -264,7 +368,10 @@ void Lowres::init(PicYuv *origPic, int poc)
     frameNum = poc;
     leadingBframes = 0;
     indB = 0;
+    decidedCost = -1;
     memset(costEst, -1, sizeof(costEst));
+    memset(lowerResCostEst, -1, sizeof(lowerResCostEst));
+    memset(lowerResIntraMbs, 0, sizeof(lowerResIntraMbs));
     memset(weightedCostDelta, 0, sizeof(weightedCostDelta));
     interPCostPercDiff = 0.0;
     intraCostPercDiff = 0.0;
@@ -274,44 +381,123 @@ void Lowres::init(PicYuv *origPic, int poc)
     if (qpAqOffset && invQscaleFactor)
         memset(costEstAq, -1, sizeof(costEstAq));
 
-    for (int y = 0; y < bframes + 2; y++)
-        for (int x = 0; x < bframes + 2; x++)
-            rowSatds[y][x][0] = -1;
-
-    for (int i = 0; i < bframes + 2; i++)
-    {
-        lowresMvs[0][i][0].x = 0x7FFF;
-        lowresMvs[1][i][0].x = 0x7FFF;
-    }
+    releaseArrays();
 
     for (int i = 0; i < bframes + 2; i++)
         intraMbs[i] = 0;
     if (origPic->m_param->rc.vbvBufferSize)
         for (int i = 0; i < X265_LOOKAHEAD_MAX + 1; i++)
             plannedType[i] = X265_TYPE_AUTO;
+}
 
-    /* downscale and generate 4 hpel planes for lookahead */
-    primitives.frameInitLowres(origPic->m_picOrg[0],
-                               lowresPlane[0], lowresPlane[1], lowresPlane[2], lowresPlane[3],
-                               origPic->m_stride, lumaStride, width, lines);
-
-    /* extend hpel planes for motion search */
-    extendPicBorder(lowresPlane[0], lumaStride, width, lines, origPic->m_lumaMarginX, origPic->m_lumaMarginY);
-    extendPicBorder(lowresPlane[1], lumaStride, width, lines, origPic->m_lumaMarginX, origPic->m_lumaMarginY);
-    extendPicBorder(lowresPlane[2], lumaStride, width, lines, origPic->m_lumaMarginX, origPic->m_lumaMarginY);
-    extendPicBorder(lowresPlane[3], lumaStride, width, lines, origPic->m_lumaMarginX, origPic->m_lumaMarginY);
-    
-    if (origPic->m_param->bEnableHME)
+/* take the cost and row satd arrays of reference distances (p0Dist, p1Dist)
+ * from the pool, if they have not been allocated yet */
+bool Lowres::allocCosts(int p0Dist, int p1Dist)
+{
+    if (lowresCosts[p0Dist][p1Dist])
+        return true;
+
+    uint8_t* block = pool ? (uint8_t*)pool->alloc(costBlockSize) : NULL;
+    if (!block)
+        return false;
+
+    lowresCosts[p0Dist][p1Dist] = (uint16_t*)block;
+    rowSatds[p0Dist][p1Dist] = (int32_t*)(block + POOL_ALIGN(maxBlocksInRow * maxBlocksInCol * sizeof(uint16_t)));
+    rowSatds[p0Dist][p1Dist][0] = -1;
+    return true;
+}
+
+/* take the motion vector and motion cost arrays of one list and reference
+ * distance, including those of the HME level, from the pool */
+bool Lowres::allocMvs(int list, int dist)
+{
+    if (lowresMvs[list][dist] != &s_unsearchedMvs)
+        return true;
+
+    uint8_t* block = pool ? (uint8_t*)pool->alloc(mvBlockSize) : NULL;
+    if (!block)
+        return false;
+
+    uint32_t cuCount = maxBlocksInRow * maxBlocksInCol;
+    lowresMvs[list][dist] = (MV*)block;
+    block += POOL_ALIGN(cuCount * sizeof(MV));
+    lowresMvCosts[list][dist] = (int32_t*)block;
+    lowresMvs[list][dist][0].x = 0x7FFF;
+    if (bEnableHME)
     {
-        primitives.frameInitLowerRes(lowresPlane[0],
-            lowerResPlane[0], lowerResPlane[1], lowerResPlane[2], lowerResPlane[3],
-            lumaStride, lumaStride/2, (width / 2), (lines / 2));
-        extendPicBorder(lowerResPlane[0], lumaStride/2, width/2, lines/2, origPic->m_lumaMarginX/2, origPic->m_lumaMarginY/2);
-        extendPicBorder(lowerResPlane[1], lumaStride/2, width/2, lines/2, origPic->m_lumaMarginX/2, origPic->m_lumaMarginY/2);
-        extendPicBorder(lowerResPlane[2], lumaStride/2, width/2, lines/2, origPic->m_lumaMarginX/2, origPic->m_lumaMarginY/2);
-        extendPicBorder(lowerResPlane[3], lumaStride/2, width/2, lines/2, origPic->m_lumaMarginX/2, origPic->m_lumaMarginY/2);
-        fpelLowerResPlane[0] = lowerResPlane[0];
+        block += POOL_ALIGN(cuCount * sizeof(int32_t));
+        lowerResMvs[list][dist] = (MV*)block;
+        block += POOL_ALIGN(lowerResCuCount * sizeof(MV));
+        lowerResMvCosts[list][dist] = (int32_t*)block;
+        lowerResMvs[list][dist][0].x = 0x7FFF;
     }
+    return true;
+}
 
+/* return all motion vector and cost arrays to the pool */
+void Lowres::releaseArrays()
+{
+    for (int i = 0; i < bframes + 2; i++)
+    {
+        for (int j = 0; j < bframes + 2; j++)
+        {
+            if (lowresCosts[i][j])
+                pool->release(lowresCosts[i][j], costBlockSize);
+            lowresCosts[i][j] = NULL;
+            rowSatds[i][j] = NULL;
+        }
+        for (int list = 0; list < 2; list++)
+        {
+            if (lowresMvs[list][i] != &s_unsearchedMvs)
+                pool->release(lowresMvs[list][i], mvBlockSize);
+            lowresMvs[list][i] = &s_unsearchedMvs;
+            lowresMvCosts[list][i] = NULL;
+            lowerResMvs[list][i] = NULL;
+            lowerResMvCosts[list][i] = NULL;
+        }
+    }
+    lowresCostForRc = NULL;
+}
+
+/* downscale and generate 4 hpel planes of lowres rows [firstRow, firstRow + numRows)
+ * for lookahead, and extend their left and right borders for motion search */
+void Lowres::initRows(PicYuv *origPic, int firstRow, int numRows)
+{
+#if HIGH_BIT_DEPTH
+    if (bLowres8bit)
+    {
+        initPlaneRows(lowresPlane8, lumaStride, width, origPic, firstRow, numRows);
+        return;
+    }
+#endif
+    initPlaneRows(lowresPlane, lumaStride, width, origPic, firstRow, numRows);
+}
+
+void Lowres::finishInit(PicYuv *origPic)
+{
+#if HIGH_BIT_DEPTH
+    if (bLowres8bit)
+    {
+        /* fpelPlane[] stays NULL, the consumers of 8-bit planes use planes<uint8_t>() */
+        finishPlanes(lowresPlane8, lowerResPlane8, lumaStride, width, lines, origPic);
+        return;
+    }
+#endif
+    finishPlanes(lowresPlane, lowerResPlane, lumaStride, width, lines, origPic);
+    if (origPic->m_param->bEnableHME)
+        fpelLowerResPlane[0] = lowerResPlane[0];
     fpelPlane[0] = lowresPlane[0];
 }
+
+void* Lowres::planeBuffer(size_t& bytes) const
+{
+#if HIGH_BIT_DEPTH
+    if (bLowres8bit)
+    {
+        bytes = 4 * (buffer8[1] - buffer8[0]);
+        return buffer8[0];
+    }
+#endif
+    bytes = 4 * (buffer[1] - buffer[0]) * sizeof(pixel);
+    return buffer[0];
+}
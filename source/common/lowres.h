@@ -28,6 +28,7 @@
 #include "common.h"
 #include "picyuv.h"
 #include "mv.h"
+#include "threading.h"
 
 namespace X265_NS {
 // private namespace
@@ -44,6 +45,13 @@ struct ReferencePlanes
     pixel*   fpelLowerResPlane[3];
     pixel*   lowerResPlane[4];
 
+#if HIGH_BIT_DEPTH
+    /* --lowres-8bit: the lowres and HME planes in 8 bits, allocated in place
+     * of lowresPlane and lowerResPlane */
+    uint8_t* lowresPlane8[4];
+    uint8_t* lowerResPlane8[4];
+#endif
+
     bool     isWeighted;
     bool     isLowres;
     bool     isHMELowres;
@@ -62,25 +70,27 @@ struct ReferencePlanes
     pixel* getCbAddr(uint32_t ctuAddr, uint32_t absPartIdx)   { return fpelPlane[1] + reconPic->m_cuOffsetC[ctuAddr] + reconPic->m_buOffsetC[absPartIdx]; }
     pixel* getCrAddr(uint32_t ctuAddr, uint32_t absPartIdx)   { return fpelPlane[2] + reconPic->m_cuOffsetC[ctuAddr] + reconPic->m_buOffsetC[absPartIdx]; }
 
+    /* the four hpel planes of the lowres (or, with hme, the HME) level, of
+     * sample type T: pixel, or uint8_t with --lowres-8bit */
+    template<typename T>
+    T** planes(bool hme);
+
     /* lowres motion compensation, you must provide a buffer and stride for QPEL averaged pixels
      * in case QPEL is required.  Else it returns a pointer to the HPEL pixels */
-    inline pixel *lowresMC(intptr_t blockOffset, const MV& qmv, pixel *buf, intptr_t& outstride, bool hme)
+    template<typename T>
+    inline T *lowresMC(intptr_t blockOffset, const MV& qmv, T *buf, intptr_t& outstride, bool hme)
     {
         intptr_t YStride = hme ? lumaStride / 2 : lumaStride;
-        pixel *plane[4];
-        for (int i = 0; i < 4; i++)
-        {
-            plane[i] = hme ? lowerResPlane[i] : lowresPlane[i];
-        }
+        T **plane = planes<T>(hme);
         if ((qmv.x | qmv.y) & 1)
         {
             int hpelA = (qmv.y & 2) | ((qmv.x & 2) >> 1);
-            pixel *frefA = plane[hpelA] + blockOffset + (qmv.x >> 2) + (qmv.y >> 2) * YStride;
+            T *frefA = plane[hpelA] + blockOffset + (qmv.x >> 2) + (qmv.y >> 2) * YStride;
             int qmvx = qmv.x + (qmv.x & 1);
             int qmvy = qmv.y + (qmv.y & 1);
             int hpelB = (qmvy & 2) | ((qmvx & 2) >> 1);
-            pixel *frefB = plane[hpelB] + blockOffset + (qmvx >> 2) + (qmvy >> 2) * YStride;
-            primitives.pu[LUMA_8x8].pixelavg_pp[(outstride % 64 == 0) && (YStride % 64 == 0)](buf, outstride, frefA, YStride, frefB, YStride, 32);
+            T *frefB = plane[hpelB] + blockOffset + (qmvx >> 2) + (qmvy >> 2) * YStride;
+            getLowresPrimitives<T>().pixelavg_pp[(outstride % 64 == 0) && (YStride % 64 == 0)](buf, outstride, frefA, YStride, frefB, YStride, 32);
             return buf;
         }
         else
@@ -91,35 +101,39 @@ struct ReferencePlanes
         }
     }
 
-    inline int lowresQPelCost(pixel *fenc, intptr_t blockOffset, const MV& qmv, pixelcmp_t comp, bool hme)
+    template<typename T>
+    inline int lowresQPelCost(const T *fenc, intptr_t blockOffset, const MV& qmv, typename LowresPrimitives<T>::cmp_t comp, bool hme)
     {
         intptr_t YStride = hme ? lumaStride / 2 : lumaStride;
-        pixel *plane[4];
-        for (int i = 0; i < 4; i++)
-        {
-            plane[i] = hme ? lowerResPlane[i] : lowresPlane[i];
-        }
+        T **plane = planes<T>(hme);
         if ((qmv.x | qmv.y) & 1)
         {
-            ALIGN_VAR_16(pixel, subpelbuf[8 * 8]);
+            ALIGN_VAR_16(T, subpelbuf[8 * 8]);
             int hpelA = (qmv.y & 2) | ((qmv.x & 2) >> 1);
-            pixel *frefA = plane[hpelA] + blockOffset + (qmv.x >> 2) + (qmv.y >> 2) * YStride;
+            T *frefA = plane[hpelA] + blockOffset + (qmv.x >> 2) + (qmv.y >> 2) * YStride;
             int qmvx = qmv.x + (qmv.x & 1);
             int qmvy = qmv.y + (qmv.y & 1);
             int hpelB = (qmvy & 2) | ((qmvx & 2) >> 1);
-            pixel *frefB = plane[hpelB] + blockOffset + (qmvx >> 2) + (qmvy >> 2) * YStride;
-            primitives.pu[LUMA_8x8].pixelavg_pp[NONALIGNED](subpelbuf, 8, frefA, YStride, frefB, YStride, 32);
+            T *frefB = plane[hpelB] + blockOffset + (qmvx >> 2) + (qmvy >> 2) * YStride;
+            getLowresPrimitives<T>().pixelavg_pp[NONALIGNED](subpelbuf, 8, frefA, YStride, frefB, YStride, 32);
             return comp(fenc, FENC_STRIDE, subpelbuf, 8);
         }
         else
         {
             int hpel = (qmv.y & 2) | ((qmv.x & 2) >> 1);
-            pixel *fref = plane[hpel] + blockOffset + (qmv.x >> 2) + (qmv.y >> 2) * YStride;
+            T *fref = plane[hpel] + blockOffset + (qmv.x >> 2) + (qmv.y >> 2) * YStride;
             return comp(fenc, FENC_STRIDE, fref, YStride);
         }
     }
 };
 
+template<>
+inline pixel** ReferencePlanes::planes<pixel>(bool hme) { return hme ? lowerResPlane : lowresPlane; }
+#if HIGH_BIT_DEPTH
+template<>
+inline uint8_t** ReferencePlanes::planes<uint8_t>(bool hme) { return hme ? lowerResPlane8 : lowresPlane8; }
+#endif
+
 static const uint32_t aqLayerDepth[3][4][4] = {
     {  // ctu size 64
         { 1, 0, 1, 0 },
@@ -163,11 +177,51 @@ struct PicQPAdaptationLayer
     void  destroy();
 };
 
+/* Slab allocator of the lowres motion vector and cost arrays. The lookahead
+ * estimates only a fraction of the reference distances a lowres picture has
+ * room for, so these arrays are taken from the pool the first time their
+ * distance is estimated and are given back when the picture is recycled.
+ * Blocks are carved from slabs and kept on a free list per block size; the
+ * slabs themselves are only freed by the destructor. Thread safe */
+class LowresPool
+{
+public:
+
+    LowresPool();
+    ~LowresPool();
+
+    /* blockSize must be a multiple of 64 */
+    void*    alloc(uint32_t blockSize);
+    void     release(void* block, uint32_t blockSize);
+
+    uint64_t m_bytesInUse;
+    uint64_t m_peakBytes;     // high-water mark of m_bytesInUse
+    uint64_t m_bytesReserved; // size of all slabs
+
+protected:
+
+    enum { MAX_BLOCK_SIZES = 4, SLAB_BLOCKS = 8, SLAB_HEADER = 64 };
+
+    struct FreeBlock { FreeBlock* next; };
+    struct Slab      { Slab* next; };
+
+    uint32_t   m_blockSize[MAX_BLOCK_SIZES];
+    FreeBlock* m_freeList[MAX_BLOCK_SIZES];
+    int        m_numBlockSizes;
+    Slab*      m_slabs;
+    Lock       m_lock;
+};
+
 /* lowres buffers, sizes and strides */
 struct Lowres : public ReferencePlanes
 {
     pixel *buffer[4];
     pixel *lowerResBuffer[4]; // Level-0 buffer
+#if HIGH_BIT_DEPTH
+    uint8_t *buffer8[4];         // --lowres-8bit, in place of buffer
+    uint8_t *lowerResBuffer8[4]; // --lowres-8bit, in place of lowerResBuffer
+#endif
+    bool   bLowres8bit;      // planes of uint8_t samples, see ReferencePlanes::planes()
 
     int    frameNum;         // Presentation frame number
     int    sliceType;        // Slice type decided by lookahead
@@ -190,6 +244,7 @@ struct Lowres : public ReferencePlanes
     int32_t*  intraCost;
     uint8_t*  intraMode;
     int64_t   satdCost;
+    int64_t   decidedCost;     // cost estimate against the references chosen by slicetypeDecide, or -1
     uint16_t* lowresCostForRc;
     uint16_t* lowresCosts[X265_BFRAME_MAX + 2][X265_BFRAME_MAX + 2];
     int32_t*  lowresMvCosts[2][X265_BFRAME_MAX + 2];
@@ -203,6 +258,20 @@ struct Lowres : public ReferencePlanes
     bool      bEnableHME;
     int32_t*  lowerResMvCosts[2][X265_BFRAME_MAX + 2];
     MV*       lowerResMvs[2][X265_BFRAME_MAX + 2];
+    int64_t   lowerResCostEst[X265_BFRAME_MAX + 2][X265_BFRAME_MAX + 2]; // path decision costs (--hme-path-costs)
+    int       lowerResIntraMbs[X265_BFRAME_MAX + 2];
+
+    /* The arrays above are allocated from the pool by allocCosts() and
+     * allocMvs() before a reference distance is first estimated. Until then
+     * lowresMvs points at s_unsearchedMvs, whose x is the "not searched"
+     * marker 0x7FFF, and the other arrays are NULL. The first lowerResMvs of
+     * an allocated distance carry the same marker until the HME level of that
+     * distance is searched */
+    LowresPool* pool;
+    uint32_t  costBlockSize;
+    uint32_t  mvBlockSize;
+    uint32_t  lowerResCuCount;
+    static MV s_unsearchedMvs;
 
     /* used for vbvLookahead */
     int       plannedType[X265_LOOKAHEAD_MAX + 1];
@@ -242,8 +311,33 @@ struct Lowres : public ReferencePlanes
 
     bool create(x265_param* param, PicYuv *origPic, uint32_t qgSize);
     void destroy();
+
+    /* the allocation holding the four lowres planes, and its size in bytes */
+    void* planeBuffer(size_t& bytes) const;
+
+    /* the padded lowres planes, of sample type T as planes<T>() */
+    template<typename T>
+    T** buffers();
     void init(PicYuv *origPic, int poc);
+
+    /* init() in steps, for callers which work on the source rows while they
+     * are still in cache: initState(), then initRows() for every row of
+     * lowres CUs in order, then finishInit() */
+    void initState(PicYuv *origPic, int poc);
+    void initRows(PicYuv *origPic, int firstRow, int numRows);
+    void finishInit(PicYuv *origPic);
+
+    bool allocCosts(int p0Dist, int p1Dist);
+    bool allocMvs(int list, int dist);
+    void releaseArrays();
 };
+
+template<>
+inline pixel** Lowres::buffers<pixel>() { return buffer; }
+#if HIGH_BIT_DEPTH
+template<>
+inline uint8_t** Lowres::buffers<uint8_t>() { return buffer8; }
+#endif
 }
 
 #endif // ifndef X265_LOWRES_H
@@ -175,6 +175,11 @@ void x265_param_default(x265_param* param)
     param->bEnableTradScdInHscd = 1;
     param->lookaheadSlices = 8;
     param->lookaheadThreads = 0;
+    param->schedPolicy = X265_SCHED_SLICETYPE;
+    param->threadPools = NULL;
+    param->poolWeight = 1;
+    param->bAdaptiveFrameThreads = 0;
+    param->bHugePages = 0;
     param->scenecutBias = 5.0;
     param->radl = 0;
     param->chunkStart = 0;
@@ -247,6 +252,10 @@ void x265_param_default(x265_param* param)
     param->analysisReuseFileName = NULL;
     param->analysisSave = NULL;
     param->analysisLoad = NULL;
+    param->lookaheadLoad = NULL;
+    param->lookaheadLatency = 0;
+    param->bHMEPathCosts = 0;
+    param->bLowres8bit = 0;
     param->bIntraInBFrames = 1;
     param->bLossless = 0;
     param->bCULossless = 0;
@@ -288,6 +297,8 @@ void x265_param_default(x265_param* param)
     param->rc.zonefileCount = 0;
     param->rc.zones = NULL;
     param->rc.bEnableSlowFirstPass = 1;
+    param->bFastSecondPass = 0;
+    param->statsFormat = X265_STATS_BINARY;
     param->rc.bStrictCbr = 0;
     param->rc.bEnableGrain = 0;
     param->rc.qpMin = 0;
@@ -341,6 +352,9 @@ void x265_param_default(x265_param* param)
     param->analysisReuseLevel = 0;  /*DEPRECATED*/
     param->analysisSaveReuseLevel = 0;
     param->analysisLoadReuseLevel = 0;
+    param->analysisSaveFormat = X265_ANALYSIS_FORMAT_INDEXED;
+    param->bAnalysisSaveCompress = 0;
+    param->bAnalysisSaveDetach = 0;
     param->toneMapFile = NULL;
     param->bDhdr10opt = 0;
     param->dolbyProfile = 0;
@@ -892,6 +906,10 @@ int x265_param_parse(x265_param* p, const char* name, const char* value)
         }
     }
     OPT("frame-threads") p->frameNumThreads = atoi(value);
+    OPT("sched-policy") p->schedPolicy = parseName(value, x265_sched_policy_names, bError);
+    OPT("pool-weight") p->poolWeight = atoi(value);
+    OPT("adaptive-frame-threads") p->bAdaptiveFrameThreads = atobool(value);
+    OPT("huge-pages") p->bHugePages = atobool(value);
     OPT("pmode") p->bDistributeModeAnalysis = atobool(value);
     OPT("pme") p->bDistributeMotionEstimation = atobool(value);
     OPT2("level-idc", "level")
@@ -1111,6 +1129,7 @@ int x265_param_parse(x265_param* p, const char* name, const char* value)
     OPT("me")        p->searchMethod = parseName(value, x265_motion_est_names, bError);
     OPT("cutree")    p->rc.cuTree = atobool(value);
     OPT("slow-firstpass") p->rc.bEnableSlowFirstPass = atobool(value);
+    OPT("fast-secondpass") p->bFastSecondPass = atobool(value);
     OPT("strict-cbr")
     {
         p->rc.bStrictCbr = atobool(value);
@@ -1192,6 +1211,7 @@ int x265_param_parse(x265_param* p, const char* name, const char* value)
         p->rc.bStatRead = pass & 2;
     }
     OPT("stats") p->rc.statFileName = strdup(value);
+    OPT("stats-format") p->statsFormat = parseName(value, x265_stats_format_names, bError);
     OPT("scaling-list") p->scalingLists = strdup(value);
     OPT2("pools", "numa-pools") p->numaPools = strdup(value);
     OPT("lambda-file") p->rc.lambdaFileName = strdup(value);
@@ -1253,6 +1273,8 @@ int x265_param_parse(x265_param* p, const char* name, const char* value)
         }
         OPT("analysis-save-reuse-level") p->analysisSaveReuseLevel = atoi(value);
         OPT("analysis-load-reuse-level") p->analysisLoadReuseLevel = atoi(value);
+        OPT("analysis-save-format") p->analysisSaveFormat = parseName(value, x265_analysis_format_names, bError);
+        OPT("analysis-save-compress") p->bAnalysisSaveCompress = atobool(value);
         OPT("ssim-rd")
         {
             int bval = atobool(value);
@@ -1305,6 +1327,9 @@ int x265_param_parse(x265_param* p, const char* name, const char* value)
         OPT("gop-lookahead") p->gopLookahead = atoi(value);
         OPT("analysis-save") p->analysisSave = strdup(value);
         OPT("analysis-load") p->analysisLoad = strdup(value);
+        OPT("lookahead-load") p->lookaheadLoad = strdup(value);
+        OPT("lookahead-latency") p->lookaheadLatency = atoi(value);
+        OPT("lowres-8bit") p->bLowres8bit = atobool(value);
         OPT("radl") p->radl = atoi(value);
         OPT("max-ausize-factor") p->maxAUSizeFactor = atof(value);
         OPT("dynamic-refine") p->bDynamicRefine = atobool(value);
@@ -1445,6 +1470,7 @@ int x265_param_parse(x265_param* p, const char* name, const char* value)
             }
             p->bEnableHME = true;
         }
+        OPT("hme-path-costs") p->bHMEPathCosts = atobool(value);
         OPT("hme-range")
         {
             sscanf(value, "%d,%d,%d", &p->hmeRange[0], &p->hmeRange[1], &p->hmeRange[2]);
@@ -1644,6 +1670,10 @@ int x265_check_params(x265_param* param)
           "limitRectAmp must be 0, 1");
     CHECK(param->frameNumThreads < 0 || param->frameNumThreads > X265_MAX_FRAME_THREADS,
           "frameNumThreads (--frame-threads) must be [0 .. X265_MAX_FRAME_THREADS)");
+    CHECK(param->schedPolicy < X265_SCHED_SLICETYPE || param->schedPolicy > X265_SCHED_CRITICAL_PATH,
+          "Invalid scheduling policy (--sched-policy)");
+    CHECK(param->poolWeight < 1 || param->poolWeight > 1000,
+          "Thread pool weight (--pool-weight) must be in the range 1 to 1000");
     CHECK(param->cbQpOffset < -12, "Min. Chroma Cb QP Offset is -12");
     CHECK(param->cbQpOffset >  12, "Max. Chroma Cb QP Offset is  12");
     CHECK(param->crQpOffset < -12, "Min. Chroma Cr QP Offset is -12");
@@ -1703,6 +1733,8 @@ int x265_check_params(x265_param* param)
           "Lookahead depth must be less than 256");
     CHECK(param->lookaheadSlices > 16 || param->lookaheadSlices < 0,
           "Lookahead slices must between 0 and 16");
+    CHECK(param->lookaheadLatency < 0,
+          "Lookahead latency must be 0 (disabled) or a positive number of milliseconds");
     CHECK(param->rc.aqMode < X265_AQ_NONE || X265_AQ_EDGE < param->rc.aqMode,
           "Aq-Mode is out of range");
     CHECK(param->rc.aqStrength < 0 || param->rc.aqStrength > 3,
@@ -1809,8 +1841,12 @@ int x265_check_params(x265_param* param)
         CHECK(0 > param->noiseReductionInter || param->noiseReductionInter > 2000, "Valid noise reduction range 0 - 2000");
     CHECK(param->rc.rateControlMode == X265_RC_CQP && param->rc.bStatRead,
           "Constant QP is incompatible with 2pass");
+    CHECK(param->statsFormat < X265_STATS_TEXT || param->statsFormat > X265_STATS_BINARY,
+          "Invalid stats file format");
     CHECK(param->rc.bStrictCbr && (param->rc.bitrate <= 0 || param->rc.vbvBufferSize <=0),
           "Strict-cbr cannot be applied without specifying target bitrate or vbv bufsize");
+    CHECK(param->analysisSaveFormat < X265_ANALYSIS_FORMAT_LEGACY || param->analysisSaveFormat > X265_ANALYSIS_FORMAT_INDEXED,
+          "Invalid analysis save file format");
     CHECK(param->analysisSave && (param->analysisSaveReuseLevel < 0 || param->analysisSaveReuseLevel > 10),
         "Invalid analysis save refine level. Value must be between 1 and 10 (inclusive)");
     CHECK(param->analysisLoad && (param->analysisLoadReuseLevel < 0 || param->analysisLoadReuseLevel > 10),
@@ -2112,6 +2148,11 @@ char *x265_param2string(x265_param* p, int padx, int pady)
     s += sprintf(s, " frame-threads=%d", p->frameNumThreads);
     if (p->numaPools)
         s += sprintf(s, " numa-pools=%s", p->numaPools);
+    s += sprintf(s, " sched-policy=%s", x265_sched_policy_names[p->schedPolicy]);
+    if (p->threadPools)
+        s += sprintf(s, " pool-weight=%d", p->poolWeight);
+    BOOL(p->bAdaptiveFrameThreads, "adaptive-frame-threads");
+    BOOL(p->bHugePages, "huge-pages");
     BOOL(p->bEnableWavefront, "wpp");
     BOOL(p->bDistributeModeAnalysis, "pmode");
     BOOL(p->bDistributeMotionEstimation, "pme");
@@ -2154,6 +2195,10 @@ char *x265_param2string(x265_param* p, int padx, int pady)
     s += sprintf(s, " bframe-bias=%d", p->bFrameBias);
     s += sprintf(s, " rc-lookahead=%d", p->lookaheadDepth);
     s += sprintf(s, " lookahead-slices=%d", p->lookaheadSlices);
+    s += sprintf(s, " lookahead-latency=%d", p->lookaheadLatency);
+#if HIGH_BIT_DEPTH
+    BOOL(p->bLowres8bit, "lowres-8bit");
+#endif
     s += sprintf(s, " scenecut=%d", p->scenecutThreshold);
     BOOL(p->bHistBasedSceneCut, "hist-scenecut");
     if (p->bHistBasedSceneCut)
@@ -2193,6 +2238,7 @@ char *x265_param2string(x265_param* p, int padx, int pady)
     {
         s += sprintf(s, " Level 0,1,2=%d,%d,%d", p->hmeSearchMethod[0], p->hmeSearchMethod[1], p->hmeSearchMethod[2]);
         s += sprintf(s, " merange L0,L1,L2=%d,%d,%d", p->hmeRange[0], p->hmeRange[1], p->hmeRange[2]);
+        BOOL(p->bHMEPathCosts, "hme-path-costs");
     }
     BOOL(p->bEnableWeightedPred, "weightp");
     BOOL(p->bEnableWeightedBiPred, "weightb");
@@ -2234,10 +2280,15 @@ char *x265_param2string(x265_param* p, int padx, int pady)
         s += sprintf(s, " stats-write=%d", p->rc.bStatWrite);
         s += sprintf(s, " stats-read=%d", p->rc.bStatRead);
         if (p->rc.bStatRead)
+        {
             s += sprintf(s, " cplxblur=%.1f qblur=%.1f",
             p->rc.complexityBlur, p->rc.qblur);
+            BOOL(p->bFastSecondPass, "fast-secondpass");
+        }
         if (p->rc.bStatWrite && !p->rc.bStatRead)
             BOOL(p->rc.bEnableSlowFirstPass, "slow-firstpass");
+        if (p->rc.bStatWrite)
+            s += sprintf(s, " stats-format=%s", x265_stats_format_names[p->statsFormat]);
         if (p->rc.vbvBufferSize)
         {
             s += sprintf(s, " vbv-maxrate=%d vbv-bufsize=%d vbv-init=%.1f min-vbv-fullness=%.1f max-vbv-fullness=%.1f",
@@ -2319,9 +2370,14 @@ char *x265_param2string(x265_param* p, int padx, int pady)
     BOOL(p->bDhdr10opt, "dhdr10-opt");
     BOOL(p->bEmitIDRRecoverySEI, "idr-recovery-sei");
     if (p->analysisSave)
-        s += sprintf(s, " analysis-save");
+    {
+        s += sprintf(s, " analysis-save analysis-save-format=%s", x265_analysis_format_names[p->analysisSaveFormat]);
+        BOOL(p->bAnalysisSaveCompress, "analysis-save-compress");
+    }
     if (p->analysisLoad)
         s += sprintf(s, " analysis-load");
+    if (p->lookaheadLoad)
+        s += sprintf(s, " lookahead-load");
     s += sprintf(s, " analysis-reuse-level=%d", p->analysisReuseLevel);
     s += sprintf(s, " analysis-save-reuse-level=%d", p->analysisSaveReuseLevel);
     s += sprintf(s, " analysis-load-reuse-level=%d", p->analysisLoadReuseLevel);
@@ -2471,6 +2527,14 @@ void x265_copy_params(x265_param* dst, x265_param* src)
     dst->lookaheadDepth = src->lookaheadDepth;
     dst->lookaheadSlices = src->lookaheadSlices;
     dst->lookaheadThreads = src->lookaheadThreads;
+    dst->lookaheadLatency = src->lookaheadLatency;
+    dst->bHMEPathCosts = src->bHMEPathCosts;
+    dst->bLowres8bit = src->bLowres8bit;
+    dst->schedPolicy = src->schedPolicy;
+    dst->threadPools = src->threadPools;
+    dst->poolWeight = src->poolWeight;
+    dst->bAdaptiveFrameThreads = src->bAdaptiveFrameThreads;
+    dst->bHugePages = src->bHugePages;
     dst->scenecutThreshold = src->scenecutThreshold;
     dst->bHistBasedSceneCut = src->bHistBasedSceneCut;
     dst->bEnableTradScdInHscd = src->bEnableTradScdInHscd;
@@ -2565,6 +2629,8 @@ void x265_copy_params(x265_param* dst, x265_param* src)
     dst->rc.qblur = src->rc.qblur;
     dst->rc.complexityBlur = src->rc.complexityBlur;
     dst->rc.bEnableSlowFirstPass = src->rc.bEnableSlowFirstPass;
+    dst->bFastSecondPass = src->bFastSecondPass;
+    dst->statsFormat = src->statsFormat;
     dst->rc.zoneCount = src->rc.zoneCount;
     dst->rc.zonefileCount = src->rc.zonefileCount;
     dst->reconfigWindowSize = src->reconfigWindowSize;
@@ -2655,6 +2721,9 @@ void x265_copy_params(x265_param* dst, x265_param* src)
     dst->analysisReuseLevel = src->analysisReuseLevel;
     dst->analysisSaveReuseLevel = src->analysisSaveReuseLevel;
     dst->analysisLoadReuseLevel = src->analysisLoadReuseLevel;
+    dst->analysisSaveFormat = src->analysisSaveFormat;
+    dst->bAnalysisSaveCompress = src->bAnalysisSaveCompress;
+    dst->bAnalysisSaveDetach = src->bAnalysisSaveDetach;
     dst->bLimitSAO = src->bLimitSAO;
     if (src->toneMapFile) dst->toneMapFile = strdup(src->toneMapFile);
     else dst->toneMapFile = NULL;
@@ -2683,6 +2752,8 @@ void x265_copy_params(x265_param* dst, x265_param* src)
     else dst->analysisSave = NULL;
     if (src->analysisLoad) dst->analysisLoad=strdup(src->analysisLoad);
     else dst->analysisLoad = NULL;
+    if (src->lookaheadLoad) dst->lookaheadLoad = strdup(src->lookaheadLoad);
+    else dst->lookaheadLoad = NULL;
     dst->gopLookahead = src->gopLookahead;
     dst->radl = src->radl;
     dst->selectiveSAO = src->selectiveSAO;
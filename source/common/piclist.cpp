@@ -24,6 +24,7 @@
 #include "common.h"
 #include "piclist.h"
 #include "frame.h"
+#include "threading.h"
 
 using namespace X265_NS;
 
@@ -158,3 +159,62 @@ void PicList::remove(Frame& curFrame)
 
     curFrame.m_next = curFrame.m_prev = NULL;
 }
+
+bool PicQueue::create(uint32_t minCapacity)
+{
+    uint32_t capacity = 1;
+    while (capacity < minCapacity)
+        capacity <<= 1;
+
+    CHECKED_MALLOC_ZERO(m_ring, Frame*, capacity);
+    m_mask = capacity - 1;
+    m_head = m_tail = 0;
+    return true;
+
+fail:
+    return false;
+}
+
+void PicQueue::destroy()
+{
+    X265_FREE(m_ring);
+    m_ring = NULL;
+    m_mask = 0;
+}
+
+bool PicQueue::push(Frame& curFrame)
+{
+    uint32_t tail = m_tail;
+    if (tail - m_head > m_mask)
+        return false;
+
+    m_ring[tail & m_mask] = &curFrame;
+    MEMORY_BARRIER(); // the slot must be visible before the new tail
+    m_tail = tail + 1;
+    return true;
+}
+
+Frame* PicQueue::pop()
+{
+    uint32_t head = m_head;
+    if (head == m_tail)
+        return NULL;
+
+    MEMORY_BARRIER(); // read the slot only after observing the tail
+    Frame* curFrame = m_ring[head & m_mask];
+    MEMORY_BARRIER(); // the slot must be read before it is released to the producer
+    m_head = head + 1;
+    return curFrame;
+}
+
+Frame* PicQueue::getPOC(int poc)
+{
+    uint32_t tail = m_tail;
+    MEMORY_BARRIER();
+    for (uint32_t i = m_head; i != tail; i++)
+    {
+        if (m_ring[i & m_mask]->m_poc == poc)
+            return m_ring[i & m_mask];
+    }
+    return NULL;
+}
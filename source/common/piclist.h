@@ -78,6 +78,50 @@ public:
 
     operator bool() const { return !!m_count; }
 };
+
+/* Bounded single-producer single-consumer ring of pictures. One thread may
+ * push while another pops without either taking a lock; the head and tail
+ * indices are each written by only one side and published with a memory
+ * barrier. Unlike PicList it does not use the m_next/m_prev links of the
+ * Frame, so a picture may be handed over while it still belongs to a list
+ * owned by the producer. */
+class PicQueue
+{
+protected:
+
+    Frame**           m_ring;
+    uint32_t          m_mask;
+    volatile uint32_t m_head;    // next slot to pop, written by the consumer
+    volatile uint32_t m_tail;    // next slot to push, written by the producer
+
+public:
+
+    PicQueue()
+    {
+        m_ring = NULL;
+        m_mask = 0;
+        m_head = 0;
+        m_tail = 0;
+    }
+
+    /** Allocate room for at least minCapacity pictures */
+    bool create(uint32_t minCapacity);
+
+    void destroy();
+
+    /** Producer: append picture, returns false if the ring is full */
+    bool push(Frame& pic);
+
+    /** Consumer: remove the oldest picture, returns NULL if the ring is empty */
+    Frame* pop();
+
+    /** Consumer: find frame with specified POC without removing it */
+    Frame* getPOC(int poc);
+
+    int size() const      { return (int)(m_tail - m_head); }
+
+    bool empty() const    { return m_tail == m_head; }
+};
 }
 
 #endif // ifndef X265_PICLIST_H
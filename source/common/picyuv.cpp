@@ -95,7 +95,7 @@ bool PicYuv::create(x265_param* param, bool picAlloc, pixel *pixelbuf)
     {
         if (picAlloc)
         {
-            CHECKED_MALLOC(m_picBuf[0], pixel, m_stride * (maxHeight + (m_lumaMarginY * 2)));
+            CHECKED_MALLOC_PAGES(m_picBuf[0], pixel, m_stride * (maxHeight + (m_lumaMarginY * 2)), !!param->bHugePages);
             m_picOrg[0] = m_picBuf[0] + m_lumaMarginY * m_stride + m_lumaMarginX;
         }
     }
@@ -107,8 +107,8 @@ bool PicYuv::create(x265_param* param, bool picAlloc, pixel *pixelbuf)
         m_strideC = ((numCuInWidth * m_param->maxCUSize) >> m_hChromaShift) + (m_chromaMarginX * 2);
         if (picAlloc)
         {
-            CHECKED_MALLOC(m_picBuf[1], pixel, m_strideC * ((maxHeight >> m_vChromaShift) + (m_chromaMarginY * 2)));
-            CHECKED_MALLOC(m_picBuf[2], pixel, m_strideC * ((maxHeight >> m_vChromaShift) + (m_chromaMarginY * 2)));
+            CHECKED_MALLOC_PAGES(m_picBuf[1], pixel, m_strideC * ((maxHeight >> m_vChromaShift) + (m_chromaMarginY * 2)), !!param->bHugePages);
+            CHECKED_MALLOC_PAGES(m_picBuf[2], pixel, m_strideC * ((maxHeight >> m_vChromaShift) + (m_chromaMarginY * 2)), !!param->bHugePages);
 
             m_picOrg[1] = m_picBuf[1] + m_chromaMarginY * m_strideC + m_chromaMarginX;
             m_picOrg[2] = m_picBuf[2] + m_chromaMarginY * m_strideC + m_chromaMarginX;
@@ -146,9 +146,31 @@ int PicYuv::getLumaBufLen(uint32_t picWidth, uint32_t picHeight, uint32_t picCsp
     return bufLen;
 }
 
+/* total bytes of pixel memory allocated by create(), including margins */
+size_t PicYuv::getAllocSize() const
+{
+    if (!m_picBuf[0])
+        return 0;
+
+    uint32_t numCuInHeight = (m_picHeight + m_param->maxCUSize - 1) / m_param->maxCUSize;
+    size_t maxHeight = numCuInHeight * m_param->maxCUSize;
+    size_t size = m_stride * (maxHeight + (m_lumaMarginY * 2));
+    if (m_picBuf[1])
+        size += 2 * m_strideC * ((maxHeight >> m_vChromaShift) + (m_chromaMarginY * 2));
+    return size * sizeof(pixel);
+}
+
+/* bytes of the pixel memory allocated by create() placed on, or advised for,
+ * huge pages */
+size_t PicYuv::getHugePageAdvisedSize() const
+{
+    return x265_huge_page_advised_bytes(m_picBuf[0]) + x265_huge_page_advised_bytes(m_picBuf[1]) + x265_huge_page_advised_bytes(m_picBuf[2]);
+}
+
 /* the first picture allocated by the encoder will be asked to generate these
  * offset arrays. Once generated, they will be provided to all future PicYuv
  * allocated by the same encoder. */
+
 bool PicYuv::createOffsets(const SPS& sps)
 {
     uint32_t numPartitions = 1 << (m_param->unitSizeDepth * 2);
@@ -199,9 +221,9 @@ fail:
 
 void PicYuv::destroy()
 {
-    X265_FREE(m_picBuf[0]);
-    X265_FREE(m_picBuf[1]);
-    X265_FREE(m_picBuf[2]);
+    X265_FREE_PAGES(m_picBuf[0]);
+    X265_FREE_PAGES(m_picBuf[1]);
+    X265_FREE_PAGES(m_picBuf[2]);
 }
 
 /* Copy pixels from an x265_picture into internal PicYuv instance.
@@ -81,6 +81,8 @@ public:
     bool  createOffsets(const SPS& sps);
     void  destroy();
     int   getLumaBufLen(uint32_t picWidth, uint32_t picHeight, uint32_t picCsp);
+    size_t getAllocSize() const;
+    size_t getHugePageAdvisedSize() const;
 
     void  copyFromPicture(const x265_picture&, const x265_param& param, int padx, int pady);
 
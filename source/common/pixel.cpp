@@ -26,7 +26,7 @@
  *****************************************************************************/
 
 #include "common.h"
-#include "slicetype.h"      // LOWRES_COST_MASK
+#include "slicetype.h"      // LOWRES_COST_MASK, EDGE_THRESHOLD
 #include "primitives.h"
 #include "x265.h"
 
@@ -37,25 +37,8 @@ using namespace X265_NS;
 namespace {
 // place functions in anonymous namespace (file static)
 
-template<int lx, int ly>
-int sad(const pixel* pix1, intptr_t stride_pix1, const pixel* pix2, intptr_t stride_pix2)
-{
-    int sum = 0;
-
-    for (int y = 0; y < ly; y++)
-    {
-        for (int x = 0; x < lx; x++)
-            sum += abs(pix1[x] - pix2[x]);
-
-        pix1 += stride_pix1;
-        pix2 += stride_pix2;
-    }
-
-    return sum;
-}
-
-template<int lx, int ly>
-int sad(const int16_t* pix1, intptr_t stride_pix1, const int16_t* pix2, intptr_t stride_pix2)
+template<int lx, int ly, typename T>
+int sad(const T* pix1, intptr_t stride_pix1, const T* pix2, intptr_t stride_pix2)
 {
     int sum = 0;
 
@@ -71,8 +54,8 @@ int sad(const int16_t* pix1, intptr_t stride_pix1, const int16_t* pix2, intptr_t
     return sum;
 }
 
-template<int lx, int ly>
-void sad_x3(const pixel* pix1, const pixel* pix2, const pixel* pix3, const pixel* pix4, intptr_t frefstride, int32_t* res)
+template<int lx, int ly, typename T>
+void sad_x3(const T* pix1, const T* pix2, const T* pix3, const T* pix4, intptr_t frefstride, int32_t* res)
 {
     res[0] = 0;
     res[1] = 0;
@@ -93,8 +76,8 @@ void sad_x3(const pixel* pix1, const pixel* pix2, const pixel* pix3, const pixel
     }
 }
 
-template<int lx, int ly>
-void sad_x4(const pixel* pix1, const pixel* pix2, const pixel* pix3, const pixel* pix4, const pixel* pix5, intptr_t frefstride, int32_t* res)
+template<int lx, int ly, typename T>
+void sad_x4(const T* pix1, const T* pix2, const T* pix3, const T* pix4, const T* pix5, intptr_t frefstride, int32_t* res)
 {
     res[0] = 0;
     res[1] = 0;
@@ -236,7 +219,8 @@ static int satd_4x4(const pixel* pix1, intptr_t stride_pix1, const pixel* pix2,
 }
 
 // x264's SWAR version of satd 8x4, performs two 4x4 SATDs at once
-static int satd_8x4(const pixel* pix1, intptr_t stride_pix1, const pixel* pix2, intptr_t stride_pix2)
+template<typename T>
+static int satd_8x4(const T* pix1, intptr_t stride_pix1, const T* pix2, intptr_t stride_pix2)
 {
     sum2_t tmp[4][4];
     sum2_t a0, a1, a2, a3;
@@ -296,6 +280,15 @@ int satd8(const pixel* pix1, intptr_t stride_pix1, const pixel* pix2, intptr_t s
     return satd;
 }
 
+#if HIGH_BIT_DEPTH
+// satd of the 8bit 8x8 lowres blocks of --lowres-8bit, in blocks of 8x4
+static int satd_8x8_lowres8(const uint8_t* pix1, intptr_t stride_pix1, const uint8_t* pix2, intptr_t stride_pix2)
+{
+    return satd_8x4(pix1, stride_pix1, pix2, stride_pix2) +
+           satd_8x4(pix1 + 4 * stride_pix1, stride_pix1, pix2 + 4 * stride_pix2, stride_pix2);
+}
+#endif
+
 inline int _sa8d_8x8(const pixel* pix1, intptr_t i_pix1, const pixel* pix2, intptr_t i_pix2)
 {
     sum2_t tmp[8][4];
@@ -515,11 +508,12 @@ static void weight_sp_c(const int16_t* src, pixel* dst, intptr_t srcStride, intp
     }
 }
 
-static void weight_pp_c(const pixel* src, pixel* dst, intptr_t stride, int width, int height, int w0, int round, int shift, int offset)
+template<typename T>
+static void weight_pp_c(const T* src, T* dst, intptr_t stride, int width, int height, int w0, int round, int shift, int offset)
 {
     int x, y;
 
-    const int correction = (IF_INTERNAL_PREC - X265_DEPTH);
+    const int correction = (IF_INTERNAL_PREC - SampleDepth<T>::value);
 
     X265_CHECK(!(width & 15), "weightp alignment error\n");
     X265_CHECK(!((w0 << 6) > 32767), "w0 using more than 16 bits, asm output will mismatch\n");
@@ -533,7 +527,7 @@ static void weight_pp_c(const pixel* src, pixel* dst, intptr_t stride, int width
         {
             // simulating pixel to short conversion
             int16_t val = src[x] << correction;
-            dst[x] = x265_clip(((w0 * (val) + round) >> shift) + offset);
+            dst[x] = x265_clipSample<T>(((w0 * (val) + round) >> shift) + offset);
             x++;
         }
 
@@ -542,8 +536,8 @@ static void weight_pp_c(const pixel* src, pixel* dst, intptr_t stride, int width
     }
 }
 
-template<int lx, int ly>
-void pixelavg_pp(pixel* dst, intptr_t dstride, const pixel* src0, intptr_t sstride0, const pixel* src1, intptr_t sstride1, int)
+template<int lx, int ly, typename T>
+void pixelavg_pp(T* dst, intptr_t dstride, const T* src0, intptr_t sstride0, const T* src1, intptr_t sstride1, int)
 {
     for (int y = 0; y < ly; y++)
     {
@@ -601,18 +595,30 @@ static void scale2D_64to32(pixel* dst, const pixel* src, intptr_t stride)
     }
 }
 
-static
-void frame_init_lowres_core(const pixel* src0, pixel* dst0, pixel* dsth, pixel* dstv, pixel* dstc,
-                            intptr_t src_stride, intptr_t dst_stride, int width, int height)
+/* rounds a lowres sample of the bit depth of S to sample type D, the 8bit
+ * lowres planes of --lowres-8bit are made from the high bit depth source */
+template<typename S, typename D>
+inline D lowresSample(int v)
+{
+    const int shift = SampleDepth<S>::value - SampleDepth<D>::value;
+
+    if (!shift)
+        return (D)v;
+    return x265_clipSample<D>((v + ((1 << shift) >> 1)) >> shift);
+}
+
+template<typename S, typename D>
+static void frame_init_lowres_core(const S* src0, D* dst0, D* dsth, D* dstv, D* dstc,
+                                   intptr_t src_stride, intptr_t dst_stride, int width, int height)
 {
     for (int y = 0; y < height; y++)
     {
-        const pixel* src1 = src0 + src_stride;
-        const pixel* src2 = src1 + src_stride;
+        const S* src1 = src0 + src_stride;
+        const S* src2 = src1 + src_stride;
         for (int x = 0; x < width; x++)
         {
             // slower than naive bilinear, but matches asm
-#define FILTER(a, b, c, d) ((((a + b + 1) >> 1) + ((c + d + 1) >> 1) + 1) >> 1)
+#define FILTER(a, b, c, d) lowresSample<S, D>((((a + b + 1) >> 1) + ((c + d + 1) >> 1) + 1) >> 1)
             dst0[x] = FILTER(src0[2 * x], src1[2 * x], src0[2 * x + 1], src1[2 * x + 1]);
             dsth[x] = FILTER(src0[2 * x + 1], src1[2 * x + 1], src0[2 * x + 2], src1[2 * x + 2]);
             dstv[x] = FILTER(src1[2 * x], src2[2 * x], src1[2 * x + 1], src2[2 * x + 1]);
@@ -756,8 +762,8 @@ int psyCost_pp(const pixel* source, intptr_t sstride, const pixel* recon, intptr
     }
 }
 
-template<int bx, int by>
-void blockcopy_pp_c(pixel* a, intptr_t stridea, const pixel* b, intptr_t strideb)
+template<int bx, int by, typename T>
+void blockcopy_pp_c(T* a, intptr_t stridea, const T* b, intptr_t strideb)
 {
     for (int y = 0; y < by; y++)
     {
@@ -955,6 +961,66 @@ static void cuTreeFix8Unpack(double *dst, uint16_t *src, int count)
     }
 }
 
+/* 5x5 Gaussian blur of one row of pixels
+ *      [2   4   5   4   2]
+ *  1   [4   9   12  9   4]
+ * ---  [5   12  15  12  5]
+ * 159  [4   9   12  9   4]
+ *      [2   4   5   4   2] */
+static void edgeGaussian_c(pixel* dst, const pixel* src, intptr_t stride, int width)
+{
+    static const int taps[5][5] =
+    {
+        { 2, 4,  5,  4,  2 },
+        { 4, 9,  12, 9,  4 },
+        { 5, 12, 15, 12, 5 },
+        { 4, 9,  12, 9,  4 },
+        { 2, 4,  5,  4,  2 }
+    };
+
+    for (int x = 0; x < width; x++)
+    {
+        const pixel* s = src + x - 2 * stride - 2;
+        int sum = 0;
+        for (int i = 0; i < 5; i++, s += stride)
+            for (int j = 0; j < 5; j++)
+                sum += taps[i][j] * s[j];
+        dst[x] = (pixel)(sum / 159);
+    }
+}
+
+/* Angle of the gradient in whole degrees, in [0, 180] */
+static inline pixel edgeAngle(float gradientV, float gradientH)
+{
+    float radians = atan2(gradientV, gradientH);
+    float theta = (float)((radians * 180) / PI);
+    if (theta < 0)
+        theta = 180 + theta;
+    return (pixel)theta;
+}
+
+/* Sobel gradients of one row of pixels, marking whitePixel where the gradient
+ * magnitude reaches EDGE_THRESHOLD
+ *      [ -3   0   3 ]        [-3   -10  -3 ]
+ * gH = [ -10  0   10]   gV = [ 0    0    0 ]
+ *      [ -3   0   3 ]        [ 3    10   3 ] */
+static void edgeSobel_c(pixel* edge, pixel* theta, const pixel* src, intptr_t stride, int width, pixel whitePixel)
+{
+    const int threshold = (int)(EDGE_THRESHOLD * EDGE_THRESHOLD);
+
+    for (int x = 0; x < width; x++)
+    {
+        const pixel* above = src + x - stride;
+        const pixel* cur = src + x;
+        const pixel* below = src + x + stride;
+        int gradientH = -3 * above[-1] + 3 * above[1] - 10 * cur[-1] + 10 * cur[1] - 3 * below[-1] + 3 * below[1];
+        int gradientV = -3 * above[-1] - 10 * above[0] - 3 * above[1] + 3 * below[-1] + 10 * below[0] + 3 * below[1];
+        edge[x] = (pixel)(gradientH * gradientH + gradientV * gradientV >= threshold ? whitePixel : 0);
+        if (theta)
+            theta[x] = edgeAngle((float)gradientV, (float)gradientH);
+    }
+}
+
 template<int log2TrSize>
 static void ssimDist_c(const pixel* fenc, uint32_t fStride, const pixel* recon, intptr_t rstride, uint64_t *ssBlock, int shift, uint64_t *ac_k)
 {
@@ -1021,25 +1087,40 @@ static pixel planeClipAndMax_c(pixel *src, intptr_t stride, int width, int heigh
 namespace X265_NS {
 // x265 private namespace
 
-/* Extend the edges of a picture so that it may safely be used for motion
- * compensation. This function assumes the picture is stored in a buffer with
- * sufficient padding for the X and Y margins */
-void extendPicBorder(pixel* pic, intptr_t stride, int width, int height, int marginX, int marginY)
+template<typename T>
+static void extendBorder(T* pic, intptr_t stride, int width, int height, int marginX, int marginY,
+                         void (*extendRowBorder)(T*, intptr_t, int, int, int))
 {
     /* extend left and right margins */
-    primitives.extendRowBorder(pic, stride, width, height, marginX);
+    extendRowBorder(pic, stride, width, height, marginX);
 
     /* copy top row to create above margin */
-    pixel* top = pic - marginX;
+    T* top = pic - marginX;
     for (int y = 0; y < marginY; y++)
-        memcpy(top - (y + 1) * stride, top, stride * sizeof(pixel));
+        memcpy(top - (y + 1) * stride, top, stride * sizeof(T));
 
     /* copy bottom row to create below margin */
-    pixel* bot = pic - marginX + (height - 1) * stride;
+    T* bot = pic - marginX + (height - 1) * stride;
     for (int y = 0; y < marginY; y++)
-        memcpy(bot + (y + 1) * stride, bot, stride * sizeof(pixel));
+        memcpy(bot + (y + 1) * stride, bot, stride * sizeof(T));
 }
 
+/* Extend the edges of a picture so that it may safely be used for motion
+ * compensation. This function assumes the picture is stored in a buffer with
+ * sufficient padding for the X and Y margins */
+void extendPicBorder(pixel* pic, intptr_t stride, int width, int height, int marginX, int marginY)
+{
+    extendBorder(pic, stride, width, height, marginX, marginY, primitives.extendRowBorder);
+}
+
+#if HIGH_BIT_DEPTH
+/* the same, for the 8bit lowres planes of --lowres-8bit */
+void extendPicBorder(uint8_t* pic, intptr_t stride, int width, int height, int marginX, int marginY)
+{
+    extendBorder(pic, stride, width, height, marginX, marginY, lowresPrimitives8.extendRowBorder);
+}
+#endif
+
 /* Initialize entries for pixel functions defined in this file */
 void setupPixelPrimitives_c(EncoderPrimitives &p)
 {
@@ -1329,8 +1410,8 @@ void setupPixelPrimitives_c(EncoderPrimitives &p)
 
     p.scale1D_128to64[NONALIGNED] = p.scale1D_128to64[ALIGNED] = scale1D_128to64;
     p.scale2D_64to32 = scale2D_64to32;
-    p.frameInitLowres = frame_init_lowres_core;
-    p.frameInitLowerRes = frame_init_lowres_core;
+    p.frameInitLowres = frame_init_lowres_core<pixel, pixel>;
+    p.frameInitLowerRes = frame_init_lowres_core<pixel, pixel>;
     p.ssim_4x4x2_core = ssim_4x4x2_core;
     p.ssim_end_4 = ssim_end_4;
 
@@ -1344,6 +1425,8 @@ void setupPixelPrimitives_c(EncoderPrimitives &p)
     p.propagateCost = estimateCUPropagateCost;
     p.fix8Unpack = cuTreeFix8Unpack;
     p.fix8Pack = cuTreeFix8Pack;
+    p.edgeGaussian = edgeGaussian_c;
+    p.edgeSobel = edgeSobel_c;
 
     p.cu[BLOCK_4x4].ssimDist = ssimDist_c<2>;
     p.cu[BLOCK_8x8].ssimDist = ssimDist_c<3>;
@@ -1356,4 +1439,22 @@ void setupPixelPrimitives_c(EncoderPrimitives &p)
     p.cu[BLOCK_32x32].normFact = normFact_c;
     p.cu[BLOCK_64x64].normFact = normFact_c;
 }
+
+#if HIGH_BIT_DEPTH
+/* Initialize the 8bit lowres entries of pixel functions defined in this file */
+void setupLowresPixelPrimitives8_c(LowresPrimitives<uint8_t> &lp)
+{
+    lp.sad = sad<8, 8>;
+    lp.sad_x3 = sad_x3<8, 8>;
+    lp.sad_x4 = sad_x4<8, 8>;
+    lp.satd = satd_8x8_lowres8;
+    lp.copy_pp = blockcopy_pp_c<8, 8>;
+    lp.pixelavg_pp[NONALIGNED] = pixelavg_pp<8, 8>;
+    lp.pixelavg_pp[ALIGNED] = pixelavg_pp<8, 8>;
+
+    lp.weight_pp = weight_pp_c;
+    lp.frameInitLowres = frame_init_lowres_core<pixel, uint8_t>;
+    lp.frameInitLowerRes = frame_init_lowres_core<uint8_t, uint8_t>;
+}
+#endif
 }
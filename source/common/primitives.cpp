@@ -51,6 +51,12 @@ extern const uint8_t lumaPartitionMapTable[] =
 /* the "authoritative" set of encoder primitives */
 EncoderPrimitives primitives;
 
+/* the lookahead's view of them, see LowresPrimitives */
+LowresPrimitives<pixel> lowresPrimitives;
+#if HIGH_BIT_DEPTH
+LowresPrimitives<uint8_t> lowresPrimitives8;
+#endif
+
 void setupPixelPrimitives_c(EncoderPrimitives &p);
 void setupDCTPrimitives_c(EncoderPrimitives &p);
 void setupFilterPrimitives_c(EncoderPrimitives &p);
@@ -59,6 +65,11 @@ void setupLoopFilterPrimitives_c(EncoderPrimitives &p);
 void setupSaoPrimitives_c(EncoderPrimitives &p);
 void setupSeaIntegralPrimitives_c(EncoderPrimitives &p);
 void setupLowPassPrimitives_c(EncoderPrimitives& p);
+#if HIGH_BIT_DEPTH
+void setupLowresPixelPrimitives8_c(LowresPrimitives<uint8_t> &lp);
+void setupLowresFilterPrimitives8_c(LowresPrimitives<uint8_t> &lp);
+void setupLowresIntraPrimitives8_c(LowresPrimitives<uint8_t> &lp);
+#endif
 
 void setupCPrimitives(EncoderPrimitives &p)
 {
@@ -85,6 +96,25 @@ void enableLowpassDCTPrimitives(EncoderPrimitives &p)
     p.cu[BLOCK_32x32].dct = p.cu[BLOCK_32x32].lowpass_dct;
 }
 
+void setupLowresPrimitives(LowresPrimitives<pixel> &lp, const EncoderPrimitives &p)
+{
+    lp.sad = p.pu[LUMA_8x8].sad;
+    lp.sad_x3 = p.pu[LUMA_8x8].sad_x3;
+    lp.sad_x4 = p.pu[LUMA_8x8].sad_x4;
+    lp.satd = p.pu[LUMA_8x8].satd;
+    lp.copy_pp = p.cu[BLOCK_8x8].copy_pp;
+    lp.pixelavg_pp[NONALIGNED] = p.pu[LUMA_8x8].pixelavg_pp[NONALIGNED];
+    lp.pixelavg_pp[ALIGNED] = p.pu[LUMA_8x8].pixelavg_pp[ALIGNED];
+    lp.intra_filter = p.cu[BLOCK_8x8].intra_filter;
+    for (int i = 0; i < NUM_INTRA_MODE; i++)
+        lp.intra_pred[i] = p.cu[BLOCK_8x8].intra_pred[i];
+
+    lp.weight_pp = p.weight_pp;
+    lp.frameInitLowres = p.frameInitLowres;
+    lp.frameInitLowerRes = p.frameInitLowerRes;
+    lp.extendRowBorder = p.extendRowBorder;
+}
+
 void setupAliasPrimitives(EncoderPrimitives &p)
 {
 #if HIGH_BIT_DEPTH
@@ -279,6 +309,13 @@ void x265_setup_primitives(x265_param *param)
         {
             enableLowpassDCTPrimitives(primitives); 
         }
+
+        setupLowresPrimitives(lowresPrimitives, primitives);
+#if HIGH_BIT_DEPTH
+        setupLowresPixelPrimitives8_c(lowresPrimitives8);   // pixel.cpp
+        setupLowresFilterPrimitives8_c(lowresPrimitives8);  // ipfilter.cpp
+        setupLowresIntraPrimitives8_c(lowresPrimitives8);   // intrapred.cpp
+#endif
     }
 
     x265_report_simd(param);
@@ -214,6 +214,9 @@ typedef void (*cutree_propagate_cost) (int* dst, const uint16_t* propagateIn, co
 typedef void (*cutree_fix8_unpack)(double *dst, uint16_t *src, int count);
 typedef void (*cutree_fix8_pack)(uint16_t *dst, double *src, int count);
 
+typedef void (*edge_gaussian_t)(pixel* dst, const pixel* src, intptr_t stride, int width);
+typedef void (*edge_sobel_t)(pixel* edge, pixel* theta, const pixel* src, intptr_t stride, int width, pixel whitePixel);
+
 typedef int (*scanPosLast_t)(const uint16_t *scan, const coeff_t *coeff, uint16_t *coeffSign, uint16_t *coeffFlag, uint8_t *coeffNum, int numSig, const uint16_t* scanCG4x4, const int trSize);
 typedef uint32_t (*findPosFirstLast_t)(const int16_t *dstCoeff, const intptr_t trSize, const uint16_t scanTbl[16]);
 
@@ -357,6 +360,11 @@ struct EncoderPrimitives
     cutree_fix8_unpack    fix8Unpack;
     cutree_fix8_pack      fix8Pack;
 
+    /* Edge detection of one row of luma pixels for aq-mode 4 and hist-scenecut.
+     * edgeSobel writes theta only if it is not NULL */
+    edge_gaussian_t       edgeGaussian;
+    edge_sobel_t          edgeSobel;
+
     extendCURowBorder_t   extendRowBorder;
     planecopy_cp_t        planecopy_cp;
     planecopy_sp_t        planecopy_sp;
@@ -431,6 +439,59 @@ struct EncoderPrimitives
 /* This copy of the table is what gets used by the encoder */
 extern EncoderPrimitives primitives;
 
+/* The lookahead works on 8x8 blocks (X265_LOWRES_CU_SIZE) of lowres planes,
+ * which are pixel planes except with --lowres-8bit, where HIGH_BIT_DEPTH
+ * builds keep them in uint8_t. These are the primitives those consumers need,
+ * for either sample type. The pixel table is a copy of the entries of the
+ * encoder table chosen by x265_setup_primitives(); the uint8_t table is
+ * filled by the C templates of the 8bit kernels */
+template<typename T>
+struct LowresPrimitives
+{
+    typedef int  (*cmp_t)(const T* fenc, intptr_t fencstride, const T* fref, intptr_t frefstride);
+    typedef void (*cmp_x3_t)(const T* fenc, const T* fref0, const T* fref1, const T* fref2, intptr_t frefstride, int32_t* res);
+    typedef void (*cmp_x4_t)(const T* fenc, const T* fref0, const T* fref1, const T* fref2, const T* fref3, intptr_t frefstride, int32_t* res);
+    typedef void (*copy_t)(T* dst, intptr_t dstStride, const T* src, intptr_t srcStride);
+    typedef void (*avg_t)(T* dst, intptr_t dstride, const T* src0, intptr_t sstride0, const T* src1, intptr_t sstride1, int weight);
+    typedef void (*filter_t)(const T* references, T* filtered);
+    typedef void (*pred_t)(T* dst, intptr_t dstStride, const T* srcPix, int dirMode, int bFilter);
+    typedef void (*weight_t)(const T* src, T* dst, intptr_t stride, int width, int height, int w0, int round, int shift, int offset);
+    typedef void (*init_t)(const pixel* src0, T* dstf, T* dsth, T* dstv, T* dstc, intptr_t src_stride, intptr_t dst_stride, int width, int height);
+    typedef void (*downscale_t)(const T* src0, T* dstf, T* dsth, T* dstv, T* dstc, intptr_t src_stride, intptr_t dst_stride, int width, int height);
+    typedef void (*extend_t)(T* txt, intptr_t stride, int width, int height, int marginX);
+
+    /* 8x8 blocks */
+    cmp_t    sad;
+    cmp_x3_t sad_x3;
+    cmp_x4_t sad_x4;
+    cmp_t    satd;
+    copy_t   copy_pp;
+    avg_t    pixelavg_pp[NUM_ALIGNMENT_TYPES];
+    filter_t intra_filter;
+    pred_t   intra_pred[NUM_INTRA_MODE];
+
+    /* whole planes */
+    weight_t    weight_pp;
+    init_t      frameInitLowres;   // source picture to lowres planes, downshifting to T
+    downscale_t frameInitLowerRes; // lowres planes to HME planes
+    extend_t    extendRowBorder;
+};
+
+extern LowresPrimitives<pixel> lowresPrimitives;
+#if HIGH_BIT_DEPTH
+extern LowresPrimitives<uint8_t> lowresPrimitives8;
+#endif
+
+template<typename T>
+inline const LowresPrimitives<T>& getLowresPrimitives();
+
+template<>
+inline const LowresPrimitives<pixel>& getLowresPrimitives<pixel>() { return lowresPrimitives; }
+#if HIGH_BIT_DEPTH
+template<>
+inline const LowresPrimitives<uint8_t>& getLowresPrimitives<uint8_t>() { return lowresPrimitives8; }
+#endif
+
 /* Returns a LumaPU enum for the given size, always expected to return a valid enum */
 inline int partitionFromSizes(int width, int height)
 {
@@ -38,6 +38,13 @@
 #include <fcntl.h>
 #endif
 
+#if defined(__linux__) && defined(__GNUC__) && !NO_ATOMICS
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <limits.h>
+#define X265_USE_FUTEX 1
+#endif
+
 #if MACOS
 #include <sys/param.h>
 #include <sys/sysctl.h>
@@ -55,6 +62,7 @@ int no_atomic_and(int* ptr, int mask);
 int no_atomic_inc(int* ptr);
 int no_atomic_dec(int* ptr);
 int no_atomic_add(int* ptr, int val);
+int64_t no_atomic_inc64(int64_t* ptr);
 }
 
 #define CLZ(id, x)            id = (unsigned long)__builtin_clz(x) ^ 31
@@ -64,7 +72,10 @@ int no_atomic_add(int* ptr, int val);
 #define ATOMIC_INC(ptr)       no_atomic_inc((int*)ptr)
 #define ATOMIC_DEC(ptr)       no_atomic_dec((int*)ptr)
 #define ATOMIC_ADD(ptr, val)  no_atomic_add((int*)ptr, val)
+#define ATOMIC_INC64(ptr)     no_atomic_inc64((int64_t*)ptr)
 #define GIVE_UP_TIME()        usleep(0)
+#define SPIN_PAUSE()
+#define MEMORY_BARRIER()
 
 #elif __GNUC__               /* GCCs builtin atomics */
 
@@ -78,7 +89,16 @@ int no_atomic_add(int* ptr, int val);
 #define ATOMIC_INC(ptr)       __sync_add_and_fetch((volatile int32_t*)ptr, 1)
 #define ATOMIC_DEC(ptr)       __sync_add_and_fetch((volatile int32_t*)ptr, -1)
 #define ATOMIC_ADD(ptr, val)  __sync_fetch_and_add((volatile int32_t*)ptr, val)
+#define ATOMIC_INC64(ptr)     __sync_add_and_fetch((volatile int64_t*)ptr, 1)
 #define GIVE_UP_TIME()        usleep(0)
+#if X265_ARCH_X86
+#define SPIN_PAUSE()          __builtin_ia32_pause()
+#elif X265_ARCH_ARM64
+#define SPIN_PAUSE()          __asm__ __volatile__("yield" ::: "memory")
+#else
+#define SPIN_PAUSE()          __sync_synchronize()
+#endif
+#define MEMORY_BARRIER()      __sync_synchronize()
 
 #elif defined(_MSC_VER)       /* Windows atomic intrinsics */
 
@@ -89,9 +109,12 @@ int no_atomic_add(int* ptr, int val);
 #define ATOMIC_INC(ptr)       InterlockedIncrement((volatile LONG*)ptr)
 #define ATOMIC_DEC(ptr)       InterlockedDecrement((volatile LONG*)ptr)
 #define ATOMIC_ADD(ptr, val)  InterlockedExchangeAdd((volatile LONG*)ptr, val)
+#define ATOMIC_INC64(ptr)     InterlockedIncrement64((volatile LONG64*)ptr)
 #define ATOMIC_OR(ptr, mask)  _InterlockedOr((volatile LONG*)ptr, (LONG)mask)
 #define ATOMIC_AND(ptr, mask) _InterlockedAnd((volatile LONG*)ptr, (LONG)mask)
 #define GIVE_UP_TIME()        Sleep(0)
+#define SPIN_PAUSE()          YieldProcessor()
+#define MEMORY_BARRIER()      MemoryBarrier()
 
 #endif // ifdef __GNUC__
 
@@ -461,6 +484,86 @@ protected:
 
 #endif // ifdef _WIN32
 
+/* A ThreadSafeInteger tuned for short waits on a value which is expected to
+ * change soon, such as the reconstructed row flags of reference pictures. A
+ * waiter may first spin for a bounded number of iterations (spinWait) before
+ * blocking (waitForChange). On Linux the blocking wait is a futex on the value
+ * itself, so set() makes no system call unless a thread is actually blocked,
+ * and waiters of different rows never share a wakeup. Other platforms fall
+ * back to the condition variable of ThreadSafeInteger. */
+#if X265_USE_FUTEX
+class SpinWaitInteger
+{
+public:
+
+    SpinWaitInteger() : m_val(0), m_waiters(0) {}
+
+    int get()
+    {
+        int ret = m_val;
+        __sync_synchronize();
+        return ret;
+    }
+
+    void set(int newval)
+    {
+        /* publish all prior writes before the new value, and the new value
+         * before the waiter count is sampled */
+        __sync_synchronize();
+        m_val = newval;
+        __sync_synchronize();
+        if (m_waiters)
+            syscall(SYS_futex, &m_val, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+
+    /* returns true if the value changed from prev within spinCount polls */
+    bool spinWait(int prev, int spinCount)
+    {
+        for (int i = 0; i < spinCount; i++)
+        {
+            if (m_val != prev)
+                break;
+            SPIN_PAUSE();
+        }
+        return get() != prev;
+    }
+
+    int waitForChange(int prev)
+    {
+        ATOMIC_INC(&m_waiters);
+        while (m_val == prev)
+            syscall(SYS_futex, &m_val, FUTEX_WAIT_PRIVATE, prev, NULL, NULL, 0);
+        ATOMIC_DEC(&m_waiters);
+        return get();
+    }
+
+protected:
+
+    volatile int m_val;
+    volatile int m_waiters;
+
+    SpinWaitInteger(const SpinWaitInteger&);
+    SpinWaitInteger& operator =(const SpinWaitInteger&);
+};
+#else
+class SpinWaitInteger : public ThreadSafeInteger
+{
+public:
+
+    /* returns true if the value changed from prev within spinCount polls */
+    bool spinWait(int prev, int spinCount)
+    {
+        for (int i = 0; i < spinCount; i++)
+        {
+            if (*(volatile int*)&m_val != prev)
+                break;
+            SPIN_PAUSE();
+        }
+        return get() != prev;
+    }
+};
+#endif
+
 class ScopedLock
 {
 public:
@@ -43,8 +43,8 @@
 #elif defined(_MSC_VER)
 
 #define SLEEPBITMAP_CTZ(id, x)     _BitScanForward64(&id, x)
-#define SLEEPBITMAP_OR(ptr, mask)  InterlockedOr64((volatile LONG64*)ptr, (LONG)mask)
-#define SLEEPBITMAP_AND(ptr, mask) InterlockedAnd64((volatile LONG64*)ptr, (LONG)mask)
+#define SLEEPBITMAP_OR(ptr, mask)  InterlockedOr64((volatile LONG64*)ptr, (LONG64)mask)
+#define SLEEPBITMAP_AND(ptr, mask) InterlockedAnd64((volatile LONG64*)ptr, (LONG64)mask)
 
 #endif // ifdef __GNUC__
 
@@ -66,6 +66,7 @@
 #endif
 #if HAVE_LIBNUMA
 #include <numa.h>
+#include <numaif.h>
 #endif
 #if defined(_MSC_VER)
 # define strcasecmp _stricmp
@@ -89,6 +90,16 @@ static int popCount(uint64_t x)
 namespace X265_NS {
 // x265 private namespace
 
+void WorkerBitmap::set(int id)
+{
+    SLEEPBITMAP_OR(&m_words[id / SLEEPBITMAP_BITS], (sleepbitmap_t)1 << (id % SLEEPBITMAP_BITS));
+}
+
+void WorkerBitmap::clear(int id)
+{
+    SLEEPBITMAP_AND(&m_words[id / SLEEPBITMAP_BITS], ~((sleepbitmap_t)1 << (id % SLEEPBITMAP_BITS)));
+}
+
 class WorkerThread : public Thread
 {
 private:
@@ -103,14 +114,54 @@ public:
 
     JobProvider*     m_curJobProvider;
     BondedTaskGroup* m_bondMaster;
+    WorkerStats      m_stats;
+    volatile int     m_scanSeq; // odd while scanning the provider table of a shared pool
 
-    WorkerThread(ThreadPool& pool, int id) : m_pool(pool), m_id(id) {}
+    WorkerThread(ThreadPool& pool, int id) : m_pool(pool), m_id(id), m_scanSeq(0) { memset(&m_stats, 0, sizeof(m_stats)); }
     virtual ~WorkerThread() {}
 
     void threadMain();
-    void awaken()           { m_wakeEvent.trigger(); }
+    void awaken()           { m_stats.wakeCount++; m_wakeEvent.trigger(); }
+    void sleep()
+    {
+        int64_t start = x265_mdate();
+        m_stats.sleepCount++;
+        m_wakeEvent.wait();
+        m_stats.idleTime += x265_mdate() - start;
+    }
 };
 
+/* Occupies the free slots of the provider table of a shared pool, so worker
+ * threads never see a NULL or a detached job provider */
+class IdleJobProvider : public JobProvider
+{
+public:
+
+    void findJob(int) {}
+};
+
+/* Scheduling rank of a job provider, lower values are more urgent */
+static inline int64_t providerPriority(const JobProvider& jp, const ThreadPool& pool)
+{
+    int64_t priority;
+    if (pool.m_schedPolicy == X265_SCHED_CRITICAL_PATH)
+    {
+        /* Blocked downstream frame encoders dominate, then slice type, then
+         * the distance from the head of the encode order */
+        int64_t notBlocking = 0xff - X265_MIN(jp.m_blockedDependents, 0xff);
+        priority = (notBlocking << 40) | ((int64_t)jp.m_sliceType << 32) | (uint32_t)jp.m_encodeOrder;
+    }
+    else
+        priority = jp.m_sliceType;
+
+    /* On a shared pool, the providers of an encoder which already runs its
+     * weighted share of the workers yield to those of other encoders */
+    const PoolClient* client = jp.m_client;
+    if (client && client->m_activeWorkers * pool.m_totalWeight >= client->m_weight * pool.m_numWorkers)
+        priority |= (int64_t)1 << 52;
+    return priority;
+}
+
 void WorkerThread::threadMain()
 {
     THREAD_NAME("Worker", m_id);
@@ -123,19 +174,20 @@ void WorkerThread::threadMain()
 
     m_pool.setCurrentThreadAffinity();
 
-    sleepbitmap_t idBit = (sleepbitmap_t)1 << m_id;
     m_curJobProvider = m_pool.m_jpTable[0];
     m_bondMaster = NULL;
 
-    SLEEPBITMAP_OR(&m_curJobProvider->m_ownerBitmap, idBit);
-    SLEEPBITMAP_OR(&m_pool.m_sleepBitmap, idBit);
-    m_wakeEvent.wait();
+    m_curJobProvider->m_ownerBitmap.set(m_id);
+    m_pool.m_sleepBitmap.set(m_id);
+    sleep();
 
     while (m_pool.m_isActive)
     {
         if (m_bondMaster)
         {
+            int64_t start = x265_mdate();
             m_bondMaster->processTasks(m_id);
+            m_stats.taskTime[m_bondMaster->m_taskType] += x265_mdate() - start;
             m_bondMaster->m_exitedPeerCount.incr();
             m_bondMaster = NULL;
         }
@@ -143,47 +195,68 @@ void WorkerThread::threadMain()
         do
         {
             /* do pending work for current job provider */
+            PoolClient* client = m_curJobProvider->m_client;
+            if (client)
+                ATOMIC_INC(&client->m_activeWorkers);
+            int64_t start = x265_mdate();
             m_curJobProvider->findJob(m_id);
+            m_stats.taskTime[m_curJobProvider->m_taskType] += x265_mdate() - start;
+            if (client)
+                ATOMIC_DEC(&client->m_activeWorkers);
+
+            /* the provider table of a shared pool may change under us, see
+             * ThreadPool::removeProvider() */
+            bool bShared = m_pool.m_isShared;
+            if (bShared)
+                ATOMIC_INC(&m_scanSeq);
 
             /* if the current job provider still wants help, only switch to a
-             * higher priority provider (lower slice type). Else take the first
-             * available job provider with the highest priority */
-            int curPriority = (m_curJobProvider->m_helpWanted) ? m_curJobProvider->m_sliceType :
-                                                                 INVALID_SLICE_PRIORITY + 1;
-            int nextProvider = -1;
+             * higher priority provider (see providerPriority). Else take the
+             * first available job provider with the highest priority */
+            int64_t curPriority = (m_curJobProvider->m_helpWanted) ? providerPriority(*m_curJobProvider, m_pool) :
+                                                                     MAX_INT64;
+            JobProvider* nextProvider = NULL;
             for (int i = 0; i < m_pool.m_numProviders; i++)
             {
-                if (m_pool.m_jpTable[i]->m_helpWanted &&
-                    m_pool.m_jpTable[i]->m_sliceType < curPriority)
+                JobProvider* jp = m_pool.m_jpTable[i];
+                if (jp->m_helpWanted)
                 {
-                    nextProvider = i;
-                    curPriority = m_pool.m_jpTable[i]->m_sliceType;
+                    int64_t priority = providerPriority(*jp, m_pool);
+                    if (priority < curPriority)
+                    {
+                        nextProvider = jp;
+                        curPriority = priority;
+                    }
                 }
             }
-            if (nextProvider != -1 && m_curJobProvider != m_pool.m_jpTable[nextProvider])
+            if (nextProvider && m_curJobProvider != nextProvider)
             {
-                SLEEPBITMAP_AND(&m_curJobProvider->m_ownerBitmap, ~idBit);
-                m_curJobProvider = m_pool.m_jpTable[nextProvider];
-                SLEEPBITMAP_OR(&m_curJobProvider->m_ownerBitmap, idBit);
+                m_curJobProvider->m_ownerBitmap.clear(m_id);
+                m_curJobProvider = nextProvider;
+                m_curJobProvider->m_ownerBitmap.set(m_id);
             }
+
+            if (bShared)
+                ATOMIC_INC(&m_scanSeq);
         }
         while (m_curJobProvider->m_helpWanted);
 
         /* While the worker sleeps, a job-provider or bond-group may acquire this
          * worker's sleep bitmap bit. Once acquired, that thread may modify 
          * m_bondMaster or m_curJobProvider, then waken the thread */
-        SLEEPBITMAP_OR(&m_pool.m_sleepBitmap, idBit);
-        m_wakeEvent.wait();
+        m_pool.m_sleepBitmap.set(m_id);
+        sleep();
     }
 
-    SLEEPBITMAP_OR(&m_pool.m_sleepBitmap, idBit);
+    m_pool.m_sleepBitmap.set(m_id);
 }
 
 void JobProvider::tryWakeOne()
 {
-    int id = m_pool->tryAcquireSleepingThread(m_ownerBitmap, ALL_POOL_THREADS);
+    int id = m_pool->tryAcquireSleepingThread(m_ownerBitmap, &m_pool->m_allWorkers);
     if (id < 0)
     {
+        ATOMIC_INC64(&m_pool->m_acquireFailures);
         m_helpWanted = true;
         return;
     }
@@ -191,63 +264,175 @@ void JobProvider::tryWakeOne()
     WorkerThread& worker = m_pool->m_workers[id];
     if (worker.m_curJobProvider != this) /* poaching */
     {
-        sleepbitmap_t bit = (sleepbitmap_t)1 << id;
-        SLEEPBITMAP_AND(&worker.m_curJobProvider->m_ownerBitmap, ~bit);
+        worker.m_curJobProvider->m_ownerBitmap.clear(id);
         worker.m_curJobProvider = this;
-        SLEEPBITMAP_OR(&worker.m_curJobProvider->m_ownerBitmap, bit);
+        worker.m_curJobProvider->m_ownerBitmap.set(id);
     }
     worker.awaken();
 }
 
-int ThreadPool::tryAcquireSleepingThread(sleepbitmap_t firstTryBitmap, sleepbitmap_t secondTryBitmap)
+/* Atomically claim one sleeping worker whose bit is also set in tryBitmap,
+ * scanning the bitmap words in order. Returns -1 if none could be claimed */
+static int acquireFromBitmap(WorkerBitmap& sleepBitmap, const WorkerBitmap& tryBitmap)
 {
     unsigned long id;
 
-    sleepbitmap_t masked = m_sleepBitmap & firstTryBitmap;
-    while (masked)
+    for (int w = 0; w < SLEEPBITMAP_WORDS; w++)
     {
-        SLEEPBITMAP_CTZ(id, masked);
+        sleepbitmap_t* word = &sleepBitmap.m_words[w];
+        sleepbitmap_t masked = *word & tryBitmap.m_words[w];
+        while (masked)
+        {
+            SLEEPBITMAP_CTZ(id, masked);
 
-        sleepbitmap_t bit = (sleepbitmap_t)1 << id;
-        if (SLEEPBITMAP_AND(&m_sleepBitmap, ~bit) & bit)
-            return (int)id;
+            sleepbitmap_t bit = (sleepbitmap_t)1 << id;
+            if (SLEEPBITMAP_AND(word, ~bit) & bit)
+                return w * SLEEPBITMAP_BITS + (int)id;
 
-        masked = m_sleepBitmap & firstTryBitmap;
+            masked = *word & tryBitmap.m_words[w];
+        }
     }
 
-    masked = m_sleepBitmap & secondTryBitmap;
-    while (masked)
+    return -1;
+}
+
+int ThreadPool::tryAcquireSleepingThread(const WorkerBitmap& firstTryBitmap, const WorkerBitmap* secondTryBitmap)
+{
+    int id = acquireFromBitmap(m_sleepBitmap, firstTryBitmap);
+    if (id < 0 && secondTryBitmap)
+        id = acquireFromBitmap(m_sleepBitmap, *secondTryBitmap);
+    return id;
+}
+
+bool ThreadPool::addProvider(JobProvider& jp)
+{
+    X265_CHECK(m_isShared, "addProvider() requires a shared thread pool\n");
+
+    ScopedLock lock(*m_providerLock);
+
+    /* slot 0 always holds the idle provider, workers start out attached to it */
+    int slot = 1;
+    while (slot < m_numProviders && m_jpTable[slot] != m_idleProvider)
+        slot++;
+    if (slot >= m_maxProviders)
+        return false;
+
+    jp.m_pool = this;
+    m_jpTable[slot] = &jp;
+    if (slot == m_numProviders)
+        ATOMIC_INC(&m_numProviders); /* publishes the table entry before the count */
+    return true;
+}
+
+void ThreadPool::removeProvider(JobProvider& jp)
+{
+    X265_CHECK(m_isShared, "removeProvider() requires a shared thread pool\n");
+
+    {
+        ScopedLock lock(*m_providerLock);
+        for (int i = 1; i < m_numProviders; i++)
+        {
+            if (m_jpTable[i] == &jp)
+                m_jpTable[i] = m_idleProvider;
+        }
+    }
+    jp.m_helpWanted = false;
+
+    /* Workers which were scanning the table may still hold the old entry and
+     * may switch to it; wait for every such scan to complete */
+    for (int i = 0; i < m_numWorkers; i++)
+    {
+        int seq = ATOMIC_ADD(&m_workers[i].m_scanSeq, 0);
+        if (seq & 1)
+        {
+            while (m_workers[i].m_scanSeq == seq)
+                GIVE_UP_TIME();
+        }
+    }
+
+    /* Now hand every worker still attached to this provider over to the idle
+     * provider. Awake workers are left to go back to sleep first; a sleeping
+     * worker is claimed via its sleep bit so nobody can wake it meanwhile */
+    for (int i = 0; i < m_numWorkers; i++)
     {
-        SLEEPBITMAP_CTZ(id, masked);
+        WorkerThread& worker = m_workers[i];
+        WorkerBitmap self;
+        self.clearAll();
+        self.m_words[i / SLEEPBITMAP_BITS] = (sleepbitmap_t)1 << (i % SLEEPBITMAP_BITS);
+
+        while (worker.m_curJobProvider == &jp)
+        {
+            if (acquireFromBitmap(m_sleepBitmap, self) == i)
+            {
+                if (worker.m_curJobProvider == &jp)
+                {
+                    jp.m_ownerBitmap.clear(i);
+                    worker.m_curJobProvider = m_idleProvider;
+                    m_idleProvider->m_ownerBitmap.set(i);
+                }
+                m_sleepBitmap.set(i);
+            }
+            else
+                GIVE_UP_TIME();
+        }
+    }
+}
 
-        sleepbitmap_t bit = (sleepbitmap_t)1 << id;
-        if (SLEEPBITMAP_AND(&m_sleepBitmap, ~bit) & bit)
-            return (int)id;
+void ThreadPool::addClient(PoolClient& client)
+{
+    X265_CHECK(m_isShared, "addClient() requires a shared thread pool\n");
 
-        masked = m_sleepBitmap & secondTryBitmap;
+    ScopedLock lock(*m_providerLock);
+    m_totalWeight += client.m_weight;
+}
+
+void ThreadPool::removeClient(PoolClient& client)
+{
+    X265_CHECK(m_isShared, "removeClient() requires a shared thread pool\n");
+
+    ScopedLock lock(*m_providerLock);
+    m_totalWeight -= client.m_weight;
+}
+
+void ThreadPool::accumulateStats(WorkerStats& total) const
+{
+    for (int i = 0; i < m_numWorkers; i++)
+    {
+        const WorkerStats& stats = m_workers[i].m_stats;
+        for (int j = 0; j < WORKER_TASK_COUNT; j++)
+            total.taskTime[j] += stats.taskTime[j];
+        total.idleTime += stats.idleTime;
+        total.sleepCount += stats.sleepCount;
+        total.wakeCount += stats.wakeCount;
     }
+}
 
-    return -1;
+void ThreadPool::getWorkerStats(int id, WorkerStats& stats) const
+{
+    stats = m_workers[id].m_stats;
 }
 
-int ThreadPool::tryBondPeers(int maxPeers, sleepbitmap_t peerBitmap, BondedTaskGroup& master)
+int ThreadPool::tryBondPeers(int maxPeers, const WorkerBitmap& peerBitmap, BondedTaskGroup& master)
 {
     int bondCount = 0;
-    do
+    while (bondCount < maxPeers)
     {
-        int id = tryAcquireSleepingThread(peerBitmap, 0);
+        int id = tryAcquireSleepingThread(peerBitmap, NULL);
         if (id < 0)
+        {
+            /* the bond falls short of the peers it asked for */
+            ATOMIC_INC64(&m_acquireFailures);
             return bondCount;
+        }
 
         m_workers[id].m_bondMaster = &master;
         m_workers[id].awaken();
         bondCount++;
     }
-    while (bondCount < maxPeers);
 
     return bondCount;
 }
-ThreadPool* ThreadPool::allocThreadPools(x265_param* p, int& numPools, bool isThreadsReserved)
+ThreadPool* ThreadPool::allocThreadPools(x265_param* p, int& numPools, bool isThreadsReserved, bool isShared)
 {
     enum { MAX_NODE_NUM = 127 };
     int cpusPerNode[MAX_NODE_NUM + 1];
@@ -394,7 +579,7 @@ ThreadPool* ThreadPool::allocThreadPools(x265_param* p, int& numPools, bool isTh
             totalNumThreads += threadsPerPool[i];
         }
     }
-    if (!isThreadsReserved)
+    if (!isThreadsReserved && !isShared)
     {
         if (!numPools)
         {
@@ -409,7 +594,7 @@ ThreadPool* ThreadPool::allocThreadPools(x265_param* p, int& numPools, bool isTh
     if (!numPools)
         return NULL;
 
-    if (numPools > p->frameNumThreads)
+    if (numPools > p->frameNumThreads && !isShared)
     {
         x265_log(p, X265_LOG_DEBUG, "Reducing number of thread pools for frame thread count\n");
         numPools = X265_MAX(p->frameNumThreads / 2, 1);
@@ -420,6 +605,8 @@ ThreadPool* ThreadPool::allocThreadPools(x265_param* p, int& numPools, bool isTh
     if (pools)
     {
         int maxProviders = (p->frameNumThreads + numPools - 1) / numPools + !isThreadsReserved; /* +1 is Lookahead, always assigned to threadpool 0 */
+        if (isShared)
+            maxProviders = MAX_SHARED_PROVIDERS;
         int node = 0;
         for (int i = 0; i < numPools; i++)
         {
@@ -440,12 +627,13 @@ ThreadPool* ThreadPool::allocThreadPools(x265_param* p, int& numPools, bool isTh
 
             else if (i == 0)
                 numThreads -= p->lookaheadThreads;
-            if (!pools[i].create(numThreads, maxProviders, nodeMaskPerPool[node]))
+            if (!pools[i].create(numThreads, maxProviders, nodeMaskPerPool[node], isShared))
             {
                 X265_FREE(pools);
                 numPools = 0;
                 return NULL;
             }
+            pools[i].m_schedPolicy = p->schedPolicy;
             if (numNumaNodes > 1)
             {
                 char *nodesstr = new char[64 * strlen(",63") + 1];
@@ -471,10 +659,12 @@ ThreadPool::ThreadPool()
     memset(this, 0, sizeof(*this));
 }
 
-bool ThreadPool::create(int numThreads, int maxProviders, uint64_t nodeMask)
+bool ThreadPool::create(int numThreads, int maxProviders, uint64_t nodeMask, bool isShared)
 {
     X265_CHECK(numThreads <= MAX_POOL_THREADS, "a single thread pool cannot have more than MAX_POOL_THREADS threads\n");
 
+    m_numaNode = -1;
+
 #if defined(_WIN32_WINNT) && _WIN32_WINNT >= _WIN32_WINNT_WIN7 
     memset(&m_groupAffinity, 0, sizeof(GROUP_AFFINITY));
     for (int i = 0; i < getNumaNodeCount(); i++)
@@ -493,6 +683,13 @@ bool ThreadPool::create(int numThreads, int maxProviders, uint64_t nodeMask)
         {
             *(nodemask->maskp) = nodeMask;
             m_numaMask = nodemask;
+            if (nodeMask && !(nodeMask & (nodeMask - 1)))
+            {
+                int node = 0;
+                while (!((nodeMask >> node) & 1))
+                    node++;
+                m_numaNode = node;
+            }
         }
         else
             x265_log(NULL, X265_LOG_ERROR, "unable to get NUMA node mask for %lx\n", nodeMask);
@@ -502,6 +699,9 @@ bool ThreadPool::create(int numThreads, int maxProviders, uint64_t nodeMask)
 #endif
 
     m_numWorkers = numThreads;
+    m_allWorkers.clearAll();
+    for (int i = 0; i < numThreads; i++)
+        m_allWorkers.set(i);
 
     m_workers = X265_MALLOC(WorkerThread, numThreads);
     /* placement new initialization */
@@ -510,8 +710,18 @@ bool ThreadPool::create(int numThreads, int maxProviders, uint64_t nodeMask)
             new (m_workers + i)WorkerThread(*this, i);
 
     m_jpTable = X265_MALLOC(JobProvider*, maxProviders);
+    m_maxProviders = maxProviders;
     m_numProviders = 0;
 
+    m_isShared = isShared;
+    if (isShared && m_jpTable)
+    {
+        m_providerLock = new Lock;
+        m_idleProvider = new IdleJobProvider;
+        m_idleProvider->m_pool = this;
+        m_jpTable[m_numProviders++] = m_idleProvider;
+    }
+
     return m_workers && m_jpTable;
 }
 
@@ -536,7 +746,7 @@ void ThreadPool::stopWorkers()
         m_isActive = false;
         for (int i = 0; i < m_numWorkers; i++)
         {
-            while (!(m_sleepBitmap & ((sleepbitmap_t)1 << i)))
+            while (!m_sleepBitmap.test(i))
                 GIVE_UP_TIME();
             m_workers[i].awaken();
             m_workers[i].stop();
@@ -554,6 +764,8 @@ ThreadPool::~ThreadPool()
 
     X265_FREE(m_workers);
     X265_FREE(m_jpTable);
+    delete m_providerLock;
+    delete m_idleProvider;
 
 #if HAVE_LIBNUMA
     if(m_numaMask)
@@ -594,6 +806,61 @@ void ThreadPool::setThreadNodeAffinity(void *numaMask)
     return;
 }
 
+#if HAVE_LIBNUMA
+/* memory policy of a thread, as saved by setThreadAllocNode() */
+struct ThreadAllocPolicy
+{
+    int             mode;
+    struct bitmask* nodes;
+};
+#endif
+
+/* Make the calling thread prefer the given NUMA node for its allocations.
+ * Returns its previous memory policy, to be given back to
+ * restoreThreadAllocPolicy(), or NULL if it could not be read */
+/* static */
+void* ThreadPool::setThreadAllocNode(int numaNode)
+{
+#if HAVE_LIBNUMA
+    if (numa_available() >= 0)
+    {
+        ThreadAllocPolicy* policy = new ThreadAllocPolicy;
+        policy->nodes = numa_allocate_nodemask();
+        if (get_mempolicy(&policy->mode, policy->nodes->maskp, policy->nodes->size + 1, NULL, 0))
+        {
+            numa_free_nodemask(policy->nodes);
+            delete policy;
+            policy = NULL;
+        }
+        numa_set_preferred(numaNode);
+        return policy;
+    }
+#else
+    (void)numaNode;
+#endif
+    return NULL;
+}
+
+/* static */
+void ThreadPool::restoreThreadAllocPolicy(void* policy)
+{
+#if HAVE_LIBNUMA
+    if (numa_available() >= 0)
+    {
+        ThreadAllocPolicy* saved = (ThreadAllocPolicy*)policy;
+        if (!saved || set_mempolicy(saved->mode, saved->nodes->maskp, saved->nodes->size + 1))
+            numa_set_localalloc();
+        if (saved)
+        {
+            numa_free_nodemask(saved->nodes);
+            delete saved;
+        }
+    }
+#else
+    (void)policy;
+#endif
+}
+
 /* static */
 int ThreadPool::getNumaNodeCount()
 {
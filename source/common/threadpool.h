@@ -40,9 +40,58 @@ typedef uint64_t sleepbitmap_t;
 typedef uint32_t sleepbitmap_t;
 #endif
 
-static const sleepbitmap_t ALL_POOL_THREADS = (sleepbitmap_t)-1;
-enum { MAX_POOL_THREADS = sizeof(sleepbitmap_t) * 8 };
+enum { SLEEPBITMAP_BITS = sizeof(sleepbitmap_t) * 8 };
+enum { MAX_POOL_THREADS = 256 };
+enum { SLEEPBITMAP_WORDS = MAX_POOL_THREADS / SLEEPBITMAP_BITS };
 enum { INVALID_SLICE_PRIORITY = 10 }; // a value larger than any X265_TYPE_* macro
+enum { MAX_SHARED_PROVIDERS = 128 };  // job provider slots of a pool shared by several encoders
+
+/* Kinds of work a worker thread may perform, for telemetry */
+enum WorkerTaskType
+{
+    WORKER_TASK_OTHER,
+    WORKER_TASK_FRAME_ROWS,      // FrameEncoder WPP rows
+    WORKER_TASK_LOOKAHEAD,       // Lookahead slicetype decisions and its bonded batches
+    WORKER_TASK_PMODE_PME,       // distributed mode analysis and motion estimation
+    WORKER_TASK_WEIGHT_ANALYSIS, // weighted prediction analysis
+    WORKER_TASK_COUNT
+};
+
+/* Per worker thread counters, updated only by the owning worker (wakeCount by
+ * the single thread which acquired the sleeping worker) so they need no
+ * atomics. Times are in x265_mdate() units (microseconds) */
+struct WorkerStats
+{
+    int64_t  taskTime[WORKER_TASK_COUNT];
+    int64_t  idleTime;
+    uint64_t sleepCount;
+    uint64_t wakeCount;
+};
+
+/* One bit per worker thread of a pool, split across several machine words so
+ * a single pool is not limited to the width of one register. Each word is
+ * modified with atomic operations; a worker bit never straddles two words, so
+ * acquiring a worker remains a single atomic AND on its word */
+struct WorkerBitmap
+{
+    sleepbitmap_t m_words[SLEEPBITMAP_WORDS];
+
+    void clearAll()            { memset(m_words, 0, sizeof(m_words)); }
+    bool test(int id) const    { return !!(m_words[id / SLEEPBITMAP_BITS] & ((sleepbitmap_t)1 << (id % SLEEPBITMAP_BITS))); }
+    void set(int id);          // atomic
+    void clear(int id);        // atomic
+};
+
+/* Fair-share account of one encoder attached to thread pools shared with
+ * other encoders. Workers prefer the job providers of clients which are
+ * running fewer workers than their weighted share of the pool */
+struct PoolClient
+{
+    int           m_weight;
+    volatile int  m_activeWorkers; // workers currently inside findJob() of this client's providers
+
+    PoolClient() : m_weight(1), m_activeWorkers(0) {}
+};
 
 // Frame level job providers. FrameEncoder and Lookahead derive from
 // this class and implement findJob()
@@ -51,20 +100,29 @@ class JobProvider
 public:
 
     ThreadPool*   m_pool;
-    sleepbitmap_t m_ownerBitmap;
+    PoolClient*   m_client;             // fair-share account, NULL unless the pool is shared
+    WorkerBitmap  m_ownerBitmap;
     int           m_jpId;
     int           m_sliceType;
+    int           m_encodeOrder;        // encode order of the current frame, used by X265_SCHED_CRITICAL_PATH
+    int           m_taskType;           // WorkerTaskType of findJob() work
+    volatile int  m_blockedDependents;  // number of frame encoders blocked on this provider's reconstructed rows
     bool          m_helpWanted;
     bool          m_isFrameEncoder; /* rather ugly hack, but nothing better presents itself */
 
     JobProvider()
         : m_pool(NULL)
-        , m_ownerBitmap(0)
+        , m_client(NULL)
         , m_jpId(-1)
         , m_sliceType(INVALID_SLICE_PRIORITY)
+        , m_encodeOrder(0)
+        , m_taskType(WORKER_TASK_OTHER)
+        , m_blockedDependents(0)
         , m_helpWanted(false)
         , m_isFrameEncoder(false)
-    {}
+    {
+        m_ownerBitmap.clearAll();
+    }
 
     virtual ~JobProvider() {}
 
@@ -80,10 +138,19 @@ class ThreadPool
 {
 public:
 
-    sleepbitmap_t m_sleepBitmap;
+    WorkerBitmap  m_sleepBitmap;
+    WorkerBitmap  m_allWorkers;   // one bit set for each worker of this pool
     int           m_numProviders;
     int           m_numWorkers;
     void*         m_numaMask; // node mask in linux, cpu mask in windows
+    int           m_numaNode; // the NUMA node of this pool if it is bound to exactly one node, else -1
+    int           m_schedPolicy; // X265_SCHED_*, how workers rank job providers
+    int64_t       m_acquireFailures; // wake and bond requests which found no idle worker, updated atomically
+    int           m_maxProviders;
+    bool          m_isShared;        // job providers of several encoders may attach and detach while workers run
+    int           m_totalWeight;     // sum of the weights of attached PoolClients (shared pools)
+    Lock*         m_providerLock;    // serializes provider table changes with workers switching providers (shared pools)
+    JobProvider*  m_idleProvider;    // occupies free slots of the provider table (shared pools)
 #if defined(_WIN32_WINNT) && _WIN32_WINNT >= _WIN32_WINNT_WIN7 
     GROUP_AFFINITY m_groupAffinity;
 #endif
@@ -95,17 +162,57 @@ public:
     ThreadPool();
     ~ThreadPool();
 
-    bool create(int numThreads, int maxProviders, uint64_t nodeMask);
+    bool create(int numThreads, int maxProviders, uint64_t nodeMask, bool isShared = false);
     bool start();
     void stopWorkers();
     void setCurrentThreadAffinity();
     void setThreadNodeAffinity(void *numaMask);
-    int  tryAcquireSleepingThread(sleepbitmap_t firstTryBitmap, sleepbitmap_t secondTryBitmap);
-    int  tryBondPeers(int maxPeers, sleepbitmap_t peerBitmap, BondedTaskGroup& master);
-    static ThreadPool* allocThreadPools(x265_param* p, int& numPools, bool isThreadsReserved);
+    int  tryAcquireSleepingThread(const WorkerBitmap& firstTryBitmap, const WorkerBitmap* secondTryBitmap);
+    int  tryBondPeers(int maxPeers, const WorkerBitmap& peerBitmap, BondedTaskGroup& master);
+    static ThreadPool* allocThreadPools(x265_param* p, int& numPools, bool isThreadsReserved, bool isShared = false);
     static int  getCpuCount();
     static int  getNumaNodeCount();
     static void getFrameThreadsCount(x265_param* p,int cpuCount);
+    static void* setThreadAllocNode(int numaNode);
+    static void restoreThreadAllocPolicy(void* policy);
+
+    void accumulateStats(WorkerStats& total) const;
+    void getWorkerStats(int id, WorkerStats& stats) const;
+
+    /* Attach and detach encoders to a shared pool. A job provider must be
+     * idle when it is removed; removeProvider() returns once no worker thread
+     * references it any longer */
+    bool addProvider(JobProvider& jp);
+    void removeProvider(JobProvider& jp);
+    void addClient(PoolClient& client);
+    void removeClient(PoolClient& client);
+};
+
+/* While an instance is in scope, memory pages first touched by the calling
+ * thread are preferentially placed on the given NUMA node. This is used by
+ * the API thread to allocate and initialize buffers on the node of the pool
+ * which will encode them. The memory policy the thread had before is put back
+ * on destruction. A node of -1 makes this a no-op */
+class ScopedNumaAlloc
+{
+public:
+
+    ScopedNumaAlloc(int numaNode) : m_numaNode(numaNode), m_savedPolicy(NULL)
+    {
+        if (m_numaNode >= 0)
+            m_savedPolicy = ThreadPool::setThreadAllocNode(m_numaNode);
+    }
+
+    ~ScopedNumaAlloc()
+    {
+        if (m_numaNode >= 0)
+            ThreadPool::restoreThreadAllocPolicy(m_savedPolicy);
+    }
+
+protected:
+
+    int   m_numaNode;
+    void* m_savedPolicy;
 };
 
 /* Any worker thread may enlist the help of idle worker threads from the same
@@ -127,8 +234,9 @@ public:
     int               m_bondedPeerCount;
     int               m_jobTotal;
     int               m_jobAcquired;
+    int               m_taskType;  // WorkerTaskType of processTasks() work
 
-    BondedTaskGroup()  { m_bondedPeerCount = m_jobTotal = m_jobAcquired = 0; }
+    BondedTaskGroup(int taskType = WORKER_TASK_OTHER) { m_bondedPeerCount = m_jobTotal = m_jobAcquired = 0; m_taskType = taskType; }
 
     /* Do not allow the instance to be destroyed before all bonded peers have
      * exited processTasks() */
@@ -149,7 +257,7 @@ public:
      * processTasks() method. */
     int tryBondPeers(ThreadPool& pool, int maxPeers)
     {
-        int count = pool.tryBondPeers(maxPeers, ALL_POOL_THREADS, *this);
+        int count = pool.tryBondPeers(maxPeers, pool.m_allWorkers, *this);
         m_bondedPeerCount += count;
         return count;
     }
@@ -171,4 +279,12 @@ public:
 
 } // end namespace X265_NS
 
+/* the public x265_thread_pools handle, a set of shared pools created by
+ * x265_thread_pools_alloc() */
+struct x265_thread_pools
+{
+    X265_NS::ThreadPool* pools;
+    int                  numPools;
+};
+
 #endif // ifndef X265_THREADPOOL_H
@@ -0,0 +1,271 @@
+/*****************************************************************************
+ * Copyright (C) 2013-2020 MulticoreWare, Inc
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at license @ x265.com.
+ *****************************************************************************/
+
+#include "common.h"
+#include "primitives.h"
+#include "slicetype.h"  // EDGE_THRESHOLD, PI
+#include <xmmintrin.h> // SSE
+#include <smmintrin.h> // SSE4.1
+
+using namespace X265_NS;
+
+namespace {
+
+/* A polynomial atan() on [0, 1]. Unfolded to [0, 180] degrees it stays within
+ * 1.3e-4 degrees of the atan2() angle of edgeSobel_c() for gradients of up to
+ * 12 bit pixels, so it truncates to the same whole degree unless it is within
+ * ANGLE_EPS of an integer. Those angles take the exact atan2() expression */
+#define ATAN_C5  -0.01172120f
+#define ATAN_C4   0.05265332f
+#define ATAN_C3  -0.11643287f
+#define ATAN_C2   0.19354346f
+#define ATAN_C1  -0.33262347f
+#define ATAN_C0   0.99997726f
+#define DEGREES   57.2957795f
+#define ANGLE_EPS 1e-3f
+
+/* edgeAngle() of pixel.cpp */
+inline pixel edgeAngleExact(float gradientV, float gradientH)
+{
+    float radians = atan2(gradientV, gradientH);
+    float theta = (float)((radians * 180) / PI);
+    if (theta < 0)
+        theta = 180 + theta;
+    return (pixel)theta;
+}
+
+inline pixel edgeAngle(float gradientV, float gradientH)
+{
+    float absH = fabsf(gradientH), absV = fabsf(gradientV);
+    float maxG = X265_MAX(absH, absV), minG = X265_MIN(absH, absV);
+    float t = maxG > 0.f ? minG / maxG : 0.f;
+    float t2 = t * t;
+    float radians = (((((ATAN_C5 * t2 + ATAN_C4) * t2 + ATAN_C3) * t2 + ATAN_C2) * t2 + ATAN_C1) * t2 + ATAN_C0) * t;
+    float theta = radians * DEGREES;
+    if (absV > absH)
+        theta = 90.f - theta;
+    if (gradientH < 0.f)
+        theta = 180.f - theta;
+    if (gradientV < 0.f)
+        theta = -theta;
+    if (theta < 0.f)
+        theta += 180.f;
+    if (fabsf(theta - floorf(theta + 0.5f)) < ANGLE_EPS)
+        return edgeAngleExact(gradientV, gradientH);
+    return (pixel)theta;
+}
+
+/* edgeAngle() of four lanes, in 32bit lanes */
+inline __m128i edgeAngle4(__m128i gradientV, __m128i gradientH)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+    __m128 gradV = _mm_cvtepi32_ps(gradientV);
+    __m128 gradH = _mm_cvtepi32_ps(gradientH);
+
+    __m128 absH = _mm_andnot_ps(signMask, gradH);
+    __m128 absV = _mm_andnot_ps(signMask, gradV);
+    __m128 maxG = _mm_max_ps(absH, absV);
+    __m128 minG = _mm_min_ps(absH, absV);
+    __m128 t = _mm_and_ps(_mm_div_ps(minG, maxG), _mm_cmpgt_ps(maxG, zero));
+    __m128 t2 = _mm_mul_ps(t, t);
+
+    __m128 radians = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ATAN_C5), t2), _mm_set1_ps(ATAN_C4));
+    radians = _mm_add_ps(_mm_mul_ps(radians, t2), _mm_set1_ps(ATAN_C3));
+    radians = _mm_add_ps(_mm_mul_ps(radians, t2), _mm_set1_ps(ATAN_C2));
+    radians = _mm_add_ps(_mm_mul_ps(radians, t2), _mm_set1_ps(ATAN_C1));
+    radians = _mm_add_ps(_mm_mul_ps(radians, t2), _mm_set1_ps(ATAN_C0));
+    radians = _mm_mul_ps(radians, t);
+
+    __m128 theta = _mm_mul_ps(radians, _mm_set1_ps(DEGREES));
+    theta = _mm_blendv_ps(theta, _mm_sub_ps(_mm_set1_ps(90.f), theta), _mm_cmpgt_ps(absV, absH));
+    theta = _mm_blendv_ps(theta, _mm_sub_ps(_mm_set1_ps(180.f), theta), _mm_cmplt_ps(gradH, zero));
+    theta = _mm_xor_ps(theta, _mm_and_ps(signMask, _mm_cmplt_ps(gradV, zero)));
+    theta = _mm_blendv_ps(theta, _mm_add_ps(theta, _mm_set1_ps(180.f)), _mm_cmplt_ps(theta, zero));
+
+    __m128 dist = _mm_andnot_ps(signMask, _mm_sub_ps(theta, _mm_round_ps(theta, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)));
+    __m128i angle = _mm_cvttps_epi32(theta);
+    int nearInt = _mm_movemask_ps(_mm_cmplt_ps(dist, _mm_set1_ps(ANGLE_EPS)));
+    if (nearInt)
+    {
+        ALIGN_VAR_16(int32_t, v[4]);
+        ALIGN_VAR_16(int32_t, h[4]);
+        ALIGN_VAR_16(int32_t, a[4]);
+        _mm_store_si128((__m128i*)v, gradientV);
+        _mm_store_si128((__m128i*)h, gradientH);
+        _mm_store_si128((__m128i*)a, angle);
+        for (int i = 0; i < 4; i++)
+            if (nearInt & (1 << i))
+                a[i] = edgeAngleExact((float)v[i], (float)h[i]);
+        angle = _mm_load_si128((const __m128i*)a);
+    }
+    return angle;
+}
+
+/* load and store four pixels as 32bit lanes */
+inline __m128i loadPixel4(const pixel* src)
+{
+#if HIGH_BIT_DEPTH
+    return _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)src));
+#else
+    return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const int32_t*)src));
+#endif
+}
+
+inline void storePixel4(pixel* dst, __m128i val)
+{
+    val = _mm_packus_epi32(val, val);
+#if HIGH_BIT_DEPTH
+    _mm_storel_epi64((__m128i*)dst, val);
+#else
+    *(int32_t*)dst = _mm_cvtsi128_si32(_mm_packus_epi16(val, val));
+#endif
+}
+
+inline int gaussian5x5(const pixel* s, intptr_t stride)
+{
+    static const int taps[5][5] =
+    {
+        { 2, 4,  5,  4,  2 },
+        { 4, 9,  12, 9,  4 },
+        { 5, 12, 15, 12, 5 },
+        { 4, 9,  12, 9,  4 },
+        { 2, 4,  5,  4,  2 }
+    };
+
+    int sum = 0;
+    for (int i = 0; i < 5; i++, s += stride)
+        for (int j = 0; j < 5; j++)
+            sum += taps[i][j] * s[j];
+    return sum / 159;
+}
+
+void edgeGaussian_sse41(pixel* dst, const pixel* src, intptr_t stride, int width)
+{
+    const pixel* r0 = src - 2 * stride - 2;
+    const pixel* r1 = r0 + stride;
+    const pixel* r2 = r1 + stride;
+    const pixel* r3 = r2 + stride;
+    const pixel* r4 = r3 + stride;
+    int x = 0;
+
+#if HIGH_BIT_DEPTH
+    /* sums exceed 16 bits, four pixels per loop in 32bit lanes and the divide
+     * by 159 in float, exact for sums below 2^18 */
+    const __m128 rcp159 = _mm_set1_ps(1.f / 159.f);
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i v04[5], v13[5], v2[5];
+        for (int k = 0; k < 5; k++)
+        {
+            v04[k] = _mm_add_epi32(loadPixel4(r0 + x + k), loadPixel4(r4 + x + k));
+            v13[k] = _mm_add_epi32(loadPixel4(r1 + x + k), loadPixel4(r3 + x + k));
+            v2[k] = loadPixel4(r2 + x + k);
+        }
+
+        __m128i sum = _mm_slli_epi32(_mm_add_epi32(v04[0], v04[4]), 1);
+        sum = _mm_add_epi32(sum, _mm_slli_epi32(_mm_add_epi32(_mm_add_epi32(v04[1], v04[3]), _mm_add_epi32(v13[0], v13[4])), 2));
+        sum = _mm_add_epi32(sum, _mm_mullo_epi32(_mm_add_epi32(_mm_add_epi32(v04[2], v2[0]), v2[4]), _mm_set1_epi32(5)));
+        sum = _mm_add_epi32(sum, _mm_mullo_epi32(_mm_add_epi32(v13[1], v13[3]), _mm_set1_epi32(9)));
+        sum = _mm_add_epi32(sum, _mm_mullo_epi32(_mm_add_epi32(_mm_add_epi32(v13[2], v2[1]), v2[3]), _mm_set1_epi32(12)));
+        sum = _mm_add_epi32(sum, _mm_mullo_epi32(v2[2], _mm_set1_epi32(15)));
+
+        __m128 sumf = _mm_add_ps(_mm_cvtepi32_ps(sum), _mm_set1_ps(0.5f));
+        storePixel4(dst + x, _mm_cvttps_epi32(_mm_mul_ps(sumf, rcp159)));
+    }
+#else
+    /* sums fit in unsigned 16 bits, eight pixels per loop and the divide by
+     * 159 as a multiply by 52759 / 2^23, exact for sums up to 159 * 255 */
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i v04[5], v13[5], v2[5];
+        for (int k = 0; k < 5; k++)
+        {
+            v04[k] = _mm_add_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(r0 + x + k))),
+                                   _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(r4 + x + k))));
+            v13[k] = _mm_add_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(r1 + x + k))),
+                                   _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(r3 + x + k))));
+            v2[k] = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(r2 + x + k)));
+        }
+
+        __m128i sum = _mm_slli_epi16(_mm_add_epi16(v04[0], v04[4]), 1);
+        sum = _mm_add_epi16(sum, _mm_slli_epi16(_mm_add_epi16(_mm_add_epi16(v04[1], v04[3]), _mm_add_epi16(v13[0], v13[4])), 2));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_add_epi16(_mm_add_epi16(v04[2], v2[0]), v2[4]), _mm_set1_epi16(5)));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_add_epi16(v13[1], v13[3]), _mm_set1_epi16(9)));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(_mm_add_epi16(_mm_add_epi16(v13[2], v2[1]), v2[3]), _mm_set1_epi16(12)));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(v2[2], _mm_set1_epi16(15)));
+
+        __m128i val = _mm_srli_epi16(_mm_mulhi_epu16(sum, _mm_set1_epi16((int16_t)52759)), 7);
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(val, val));
+    }
+#endif
+
+    for (; x < width; x++)
+        dst[x] = (pixel)gaussian5x5(r0 + x, stride);
+}
+
+void edgeSobel_sse41(pixel* edge, pixel* theta, const pixel* src, intptr_t stride, int width, pixel whitePixel)
+{
+    const int threshold = (int)(EDGE_THRESHOLD * EDGE_THRESHOLD);
+    const __m128i thresholdMinusOne = _mm_set1_epi32(threshold - 1);
+    const __m128i white = _mm_set1_epi32(whitePixel);
+    const __m128i three = _mm_set1_epi32(3);
+    const __m128i ten = _mm_set1_epi32(10);
+    const pixel* above = src - stride;
+    const pixel* below = src + stride;
+    int x = 0;
+
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i aboveL = loadPixel4(above + x - 1), aboveC = loadPixel4(above + x), aboveR = loadPixel4(above + x + 1);
+        __m128i curL = loadPixel4(src + x - 1), curR = loadPixel4(src + x + 1);
+        __m128i belowL = loadPixel4(below + x - 1), belowC = loadPixel4(below + x), belowR = loadPixel4(below + x + 1);
+
+        __m128i gradientH = _mm_mullo_epi32(_mm_sub_epi32(_mm_add_epi32(aboveR, belowR), _mm_add_epi32(aboveL, belowL)), three);
+        gradientH = _mm_add_epi32(gradientH, _mm_mullo_epi32(_mm_sub_epi32(curR, curL), ten));
+        __m128i gradientV = _mm_mullo_epi32(_mm_sub_epi32(_mm_add_epi32(belowL, belowR), _mm_add_epi32(aboveL, aboveR)), three);
+        gradientV = _mm_add_epi32(gradientV, _mm_mullo_epi32(_mm_sub_epi32(belowC, aboveC), ten));
+
+        __m128i magnitude = _mm_add_epi32(_mm_mullo_epi32(gradientH, gradientH), _mm_mullo_epi32(gradientV, gradientV));
+        storePixel4(edge + x, _mm_and_si128(_mm_cmpgt_epi32(magnitude, thresholdMinusOne), white));
+        if (theta)
+            storePixel4(theta + x, edgeAngle4(gradientV, gradientH));
+    }
+
+    for (; x < width; x++)
+    {
+        int gradientH = -3 * above[x - 1] + 3 * above[x + 1] - 10 * src[x - 1] + 10 * src[x + 1] - 3 * below[x - 1] + 3 * below[x + 1];
+        int gradientV = -3 * above[x - 1] - 10 * above[x] - 3 * above[x + 1] + 3 * below[x - 1] + 10 * below[x] + 3 * below[x + 1];
+        edge[x] = (pixel)(gradientH * gradientH + gradientV * gradientV >= threshold ? whitePixel : 0);
+        if (theta)
+            theta[x] = edgeAngle((float)gradientV, (float)gradientH);
+    }
+}
+
+}
+
+namespace X265_NS {
+void setupIntrinsicEdge_sse41(EncoderPrimitives &p)
+{
+    p.edgeGaussian = edgeGaussian_sse41;
+    p.edgeSobel = edgeSobel_sse41;
+}
+}
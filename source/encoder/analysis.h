@@ -94,7 +94,7 @@ public:
         const CUGeom& cuGeom;
         int           modes[MAX_PRED_TYPES];
 
-        PMODE(Analysis& m, const CUGeom& g) : master(m), cuGeom(g) {}
+        PMODE(Analysis& m, const CUGeom& g) : BondedTaskGroup(WORKER_TASK_PMODE_PME), master(m), cuGeom(g) {}
 
         void processTasks(int workerThreadId);
 
@@ -0,0 +1,563 @@
+/*****************************************************************************
+ * Copyright (C) 2013-2020 MulticoreWare, Inc
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at license @ x265.com.
+ *****************************************************************************/
+
+#include "common.h"
+#include "analysisfile.h"
+
+using namespace X265_NS;
+
+namespace {
+
+/* LZ77 coding of the frame records, in the sequence layout of LZ4 blocks: a
+ * token with the literal run length in its high nibble and the match length
+ * minus 4 in its low nibble (15 continues in the following bytes, each 255
+ * but the last), the literals, then a 16 bit little endian match offset and
+ * the continued match length. The last sequence has literals only */
+#define LZ_MIN_MATCH  4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_LOG   12
+
+inline uint32_t lzRead32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline bool lzPutLength(uint8_t* dst, uint32_t& op, uint32_t cap, uint32_t len)
+{
+    for (; len >= 255; len -= 255)
+    {
+        if (op >= cap)
+            return false;
+        dst[op++] = 255;
+    }
+    if (op >= cap)
+        return false;
+    dst[op++] = (uint8_t)len;
+    return true;
+}
+
+bool lzPutSequence(uint8_t* dst, uint32_t& op, uint32_t cap, const uint8_t* lit, uint32_t litLen, uint32_t offset, uint32_t matchLen)
+{
+    if (op >= cap)
+        return false;
+    uint32_t matchCode = matchLen ? matchLen - LZ_MIN_MATCH : 0;
+    dst[op++] = (uint8_t)((X265_MIN(litLen, 15u) << 4) | X265_MIN(matchCode, 15u));
+    if (litLen >= 15 && !lzPutLength(dst, op, cap, litLen - 15))
+        return false;
+    if (op + litLen > cap)
+        return false;
+    memcpy(dst + op, lit, litLen);
+    op += litLen;
+    if (!matchLen)
+        return true;
+    if (op + 2 > cap)
+        return false;
+    dst[op++] = (uint8_t)offset;
+    dst[op++] = (uint8_t)(offset >> 8);
+    return matchCode < 15 || lzPutLength(dst, op, cap, matchCode - 15);
+}
+
+/* returns the compressed size, or 0 if it does not fit in cap bytes */
+uint32_t lzCompress(const uint8_t* src, uint32_t srcSize, uint8_t* dst, uint32_t cap)
+{
+    uint32_t table[1 << LZ_HASH_LOG];
+    memset(table, 0, sizeof(table));
+
+    uint32_t ip = 0, anchor = 0, op = 0;
+    while (ip + LZ_MIN_MATCH <= srcSize)
+    {
+        uint32_t seq = lzRead32(src + ip);
+        uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_LOG);
+        uint32_t ref = table[h];
+        table[h] = ip;
+        if (ref < ip && ip - ref <= LZ_MAX_OFFSET && lzRead32(src + ref) == seq)
+        {
+            uint32_t len = LZ_MIN_MATCH;
+            while (ip + len < srcSize && src[ref + len] == src[ip + len])
+                len++;
+            if (!lzPutSequence(dst, op, cap, src + anchor, ip - anchor, ip - ref, len))
+                return 0;
+            ip += len;
+            anchor = ip;
+        }
+        else
+            ip++;
+    }
+    if (!lzPutSequence(dst, op, cap, src + anchor, srcSize - anchor, 0, 0))
+        return 0;
+    return op;
+}
+
+inline bool lzGetLength(const uint8_t* src, uint32_t& ip, uint32_t srcSize, uint32_t& len)
+{
+    uint8_t b;
+    do
+    {
+        if (ip >= srcSize)
+            return false;
+        b = src[ip++];
+        len += b;
+    }
+    while (b == 255);
+    return true;
+}
+
+bool lzDecompress(const uint8_t* src, uint32_t srcSize, uint8_t* dst, uint32_t dstSize)
+{
+    uint32_t ip = 0, op = 0;
+    while (ip < srcSize)
+    {
+        uint8_t token = src[ip++];
+        uint32_t litLen = token >> 4;
+        if (litLen == 15 && !lzGetLength(src, ip, srcSize, litLen))
+            return false;
+        if (litLen > srcSize - ip || litLen > dstSize - op)
+            return false;
+        memcpy(dst + op, src + ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if (ip == srcSize)
+            break;
+
+        if (ip + 2 > srcSize)
+            return false;
+        uint32_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        uint32_t matchLen = token & 15;
+        if (matchLen == 15 && !lzGetLength(src, ip, srcSize, matchLen))
+            return false;
+        matchLen += LZ_MIN_MATCH;
+        if (!offset || offset > op || matchLen > dstSize - op)
+            return false;
+        /* the match may overlap the bytes it produces */
+        for (uint32_t i = 0; i < matchLen; i++, op++)
+            dst[op] = dst[op - offset];
+    }
+    return op == dstSize;
+}
+
+bool growBuffer(uint8_t*& buf, size_t& cap, size_t size)
+{
+    if (size <= cap)
+        return true;
+    size_t newCap = X265_MAX(cap * 2, size);
+    uint8_t* newBuf = X265_MALLOC(uint8_t, newCap);
+    if (!newBuf)
+        return false;
+    if (buf)
+        memcpy(newBuf, buf, cap);
+    X265_FREE(buf);
+    buf = newBuf;
+    cap = newCap;
+    return true;
+}
+
+}
+
+AnalysisFile::AnalysisFile()
+{
+    m_bIndexed = false;
+    m_file = NULL;
+    m_bCompress = false;
+    m_filePos = 0;
+    m_optionsOffset = m_optionsSize = 0;
+    m_buf = m_lzBuf = NULL;
+    m_bufSize = m_bufCap = m_lzCap = 0;
+    m_entries = NULL;
+    m_numEntries = m_entryCap = 0;
+
+    m_map = NULL;
+    m_mapSize = 0;
+    m_cur = m_end = NULL;
+    m_index = NULL;
+    m_numFrames = 0;
+    m_byPoc = NULL;
+
+    m_bThreadActive = false;
+    m_bStop = false;
+    m_numSlots = 0;
+    m_readPos = 0;
+    m_slotRecord = NULL;
+    m_slotBuf = NULL;
+    m_slotCap = NULL;
+    m_slotData = NULL;
+}
+
+AnalysisFile::~AnalysisFile()
+{
+    if (m_file)
+        fclose(m_file);
+    release();
+}
+
+void AnalysisFile::release()
+{
+    if (m_bThreadActive)
+    {
+        m_slotLock.acquire();
+        m_bStop = true;
+        m_slotLock.release();
+        m_wake.trigger();
+        stop();
+        m_bThreadActive = false;
+    }
+    for (int i = 0; m_slotBuf && i < m_numSlots; i++)
+        X265_FREE(m_slotBuf[i]);
+    X265_FREE(m_slotBuf);
+    X265_FREE(m_slotCap);
+    X265_FREE(m_slotRecord);
+    X265_FREE((void*)m_slotData);
+    X265_FREE(m_byPoc);
+    X265_FREE(m_buf);
+    X265_FREE(m_lzBuf);
+    X265_FREE(m_entries);
+    x265_unmap_file(m_map, m_mapSize);
+    m_slotBuf = NULL;
+    m_slotCap = NULL;
+    m_slotRecord = NULL;
+    m_slotData = NULL;
+    m_byPoc = NULL;
+    m_buf = m_lzBuf = NULL;
+    m_entries = NULL;
+    m_map = NULL;
+}
+
+bool AnalysisFile::create(const char* fileName, int format, bool bCompress)
+{
+    m_file = x265_fopen(fileName, "wb");
+    if (!m_file)
+        return false;
+    m_bIndexed = format == X265_ANALYSIS_FORMAT_INDEXED;
+    m_bCompress = bCompress;
+    if (!m_bIndexed)
+        return true;
+
+    /* the header is written again with the offsets when the file is closed */
+    AnalysisFileHeader header;
+    memset(&header, 0, sizeof(header));
+    return writeBytes(&header, sizeof(header)) && padFile(X265_ANALYSIS_FILE_ALIGN);
+}
+
+bool AnalysisFile::writeBytes(const void* src, size_t bytes)
+{
+    if (fwrite(src, 1, bytes, m_file) != bytes)
+        return false;
+    m_filePos += bytes;
+    return true;
+}
+
+bool AnalysisFile::padFile(uint32_t align)
+{
+    static const uint8_t zeros[X265_ANALYSIS_FILE_ALIGN] = { 0 };
+    uint32_t pad = (uint32_t)((align - (m_filePos & (align - 1))) & (align - 1));
+    return writeBytes(zeros, pad);
+}
+
+bool AnalysisFile::write(const void* src, size_t bytes)
+{
+    if (!m_bIndexed)
+        return fwrite(src, 1, bytes, m_file) == bytes;
+    if (!growBuffer(m_buf, m_bufCap, m_bufSize + bytes))
+        return false;
+    memcpy(m_buf + m_bufSize, src, bytes);
+    m_bufSize += bytes;
+    return true;
+}
+
+bool AnalysisFile::endOptions()
+{
+    if (!m_bIndexed)
+        return true;
+    m_optionsOffset = m_filePos;
+    m_optionsSize = m_bufSize;
+    m_bufSize = 0;
+    return writeBytes(m_buf, (size_t)m_optionsSize);
+}
+
+bool AnalysisFile::endFrame(int poc)
+{
+    if (!m_bIndexed)
+        return true;
+    if (m_bufSize > UINT32_MAX || !padFile(X265_ANALYSIS_FILE_ALIGN))
+        return false;
+    if (m_numEntries == m_entryCap)
+    {
+        uint32_t newCap = X265_MAX(m_entryCap * 2, 256u);
+        AnalysisFileIndexEntry* entries = X265_MALLOC(AnalysisFileIndexEntry, newCap);
+        if (!entries)
+            return false;
+        if (m_entries)
+            memcpy(entries, m_entries, m_numEntries * sizeof(AnalysisFileIndexEntry));
+        X265_FREE(m_entries);
+        m_entries = entries;
+        m_entryCap = newCap;
+    }
+
+    AnalysisFileIndexEntry& entry = m_entries[m_numEntries++];
+    entry.offset = m_filePos;
+    entry.recordSize = (uint32_t)m_bufSize;
+    entry.storedSize = entry.recordSize;
+    entry.poc = poc;
+    entry.bCompressed = 0;
+
+    const uint8_t* stored = m_buf;
+    if (m_bCompress && m_bufSize && growBuffer(m_lzBuf, m_lzCap, m_bufSize))
+    {
+        /* keep the record as it is unless it shrinks */
+        uint32_t size = lzCompress(m_buf, entry.recordSize, m_lzBuf, entry.recordSize - 1);
+        if (size)
+        {
+            entry.storedSize = size;
+            entry.bCompressed = 1;
+            stored = m_lzBuf;
+        }
+    }
+    m_bufSize = 0;
+    return writeBytes(stored, entry.storedSize);
+}
+
+bool AnalysisFile::close()
+{
+    bool ok = true;
+    if (m_bIndexed)
+    {
+        AnalysisFileHeader header;
+        memset(&header, 0, sizeof(header));
+        strcpy(header.magic, X265_ANALYSIS_FILE_MAGIC);
+        header.version = X265_ANALYSIS_FILE_VERSION;
+        header.numFrames = m_numEntries;
+        header.optionsOffset = m_optionsOffset;
+        header.optionsSize = m_optionsSize;
+        ok = padFile(8);
+        header.indexOffset = m_filePos;
+        ok = ok && writeBytes(m_entries, m_numEntries * sizeof(AnalysisFileIndexEntry));
+        ok = ok && !fseeko(m_file, 0, SEEK_SET) && fwrite(&header, sizeof(header), 1, m_file) == 1;
+    }
+    ok &= !fclose(m_file);
+    m_file = NULL;
+    return ok;
+}
+
+bool AnalysisFile::open(const char* fileName, int readAhead)
+{
+    m_map = (uint8_t*)x265_map_file(fileName, &m_mapSize);
+    if (!m_map)
+        return false;
+    m_cur = m_map;
+    m_end = m_map + m_mapSize;
+
+    const AnalysisFileHeader* header = (const AnalysisFileHeader*)m_map;
+    if (m_mapSize < sizeof(AnalysisFileHeader) || memcmp(header->magic, X265_ANALYSIS_FILE_MAGIC, sizeof(header->magic)))
+        return true; /* legacy, read from the start */
+
+    m_bIndexed = true;
+    m_numFrames = header->numFrames;
+    if (header->version != X265_ANALYSIS_FILE_VERSION ||
+        header->optionsOffset > m_mapSize || header->optionsSize > m_mapSize - header->optionsOffset ||
+        header->indexOffset > m_mapSize || (header->indexOffset & 7) ||
+        (uint64_t)m_numFrames * sizeof(AnalysisFileIndexEntry) > m_mapSize - header->indexOffset)
+    {
+        x265_log(NULL, X265_LOG_ERROR, "analysis file %s is truncated or of an unsupported version\n", fileName);
+        return false;
+    }
+    m_index = (const AnalysisFileIndexEntry*)(m_map + header->indexOffset);
+    for (uint32_t i = 0; i < m_numFrames; i++)
+    {
+        if (m_index[i].offset > header->indexOffset || m_index[i].storedSize > header->indexOffset - m_index[i].offset ||
+            (!m_index[i].bCompressed && m_index[i].storedSize != m_index[i].recordSize))
+        {
+            x265_log(NULL, X265_LOG_ERROR, "analysis file %s has a corrupt index\n", fileName);
+            return false;
+        }
+    }
+
+    /* records are requested in POC order */
+    m_byPoc = X265_MALLOC(uint32_t, m_numFrames + 1);
+    if (!m_byPoc)
+        return false;
+    for (uint32_t i = 0; i < m_numFrames; i++)
+    {
+        uint32_t j = i;
+        for (; j && m_index[m_byPoc[j - 1]].poc > m_index[i].poc; j--)
+            m_byPoc[j] = m_byPoc[j - 1];
+        m_byPoc[j] = i;
+    }
+
+    m_numSlots = X265_MAX(readAhead, 1) + 1;
+    m_slotRecord = X265_MALLOC(int, m_numSlots);
+    m_slotBuf = X265_MALLOC(uint8_t*, m_numSlots);
+    m_slotCap = X265_MALLOC(uint32_t, m_numSlots);
+    m_slotData = X265_MALLOC(const uint8_t*, m_numSlots);
+    if (!m_slotRecord || !m_slotBuf || !m_slotCap || !m_slotData)
+        return false;
+    for (int i = 0; i < m_numSlots; i++)
+    {
+        m_slotRecord[i] = -1;
+        m_slotBuf[i] = NULL;
+        m_slotCap[i] = 0;
+        m_slotData[i] = NULL;
+    }
+
+    /* the options section is read first */
+    m_cur = m_map + header->optionsOffset;
+    m_end = m_cur + header->optionsSize;
+
+    /* without the thread, seekFrame() loads the records itself */
+    m_bThreadActive = start();
+    return true;
+}
+
+bool AnalysisFile::read(void* dst, size_t bytes)
+{
+    if (bytes > (size_t)(m_end - m_cur))
+        return false;
+    memcpy(dst, m_cur, bytes);
+    m_cur += bytes;
+    return true;
+}
+
+void AnalysisFile::seek(uint64_t offset)
+{
+    m_cur = m_map + X265_MIN(offset, (uint64_t)m_mapSize);
+    m_end = m_map + m_mapSize;
+}
+
+bool AnalysisFile::loadRecord(int pos, int slot)
+{
+    const AnalysisFileIndexEntry& entry = m_index[m_byPoc[pos]];
+    const uint8_t* stored = m_map + entry.offset;
+    m_slotData[slot] = NULL;
+    if (entry.bCompressed)
+    {
+        if (m_slotCap[slot] < entry.recordSize)
+        {
+            X265_FREE(m_slotBuf[slot]);
+            m_slotBuf[slot] = X265_MALLOC(uint8_t, entry.recordSize);
+            m_slotCap[slot] = m_slotBuf[slot] ? entry.recordSize : 0;
+            if (!m_slotBuf[slot])
+                return false;
+        }
+        if (!lzDecompress(stored, entry.storedSize, m_slotBuf[slot], entry.recordSize))
+            return false;
+        m_slotData[slot] = m_slotBuf[slot];
+    }
+    else
+    {
+        /* fault the pages of the record in, it is read in place */
+        volatile uint8_t sum = 0;
+        for (uint32_t i = 0; i < entry.storedSize; i += 4096)
+            sum += stored[i];
+        m_slotData[slot] = stored;
+    }
+    return true;
+}
+
+void AnalysisFile::threadMain()
+{
+    THREAD_NAME("AnalysisLoad", 0);
+
+    m_slotLock.acquire();
+    while (!m_bStop)
+    {
+        /* the slot of the record before m_readPos is being read, the window
+         * of m_numSlots - 1 records from m_readPos does not reach it */
+        int pos = -1;
+        for (int i = m_readPos; i < m_readPos + m_numSlots - 1 && i < (int)m_numFrames; i++)
+        {
+            if (m_slotRecord[i % m_numSlots] != i)
+            {
+                pos = i;
+                break;
+            }
+        }
+        if (pos < 0)
+        {
+            m_slotLock.release();
+            m_wake.wait();
+            m_slotLock.acquire();
+            continue;
+        }
+
+        int slot = pos % m_numSlots;
+        m_slotRecord[slot] = -1;
+        m_slotLock.release();
+        if (!loadRecord(pos, slot))
+            x265_log(NULL, X265_LOG_ERROR, "analysis load: corrupt record of POC %d\n", m_index[m_byPoc[pos]].poc);
+        m_slotLock.acquire();
+        m_slotRecord[slot] = pos;
+        m_loaded.trigger();
+    }
+    m_slotLock.release();
+}
+
+bool AnalysisFile::seekFrame(int poc)
+{
+    int lo = 0, hi = (int)m_numFrames - 1, pos = -1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) >> 1;
+        int midPoc = m_index[m_byPoc[mid]].poc;
+        if (midPoc == poc)
+        {
+            pos = mid;
+            break;
+        }
+        else if (midPoc < poc)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    if (pos < 0)
+        return false;
+
+    int slot = pos % m_numSlots;
+    if (!m_bThreadActive)
+    {
+        if (m_slotRecord[slot] != pos)
+        {
+            loadRecord(pos, slot);
+            m_slotRecord[slot] = pos;
+        }
+    }
+    else
+    {
+        m_slotLock.acquire();
+        m_readPos = pos;
+        m_wake.trigger();
+        while (m_slotRecord[slot] != pos)
+        {
+            m_slotLock.release();
+            m_loaded.wait();
+            m_slotLock.acquire();
+        }
+        m_readPos = pos + 1;
+        m_slotLock.release();
+        m_wake.trigger();
+    }
+
+    if (!m_slotData[slot])
+        return false;
+    m_cur = m_slotData[slot];
+    m_end = m_cur + m_index[m_byPoc[pos]].recordSize;
+    return true;
+}
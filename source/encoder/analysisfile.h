@@ -0,0 +1,141 @@
+/*****************************************************************************
+ * Copyright (C) 2013-2020 MulticoreWare, Inc
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at license @ x265.com.
+ *****************************************************************************/
+
+#ifndef X265_ANALYSISFILE_H
+#define X265_ANALYSISFILE_H
+
+#include "common.h"
+#include "threading.h"
+
+namespace X265_NS {
+// private x265 namespace
+
+/* Indexed analysis file (--analysis-save-format indexed), in native byte
+ * order: the header, the options section (conformance window and the options
+ * validated by the load), the frame records, each at an aligned offset and
+ * optionally compressed, and at indexOffset one AnalysisFileIndexEntry per
+ * frame, in the order the frames were written. A frame record holds the same
+ * fields as a record of the legacy sequential file. numFrames and
+ * indexOffset are written when the file is closed */
+#define X265_ANALYSIS_FILE_MAGIC    "x265ana"
+#define X265_ANALYSIS_FILE_VERSION  1
+#define X265_ANALYSIS_FILE_ALIGN    64
+
+struct AnalysisFileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t numFrames;
+    uint64_t optionsOffset;
+    uint64_t optionsSize;
+    uint64_t indexOffset;
+};
+
+struct AnalysisFileIndexEntry
+{
+    uint64_t offset;        /* of the stored record, X265_ANALYSIS_FILE_ALIGN aligned */
+    uint32_t storedSize;    /* bytes stored in the file */
+    uint32_t recordSize;    /* bytes of the record, storedSize if not compressed */
+    int32_t  poc;
+    uint32_t bCompressed;
+};
+
+/* The analysis file of --analysis-save and --analysis-load, in either format,
+ * or the multi-pass analysis file, which is always legacy. The Encoder moves
+ * the fields of the records through read() and write() in the same order for
+ * both formats.
+ *
+ * A read maps the whole file. The records of an indexed file are found by POC
+ * through the index and a thread loads those following the last one read,
+ * in POC order, ahead of the encoder: it decompresses them, or touches the
+ * mapped pages of the records stored uncompressed, which are read in place */
+class AnalysisFile : public Thread
+{
+public:
+
+    AnalysisFile();
+    ~AnalysisFile();
+
+    /* write side */
+    bool create(const char* fileName, int format, bool bCompress);
+    bool write(const void* src, size_t bytes);
+    bool endOptions();          /* the bytes written so far are the options section */
+    bool endFrame(int poc);     /* the bytes written since are the record of poc */
+    bool close();               /* writes the index and the header, closes the file */
+
+    /* read side, readAhead is the number of records loaded ahead of the encoder */
+    bool open(const char* fileName, int readAhead);
+    bool read(void* dst, size_t bytes);
+    bool isIndexed() const { return m_bIndexed; }
+    bool seekFrame(int poc);    /* indexed, the record of poc is read next */
+    void seek(uint64_t offset); /* legacy, the byte at offset is read next */
+    bool eof() const            { return m_cur >= m_end; }
+
+protected:
+
+    bool            m_bIndexed;
+
+    /* write side */
+    FILE*           m_file;
+    bool            m_bCompress;
+    uint64_t        m_filePos;
+    uint64_t        m_optionsOffset;
+    uint64_t        m_optionsSize;
+    uint8_t*        m_buf;      /* bytes of the options or of the record being written */
+    size_t          m_bufSize;
+    size_t          m_bufCap;
+    uint8_t*        m_lzBuf;
+    size_t          m_lzCap;
+    AnalysisFileIndexEntry* m_entries;
+    uint32_t        m_numEntries;
+    uint32_t        m_entryCap;
+
+    /* read side */
+    uint8_t*        m_map;
+    size_t          m_mapSize;
+    const uint8_t*  m_cur;
+    const uint8_t*  m_end;
+    const AnalysisFileIndexEntry* m_index;
+    uint32_t        m_numFrames;
+    uint32_t*       m_byPoc;    /* entries of the index sorted by POC */
+
+    /* read ahead, slot k % m_numSlots holds the k-th record in POC order */
+    bool            m_bThreadActive;
+    bool            m_bStop;
+    int             m_numSlots;
+    int             m_readPos;  /* first record the thread may load */
+    int*            m_slotRecord;
+    uint8_t**       m_slotBuf;
+    uint32_t*       m_slotCap;
+    const uint8_t** m_slotData; /* NULL if the record could not be loaded */
+    Lock            m_slotLock;
+    Event           m_wake;
+    Event           m_loaded;
+
+    bool writeBytes(const void* src, size_t bytes);
+    bool padFile(uint32_t align);
+    bool loadRecord(int pos, int slot);
+    void threadMain();
+    void release();
+};
+}
+
+#endif // ifndef X265_ANALYSISFILE_H
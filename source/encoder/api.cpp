@@ -31,6 +31,8 @@
 #include "nal.h"
 #include "bitcost.h"
 #include "svt.h"
+#include "slicetype.h"
+#include "ratecontrol.h"
 
 #if ENABLE_LIBVMAF
 #include "libvmaf/libvmaf.h"
@@ -73,6 +75,10 @@ static const char* summaryCSVHeader =
     "I count, I ave-QP, I kbps, I-PSNR Y, I-PSNR U, I-PSNR V, I-SSIM (dB), "
     "P count, P ave-QP, P kbps, P-PSNR Y, P-PSNR U, P-PSNR V, P-SSIM (dB), "
     "B count, B ave-QP, B kbps, B-PSNR Y, B-PSNR U, B-PSNR V, B-SSIM (dB), ";
+
+static const char* threadStatsCSVHeader =
+    " Workers, Worker Busy (ms), Worker Idle (ms), Worker Sleeps, Worker Wakes, Wake Failures,"
+    " Row Time (ms), Lookahead Time (ms), PMODE/PME Time (ms), Weight Analysis Time (ms),";
 x265_encoder *x265_encoder_open(x265_param *p)
 {
     if (!p)
@@ -232,6 +238,12 @@ x265_encoder *x265_encoder_open(x265_param *p)
     return encoder;
 
 fail:
+    if (encoder && encoder->m_bSharedPools)
+    {
+        /* the job providers must not outlive their registration in the shared pools */
+        encoder->stopJobs();
+        encoder->destroy();
+    }
     delete encoder;
     PARAM_NS::x265_param_free(param);
     PARAM_NS::x265_param_free(latestParam);
@@ -722,6 +734,89 @@ void x265_encoder_close(x265_encoder *enc)
     }
 }
 
+x265_encoder *x265_lookahead_open(x265_param *p)
+{
+    if (!p)
+        return NULL;
+
+    /* no picture is encoded, a single (idle) frame encoder is enough */
+    x265_param param;
+    memcpy(&param, p, sizeof(x265_param));
+    param.frameNumThreads = 1;
+    param.bAdaptiveFrameThreads = 0;
+    /* the frame costs of the records are read back at full precision */
+    param.bLowres8bit = 0;
+
+    x265_encoder *enc = x265_encoder_open(&param);
+    if (enc)
+    {
+        /* the records carry the frame costs */
+        static_cast<Encoder*>(enc)->m_bLookaheadOnly = true;
+        static_cast<Encoder*>(enc)->m_lookahead->m_bReuseFirstPass = false;
+    }
+    return enc;
+}
+
+int x265_lookahead_analyse(x265_encoder *enc, x265_picture *pic_in, x265_lookahead_frame *lookahead_out)
+{
+    if (!enc || !lookahead_out)
+        return -1;
+
+    Encoder *encoder = static_cast<Encoder*>(enc);
+    if (!encoder->m_bLookaheadOnly)
+    {
+        x265_log(encoder->m_param, X265_LOG_ERROR, "x265_lookahead_analyse() requires an encoder opened by x265_lookahead_open()\n");
+        return -1;
+    }
+    return encoder->analyseLookahead(pic_in, lookahead_out);
+}
+
+int x265_stats_merge(x265_param *p, const char * const *statsFiles, int numFiles)
+{
+    if (!p || !statsFiles || numFiles < 1)
+        return -1;
+
+    /* planning adjusts the rate control params it is given */
+    x265_param param;
+    memcpy(&param, p, sizeof(x265_param));
+    return RateControl::mergeChunkStats(param, statsFiles, numFiles) ? 0 : -1;
+}
+
+x265_thread_pools* x265_thread_pools_alloc(x265_param *p)
+{
+    if (!p)
+        return NULL;
+
+    /* allocThreadPools() adjusts some of the params it is given */
+    x265_param param;
+    memcpy(&param, p, sizeof(x265_param));
+    param.lookaheadThreads = 0;
+
+    int numPools = 0;
+    ThreadPool* pools = ThreadPool::allocThreadPools(&param, numPools, false, true);
+    if (!pools)
+        return NULL;
+
+    for (int i = 0; i < numPools; i++)
+        pools[i].start();
+
+    x265_thread_pools* handle = new x265_thread_pools;
+    handle->pools = pools;
+    handle->numPools = numPools;
+    return handle;
+}
+
+void x265_thread_pools_free(x265_thread_pools *handle)
+{
+    if (!handle)
+        return;
+
+    for (int i = 0; i < handle->numPools; i++)
+        handle->pools[i].stopWorkers();
+    delete [] handle->pools;
+    delete handle;
+}
+
 int x265_encoder_intra_refresh(x265_encoder *enc)
 {
     if (!enc)
@@ -1081,7 +1176,12 @@ static const x265_api libapi =
     &x265_calculate_vmaf_framelevelscore,
     &x265_vmaf_encoder_log,
 #endif
-    &PARAM_NS::x265_zone_param_parse
+    &PARAM_NS::x265_zone_param_parse,
+    &x265_thread_pools_alloc,
+    &x265_thread_pools_free,
+    &x265_lookahead_open,
+    &x265_lookahead_analyse,
+    &x265_stats_merge,
 };
 
 typedef const x265_api* (*api_get_func)(int bitDepth);
@@ -1378,7 +1478,7 @@ FILE* x265_csvlog_open(const x265_param* param)
 
                     /* detailed performance statistics */
                     fprintf(csvfp, ", DecideWait (ms), Row0Wait (ms), Wall time (ms), Ref Wait Wall (ms), Total CTU time (ms),"
-                        "Stall Time (ms), Total frame time (ms), Avg WPP, Row Blocks");
+                        "Stall Time (ms), Total frame time (ms), Avg WPP, Row Blocks, Ref Row Blocks, Ref Row Block Time (ms), Frame Threads");
 #if ENABLE_LIBVMAF
                     fprintf(csvfp, ", VMAF Frame Score");
 #endif
@@ -1390,6 +1490,8 @@ FILE* x265_csvlog_open(const x265_param* param)
                 fputs(summaryCSVHeader, csvfp);
                 if (param->csvLogLevel >= 2 || param->maxCLL || param->maxFALL)
                     fputs("MaxCLL, MaxFALL,", csvfp);
+                if (param->csvLogLevel >= 2)
+                    fputs(threadStatsCSVHeader, csvfp);
 #if ENABLE_LIBVMAF
                 fputs(" Aggregate VMAF Score,", csvfp);
 #endif
@@ -1503,7 +1605,8 @@ void x265_csvlog_frame(const x265_param* param, const x265_picture* pic)
                                                                                      frameStats->totalCTUTime, frameStats->stallTime,
                                                                                      frameStats->totalFrameTime);
 
-        fprintf(param->csvfpt, " %.3lf, %d", frameStats->avgWPP, frameStats->countRowBlocks);
+        fprintf(param->csvfpt, " %.3lf, %d, %d, %.3lf, %d", frameStats->avgWPP, frameStats->countRowBlocks,
+                                                             frameStats->refRowBlocks, frameStats->refRowBlockTime, frameStats->frameThreads);
 #if ENABLE_LIBVMAF
         fprintf(param->csvfpt, ", %lf", frameStats->vmafFrameScore);
 #endif
@@ -1525,6 +1628,8 @@ void x265_csvlog_encode(const x265_param *p, const x265_stats *stats, int padx,
             fputs(summaryCSVHeader, p->csvfpt);
             if (p->csvLogLevel >= 2 || p->maxCLL || p->maxFALL)
                 fputs("MaxCLL, MaxFALL,", p->csvfpt);
+            if (p->csvLogLevel >= 2)
+                fputs(threadStatsCSVHeader, p->csvfpt);
 #if ENABLE_LIBVMAF
             fputs(" Aggregate VMAF score,", p->csvfpt);
 #endif
@@ -1623,6 +1728,13 @@ void x265_csvlog_encode(const x265_param *p, const x265_stats *stats, int padx,
             fprintf(p->csvfpt, " -, -, -, -, -, -, -,");
         if (p->csvLogLevel >= 2 || p->maxCLL || p->maxFALL)
             fprintf(p->csvfpt, " %-6u, %-6u,", stats->maxCLL, stats->maxFALL);
+        if (p->csvLogLevel >= 2)
+        {
+            const x265_thread_stats& ts = stats->threadStats;
+            fprintf(p->csvfpt, " %u, %.1lf, %.1lf, " X265_LL ", " X265_LL ", " X265_LL ", %.1lf, %.1lf, %.1lf, %.1lf,",
+                    ts.numWorkers, ts.busyTime, ts.idleTime, ts.sleepCount, ts.wakeCount, ts.acquireFailures,
+                    ts.frameRowTime, ts.lookaheadTime, ts.pmodeTime, ts.weightAnalysisTime);
+        }
 #if ENABLE_LIBVMAF
         fprintf(p->csvfpt, " %lf,", stats->aggregateVmafScore);
 #endif
@@ -61,6 +61,30 @@ DPB::~DPB()
     }
 }
 
+/* Pop a recycled FrameData instance from the free list, preferring one which
+ * was allocated on the given NUMA node so that a frame encoder keeps working
+ * on node-local memory. Returns NULL if the free list is empty */
+FrameData* DPB::takeFreeFrameData(int numaNode)
+{
+    FrameData** link = &m_frameDataFreeList;
+    if (numaNode >= 0)
+    {
+        for (FrameData** it = &m_frameDataFreeList; *it; it = &(*it)->m_freeListNext)
+        {
+            if ((*it)->m_numaNode == numaNode)
+            {
+                link = it;
+                break;
+            }
+        }
+    }
+
+    FrameData* encData = *link;
+    if (encData)
+        *link = encData->m_freeListNext;
+    return encData;
+}
+
 // move unreferenced pictures from picList to freeList for recycle
 void DPB::recycleUnreferenced()
 {
@@ -73,6 +97,7 @@ void DPB::recycleUnreferenced()
         if (!curFrame->m_encData->m_bHasReferences && !curFrame->m_countRefEncoders)
         {
             curFrame->m_bChromaExtended = false;
+            curFrame->m_lowres.releaseArrays();
 
             // Reset column counter
             X265_CHECK(curFrame->m_reconRowFlag != NULL, "curFrame->m_reconRowFlag check failure");
@@ -75,6 +75,8 @@ public:
 
     void recycleUnreferenced();
 
+    FrameData* takeFreeFrameData(int numaNode);
+
 protected:
 
     void computeRPS(int curPoc, bool isRAP, RPS * rps, unsigned int maxDecPicBuffer);
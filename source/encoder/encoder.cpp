@@ -49,6 +49,31 @@
 namespace X265_NS {
 const char g_sliceTypeToChar[] = {'B', 'P', 'I'};
 
+/* Serialized lookahead decisions of one picture, see x265_lookahead_frame.
+ * The 64 byte header is followed by the fix8 packed cuTree offsets (as in the
+ * cutree stats file of multi-pass encodes), the intra costs and the propagate
+ * costs, each padded to a multiple of 32 bytes so the arrays of records read
+ * into an aligned buffer stay aligned for the fix8 primitives. All values are
+ * in host byte order */
+struct LookaheadRecordHeader
+{
+    uint32_t magic;
+    uint32_t size;          // bytes of the header and arrays
+    int32_t  poc;
+    int32_t  sliceType;
+    uint32_t flags;
+    uint32_t numCUs;
+    uint32_t numQpOffsets;
+    uint32_t reserved[5];
+    int64_t  pts;
+    int64_t  frameCost;
+};
+
+#define LOOKAHEAD_RECORD_MAGIC    0x3141484c // "LHA1"
+#define LOOKAHEAD_FLAG_KEYFRAME   1
+#define LOOKAHEAD_FLAG_SCENECUT   2
+#define LOOKAHEAD_RECORD_ALIGN(x) (((x) + 31) & ~(uint32_t)31)
+
 /* Dolby Vision profile specific settings */
 typedef struct
 {
@@ -126,10 +151,28 @@ Encoder::Encoder()
     m_encodedFrameNum = 0;
     m_pocLast = -1;
     m_curEncoder = 0;
+    m_activeFrameEncoders = 0;
+    m_adaptStartTime = 0;
+    m_adaptIdleTime = 0;
+    m_adaptCompressTime = 0;
+    m_adaptRefWaitTime = 0;
+    m_adaptStallTime = 0;
     m_numLumaWPFrames = 0;
     m_numChromaWPFrames = 0;
     m_numLumaWPBiFrames = 0;
     m_numChromaWPBiFrames = 0;
+    memset(m_numaNodeBytes, 0, sizeof(m_numaNodeBytes));
+    m_hugePageAdvisedBytes = m_normalPageBytes = 0;
+    m_workerStats = NULL;
+    m_bLookaheadOnly = false;
+    m_lookaheadHeldFrame = NULL;
+    m_lookaheadQpOffsets = NULL;
+    m_lookaheadIntraCost = NULL;
+    m_lookaheadPropagateCost = NULL;
+    m_lookaheadRecord = NULL;
+    m_lookaheadLoadData = NULL;
+    m_lookaheadLoadRecord = NULL;
+    m_lookaheadLoadCount = 0;
     m_lookahead = NULL;
     m_rateControl = NULL;
     m_dpb = NULL;
@@ -139,6 +182,7 @@ Encoder::Encoder()
     m_param = NULL;
     m_latestParam = NULL;
     m_threadPool = NULL;
+    m_bSharedPools = false;
     m_analysisFileIn = NULL;
     m_analysisFileOut = NULL;
     m_naluFile = NULL;
@@ -167,10 +211,8 @@ Encoder::Encoder()
     m_startPoint = 0;
     m_saveCTUSize = 0;
     m_edgePic = NULL;
-    m_edgeHistThreshold = 0;
-    m_chromaHistThreshold = 0.0;
-    m_scaledEdgeThreshold = 0.0;
-    m_scaledChromaThreshold = 0.0;
+    for (int i = 0; i < 3; i++)
+        m_inputPic[i] = NULL;
     m_zoneIndex = 0;
 }
 
@@ -248,34 +290,6 @@ void Encoder::create()
         }
     }
 
-    if (m_param->bHistBasedSceneCut)
-    {
-        m_planeSizes[0] = (m_param->sourceWidth >> x265_cli_csps[p->internalCsp].width[0]) * (m_param->sourceHeight >> x265_cli_csps[m_param->internalCsp].height[0]);
-        uint32_t pixelbytes = m_param->internalBitDepth > 8 ? 2 : 1;
-        m_edgePic = X265_MALLOC(pixel, m_planeSizes[0] * pixelbytes);
-        m_edgeHistThreshold = m_param->edgeTransitionThreshold;
-        m_chromaHistThreshold = x265_min(m_edgeHistThreshold * 10.0, MAX_SCENECUT_THRESHOLD);
-        m_scaledEdgeThreshold = x265_min(m_edgeHistThreshold * SCENECUT_STRENGTH_FACTOR, MAX_SCENECUT_THRESHOLD);
-        m_scaledChromaThreshold = x265_min(m_chromaHistThreshold * SCENECUT_STRENGTH_FACTOR, MAX_SCENECUT_THRESHOLD);
-        if (m_param->sourceBitDepth != m_param->internalBitDepth)
-        {
-            int size = m_param->sourceWidth * m_param->sourceHeight;
-            int hshift = CHROMA_H_SHIFT(m_param->internalCsp);
-            int vshift = CHROMA_V_SHIFT(m_param->internalCsp);
-            int widthC = m_param->sourceWidth >> hshift;
-            int heightC = m_param->sourceHeight >> vshift;
-
-            m_inputPic[0] = X265_MALLOC(pixel, size);
-            if (m_param->internalCsp != X265_CSP_I400)
-            {
-                for (int j = 1; j < 3; j++)
-                {
-                    m_inputPic[j] = X265_MALLOC(pixel, widthC * heightC);
-                }
-            }
-        }
-    }
-
     // Do not allow WPP if only one row or fewer than 3 columns, it is pointless and unstable
     if (rows == 1 || cols < 3)
     {
@@ -290,7 +304,27 @@ void Encoder::create()
         allowPools = false;
 
     m_numPools = 0;
-    if (allowPools)
+    if (allowPools && p->threadPools)
+    {
+        /* attach to the thread pools the application shares between encoders */
+        m_threadPool = p->threadPools->pools;
+        m_numPools = p->threadPools->numPools;
+        m_bSharedPools = true;
+        m_poolClient.m_weight = p->poolWeight;
+        if (p->lookaheadThreads)
+        {
+            x265_log(p, X265_LOG_WARNING, "--lookahead-threads is not supported with shared thread pools, disabled\n");
+            p->lookaheadThreads = 0;
+        }
+        if (!p->frameNumThreads)
+        {
+            int totalWorkers = 0;
+            for (int i = 0; i < m_numPools; i++)
+                totalWorkers += m_threadPool[i].m_numWorkers;
+            ThreadPool::getFrameThreadsCount(p, totalWorkers);
+        }
+    }
+    else if (allowPools)
         m_threadPool = ThreadPool::allocThreadPools(p, m_numPools, 0);
     else
     {
@@ -331,7 +365,12 @@ void Encoder::create()
     if (!len)
         strcpy(buf, "none");
 
-    x265_log(p, X265_LOG_INFO, "frame threads / pool features       : %d / %s\n", p->frameNumThreads, buf);
+    if (p->bAdaptiveFrameThreads && p->frameNumThreads == 1)
+        p->bAdaptiveFrameThreads = 0;
+    m_activeFrameEncoders = p->frameNumThreads;
+
+    x265_log(p, X265_LOG_INFO, "frame threads / pool features       : %d%s / %s\n", p->frameNumThreads,
+             p->bAdaptiveFrameThreads ? " (adaptive)" : "", buf);
 
     for (int i = 0; i < m_param->frameNumThreads; i++)
     {
@@ -339,7 +378,26 @@ void Encoder::create()
         m_frameEncoder[i]->m_nalList.m_annexB = !!m_param->bAnnexB;
     }
 
-    if (m_numPools)
+    if (m_bSharedPools)
+    {
+        /* the pools are already running; jpId stays local to this encoder since
+         * it indexes per-encoder thread local data */
+        for (int i = 0; i < m_numPools; i++)
+            m_threadPool[i].addClient(m_poolClient);
+        for (int i = 0; i < m_param->frameNumThreads; i++)
+        {
+            int pool = i % m_numPools;
+            m_frameEncoder[i]->m_pool = &m_threadPool[pool];
+            m_frameEncoder[i]->m_jpId = i / m_numPools;
+            m_frameEncoder[i]->m_client = &m_poolClient;
+            if (!m_threadPool[pool].addProvider(*m_frameEncoder[i]))
+            {
+                x265_log(p, X265_LOG_ERROR, "shared thread pool %d has no free job provider slots\n", pool);
+                m_aborted = true;
+            }
+        }
+    }
+    else if (m_numPools)
     {
         for (int i = 0; i < m_param->frameNumThreads; i++)
         {
@@ -379,7 +437,41 @@ void Encoder::create()
     else
         lookAheadThreadPool = m_threadPool;
     m_lookahead = new Lookahead(m_param, lookAheadThreadPool);
-    if (pools)
+    /* buffers of the histograms computed by the API thread, see Lookahead::m_bHistInPreLookahead */
+    if (m_param->bHistBasedSceneCut && !m_lookahead->m_bHistInPreLookahead)
+    {
+        m_planeSizes[0] = (m_param->sourceWidth >> x265_cli_csps[p->internalCsp].width[0]) * (m_param->sourceHeight >> x265_cli_csps[m_param->internalCsp].height[0]);
+        uint32_t pixelbytes = m_param->internalBitDepth > 8 ? 2 : 1;
+        m_edgePic = X265_MALLOC(pixel, m_planeSizes[0] * pixelbytes);
+        if (m_param->sourceBitDepth != m_param->internalBitDepth)
+        {
+            int size = m_param->sourceWidth * m_param->sourceHeight;
+            int hshift = CHROMA_H_SHIFT(m_param->internalCsp);
+            int vshift = CHROMA_V_SHIFT(m_param->internalCsp);
+            int widthC = m_param->sourceWidth >> hshift;
+            int heightC = m_param->sourceHeight >> vshift;
+
+            m_inputPic[0] = X265_MALLOC(pixel, size);
+            if (m_param->internalCsp != X265_CSP_I400)
+            {
+                for (int j = 1; j < 3; j++)
+                {
+                    m_inputPic[j] = X265_MALLOC(pixel, widthC * heightC);
+                }
+            }
+        }
+    }
+
+    if (pools && m_bSharedPools)
+    {
+        m_lookahead->m_client = &m_poolClient;
+        if (!lookAheadThreadPool[0].addProvider(*m_lookahead))
+        {
+            x265_log(p, X265_LOG_ERROR, "shared thread pool 0 has no free job provider slots\n");
+            m_aborted = true;
+        }
+    }
+    else if (pools)
     {
         m_lookahead->m_jpId = lookAheadThreadPool[0].m_numProviders++;
         lookAheadThreadPool[0].m_jpTable[m_lookahead->m_jpId] = m_lookahead;
@@ -480,6 +572,8 @@ void Encoder::create()
     int numCols = (m_param->sourceWidth  + m_param->maxCUSize - 1) / m_param->maxCUSize;
     for (int i = 0; i < m_param->frameNumThreads; i++)
     {
+        /* allocate the row state of each frame encoder on the NUMA node of its pool */
+        ScopedNumaAlloc numaAlloc(m_frameEncoder[i]->m_pool ? m_frameEncoder[i]->m_pool->m_numaNode : -1);
         if (!m_frameEncoder[i]->init(this, numRows, numCols))
         {
             x265_log(m_param, X265_LOG_ERROR, "Unable to initialize frame encoder, aborting\n");
@@ -500,6 +594,8 @@ void Encoder::create()
         m_aborted = true;
     if (!m_lookahead->create())
         m_aborted = true;
+    if (m_param->lookaheadLoad && !m_aborted && !loadLookaheadFile(m_param->lookaheadLoad))
+        m_aborted = true;
 
     initRefIdx();
     if (m_param->analysisSave && m_param->bUseAnalysisFile)
@@ -509,7 +605,12 @@ void Encoder::create()
             m_aborted = true;
         else
         {
-            m_analysisFileOut = x265_fopen(temp, "wb");
+            m_analysisFileOut = new AnalysisFile;
+            if (!m_analysisFileOut->create(temp, m_param->analysisSaveFormat, !!m_param->bAnalysisSaveCompress))
+            {
+                delete m_analysisFileOut;
+                m_analysisFileOut = NULL;
+            }
             X265_FREE(temp);
         }
         if (!m_analysisFileOut)
@@ -531,7 +632,12 @@ void Encoder::create()
                 m_aborted = true;
             else
             {
-                m_analysisFileOut = x265_fopen(temp, "wb");
+                m_analysisFileOut = new AnalysisFile;
+                if (!m_analysisFileOut->create(temp, X265_ANALYSIS_FORMAT_LEGACY, false))
+                {
+                    delete m_analysisFileOut;
+                    m_analysisFileOut = NULL;
+                }
                 X265_FREE(temp);
             }
             if (!m_analysisFileOut)
@@ -542,9 +648,11 @@ void Encoder::create()
         }
         if (m_param->rc.bStatRead)
         {
-            m_analysisFileIn = x265_fopen(name, "rb");
-            if (!m_analysisFileIn)
+            m_analysisFileIn = new AnalysisFile;
+            if (!m_analysisFileIn->open(name, 0))
             {
+                delete m_analysisFileIn;
+                m_analysisFileIn = NULL;
                 x265_log_file(NULL, X265_LOG_ERROR, "Analysis 2 pass: failed to open file %s\n", name);
                 m_aborted = true;
             }
@@ -607,7 +715,20 @@ void Encoder::stopJobs()
         }
     }
 
-    if (m_threadPool)
+    if (m_bSharedPools)
+    {
+        /* detach from the shared pools, other encoders keep using them */
+        for (int i = 0; i < m_param->frameNumThreads; i++)
+        {
+            if (m_frameEncoder[i] && m_frameEncoder[i]->m_pool)
+                m_frameEncoder[i]->m_pool->removeProvider(*m_frameEncoder[i]);
+        }
+        if (m_lookahead && m_lookahead->m_pool)
+            m_lookahead->m_pool->removeProvider(*m_lookahead);
+        for (int i = 0; i < m_numPools; i++)
+            m_threadPool[i].removeClient(m_poolClient);
+    }
+    else if (m_threadPool)
     {
         for (int i = 0; i < m_numPools; i++)
             m_threadPool[i].stopWorkers();
@@ -941,8 +1062,9 @@ void Encoder::destroy()
     }
 
     // thread pools can be cleaned up now that all the JobProviders are
-    // known to be shutdown
-    delete [] m_threadPool;
+    // known to be shutdown. Shared pools are owned by the application
+    if (!m_bSharedPools)
+        delete [] m_threadPool;
 
     if (m_lookahead)
     {
@@ -950,7 +1072,16 @@ void Encoder::destroy()
         delete m_lookahead;
     }
 
+    if (m_lookaheadHeldFrame)
+        m_dpb->m_freeList.pushBack(*m_lookaheadHeldFrame);
     delete m_dpb;
+    X265_FREE(m_lookaheadQpOffsets);
+    X265_FREE(m_lookaheadIntraCost);
+    X265_FREE(m_lookaheadPropagateCost);
+    X265_FREE(m_lookaheadRecord);
+    X265_FREE(m_lookaheadLoadData);
+    X265_FREE(m_lookaheadLoadRecord);
+    X265_FREE(m_workerStats);
     if (!m_param->bResetZoneConfig && m_param->rc.zonefileCount)
     {
         delete[] zoneReadCount;
@@ -971,13 +1102,14 @@ void Encoder::destroy()
 
         PARAM_NS::x265_param_free(m_latestParam);
     }
-    if (m_analysisFileIn)
-        fclose(m_analysisFileIn);
+    delete m_analysisFileIn;
 
     if (m_analysisFileOut)
     {
         int bError = 1;
-        fclose(m_analysisFileOut);
+        if (!m_analysisFileOut->close())
+            x265_log(m_param, X265_LOG_ERROR, "failed to write analysis stats file\n");
+        delete m_analysisFileOut;
         const char* name = m_param->analysisSave ? m_param->analysisSave : m_param->analysisReuseFileName;
         if (!name)
             name = defaultAnalysisFileName;
@@ -1519,89 +1651,6 @@ bool Encoder::computeHistograms(x265_picture *pic)
     return true;
 }
 
-void Encoder::computeHistogramSAD(double *normalizedMaxUVSad, double *normalizedEdgeSad, int curPoc)
-{
-
-    if (curPoc == 0)
-    {   /* first frame is scenecut by default no sad computation for the same. */
-        *normalizedMaxUVSad = 0.0;
-        *normalizedEdgeSad = 0.0;
-    }
-    else
-    {
-        /* compute sum of absolute differences of histogram bins of chroma and luma edge response between the current and prev pictures. */
-        int32_t edgeHistSad = 0;
-        int32_t uHistSad = 0;
-        int32_t vHistSad = 0;
-        double normalizedUSad = 0.0;
-        double normalizedVSad = 0.0;
-
-        for (int j = 0; j < HISTOGRAM_BINS; j++)
-        {
-            if (j < 2)
-            {
-                edgeHistSad += abs(m_curEdgeHist[j] - m_prevEdgeHist[j]);
-            }
-            uHistSad += abs(m_curYUVHist[1][j] - m_prevYUVHist[1][j]);
-            vHistSad += abs(m_curYUVHist[2][j] - m_prevYUVHist[2][j]);
-        }
-        *normalizedEdgeSad = normalizeRange(edgeHistSad, 0, 2 * m_planeSizes[0], 0.0, 1.0);
-        normalizedUSad = normalizeRange(uHistSad, 0, 2 * m_planeSizes[1], 0.0, 1.0);
-        normalizedVSad = normalizeRange(vHistSad, 0, 2 * m_planeSizes[2], 0.0, 1.0);
-        *normalizedMaxUVSad = x265_max(normalizedUSad, normalizedVSad);
-    }
-
-    /* store histograms of previous frame for reference */
-    memcpy(m_prevEdgeHist, m_curEdgeHist, sizeof(m_curEdgeHist));
-    memcpy(m_prevYUVHist, m_curYUVHist, sizeof(m_curYUVHist));
-}
-
-double Encoder::normalizeRange(int32_t value, int32_t minValue, int32_t maxValue, double rangeStart, double rangeEnd)
-{
-    return (double)(value - minValue) * (rangeEnd - rangeStart) / (maxValue - minValue) + rangeStart;
-}
-
-void Encoder::findSceneCuts(x265_picture *pic, bool& bDup, double maxUVSad, double edgeSad, bool& isMaxThres, bool& isHardSC)
-{
-    double minEdgeT = m_edgeHistThreshold * MIN_EDGE_FACTOR;
-    double minChromaT = minEdgeT * SCENECUT_CHROMA_FACTOR;
-    double maxEdgeT = m_edgeHistThreshold * MAX_EDGE_FACTOR;
-    double maxChromaT = maxEdgeT * SCENECUT_CHROMA_FACTOR;
-    pic->frameData.bScenecut = false;
-
-    if (pic->poc == 0)
-    {
-        /* for first frame */
-        pic->frameData.bScenecut = false;
-        bDup = false;
-    }
-    else
-    {
-        if (edgeSad == 0.0 && maxUVSad == 0.0)
-        {
-            bDup = true;
-        }
-        else if (edgeSad < minEdgeT && maxUVSad < minChromaT)
-        {
-            pic->frameData.bScenecut = false;
-        }
-        else if (edgeSad > maxEdgeT && maxUVSad > maxChromaT)
-        {
-            pic->frameData.bScenecut = true;
-            isMaxThres = true;
-            isHardSC = true;
-        }
-        else if (edgeSad > m_scaledEdgeThreshold || maxUVSad >= m_scaledChromaThreshold
-                 || (edgeSad > m_edgeHistThreshold && maxUVSad >= m_chromaHistThreshold))
-        {
-            pic->frameData.bScenecut = true;
-            bDup = false;
-            if (edgeSad > m_scaledEdgeThreshold || maxUVSad >= m_scaledChromaThreshold)
-                isHardSC = true;
-        }
-    }
-}
-
 /**
  * Feed one new input frame into the encoder, get one frame out. If pic_in is
  * NULL, a flush condition is implied and pic_in must be NULL for all subsequent
@@ -1636,14 +1685,30 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
     if (m_exportedPic)
     {
         if (!m_param->bUseAnalysisFile && m_param->analysisSave)
-            x265_free_analysis_data(m_param, &m_exportedPic->m_analysisData);
+        {
+            x265_analysis_data* analysis = &m_exportedPic->m_analysisData;
+            if (m_param->bAnalysisSaveDetach)
+            {
+                /* the caller owns the buffers exported in pic_out now, the
+                 * next encode of this frame allocates new ones */
+                analysis->wt = NULL;
+                analysis->interData = NULL;
+                analysis->intraData = NULL;
+                analysis->distortionData = NULL;
+                analysis->modeFlag[0] = analysis->modeFlag[1] = NULL;
+                analysis->lookahead.vbvCost = analysis->lookahead.intraVbvCost = NULL;
+                analysis->lookahead.satdForVbv = analysis->lookahead.intraSatdForVbv = NULL;
+            }
+            else
+                x265_free_analysis_data(m_param, analysis);
+        }
         ATOMIC_DEC(&m_exportedPic->m_countRefEncoders);
         m_exportedPic = NULL;
         m_dpb->recycleUnreferenced();
     }
     if ((pic_in && (!m_param->chunkEnd || (m_encodedFrameNum < m_param->chunkEnd))) || (m_param->bEnableFrameDuplication && !pic_in && (read < written)))
     {
-        if (m_param->bHistBasedSceneCut && pic_in)
+        if (m_param->bHistBasedSceneCut && pic_in && !m_lookahead->m_bHistInPreLookahead)
         {
             x265_picture *pic = (x265_picture *) pic_in;
 
@@ -1655,11 +1720,7 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
             }
 
             if (computeHistograms(pic))
-            {
-                double maxUVSad = 0.0, edgeSad = 0.0;
-                computeHistogramSAD(&maxUVSad, &edgeSad, pic_in->poc);
-                findSceneCuts(pic, bdropFrame, maxUVSad, edgeSad, isMaxThres, isHardSC);
-            }
+                pic->frameData.bScenecut = m_lookahead->histSceneCut(m_curEdgeHist, m_curYUVHist, pic->poc == 0, bdropFrame, isMaxThres, isHardSC);
         }
 
         if ((m_param->bEnableFrameDuplication && !pic_in && (read < written)))
@@ -1759,12 +1820,26 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
 
         Frame *inFrame;
         x265_param *p = (m_reconfigure || m_reconfigureRc) ? m_latestParam : m_param;
+
+        /* source and lowres planes are first touched here but mostly read by
+         * the lookahead, which always runs in the first thread pool */
+        int lookaheadNode = m_numPools ? m_threadPool[0].m_numaNode : -1;
+        ScopedNumaAlloc numaAlloc(lookaheadNode);
         if (m_dpb->m_freeList.empty())
         {
             inFrame = new Frame;
             inFrame->m_encodeStartTime = x265_mdate();
             if (inFrame->create(p, inputPic->quantOffsets))
             {
+                size_t lowresBytes;
+                void* lowresBuffer = inFrame->m_lowres.planeBuffer(lowresBytes);
+                if (lookaheadNode >= 0 && lookaheadNode < X265_MAX_NUMA_NODES)
+                    m_numaNodeBytes[lookaheadNode] += inFrame->m_fencPic->getAllocSize() + lowresBytes;
+
+                size_t hugeBytes = inFrame->m_fencPic->getHugePageAdvisedSize() + x265_huge_page_advised_bytes(lowresBuffer);
+                m_hugePageAdvisedBytes += hugeBytes;
+                m_normalPageBytes += inFrame->m_fencPic->getAllocSize() + lowresBytes - hugeBytes;
+
                 /* the first PicYuv created is asked to generate the CU and block unit offset
                  * arrays which are then shared with all subsequent PicYuv (orig and recon) 
                  * allocated by this top level encoder */
@@ -1801,12 +1876,6 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
                         }
                     }
                 }
-                if (m_param->recursionSkipMode == EDGE_BASED_RSKIP && m_param->bHistBasedSceneCut)
-                {
-                    pixel* src = m_edgePic;
-                    primitives.planecopy_pp_shr(src, inFrame->m_fencPic->m_picWidth, inFrame->m_edgeBitPic, inFrame->m_fencPic->m_stride,
-                        inFrame->m_fencPic->m_picWidth, inFrame->m_fencPic->m_picHeight, 0);
-                }
             }
             else
             {
@@ -1832,10 +1901,19 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
         /* Copy input picture into a Frame and PicYuv, send to lookahead */
         inFrame->m_fencPic->copyFromPicture(*inputPic, *m_param, m_sps.conformanceWindow.rightOffset, m_sps.conformanceWindow.bottomOffset);
 
+        /* the edge plane of --rskip 2, written for every picture since recycled
+         * frames still hold the plane of the picture they last carried */
+        if (m_param->recursionSkipMode == EDGE_BASED_RSKIP && m_param->bHistBasedSceneCut && !m_lookahead->m_bHistInPreLookahead)
+        {
+            pixel* src = m_edgePic;
+            primitives.planecopy_pp_shr(src, inFrame->m_fencPic->m_picWidth, inFrame->m_edgeBitPic, inFrame->m_fencPic->m_stride,
+                inFrame->m_fencPic->m_picWidth, inFrame->m_fencPic->m_picHeight, 0);
+        }
+
         inFrame->m_poc       = ++m_pocLast;
         inFrame->m_userData  = inputPic->userData;
         inFrame->m_pts       = inputPic->pts;
-        if (m_param->bHistBasedSceneCut)
+        if (m_param->bHistBasedSceneCut && !m_lookahead->m_bHistInPreLookahead)
         {
             inFrame->m_lowres.bScenecut = (inputPic->frameData.bScenecut == 1) ? true : false;
             inFrame->m_lowres.m_bIsMaxThres = isMaxThres;
@@ -1853,13 +1931,13 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
                 for (int i = 1; i <= backwardWindow; i++)
                 {
                     int frameNum = inFrame->m_poc - i;
-                    Frame * frame = m_lookahead->m_inputQueue.getPOC(frameNum);
+                    Frame * frame = m_lookahead->getInputPOC(frameNum);
                     if (frame)
                         frame->m_isInsideWindow = BACKWARD_WINDOW;
                 }
             }
         }
-        if (m_param->bHistBasedSceneCut && m_param->analysisSave)
+        if (m_param->bHistBasedSceneCut && m_param->analysisSave && !m_lookahead->m_bHistInPreLookahead)
         {
             memcpy(inFrame->m_analysisData.edgeHist, m_curEdgeHist, EDGE_BINS * sizeof(int32_t));
             memcpy(inFrame->m_analysisData.yuvHist[0], m_curYUVHist[0], HISTOGRAM_BINS *sizeof(int32_t));
@@ -1915,6 +1993,21 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
 
         /* Use the frame types from the first pass, if available */
         int sliceType = (m_param->rc.bStatRead) ? m_rateControl->rateControlSliceType(inFrame->m_poc) : inputPic->sliceType;
+        if (m_lookaheadLoadRecord)
+        {
+            const uint8_t* record = inFrame->m_poc < m_lookaheadLoadCount ? m_lookaheadLoadRecord[inFrame->m_poc] : NULL;
+            if (record)
+            {
+                sliceType = ((const LookaheadRecordHeader*)record)->sliceType;
+                inFrame->m_loadedCuTreeOffsets = (const uint16_t*)(record + sizeof(LookaheadRecordHeader));
+            }
+            else
+            {
+                inFrame->m_loadedCuTreeOffsets = NULL;
+                if (inFrame->m_poc <= m_lookaheadLoadCount)
+                    x265_log(m_param, X265_LOG_WARNING, "lookahead-load: no decisions for POC %d\n", inFrame->m_poc);
+            }
+        }
 
         /* In analysisSave mode, x265_analysis_data is allocated in inputPic and inFrame points to this */
         /* Load analysis data before lookahead->addPicture, since sliceType has been decided */
@@ -2018,8 +2111,26 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
     else
         m_lookahead->flush();
 
-    FrameEncoder *curEncoder = m_frameEncoder[m_curEncoder];
-    m_curEncoder = (m_curEncoder + 1) % m_param->frameNumThreads;
+    /* decided pictures are taken by analyseLookahead() */
+    if (m_bLookaheadOnly)
+        return 0;
+
+    /* Frame encoders above m_activeFrameEncoders are parked; they stay in the
+     * round-robin order, so the output remains in encode order, but are given
+     * no new frames. Each visit of a parked frame encoder takes a skipped rate
+     * control slot, so frames keep waiting on frameNumThreads - 1 slots */
+    int feIdx = m_curEncoder;
+    while (feIdx >= m_activeFrameEncoders)
+    {
+        if (!m_rateControl->m_finalFrameCount)
+            m_rateControl->allocStartEndSlot(true);
+        if (m_frameEncoder[feIdx]->m_frame)
+            break;
+        feIdx = (feIdx + 1) % m_param->frameNumThreads;
+    }
+    FrameEncoder *curEncoder = m_frameEncoder[feIdx];
+    bool bParkedEncoder = feIdx >= m_activeFrameEncoders;
+    m_curEncoder = (feIdx + 1) % m_param->frameNumThreads;
     int ret = 0;
 
     /* Normal operation is to wait for the current frame encoder to complete its current frame
@@ -2129,6 +2240,11 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
                         }
                     }
                     writeAnalysisFile(&pic_out->analysisData, *outFrame->m_encData);
+                    if (m_param->bUseAnalysisFile && !m_aborted && !m_analysisFileOut->endFrame(pic_out->analysisData.poc))
+                    {
+                        x265_log(NULL, X265_LOG_ERROR, "Error writing analysis data\n");
+                        m_aborted = true;
+                    }
                     pic_out->analysisData.saveParam = pic_out->analysisData.saveParam;
                     if (m_param->bUseAnalysisFile)
                         x265_free_analysis_data(m_param, &pic_out->analysisData);
@@ -2199,6 +2315,12 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
 
             if ((m_outputCount + 1)  >= m_param->chunkStart)
                 finishFrameStats(outFrame, curEncoder, frameData, m_pocLast);
+            if (m_param->bAdaptiveFrameThreads)
+            {
+                m_adaptCompressTime += curEncoder->m_endCompressTime - curEncoder->m_startCompressTime;
+                m_adaptRefWaitTime += curEncoder->m_refRowBlockTime;
+                m_adaptStallTime += curEncoder->m_totalNoWorkerTime;
+            }
             if (m_param->analysisSave)
             {
                 pic_out->analysisData.frameBits = frameData->bits;
@@ -2271,7 +2393,7 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
 
         /* pop a single frame from decided list, then provide to frame encoder
          * curEncoder is guaranteed to be idle at this point */
-        if (!pass)
+        if (!pass && !bParkedEncoder)
             frameEnc = m_lookahead->getDecidedPicture();
         if (frameEnc && !pass && (!m_param->chunkEnd || (m_encodedFrameNum < m_param->chunkEnd)))
         {
@@ -2336,18 +2458,26 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
             curEncoder->m_param = m_reconfigure ? m_latestParam : m_param;
             curEncoder->m_reconfigure = m_reconfigure;
 
-            /* give this frame a FrameData instance before encoding */
-            if (m_dpb->m_frameDataFreeList)
+            /* give this frame a FrameData instance before encoding, preferably
+             * one allocated on the NUMA node of the frame encoder's pool */
+            int numaNode = curEncoder->m_pool ? curEncoder->m_pool->m_numaNode : -1;
+            FrameData* encData = m_dpb->takeFreeFrameData(numaNode);
+            if (encData)
             {
-                frameEnc->m_encData = m_dpb->m_frameDataFreeList;
-                m_dpb->m_frameDataFreeList = m_dpb->m_frameDataFreeList->m_freeListNext;
+                frameEnc->m_encData = encData;
                 frameEnc->reinit(m_sps);
                 frameEnc->m_param = m_reconfigure ? m_latestParam : m_param;
                 frameEnc->m_encData->m_param = m_reconfigure ? m_latestParam : m_param;
             }
             else
             {
+                ScopedNumaAlloc numaAlloc(numaNode);
                 frameEnc->allocEncodeData(m_reconfigure ? m_latestParam : m_param, m_sps);
+                frameEnc->m_encData->m_numaNode = numaNode;
+                if (numaNode >= 0 && numaNode < X265_MAX_NUMA_NODES)
+                    m_numaNodeBytes[numaNode] += frameEnc->m_reconPic->getAllocSize();
+                m_hugePageAdvisedBytes += frameEnc->m_reconPic->getHugePageAdvisedSize();
+                m_normalPageBytes += frameEnc->m_reconPic->getAllocSize() - frameEnc->m_reconPic->getHugePageAdvisedSize();
                 Slice* slice = frameEnc->m_encData->m_slice;
                 slice->m_sps = &m_sps;
                 slice->m_pps = &m_pps;
@@ -2425,6 +2555,7 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
             frameEnc->m_encData->m_slice->m_iNumRPSInSPS = m_sps.spsrpsNum;
 
             curEncoder->m_rce.encodeOrder = frameEnc->m_encodeOrder = m_encodedFrameNum++;
+            curEncoder->m_rce.startEndSlot = m_rateControl->allocStartEndSlot(false);
 
             if (!m_param->analysisLoad || !m_param->bDisableLookahead)
             {
@@ -2485,18 +2616,212 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
             if (m_param->bIntraRefresh)
                  calcRefreshInterval(frameEnc);
 
+            /* the frame thread count is only changed between GOPs */
+            if (m_param->bAdaptiveFrameThreads && frameEnc->m_lowres.bKeyframe)
+                adaptFrameThreads();
+            curEncoder->m_activeFrameThreads = m_activeFrameEncoders;
+
             /* Allow FrameEncoder::compressFrame() to start in the frame encoder thread */
             if (!curEncoder->startCompressFrame(frameEnc))
                 m_aborted = true;
         }
-        else if (m_encodedFrameNum)
-            m_rateControl->setFinalFrameCount(m_encodedFrameNum);
+        else if (m_encodedFrameNum && !bParkedEncoder)
+            m_rateControl->setFinalFrameCount(m_rateControl->m_startEndSlots);
     }
     while (m_bZeroLatency && ++pass < 2);
 
     return ret;
 }
 
+/* Lookahead-only mode: send one picture, or NULL to flush, and return the
+ * decisions of at most one picture, in encode order */
+int Encoder::analyseLookahead(const x265_picture* pic_in, x265_lookahead_frame* lookaheadOut)
+{
+    if (encode(pic_in, NULL) < 0)
+        return -1;
+
+    Frame* frame = m_lookahead->getDecidedPicture();
+    if (!frame)
+        return 0;
+
+    exportLookaheadFrame(*frame, *lookaheadOut);
+
+    /* the last non-B frame output is the first reference of the next
+     * slicetypeDecide(), which may already be running, so it is recycled only
+     * once a later non-B frame has been decided */
+    if (IS_X265_TYPE_B(frame->m_lowres.sliceType))
+        m_dpb->m_freeList.pushBack(*frame);
+    else
+    {
+        if (m_lookaheadHeldFrame)
+            m_dpb->m_freeList.pushBack(*m_lookaheadHeldFrame);
+        m_lookaheadHeldFrame = frame;
+    }
+
+    if (!lookaheadOut->record)
+    {
+        m_aborted = true;
+        return -1;
+    }
+    return 1;
+}
+
+void Encoder::exportLookaheadFrame(Frame& frame, x265_lookahead_frame& lookaheadOut)
+{
+    Lowres& lowres = frame.m_lowres;
+    uint32_t numCUs = lowres.maxBlocksInRow * lowres.maxBlocksInCol;
+    uint32_t numQpOffsets = !lowres.qpCuTreeOffset ? 0 : m_param->rc.qgSize == 8 ? numCUs * 4 : numCUs;
+    uint32_t qpBytes = LOOKAHEAD_RECORD_ALIGN(numQpOffsets * sizeof(uint16_t));
+    uint32_t intraBytes = LOOKAHEAD_RECORD_ALIGN(numCUs * sizeof(int32_t));
+    uint32_t propagateBytes = LOOKAHEAD_RECORD_ALIGN(numCUs * sizeof(uint16_t));
+    uint32_t size = sizeof(LookaheadRecordHeader) + qpBytes + intraBytes + propagateBytes;
+
+    memset(&lookaheadOut, 0, sizeof(lookaheadOut));
+
+    /* the sizes are fixed for the whole encode */
+    if (!m_lookaheadRecord)
+    {
+        CHECKED_MALLOC(m_lookaheadQpOffsets, double, X265_MAX(numQpOffsets, 1));
+        CHECKED_MALLOC(m_lookaheadIntraCost, int32_t, numCUs);
+        CHECKED_MALLOC(m_lookaheadPropagateCost, uint16_t, numCUs);
+        CHECKED_MALLOC(m_lookaheadRecord, uint8_t, size);
+    }
+
+    /* copies, since the lookahead may still update the frame it references */
+    if (numQpOffsets)
+        memcpy(m_lookaheadQpOffsets, lowres.qpCuTreeOffset, numQpOffsets * sizeof(double));
+    memcpy(m_lookaheadIntraCost, lowres.intraCost, numCUs * sizeof(int32_t));
+    memcpy(m_lookaheadPropagateCost, lowres.propagateCost, numCUs * sizeof(uint16_t));
+
+    {
+        memset(m_lookaheadRecord, 0, size);
+        LookaheadRecordHeader* header = (LookaheadRecordHeader*)m_lookaheadRecord;
+        header->magic = LOOKAHEAD_RECORD_MAGIC;
+        header->size = size;
+        header->poc = frame.m_poc;
+        header->sliceType = lowres.sliceType;
+        header->flags = (lowres.bKeyframe ? LOOKAHEAD_FLAG_KEYFRAME : 0) | (lowres.bScenecut ? LOOKAHEAD_FLAG_SCENECUT : 0);
+        header->numCUs = numCUs;
+        header->numQpOffsets = numQpOffsets;
+        header->pts = frame.m_pts;
+        header->frameCost = lowres.decidedCost;
+
+        uint8_t* data = m_lookaheadRecord + sizeof(LookaheadRecordHeader);
+        if (numQpOffsets)
+            primitives.fix8Pack((uint16_t*)data, m_lookaheadQpOffsets, numQpOffsets);
+        memcpy(data + qpBytes, m_lookaheadIntraCost, numCUs * sizeof(int32_t));
+        memcpy(data + qpBytes + intraBytes, m_lookaheadPropagateCost, numCUs * sizeof(uint16_t));
+
+        lookaheadOut.poc = header->poc;
+        lookaheadOut.sliceType = header->sliceType;
+        lookaheadOut.bKeyframe = lowres.bKeyframe;
+        lookaheadOut.bScenecut = lowres.bScenecut;
+        lookaheadOut.pts = header->pts;
+        lookaheadOut.frameCost = header->frameCost;
+        lookaheadOut.numCUs = numCUs;
+        lookaheadOut.numQpOffsets = numQpOffsets;
+        lookaheadOut.qpCuTreeOffset = m_lookaheadQpOffsets;
+        lookaheadOut.intraCost = m_lookaheadIntraCost;
+        lookaheadOut.propagateCost = m_lookaheadPropagateCost;
+        lookaheadOut.record = m_lookaheadRecord;
+        lookaheadOut.recordSize = size;
+    }
+    return;
+
+fail:
+    X265_FREE(m_lookaheadQpOffsets);
+    X265_FREE(m_lookaheadIntraCost);
+    X265_FREE(m_lookaheadPropagateCost);
+    m_lookaheadQpOffsets = NULL;
+    m_lookaheadIntraCost = NULL;
+    m_lookaheadPropagateCost = NULL;
+}
+
+/* Reads a file of lookahead records and indexes them by POC. The records
+ * must have been saved with the block layout of this encode */
+bool Encoder::loadLookaheadFile(const char* filename)
+{
+    uint32_t numCUs = (uint32_t)m_lookahead->m_cuCount;
+    uint32_t numQpOffsets = m_param->rc.qgSize == 8 ? numCUs * 4 : numCUs;
+    int64_t fileSize;
+    size_t pos = 0;
+
+    FILE* file = x265_fopen(filename, "rb");
+    if (!file)
+    {
+        x265_log_file(m_param, X265_LOG_ERROR, "lookahead-load: unable to open %s\n", filename);
+        return false;
+    }
+    fseeko(file, 0, SEEK_END);
+    fileSize = ftello(file);
+    fseeko(file, 0, SEEK_SET);
+    if (fileSize <= 0 || (uint64_t)fileSize > (size_t)-1)
+    {
+        x265_log_file(m_param, X265_LOG_ERROR, "lookahead-load: %s is empty or too large\n", filename);
+        fclose(file);
+        return false;
+    }
+
+    m_lookaheadLoadData = X265_MALLOC(uint8_t, (size_t)fileSize);
+    if (!m_lookaheadLoadData || fread(m_lookaheadLoadData, 1, (size_t)fileSize, file) != (size_t)fileSize)
+    {
+        x265_log_file(m_param, X265_LOG_ERROR, "lookahead-load: unable to read %s\n", filename);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    /* first pass validates the records and finds the largest POC */
+    int maxPoc = -1, numRecords = 0;
+    while (pos < (size_t)fileSize)
+    {
+        const LookaheadRecordHeader* header = (const LookaheadRecordHeader*)(m_lookaheadLoadData + pos);
+        if ((size_t)fileSize - pos < sizeof(LookaheadRecordHeader) || header->magic != LOOKAHEAD_RECORD_MAGIC ||
+            header->size != sizeof(LookaheadRecordHeader) + LOOKAHEAD_RECORD_ALIGN(header->numQpOffsets * sizeof(uint16_t)) +
+                            LOOKAHEAD_RECORD_ALIGN(header->numCUs * sizeof(int32_t)) + LOOKAHEAD_RECORD_ALIGN(header->numCUs * sizeof(uint16_t)) ||
+            header->size > (size_t)fileSize - pos || header->poc < 0)
+        {
+            x265_log_file(m_param, X265_LOG_ERROR, "lookahead-load: %s is not a valid lookahead file\n", filename);
+            return false;
+        }
+        if (header->numCUs != numCUs || (m_param->rc.cuTree && header->numQpOffsets != numQpOffsets))
+        {
+            x265_log(m_param, X265_LOG_ERROR, "lookahead-load: the decisions were saved with a different resolution or qg-size\n");
+            return false;
+        }
+        maxPoc = X265_MAX(maxPoc, header->poc);
+        numRecords++;
+        pos += header->size;
+    }
+
+    /* a file holds one record per picture of the saving encode, so its POCs
+     * are exactly 0 .. numRecords - 1 */
+    if (maxPoc >= numRecords)
+    {
+        x265_log_file(m_param, X265_LOG_ERROR, "lookahead-load: %s has %d records but a record for POC %d\n", filename, numRecords, maxPoc);
+        return false;
+    }
+
+    m_lookaheadLoadCount = numRecords;
+    m_lookaheadLoadRecord = X265_MALLOC(const uint8_t*, m_lookaheadLoadCount);
+    if (!m_lookaheadLoadRecord)
+        return false;
+    memset(m_lookaheadLoadRecord, 0, m_lookaheadLoadCount * sizeof(const uint8_t*));
+    for (pos = 0; pos < (size_t)fileSize; pos += ((const LookaheadRecordHeader*)(m_lookaheadLoadData + pos))->size)
+    {
+        int poc = ((const LookaheadRecordHeader*)(m_lookaheadLoadData + pos))->poc;
+        if (m_lookaheadLoadRecord[poc])
+        {
+            x265_log_file(m_param, X265_LOG_ERROR, "lookahead-load: %s has more than one record for POC %d\n", filename, poc);
+            return false;
+        }
+        m_lookaheadLoadRecord[poc] = m_lookaheadLoadData + pos;
+    }
+
+    x265_log(m_param, X265_LOG_INFO, "lookahead-load: decisions of %d pictures read from %s\n", m_lookaheadLoadCount, filename);
+    return true;
+}
+
 int Encoder::reconfigureParam(x265_param* encParam, x265_param* param)
 {
     if (isReconfigureRc(encParam, param) && !param->rc.zonefileCount)
@@ -2588,13 +2913,13 @@ void Encoder::copyCtuInfo(x265_ctu_info_t** frameCtuInfo, int poc)
     bool copied = false;
     do
     {
-        curFrame = m_lookahead->m_inputQueue.getPOC(poc);
+        curFrame = m_lookahead->getInputPOC(poc);
         if (!curFrame)
             curFrame = m_lookahead->m_outputQueue.getPOC(poc);
 
         if (poc > 0)
         {
-            prevFrame = m_lookahead->m_inputQueue.getPOC(poc - 1);
+            prevFrame = m_lookahead->getInputPOC(poc - 1);
             if (!prevFrame)
                 prevFrame = m_lookahead->m_outputQueue.getPOC(poc - 1);
             if (!prevFrame)
@@ -2774,6 +3099,29 @@ void Encoder::printSummary()
 
         x265_log(m_param, X265_LOG_INFO, "consecutive B-frames: %s\n", buffer);
     }
+    if (m_lookahead->m_decidedFrames && m_lookahead->m_decideElapsedTime > 0)
+    {
+        double elapsedDecideTime = (double)m_lookahead->m_decideElapsedTime / 1000000;
+        x265_log(m_param, X265_LOG_INFO, "lookahead: %d frames decided in %.2fs (%.2f fps)\n",
+                 m_lookahead->m_decidedFrames, elapsedDecideTime, m_lookahead->m_decidedFrames / elapsedDecideTime);
+    }
+    if (m_lookahead->m_bReuseFirstPass)
+        x265_log(m_param, X265_LOG_INFO, "lookahead: decisions read from the first pass, %d frame cost estimates at lowres\n",
+                 m_lookahead->m_numLowresEstimates);
+    if (m_param->bHMEPathCosts)
+        x265_log(m_param, X265_LOG_INFO, "lookahead: %d path cost estimates on the HME level, %d frame cost estimates at lowres\n",
+                 m_lookahead->m_numLowerResEstimates, m_lookahead->m_numLowresEstimates);
+    if (m_lookahead->m_lowresPool.m_peakBytes)
+        x265_log(m_param, X265_LOG_INFO, "lookahead: lowres motion/cost arrays peaked at %.1f MiB in use, %.1f MiB reserved\n",
+                 m_lookahead->m_lowresPool.m_peakBytes / (1024.0 * 1024.0), m_lookahead->m_lowresPool.m_bytesReserved / (1024.0 * 1024.0));
+    for (int i = 0; i < X265_MAX_NUMA_NODES; i++)
+    {
+        if (m_numaNodeBytes[i])
+            x265_log(m_param, X265_LOG_INFO, "NUMA node %d picture buffers: %.1f MiB\n", i, m_numaNodeBytes[i] / (1024.0 * 1024.0));
+    }
+    if (m_param->bHugePages)
+        x265_log(m_param, X265_LOG_INFO, "picture buffers: %.1f MiB on or advised for huge pages, %.1f MiB on normal pages\n",
+                 m_hugePageAdvisedBytes / (1024.0 * 1024.0), m_normalPageBytes / (1024.0 * 1024.0));
     if (m_param->bLossless)
     {
         float frameSize = (float)(m_param->sourceWidth - m_sps.conformanceWindow.rightOffset) *
@@ -2964,6 +3312,23 @@ void Encoder::printSummary()
 #endif
 }
 
+/* Worker counters in the units of x265_thread_stats and x265_worker_stats */
+template<typename T>
+static void exportWorkerStats(T& out, const WorkerStats& in)
+{
+    int64_t busy = 0;
+    for (int i = 0; i < WORKER_TASK_COUNT; i++)
+        busy += in.taskTime[i];
+    out.busyTime = busy / 1000.0;
+    out.idleTime = in.idleTime / 1000.0;
+    out.sleepCount = in.sleepCount;
+    out.wakeCount = in.wakeCount;
+    out.frameRowTime = in.taskTime[WORKER_TASK_FRAME_ROWS] / 1000.0;
+    out.lookaheadTime = in.taskTime[WORKER_TASK_LOOKAHEAD] / 1000.0;
+    out.pmodeTime = in.taskTime[WORKER_TASK_PMODE_PME] / 1000.0;
+    out.weightAnalysisTime = in.taskTime[WORKER_TASK_WEIGHT_ANALYSIS] / 1000.0;
+}
+
 void Encoder::fetchStats(x265_stats *stats, size_t statsSizeBytes)
 {
     if (statsSizeBytes >= sizeof(stats))
@@ -3025,6 +3390,114 @@ void Encoder::fetchStats(x265_stats *stats, size_t statsSizeBytes)
     /* If new statistics are added to x265_stats, we must check here whether the
      * structure provided by the user is the new structure or an older one (for
      * future safety) */
+    if (statsSizeBytes >= offsetof(x265_stats, numaNodeBytes) + sizeof(stats->numaNodeBytes))
+        memcpy(stats->numaNodeBytes, m_numaNodeBytes, sizeof(m_numaNodeBytes));
+    if (statsSizeBytes >= offsetof(x265_stats, threadStats) + sizeof(stats->threadStats))
+    {
+        int numPools = m_numPools;
+        if (m_param->lookaheadThreads > 0 && m_lookahead && m_lookahead->m_pool)
+            numPools += m_lookahead->m_numPools;
+
+        WorkerStats total;
+        memset(&total, 0, sizeof(total));
+        x265_thread_stats& ts = stats->threadStats;
+        memset(&ts, 0, sizeof(ts));
+        for (int i = 0; i < numPools; i++)
+        {
+            const ThreadPool& pool = i < m_numPools ? m_threadPool[i] : m_lookahead->m_pool[i - m_numPools];
+            pool.accumulateStats(total);
+            ts.numWorkers += pool.m_numWorkers;
+            ts.acquireFailures += pool.m_acquireFailures;
+        }
+        ts.version = X265_THREAD_STATS_VERSION;
+        exportWorkerStats(ts, total);
+
+        /* the number of workers is fixed once the encoder is open */
+        if (!m_workerStats && ts.numWorkers)
+            m_workerStats = X265_MALLOC(x265_worker_stats, ts.numWorkers);
+        if (m_workerStats)
+        {
+            x265_worker_stats* out = m_workerStats;
+            for (int i = 0; i < numPools; i++)
+            {
+                const ThreadPool& pool = i < m_numPools ? m_threadPool[i] : m_lookahead->m_pool[i - m_numPools];
+                for (int j = 0; j < pool.m_numWorkers; j++, out++)
+                {
+                    WorkerStats worker;
+                    pool.getWorkerStats(j, worker);
+                    out->pool = i;
+                    out->numaNode = pool.m_numaNode;
+                    exportWorkerStats(*out, worker);
+                }
+            }
+            ts.workers = m_workerStats;
+        }
+    }
+    if (statsSizeBytes >= offsetof(x265_stats, normalPageBytes) + sizeof(stats->normalPageBytes))
+    {
+        stats->hugePageAdvisedBytes = m_hugePageAdvisedBytes;
+        stats->normalPageBytes = m_normalPageBytes;
+    }
+}
+
+/* Thresholds of --adaptive-frame-threads, as fractions of frame compress time
+ * (reference waits, stalls) or of pool worker time (idle) */
+#define ADAPT_REF_WAIT_HIGH 0.30
+#define ADAPT_REF_WAIT_LOW  0.10
+#define ADAPT_IDLE_HIGH     0.15
+
+/* Decides at a keyframe how many frame encoders are active for the next GOP.
+ * Frame encoders which spent a large part of the last GOP blocked on reference
+ * rows are in each other's way, so one of them is parked. When reference waits
+ * were rare but the workers were still idle (or, without pools, wavefronts
+ * stalled) there is room for one more frame in flight. Only the distribution
+ * of frames to frame encoders changes, so for a given schedule of active
+ * counts the output is deterministic */
+void Encoder::adaptFrameThreads()
+{
+    int64_t now = x265_mdate();
+    int64_t idleTime = 0;
+    int numWorkers = 0;
+    if (m_numPools)
+    {
+        WorkerStats total;
+        memset(&total, 0, sizeof(total));
+        for (int i = 0; i < m_numPools; i++)
+        {
+            m_threadPool[i].accumulateStats(total);
+            numWorkers += m_threadPool[i].m_numWorkers;
+        }
+        idleTime = total.idleTime;
+    }
+
+    if (m_adaptCompressTime > 0 && now > m_adaptStartTime)
+    {
+        double refWaitRatio = (double)m_adaptRefWaitTime / m_adaptCompressTime;
+        double idleRatio;
+        if (numWorkers)
+            idleRatio = (double)(idleTime - m_adaptIdleTime) / ((double)(now - m_adaptStartTime) * numWorkers);
+        else
+            idleRatio = (double)m_adaptStallTime / m_adaptCompressTime;
+
+        int active = m_activeFrameEncoders;
+        if (refWaitRatio > ADAPT_REF_WAIT_HIGH && active > 1)
+            active--;
+        else if (refWaitRatio < ADAPT_REF_WAIT_LOW && idleRatio > ADAPT_IDLE_HIGH && active < m_param->frameNumThreads)
+            active++;
+
+        if (active != m_activeFrameEncoders)
+        {
+            x265_log(m_param, X265_LOG_DEBUG, "frame threads %d -> %d (ref wait %.1f%%, idle %.1f%%)\n",
+                     m_activeFrameEncoders, active, refWaitRatio * 100, idleRatio * 100);
+            m_activeFrameEncoders = active;
+        }
+    }
+
+    m_adaptStartTime = now;
+    m_adaptIdleTime = idleTime;
+    m_adaptCompressTime = 0;
+    m_adaptRefWaitTime = 0;
+    m_adaptStallTime = 0;
 }
 
 void Encoder::finishFrameStats(Frame* curFrame, FrameEncoder *curEncoder, x265_frame_stats* frameStats, int inPoc)
@@ -3157,6 +3630,9 @@ void Encoder::finishFrameStats(Frame* curFrame, FrameEncoder *curEncoder, x265_f
             else
                 frameStats->avgWPP = 1;
             frameStats->countRowBlocks = curEncoder->m_countRowBlocks;
+            frameStats->refRowBlocks = curEncoder->m_refRowBlocks;
+            frameStats->refRowBlockTime = ELAPSED_MSEC(0, curEncoder->m_refRowBlockTime);
+            frameStats->frameThreads = curEncoder->m_activeFrameThreads;
 
             frameStats->avgChromaDistortion = curFrame->m_encData->m_frameStats.avgChromaDistortion;
             frameStats->avgLumaDistortion = curFrame->m_encData->m_frameStats.avgLumaDistortion;
@@ -4032,16 +4508,20 @@ void Encoder::configure(x265_param *p)
     uint32_t padsize = 0;
     if (m_param->analysisLoad && m_param->bUseAnalysisFile)
     {
-        m_analysisFileIn = x265_fopen(m_param->analysisLoad, "rb");
-        if (!m_analysisFileIn)
+        /* the frames are read in POC order, the records of the next mini-GOP
+         * are loaded by the reader's thread while the current one is read */
+        m_analysisFileIn = new AnalysisFile;
+        if (!m_analysisFileIn->open(m_param->analysisLoad, p->bframes + 2))
         {
+            delete m_analysisFileIn;
+            m_analysisFileIn = NULL;
             x265_log_file(NULL, X265_LOG_ERROR, "Analysis load: failed to open file %s\n", m_param->analysisLoad);
             m_aborted = true;
         }
         else
         {
             int rightOffset, bottomOffset;
-            if (fread(&rightOffset, sizeof(int), 1, m_analysisFileIn) != 1)
+            if (!m_analysisFileIn->read(&rightOffset, sizeof(int)))
             {
                 x265_log(NULL, X265_LOG_ERROR, "Error reading analysis data. Conformance window right offset missing\n");
                 m_aborted = true;
@@ -4055,7 +4535,7 @@ void Encoder::configure(x265_param *p)
                 m_conformanceWindow.rightOffset = padsize;
             }
 
-            if (fread(&bottomOffset, sizeof(int), 1, m_analysisFileIn) != 1)
+            if (!m_analysisFileIn->read(&bottomOffset, sizeof(int)))
             {
                 x265_log(NULL, X265_LOG_ERROR, "Error reading analysis data. Conformance window bottom offset missing\n");
                 m_aborted = true;
@@ -4415,6 +4895,30 @@ void Encoder::configure(x265_param *p)
         }
     }
 
+    if (p->bHMEPathCosts && (!p->bEnableHME || p->bFrameAdaptive != X265_B_ADAPT_TRELLIS || !p->bframes))
+    {
+        x265_log(p, X265_LOG_WARNING, "--hme-path-costs requires --hme and --b-adapt 2, disabling\n");
+        p->bHMEPathCosts = 0;
+    }
+
+    /* VBV plans with the lowres costs, and the analysis files store them */
+    if (p->bFastSecondPass && (!p->rc.bStatRead || (p->rc.vbvBufferSize && p->rc.vbvMaxBitrate) ||
+        p->analysisSave || p->analysisLoad || p->lookaheadLoad))
+    {
+        x265_log(p, X265_LOG_WARNING, "--fast-secondpass requires --pass 2 or 3 without VBV, analysis or lookahead load/save, disabling\n");
+        p->bFastSecondPass = 0;
+    }
+
+#if HIGH_BIT_DEPTH
+    if (p->bLowres8bit && (p->analysisSave || p->analysisLoad || p->lookaheadLoad))
+    {
+        x265_log(p, X265_LOG_WARNING, "--lowres-8bit is not compatible with analysis or lookahead load/save, disabling\n");
+        p->bLowres8bit = 0;
+    }
+#else
+    p->bLowres8bit = 0; /* the lowres planes are already 8 bits */
+#endif
+
     if (m_param->bEnableHME)
     {
         if (m_param->searchMethod != m_param->hmeSearchMethod[2])
@@ -4443,7 +4947,7 @@ void Encoder::readAnalysisFile(x265_analysis_data* analysis, int curPoc, const x
         {\
         memcpy(val, src, (size * readSize));\
         }\
-        else if (fread(val, size, readSize, fileOffset) != readSize)\
+        else if (!fileOffset->read(val, size * readSize))\
     {\
         x265_log(NULL, X265_LOG_ERROR, "Error reading analysis data\n");\
         x265_free_analysis_data(m_param, analysis);\
@@ -4455,7 +4959,19 @@ void Encoder::readAnalysisFile(x265_analysis_data* analysis, int curPoc, const x
     static uint64_t totalConsumedBytes = 0;
     uint32_t depthBytes = 0;
     if (m_param->bUseAnalysisFile)
-        fseeko(m_analysisFileIn, totalConsumedBytes + paramBytes, SEEK_SET);
+    {
+        if (m_analysisFileIn->isIndexed())
+        {
+            if (!m_analysisFileIn->seekFrame(curPoc))
+            {
+                x265_log(NULL, X265_LOG_WARNING, "Error reading analysis data: Cannot find POC %d\n", curPoc);
+                x265_free_analysis_data(m_param, analysis);
+                return;
+            }
+        }
+        else
+            m_analysisFileIn->seek(totalConsumedBytes + paramBytes);
+    }
     const x265_analysis_data *picData = &(picIn->analysisData);
     x265_analysis_intra_data *intraPic = picData->intraData;
     x265_analysis_inter_data *interPic = picData->interData;
@@ -4471,15 +4987,15 @@ void Encoder::readAnalysisFile(x265_analysis_data* analysis, int curPoc, const x
         uint64_t currentOffset = totalConsumedBytes;
 
         /* Seeking to the right frame Record */
-        while (poc != curPoc && !feof(m_analysisFileIn))
+        while (poc != curPoc && !m_analysisFileIn->eof())
         {
             currentOffset += frameRecordSize;
-            fseeko(m_analysisFileIn, currentOffset + paramBytes, SEEK_SET);
+            m_analysisFileIn->seek(currentOffset + paramBytes);
             X265_FREAD(&frameRecordSize, sizeof(uint32_t), 1, m_analysisFileIn, &(picData->frameRecordSize));
             X265_FREAD(&depthBytes, sizeof(uint32_t), 1, m_analysisFileIn, &(picData->depthBytes));
             X265_FREAD(&poc, sizeof(int), 1, m_analysisFileIn, &(picData->poc));
         }
-        if (poc != curPoc || feof(m_analysisFileIn))
+        if (poc != curPoc || m_analysisFileIn->eof())
         {
             x265_log(NULL, X265_LOG_WARNING, "Error reading analysis data: Cannot find POC %d\n", curPoc);
             x265_free_analysis_data(m_param, analysis);
@@ -4776,7 +5292,7 @@ void Encoder::readAnalysisFile(x265_analysis_data* analysis, int curPoc, const x
     {\
         memcpy(val, src, (size * readSize));\
     }\
-    else if (fread(val, size, readSize, fileOffset) != readSize)\
+    else if (!fileOffset->read(val, size * readSize))\
     {\
         x265_log(NULL, X265_LOG_ERROR, "Error reading analysis data\n");\
         x265_free_analysis_data(m_param, analysis);\
@@ -4788,7 +5304,19 @@ void Encoder::readAnalysisFile(x265_analysis_data* analysis, int curPoc, const x
     static uint64_t totalConsumedBytes = 0;
     uint32_t depthBytes = 0;
     if (m_param->bUseAnalysisFile)
-        fseeko(m_analysisFileIn, totalConsumedBytes + paramBytes, SEEK_SET);
+    {
+        if (m_analysisFileIn->isIndexed())
+        {
+            if (!m_analysisFileIn->seekFrame(curPoc))
+            {
+                x265_log(NULL, X265_LOG_WARNING, "Error reading analysis data: Cannot find POC %d\n", curPoc);
+                x265_free_analysis_data(m_param, analysis);
+                return;
+            }
+        }
+        else
+            m_analysisFileIn->seek(totalConsumedBytes + paramBytes);
+    }
 
     const x265_analysis_data *picData = &(picIn->analysisData);
     x265_analysis_intra_data *intraPic = picData->intraData;
@@ -4805,15 +5333,15 @@ void Encoder::readAnalysisFile(x265_analysis_data* analysis, int curPoc, const x
         uint64_t currentOffset = totalConsumedBytes;
 
         /* Seeking to the right frame Record */
-        while (poc != curPoc && !feof(m_analysisFileIn))
+        while (poc != curPoc && !m_analysisFileIn->eof())
         {
             currentOffset += frameRecordSize;
-            fseeko(m_analysisFileIn, currentOffset + paramBytes, SEEK_SET);
+            m_analysisFileIn->seek(currentOffset + paramBytes);
             X265_FREAD(&frameRecordSize, sizeof(uint32_t), 1, m_analysisFileIn, &(picData->frameRecordSize));
             X265_FREAD(&depthBytes, sizeof(uint32_t), 1, m_analysisFileIn, &(picData->depthBytes));
             X265_FREAD(&poc, sizeof(int), 1, m_analysisFileIn, &(picData->poc));
         }
-        if (poc != curPoc || feof(m_analysisFileIn))
+        if (poc != curPoc || m_analysisFileIn->eof())
         {
             x265_log(NULL, X265_LOG_WARNING, "Error reading analysis data: Cannot find POC %d\n", curPoc);
             x265_free_analysis_data(m_param, analysis);
@@ -5183,7 +5711,7 @@ int Encoder::validateAnalysisData(x265_analysis_validate* saveParam, int writeFl
     {\
         fileOffset = m_analysisFileIn;\
         if ((!m_param->bUseAnalysisFile && analysisParam != (int)*param) || \
-            (m_param->bUseAnalysisFile && (fread(&readValue, size, bytes, fileOffset) != bytes || (readValue != (int)*param))))\
+            (m_param->bUseAnalysisFile && (!fileOffset->read(&readValue, size * bytes) || (readValue != (int)*param))))\
         {\
             x265_log(NULL, X265_LOG_ERROR, "Error reading analysis data. Incompatible option : <%s> \n", #errorMsg);\
             m_aborted = true;\
@@ -5195,7 +5723,7 @@ int Encoder::validateAnalysisData(x265_analysis_validate* saveParam, int writeFl
         fileOffset = m_analysisFileOut;\
         if(!m_param->bUseAnalysisFile)\
             analysisParam = *param;\
-        else if(fwrite(param, size, bytes, fileOffset) < bytes)\
+        else if (!fileOffset->write(param, size * bytes))\
         {\
             x265_log(NULL, X265_LOG_ERROR, "Error writing analysis data\n"); \
             m_aborted = true;\
@@ -5209,7 +5737,7 @@ int Encoder::validateAnalysisData(x265_analysis_validate* saveParam, int writeFl
     {\
         memcpy(val, src, (size * readSize));\
     }\
-    else if (fread(val, size, readSize, fileOffset) != readSize)\
+    else if (!fileOffset->read(val, size * readSize))\
     {\
         x265_log(NULL, X265_LOG_ERROR, "Error reading analysis data\n");\
         m_aborted = true;\
@@ -5217,7 +5745,7 @@ int Encoder::validateAnalysisData(x265_analysis_validate* saveParam, int writeFl
     }\
     count++;
 
-    FILE*     fileOffset = NULL;
+    AnalysisFile* fileOffset = NULL;
     int       readValue = 0;
     int       count = 0;
 
@@ -5456,7 +5984,7 @@ void Encoder::readAnalysisFile(x265_analysis_data* analysis, int curPoc, int sli
 {
 
 #define X265_FREAD(val, size, readSize, fileOffset)\
-    if (fread(val, size, readSize, fileOffset) != readSize)\
+    if (!fileOffset->read(val, size * readSize))\
     {\
     x265_log(NULL, X265_LOG_ERROR, "Error reading analysis 2 pass data\n"); \
     x265_alloc_analysis_data(m_param, analysis); \
@@ -5470,7 +5998,7 @@ void Encoder::readAnalysisFile(x265_analysis_data* analysis, int curPoc, int sli
     X265_FREAD(&depthBytes, sizeof(uint32_t), 1, m_analysisFileIn);
     X265_FREAD(&poc, sizeof(int), 1, m_analysisFileIn);
 
-    if (poc != curPoc || feof(m_analysisFileIn))
+    if (poc != curPoc || m_analysisFileIn->eof())
     {
         x265_log(NULL, X265_LOG_WARNING, "Error reading analysis 2 pass data: Cannot find POC %d\n", curPoc);
         x265_free_analysis_data(m_param, analysis);
@@ -5577,7 +6105,7 @@ void Encoder::writeAnalysisFile(x265_analysis_data* analysis, FrameData &curEncD
 {
 
 #define X265_FWRITE(val, size, writeSize, fileOffset)\
-    if (fwrite(val, size, writeSize, fileOffset) < writeSize)\
+    if (!fileOffset->write(val, size * writeSize))\
     {\
         x265_log(NULL, X265_LOG_ERROR, "Error writing analysis data\n");\
         x265_free_analysis_data(m_param, analysis);\
@@ -5591,7 +6119,8 @@ void Encoder::writeAnalysisFile(x265_analysis_data* analysis, FrameData &curEncD
 
     if (!analysis->poc)
     {
-        if (validateAnalysisData(&analysis->saveParam, 1) == -1)
+        if (validateAnalysisData(&analysis->saveParam, 1) == -1 ||
+            (m_param->bUseAnalysisFile && !m_analysisFileOut->endOptions()))
         {
             m_aborted = true;
             return;
@@ -5821,7 +6350,7 @@ void Encoder::writeAnalysisFile(x265_analysis_data* analysis, FrameData &curEncD
 void Encoder::writeAnalysisFileRefine(x265_analysis_data* analysis, FrameData &curEncData)
 {
 #define X265_FWRITE(val, size, writeSize, fileOffset)\
-    if (fwrite(val, size, writeSize, fileOffset) < writeSize)\
+    if (!fileOffset->write(val, size * writeSize))\
     {\
     x265_log(NULL, X265_LOG_ERROR, "Error writing analysis 2 pass data\n"); \
     x265_free_analysis_data(m_param, analysis); \
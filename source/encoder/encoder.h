@@ -27,11 +27,13 @@
 #include "common.h"
 #include "slice.h"
 #include "threading.h"
+#include "threadpool.h"
 #include "scalinglist.h"
 #include "x265.h"
 #include "nal.h"
 #include "framedata.h"
 #include "svt.h"
+#include "analysisfile.h"
 #ifdef ENABLE_HDR10_PLUS
     #include "dynamicHDR10/hdr10plus.h"
 #endif
@@ -163,12 +165,6 @@ class RateControl;
 class ThreadPool;
 class FrameData;
 
-#define MAX_SCENECUT_THRESHOLD 1.0
-#define SCENECUT_STRENGTH_FACTOR 2.0
-#define MIN_EDGE_FACTOR 0.5
-#define MAX_EDGE_FACTOR 1.5
-#define SCENECUT_CHROMA_FACTOR 10.0
-
 class Encoder : public x265_encoder
 {
 public:
@@ -187,7 +183,34 @@ public:
     int                m_outputCount;
     int                m_bframeDelay;
     int                m_numPools;
+    bool               m_bSharedPools;    // m_threadPool belongs to an x265_thread_pools handle
+    PoolClient         m_poolClient;      // fair-share account on shared pools
     int                m_curEncoder;
+    int                m_activeFrameEncoders; // frame encoders receiving new frames, <= frameNumThreads
+
+    /* --adaptive-frame-threads statistics gathered since the last keyframe */
+    int64_t            m_adaptStartTime;
+    int64_t            m_adaptIdleTime;      // pool idle time at m_adaptStartTime
+    int64_t            m_adaptCompressTime;  // sum of frame compress times
+    int64_t            m_adaptRefWaitTime;   // sum of time frame encoders were blocked on reference rows
+    int64_t            m_adaptStallTime;     // sum of time frames had no active worker
+    uint64_t           m_numaNodeBytes[X265_MAX_NUMA_NODES]; // picture buffer bytes placed on each NUMA node
+    uint64_t           m_hugePageAdvisedBytes; // picture buffer bytes placed on, or advised for, huge pages
+    uint64_t           m_normalPageBytes;  // picture buffer bytes placed on normal pages
+    x265_worker_stats* m_workerStats;      // exported by fetchStats(), one per worker of all pools
+
+    /* lookahead-only mode, see x265_lookahead_open() */
+    bool               m_bLookaheadOnly;
+    Frame*             m_lookaheadHeldFrame;  // last exported non-B frame, still the lookahead's m_lastNonB
+    double*            m_lookaheadQpOffsets;  // exported copies of the lowres arrays
+    int32_t*           m_lookaheadIntraCost;
+    uint16_t*          m_lookaheadPropagateCost;
+    uint8_t*           m_lookaheadRecord;     // exported serialized decisions
+
+    /* --lookahead-load */
+    uint8_t*           m_lookaheadLoadData;   // contents of the file
+    const uint8_t**    m_lookaheadLoadRecord; // record of each POC, or NULL
+    int                m_lookaheadLoadCount;  // number of POCs in m_lookaheadLoadRecord
 
     // weighted prediction
     int                m_numLumaWPFrames;    // number of P frames with weighted luma reference
@@ -202,8 +225,8 @@ public:
     FrameEncoder*      m_frameEncoder[X265_MAX_FRAME_THREADS];
     DPB*               m_dpb;
     Frame*             m_exportedPic;
-    FILE*              m_analysisFileIn;
-    FILE*              m_analysisFileOut;
+    AnalysisFile*      m_analysisFileIn;
+    AnalysisFile*      m_analysisFileOut;
     FILE*              m_naluFile;
     x265_param*        m_param;
     x265_param*        m_latestParam;     // Holds latest param during a reconfigure
@@ -256,18 +279,12 @@ public:
     int                m_bToneMap; // Enables tone-mapping
     int                m_enableNal;
 
-    /* For histogram based scene-cut detection */
+    /* For histogram based scene-cut detection on the API thread */
     pixel*             m_edgePic;
     pixel*             m_inputPic[3];
     int32_t            m_curYUVHist[3][HISTOGRAM_BINS];
-    int32_t            m_prevYUVHist[3][HISTOGRAM_BINS];
     int32_t            m_curEdgeHist[2];
-    int32_t            m_prevEdgeHist[2];
     uint32_t           m_planeSizes[3];
-    double             m_edgeHistThreshold;
-    double             m_chromaHistThreshold;
-    double             m_scaledEdgeThreshold;
-    double             m_scaledChromaThreshold;
 
 #ifdef ENABLE_HDR10_PLUS
     const hdr10plus_api     *m_hdr10plus_api;
@@ -311,6 +328,12 @@ public:
 
     int encode(const x265_picture* pic, x265_picture *pic_out);
 
+    int analyseLookahead(const x265_picture* pic, x265_lookahead_frame* lookaheadOut);
+
+    void exportLookaheadFrame(Frame& frame, x265_lookahead_frame& lookaheadOut);
+
+    bool loadLookaheadFile(const char* filename);
+
     int reconfigureParam(x265_param* encParam, x265_param* param);
 
     bool isReconfigureRc(x265_param* latestParam, x265_param* param_in);
@@ -361,6 +384,8 @@ public:
 
     void copyDistortionData(x265_analysis_data* analysis, FrameData &curEncData);
 
+    void adaptFrameThreads();
+
     void finishFrameStats(Frame* pic, FrameEncoder *curEncoder, x265_frame_stats* frameStats, int inPoc);
 
     int validateAnalysisData(x265_analysis_validate* param, int readWriteFlag);
@@ -376,9 +401,6 @@ public:
     void copyPicture(x265_picture *dest, const x265_picture *src);
 
     bool computeHistograms(x265_picture *pic);
-    void computeHistogramSAD(double *maxUVNormalizedSAD, double *edgeNormalizedSAD, int curPoc);
-    double normalizeRange(int32_t value, int32_t minValue, int32_t maxValue, double rangeStart, double rangeEnd);
-    void findSceneCuts(x265_picture *pic, bool& bDup, double m_maxUVSADVal, double m_edgeSADVal, bool& isMaxThres, bool& isHardSC);
 
     void initRefIdx();
     void analyseRefIdx(int *numRefIdx);
@@ -38,27 +38,37 @@
 namespace X265_NS {
 void weightAnalyse(Slice& slice, Frame& frame, x265_param& param);
 
+/* bounds of the adaptive spin budget used before blocking on a reference row */
+#define REF_ROW_SPIN_MIN  64
+#define REF_ROW_SPIN_INIT 1024
+#define REF_ROW_SPIN_MAX  16384
+
 FrameEncoder::FrameEncoder()
 {
     m_prevOutputTime = x265_mdate();
     m_reconfigure = false;
     m_isFrameEncoder = true;
+    m_taskType = WORKER_TASK_FRAME_ROWS;
     m_threadActive = true;
     m_slicetypeWaitTime = 0;
     m_activeWorkerCount = 0;
     m_completionCount = 0;
+    m_refSpinLimit = REF_ROW_SPIN_INIT;
+    m_activeFrameThreads = 1;
     m_outStreams = NULL;
     m_backupStreams = NULL;
     m_substreamSizes = NULL;
     m_nr = NULL;
     m_tld = NULL;
     m_rows = NULL;
+    m_vbvRowScratch = NULL;
     m_top = NULL;
     m_param = NULL;
     m_frame = NULL;
     m_cuGeoms = NULL;
     m_ctuGeomMap = NULL;
     m_localTldIdx = 0;
+    m_numTLD = 1;
     memset(&m_rce, 0, sizeof(RateControlEntry));
 }
 
@@ -68,10 +78,7 @@ void FrameEncoder::destroy()
     {
         if (!m_jpId)
         {
-            int numTLD = m_pool->m_numWorkers;
-            if (!m_param->bEnableWavefront)
-                numTLD += m_pool->m_numProviders;
-            for (int i = 0; i < numTLD; i++)
+            for (int i = 0; i < m_numTLD; i++)
                 m_tld[i].destroy();
             delete [] m_tld;
         }
@@ -83,6 +90,7 @@ void FrameEncoder::destroy()
     }
 
     delete[] m_rows;
+    X265_FREE(m_vbvRowScratch);
     delete[] m_outStreams;
     delete[] m_backupStreams;
     X265_FREE(m_sliceBaseRow);
@@ -116,6 +124,12 @@ bool FrameEncoder::init(Encoder *top, int numRows, int numCols)
     m_filterRowDelayCus = m_filterRowDelay * numCols;
     m_rows = new CTURow[m_numRows];
     bool ok = !!m_numRows;
+    if (m_param->rc.vbvBufferSize && m_param->rc.vbvMaxBitrate)
+    {
+        /* one row size estimate per row of CTUs, for its row VBV rate control */
+        m_vbvRowScratch = X265_MALLOC(RowSizeEstimate::Row, m_numRows * m_numRows);
+        ok &= !!m_vbvRowScratch;
+    }
 
     m_sliceBaseRow = X265_MALLOC(uint32_t, m_param->maxSlices + 1);
     m_bAllRowsStop = X265_MALLOC(bool, m_param->maxSlices);
@@ -261,11 +275,40 @@ bool FrameEncoder::initializeGeoms()
     return true;
 }
 
+/* Block until the given CTU row of a reference picture is reconstructed. While
+ * blocked, the job provider encoding the reference is told how many frame
+ * encoders depend on it so critical-path scheduling can favour it */
+void FrameEncoder::waitForReconRow(Frame* refPic, int row)
+{
+    if (refPic->m_reconRowFlag[row].get())
+        return;
+
+    /* Reference rows usually complete within a few microseconds of being
+     * needed, so spin briefly before paying for a sleep and a wakeup. The
+     * spin budget grows while spinning pays off and shrinks when it does not */
+    int64_t startTime = x265_mdate();
+    JobProvider* upstream = refPic->m_encData->m_jobProvider;
+    ATOMIC_INC(&upstream->m_blockedDependents);
+    if (refPic->m_reconRowFlag[row].spinWait(0, m_refSpinLimit))
+        m_refSpinLimit = X265_MIN(m_refSpinLimit * 2, REF_ROW_SPIN_MAX);
+    else
+    {
+        m_refSpinLimit = X265_MAX(m_refSpinLimit / 2, REF_ROW_SPIN_MIN);
+        while (refPic->m_reconRowFlag[row].get() == 0)
+            refPic->m_reconRowFlag[row].waitForChange(0);
+    }
+    ATOMIC_DEC(&upstream->m_blockedDependents);
+
+    m_refRowBlocks++;
+    m_refRowBlockTime += x265_mdate() - startTime;
+}
+
 bool FrameEncoder::startCompressFrame(Frame* curFrame)
 {
     m_slicetypeWaitTime = x265_mdate() - m_prevOutputTime;
     m_frame = curFrame;
     m_sliceType = curFrame->m_lowres.sliceType;
+    m_encodeOrder = curFrame->m_encodeOrder;
     curFrame->m_encData->m_frameEncoderID = m_jpId;
     curFrame->m_encData->m_jobProvider = this;
     curFrame->m_encData->m_slice->m_mref = m_mref;
@@ -290,27 +333,29 @@ void FrameEncoder::threadMain()
 
         /* the first FE on each NUMA node is responsible for allocating thread
          * local data for all worker threads in that pool. If WPP is disabled, then
-         * each FE also needs a TLD instance */
+         * each FE also needs a TLD instance. Only this encoder's FEs are peers,
+         * the pool may be shared with other encoders */
+        int numPeers = 0;
+        for (int i = 0; i < m_param->frameNumThreads; i++)
+            numPeers += m_top->m_frameEncoder[i]->m_pool == m_pool;
+        m_numTLD = m_pool->m_numWorkers;
+        if (!m_param->bEnableWavefront)
+            m_numTLD += numPeers;
+
         if (!m_jpId)
         {
-            int numTLD = m_pool->m_numWorkers;
-            if (!m_param->bEnableWavefront)
-                numTLD += m_pool->m_numProviders;
-
-            m_tld = new ThreadLocalData[numTLD];
-            for (int i = 0; i < numTLD; i++)
+            m_tld = new ThreadLocalData[m_numTLD];
+            for (int i = 0; i < m_numTLD; i++)
             {
                 m_tld[i].analysis.initSearch(*m_param, m_top->m_scalingList);
                 m_tld[i].analysis.create(m_tld);
             }
 
-            for (int i = 0; i < m_pool->m_numProviders; i++)
+            for (int i = 0; i < m_param->frameNumThreads; i++)
             {
-                if (m_pool->m_jpTable[i]->m_isFrameEncoder) /* ugh; over-allocation and other issues here */
-                {
-                    FrameEncoder *peer = dynamic_cast<FrameEncoder*>(m_pool->m_jpTable[i]);
+                FrameEncoder *peer = m_top->m_frameEncoder[i];
+                if (peer->m_pool == m_pool)
                     peer->m_tld = m_tld;
-                }
             }
         }
 
@@ -436,6 +481,8 @@ void FrameEncoder::compressFrame()
     m_totalWorkerElapsedTime = 0;
     m_totalNoWorkerTime = 0;
     m_countRowBlocks = 0;
+    m_refRowBlocks = 0;
+    m_refRowBlockTime = 0;
     m_allRowsAvailableTime = 0;
     m_stallStartTime = 0;
 
@@ -568,11 +615,7 @@ void FrameEncoder::compressFrame()
 
     }
 
-    int numTLD;
-    if (m_pool)
-        numTLD = m_param->bEnableWavefront ? m_pool->m_numWorkers : m_pool->m_numWorkers + m_pool->m_numProviders;
-    else
-        numTLD = 1;
+    int numTLD = m_numTLD;
 
     /* Get the QP for this frame from rate control. This call may block until
      * frames ahead of it in encode order have called rateControlEnd() */
@@ -805,10 +848,7 @@ void FrameEncoder::compressFrame()
      * and VBV, unlock only after rateControlUpdateStats of this frame is called */
     if (m_param->rc.rateControlMode != X265_RC_ABR && !m_top->m_rateControl->m_isVbv)
     {
-        m_top->m_rateControl->m_startEndOrder.incr();
-
-        if (m_rce.encodeOrder < m_param->frameNumThreads - 1)
-            m_top->m_rateControl->m_startEndOrder.incr(); // faked rateControlEnd calls for negative frames
+        m_top->m_rateControl->advanceStartEndOrder();
     }
 
     if (m_param->bDynamicRefine)
@@ -865,8 +905,7 @@ void FrameEncoder::compressFrame()
                         // NOTE: we unnecessary wait row that beyond current slice boundary
                         const int rowIdx = X265_MIN(sliceEndRow, (row + m_refLagRows));
 
-                        while (refpic->m_reconRowFlag[rowIdx].get() == 0)
-                            refpic->m_reconRowFlag[rowIdx].waitForChange(0);
+                        waitForReconRow(refpic, rowIdx);
 
                         if ((bUseWeightP || bUseWeightB) && m_mref[l][ref].isWeighted)
                             m_mref[l][ref].applyWeight(rowIdx, m_numRows, sliceEndRow, sliceId);
@@ -905,8 +944,7 @@ void FrameEncoder::compressFrame()
                         Frame *refpic = slice->m_refFrameList[list][ref];
 
                         const int rowIdx = X265_MIN(m_numRows - 1, (i + m_refLagRows));
-                        while (refpic->m_reconRowFlag[rowIdx].get() == 0)
-                            refpic->m_reconRowFlag[rowIdx].waitForChange(0);
+                        waitForReconRow(refpic, rowIdx);
 
                         if ((bUseWeightP || bUseWeightB) && m_mref[l][ref].isWeighted)
                             m_mref[list][ref].applyWeight(rowIdx, m_numRows, m_numRows, 0);
@@ -1643,18 +1681,33 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
             FrameData::RCStatCU& cuStat = curEncData.m_cuStat[cuAddr];    
             if ((m_param->bEnableWavefront && ((cuAddr == m_sliceBaseRow[sliceId] * numCols) || !m_param->rc.bEnableConstVbv)) || !m_param->bEnableWavefront)
             {
-                curEncData.m_rowStat[row].rowSatd += cuStat.vbvCost;
-                curEncData.m_rowStat[row].rowIntraSatd += cuStat.intraVbvCost;
-                curEncData.m_rowStat[row].encodedBits += cuStat.totalBits;
-                curEncData.m_rowStat[row].sumQpRc += cuStat.baseQp;
-                curEncData.m_rowStat[row].numEncodedCUs = cuAddr;
+                FrameData::RCStatRow& rowStat = curEncData.m_rowStat[row];
+                rowStat.beginUpdate();
+                rowStat.rowSatd += cuStat.vbvCost;
+                rowStat.rowIntraSatd += cuStat.intraVbvCost;
+                rowStat.encodedBits += cuStat.totalBits;
+                rowStat.sumQpRc += cuStat.baseQp;
+                rowStat.numEncodedCUs = cuAddr;
+                if (slice->m_sliceType != I_SLICE && !m_param->rc.bEnableConstVbv)
+                {
+                    /* costs and bits of the CTUs of the reference row after this one */
+                    FrameData& refEncData = *slice->m_refFrameList[0][0]->m_encData;
+                    if (!col)
+                    {
+                        rowStat.refSatdLeft = refEncData.m_rowStat[row].rowSatd;
+                        rowStat.refBitsLeft = refEncData.m_rowStat[row].encodedBits;
+                    }
+                    rowStat.refSatdLeft -= refEncData.m_cuStat[cuAddr].vbvCost;
+                    rowStat.refBitsLeft -= refEncData.m_cuStat[cuAddr].totalBits;
+                }
+                rowStat.endUpdate();
             }
             
             // If current block is at row end checkpoint, call vbv ratecontrol.
             if (!m_param->bEnableWavefront && col == numCols - 1)
             {
                 double qpBase = curEncData.m_cuStat[cuAddr].baseQp;
-                curRow.reEncode = m_top->m_rateControl->rowVbvRateControl(m_frame, row, &m_rce, qpBase, m_sliceBaseRow, sliceId);
+                curRow.reEncode = m_top->m_rateControl->rowVbvRateControl(m_frame, row, &m_rce, qpBase, m_sliceBaseRow, sliceId, m_vbvRowScratch + row * m_numRows);
                 qpBase = x265_clip3((double)m_param->rc.qpMin, (double)m_param->rc.qpMax, qpBase);
                 curEncData.m_rowStat[row].rowQp = qpBase;
                 curEncData.m_rowStat[row].rowQpScale = x265_qp2qScale(qpBase);
@@ -1671,12 +1724,14 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
 
                     curRow.completed = 0;
                     memset(&curRow.rowStats, 0, sizeof(curRow.rowStats));
+                    curEncData.m_rowStat[row].beginUpdate();
                     curEncData.m_rowStat[row].numEncodedCUs = 0;
                     curEncData.m_rowStat[row].encodedBits = 0;
                     curEncData.m_rowStat[row].rowSatd = 0;
                     curEncData.m_rowStat[row].rowIntraSatd = 0;
                     curEncData.m_rowStat[row].sumQpRc = 0;
                     curEncData.m_rowStat[row].sumQpAq = 0;
+                    curEncData.m_rowStat[row].endUpdate();
                 }
             }
             // If current block is at row diagonal checkpoint, call vbv ratecontrol.
@@ -1689,6 +1744,7 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
 
                     for (int32_t r = row; r >= (int32_t)m_sliceBaseRow[sliceId]; r--)
                     {
+                        curEncData.m_rowStat[r].beginUpdate();
                         for (uint32_t c = startCuAddr; c <= EndCuAddr && c <= numCols * (r + 1) - 1; c++)
                         {
                             curEncData.m_rowStat[r].rowSatd += curEncData.m_cuStat[c].vbvCost;
@@ -1697,6 +1753,7 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
                             curEncData.m_rowStat[r].sumQpRc += curEncData.m_cuStat[c].baseQp;
                             curEncData.m_rowStat[r].numEncodedCUs = c;
                         }
+                        curEncData.m_rowStat[r].endUpdate();
                         if (curRow.reEncode < 0)
                             break;
                         startCuAddr = EndCuAddr - numCols;
@@ -1704,7 +1761,7 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
                     }
                 }
                 double qpBase = curEncData.m_cuStat[cuAddr].baseQp;
-                curRow.reEncode = m_top->m_rateControl->rowVbvRateControl(m_frame, row, &m_rce, qpBase, m_sliceBaseRow, sliceId);
+                curRow.reEncode = m_top->m_rateControl->rowVbvRateControl(m_frame, row, &m_rce, qpBase, m_sliceBaseRow, sliceId, m_vbvRowScratch + row * m_numRows);
                 qpBase = x265_clip3((double)m_param->rc.qpMin, (double)m_param->rc.qpMax, qpBase);
                 curEncData.m_rowStat[row].rowQp = qpBase;
                 curEncData.m_rowStat[row].rowQpScale = x265_qp2qScale(qpBase);
@@ -1758,12 +1815,14 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
                         m_outStreams[r].resetBits();
                         stopRow.completed = 0;
                         memset(&stopRow.rowStats, 0, sizeof(stopRow.rowStats));
+                        curEncData.m_rowStat[r].beginUpdate();
                         curEncData.m_rowStat[r].numEncodedCUs = 0;
                         curEncData.m_rowStat[r].encodedBits = 0;
                         curEncData.m_rowStat[r].rowSatd = 0;
                         curEncData.m_rowStat[r].rowIntraSatd = 0;
                         curEncData.m_rowStat[r].sumQpRc = 0;
                         curEncData.m_rowStat[r].sumQpAq = 0;
+                        curEncData.m_rowStat[r].endUpdate();
                     }
 
                     m_bAllRowsStop[curRow.sliceId] = false;
@@ -1804,6 +1863,7 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
         {
             for (uint32_t r = m_sliceBaseRow[sliceId]; r < m_sliceBaseRow[sliceId + 1]; r++)
             {
+                curEncData.m_rowStat[r].beginUpdate();
                 for (uint32_t c = curEncData.m_rowStat[r].numEncodedCUs + 1; c < numCols * (r + 1); c++)
                 {
                     curEncData.m_rowStat[r].rowSatd += curEncData.m_cuStat[c].vbvCost;
@@ -1812,6 +1872,7 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
                     curEncData.m_rowStat[r].sumQpRc += curEncData.m_cuStat[c].baseQp;
                     curEncData.m_rowStat[r].numEncodedCUs = c;
                 }
+                curEncData.m_rowStat[r].endUpdate();
             }
         }
     }
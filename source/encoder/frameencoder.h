@@ -138,6 +138,7 @@ public:
     Event                    m_done;
     Event                    m_completionEvent;
     int                      m_localTldIdx;
+    int                      m_numTLD;      /* thread local data instances shared by the FEs of this pool */
     bool                     m_reconfigure; /* reconfigure in progress */
     volatile bool            m_threadActive;
     volatile bool            *m_bAllRowsStop;
@@ -153,6 +154,7 @@ public:
     bool                     m_bUseSao;
 
     CTURow*                  m_rows;
+    RowSizeEstimate::Row*    m_vbvRowScratch;   /* m_numRows estimates per row, VBV only */
     uint16_t                 m_sliceAddrBits;
     uint32_t                 m_sliceGroupSize;
     uint32_t*                m_sliceBaseRow;    
@@ -172,6 +174,9 @@ public:
     volatile int             m_totalActiveWorkerCount;   // sum of m_activeWorkerCount sampled at end of each CTU
     volatile int             m_activeWorkerCountSamples; // count of times m_activeWorkerCount was sampled (think vbv restarts)
     volatile int             m_countRowBlocks;           // count of workers forced to abandon a row because of top dependency
+    int                      m_refRowBlocks;             // count of times the frame thread waited for a reference row
+    int                      m_refSpinLimit;             // adaptive spin budget before blocking on a reference row
+    int                      m_activeFrameThreads;       // count of active frame encoders when this frame was started
     int64_t                  m_startCompressTime;        // timestamp when frame encoder is given a frame
     int64_t                  m_row0WaitTime;             // timestamp when row 0 is allowed to start
     int64_t                  m_allRowsAvailableTime;     // timestamp when all reference dependencies are resolved
@@ -182,6 +187,7 @@ public:
     int64_t                  m_slicetypeWaitTime;        // total elapsed time waiting for decided frame
     int64_t                  m_totalWorkerElapsedTime;   // total elapsed time spent by worker threads processing CTUs
     int64_t                  m_totalNoWorkerTime;        // total elapsed time without any active worker threads
+    int64_t                  m_refRowBlockTime;          // total elapsed time waiting for reference rows
 #if DETAILED_CU_STATS
     CUStats                  m_cuStats;
 #endif
@@ -211,7 +217,7 @@ public:
 
         FrameEncoder& master;
 
-        WeightAnalysis(FrameEncoder& fe) : master(fe) {}
+        WeightAnalysis(FrameEncoder& fe) : BondedTaskGroup(WORKER_TASK_WEIGHT_ANALYSIS), master(fe) {}
 
         void processTasks(int workerThreadId);
 
@@ -231,6 +237,7 @@ protected:
     void encodeSlice(uint32_t sliceAddr);
 
     void threadMain();
+    void waitForReconRow(Frame* refPic, int row);
     int  collectCTUStatistics(const CUData& ctu, FrameStats* frameLog);
     void noiseReductionUpdate();
     void writeTrailingSEIMessages();
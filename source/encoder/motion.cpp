@@ -225,7 +225,7 @@ void MotionEstimate::setSourcePU(const Yuv& srcFencYuv, int _ctuAddr, int cuPart
     do \
     { \
         MV tmv(mx, my); \
-        int cost = sad(fenc, FENC_STRIDE, fref + mx + my * stride, stride); \
+        int cost = sadf(fenc, FENC_STRIDE, fref + mx + my * stride, stride); \
         cost += mvcost(tmv << 2); \
         if (cost < bcost) { \
             bcost = cost; \
@@ -238,18 +238,18 @@ void MotionEstimate::setSourcePU(const Yuv& srcFencYuv, int _ctuAddr, int cuPart
 #define COST_MV(mx, my) \
     do \
     { \
-        int cost = sad(fenc, FENC_STRIDE, fref + (mx) + (my) * stride, stride); \
+        int cost = sadf(fenc, FENC_STRIDE, fref + (mx) + (my) * stride, stride); \
         cost += mvcost(MV(mx, my) << 2); \
         COPY2_IF_LT(bcost, cost, bmv, MV(mx, my)); \
     } while (0)
 
 #define COST_MV_X3_DIR(m0x, m0y, m1x, m1y, m2x, m2y, costs) \
     { \
-        pixel *pix_base = fref + bmv.x + bmv.y * stride; \
-        sad_x3(fenc, \
-               pix_base + (m0x) + (m0y) * stride, \
-               pix_base + (m1x) + (m1y) * stride, \
-               pix_base + (m2x) + (m2y) * stride, \
+        intptr_t base = bmv.x + bmv.y * stride; \
+        sadf_x3(fenc, \
+               fref + base + (m0x) + (m0y) * stride, \
+               fref + base + (m1x) + (m1y) * stride, \
+               fref + base + (m2x) + (m2y) * stride, \
                stride, costs); \
         (costs)[0] += mvcost((bmv + MV(m0x, m0y)) << 2); \
         (costs)[1] += mvcost((bmv + MV(m1x, m1y)) << 2); \
@@ -258,7 +258,7 @@ void MotionEstimate::setSourcePU(const Yuv& srcFencYuv, int _ctuAddr, int cuPart
 
 #define COST_MV_PT_DIST_X4(m0x, m0y, p0, d0, m1x, m1y, p1, d1, m2x, m2y, p2, d2, m3x, m3y, p3, d3) \
     { \
-        sad_x4(fenc, \
+        sadf_x4(fenc, \
                fref + (m0x) + (m0y) * stride, \
                fref + (m1x) + (m1y) * stride, \
                fref + (m2x) + (m2y) * stride, \
@@ -276,12 +276,12 @@ void MotionEstimate::setSourcePU(const Yuv& srcFencYuv, int _ctuAddr, int cuPart
 
 #define COST_MV_X4(m0x, m0y, m1x, m1y, m2x, m2y, m3x, m3y) \
     { \
-        pixel *pix_base = fref + omv.x + omv.y * stride; \
-        sad_x4(fenc, \
-               pix_base + (m0x) + (m0y) * stride, \
-               pix_base + (m1x) + (m1y) * stride, \
-               pix_base + (m2x) + (m2y) * stride, \
-               pix_base + (m3x) + (m3y) * stride, \
+        intptr_t base = omv.x + omv.y * stride; \
+        sadf_x4(fenc, \
+               fref + base + (m0x) + (m0y) * stride, \
+               fref + base + (m1x) + (m1y) * stride, \
+               fref + base + (m2x) + (m2y) * stride, \
+               fref + base + (m3x) + (m3y) * stride, \
                stride, costs); \
         costs[0] += mvcost((omv + MV(m0x, m0y)) << 2); \
         costs[1] += mvcost((omv + MV(m1x, m1y)) << 2); \
@@ -299,7 +299,7 @@ void MotionEstimate::setSourcePU(const Yuv& srcFencYuv, int _ctuAddr, int cuPart
 
 #define COST_MV_X3_ABS( m0x, m0y, m1x, m1y, m2x, m2y )\
 {\
-    sad_x3(fenc, \
+    sadf_x3(fenc, \
     fref + (m0x) + (m0y) * stride, \
     fref + (m1x) + (m1y) * stride, \
     fref + (m2x) + (m2y) * stride, \
@@ -314,12 +314,12 @@ void MotionEstimate::setSourcePU(const Yuv& srcFencYuv, int _ctuAddr, int cuPart
 
 #define COST_MV_X4_DIR(m0x, m0y, m1x, m1y, m2x, m2y, m3x, m3y, costs) \
     { \
-        pixel *pix_base = fref + bmv.x + bmv.y * stride; \
-        sad_x4(fenc, \
-               pix_base + (m0x) + (m0y) * stride, \
-               pix_base + (m1x) + (m1y) * stride, \
-               pix_base + (m2x) + (m2y) * stride, \
-               pix_base + (m3x) + (m3y) * stride, \
+        intptr_t base = bmv.x + bmv.y * stride; \
+        sadf_x4(fenc, \
+               fref + base + (m0x) + (m0y) * stride, \
+               fref + base + (m1x) + (m1y) * stride, \
+               fref + base + (m2x) + (m2y) * stride, \
+               fref + base + (m3x) + (m3y) * stride, \
                stride, costs); \
         (costs)[0] += mvcost((bmv + MV(m0x, m0y)) << 2); \
         (costs)[1] += mvcost((bmv + MV(m1x, m1y)) << 2); \
@@ -359,7 +359,12 @@ void MotionEstimate::setSourcePU(const Yuv& srcFencYuv, int _ctuAddr, int cuPart
         } \
     }
 
-void MotionEstimate::StarPatternSearch(ReferencePlanes *ref,
+template<typename T>
+void MotionEstimate::StarPatternSearch(const T *        fenc,
+                                       const T *        fref,
+                                       intptr_t         stride,
+                                       typename LowresPrimitives<T>::cmp_t    sadf,
+                                       typename LowresPrimitives<T>::cmp_x4_t sadf_x4,
                                        const MV &       mvmin,
                                        const MV &       mvmax,
                                        MV &             bmv,
@@ -367,13 +372,9 @@ void MotionEstimate::StarPatternSearch(ReferencePlanes *ref,
                                        int &            bPointNr,
                                        int &            bDistance,
                                        int              earlyExitIters,
-                                       int              merange,
-                                       int              hme)
+                                       int              merange)
 {
     ALIGN_VAR_16(int, costs[16]);
-    pixel* fenc = fencPUYuv.m_buf[0];
-    pixel* fref = (hme? ref->fpelLowerResPlane[0] : ref->fpelPlane[0]) + blockOffset;
-    intptr_t stride = hme? ref->lumaStride / 2 : ref->lumaStride;
 
     MV omv = bmv;
     int saved = bcost;
@@ -615,6 +616,7 @@ void MotionEstimate::refineMV(ReferencePlanes* ref,
     intptr_t stride = ref->lumaStride;
     pixel* fenc = fencPUYuv.m_buf[0];
     pixel* fref = ref->fpelPlane[0] + blockOffset;
+    pixelcmp_x4_t sadf_x4 = sad_x4;
     
     setMVP(qmvp);
     
@@ -747,13 +749,262 @@ int MotionEstimate::motionEstimate(ReferencePlanes *ref,
                                    uint32_t         maxSlices,
                                    pixel *          srcReferencePlane)
 {
-    ALIGN_VAR_16(int, costs[16]);
     bool hme = srcReferencePlane && srcReferencePlane == ref->fpelLowerResPlane[0];
+    pixel* refPlane = srcReferencePlane == 0 ? ref->fpelPlane[0] : srcReferencePlane;
+    return motionSearch(ref, mvmin, mvmax, qmvp, numCandidates, mvc, merange, outQMv, maxSlices, refPlane, hme);
+}
+
+void MotionEstimate::searchPrimitives(const pixel*& fenc, pixelcmp_t& sadf, pixelcmp_x3_t& sadf_x3, pixelcmp_x4_t& sadf_x4, pixelcmp_t& satdf)
+{
+    fenc = fencPUYuv.m_buf[0];
+    sadf = sad;
+    sadf_x3 = sad_x3;
+    sadf_x4 = sad_x4;
+    satdf = satd;
+}
+
+int MotionEstimate::subpelCost(ReferencePlanes *ref, const MV& qmv, pixelcmp_t cmp, bool)
+{
+    return subpelCompare(ref, qmv, cmp);
+}
+
+/* Successive Elimination Algorithm, on the integral planes of a full-res reference */
+void MotionEstimate::successiveElimination(const pixel* fenc, const pixel* fref, intptr_t stride, const MV& omv, const MV& mvmin, const MV& mvmax,
+                                           const MV& qmvp, int merange, MV& bmv, int& bcost)
+{
+    ALIGN_VAR_16(int, costs[16]);
+    pixelcmp_t sadf = sad;
+    pixelcmp_x3_t sadf_x3 = sad_x3;
+    const int32_t minX = X265_MAX(omv.x - (int32_t)merange, mvmin.x);
+    const int32_t minY = X265_MAX(omv.y - (int32_t)merange, mvmin.y);
+    const int32_t maxX = X265_MIN(omv.x + (int32_t)merange, mvmax.x);
+    const int32_t maxY = X265_MIN(omv.y + (int32_t)merange, mvmax.y);
+    const uint16_t *p_cost_mvx = m_cost_mvx - qmvp.x;
+    const uint16_t *p_cost_mvy = m_cost_mvy - qmvp.y;
+    int16_t* meScratchBuffer = NULL;
+    int scratchSize = merange * 2 + 4;
+    if (scratchSize)
+    {
+        meScratchBuffer = X265_MALLOC(int16_t, scratchSize);
+        memset(meScratchBuffer, 0, sizeof(int16_t)* scratchSize);
+    }
+
+    /* SEA is fastest in multiples of 4 */
+    int meRangeWidth = (maxX - minX + 3) & ~3;
+    int w = 0, h = 0;                    // Width and height of the PU
+    ALIGN_VAR_32(pixel, zero[64 * FENC_STRIDE]) = { 0 };
+    ALIGN_VAR_32(int, encDC[4]);
+    uint16_t *fpelCostMvX = m_fpelMvCosts[-qmvp.x & 3] + (-qmvp.x >> 2);
+    sizesFromPartition(partEnum, &w, &h);
+    int deltaX = (w <= 8) ? (w) : (w >> 1);
+    int deltaY = (h <= 8) ? (h) : (h >> 1);
+
+    /* Check if very small rectangular blocks which cannot be sub-divided anymore */
+    bool smallRectPartition = partEnum == LUMA_4x4 || partEnum == LUMA_16x12 ||
+        partEnum == LUMA_12x16 || partEnum == LUMA_16x4 || partEnum == LUMA_4x16;
+    /* Check if vertical partition */
+    bool verticalRect = partEnum == LUMA_32x64 || partEnum == LUMA_16x32 || partEnum == LUMA_8x16 ||
+        partEnum == LUMA_4x8;
+    /* Check if horizontal partition */
+    bool horizontalRect = partEnum == LUMA_64x32 || partEnum == LUMA_32x16 || partEnum == LUMA_16x8 ||
+        partEnum == LUMA_8x4;
+    /* Check if assymetric vertical partition */
+    bool assymetricVertical = partEnum == LUMA_12x16 || partEnum == LUMA_4x16 || partEnum == LUMA_24x32 ||
+        partEnum == LUMA_8x32 || partEnum == LUMA_48x64 || partEnum == LUMA_16x64;
+    /* Check if assymetric horizontal partition */
+    bool assymetricHorizontal = partEnum == LUMA_16x12 || partEnum == LUMA_16x4 || partEnum == LUMA_32x24 ||
+        partEnum == LUMA_32x8 || partEnum == LUMA_64x48 || partEnum == LUMA_64x16;
+
+    int tempPartEnum = 0;
+
+    /* If a vertical rectangular partition, it is horizontally split into two, for ads_x2() */
+    if (verticalRect)
+        tempPartEnum = partitionFromSizes(w, h >> 1);
+    /* If a horizontal rectangular partition, it is vertically split into two, for ads_x2() */
+    else if (horizontalRect)
+        tempPartEnum = partitionFromSizes(w >> 1, h);
+    /* We have integral planes introduced to account for assymetric partitions.
+     * Hence all assymetric partitions except those which cannot be split into legal sizes,
+     * are split into four for ads_x4() */
+    else if (assymetricVertical || assymetricHorizontal)
+        tempPartEnum = smallRectPartition ? partEnum : partitionFromSizes(w >> 1, h >> 1);
+    /* General case: Square partitions. All partitions with width > 8 are split into four
+     * for ads_x4(), for 4x4 and 8x8 we do ads_x1() */
+    else
+        tempPartEnum = (w <= 8) ? partEnum : partitionFromSizes(w >> 1, h >> 1);
+
+    /* Successive elimination by comparing DC before a full SAD,
+     * because sum(abs(diff)) >= abs(diff(sum)). */
+    primitives.pu[tempPartEnum].sad_x4(zero,
+                     fenc,
+                     fenc + deltaX,
+                     fenc + deltaY * FENC_STRIDE,
+                     fenc + deltaX + deltaY * FENC_STRIDE,
+                     FENC_STRIDE,
+                     encDC);
+
+    /* Assigning appropriate integral plane */
+    uint32_t *sumsBase = NULL;
+    switch (deltaX)
+    {
+        case 32: if (deltaY % 24 == 0)
+                     sumsBase = integral[1];
+                 else if (deltaY == 8)
+                     sumsBase = integral[2];
+                 else
+                     sumsBase = integral[0];
+           break;
+        case 24: sumsBase = integral[3];
+           break;
+        case 16: if (deltaY % 12 == 0)
+                     sumsBase = integral[5];
+                 else if (deltaY == 4)
+                     sumsBase = integral[6];
+                 else
+                     sumsBase = integral[4];
+           break;
+        case 12: sumsBase = integral[7];
+            break;
+        case 8: if (deltaY == 32)
+                    sumsBase = integral[8];
+                else
+                    sumsBase = integral[9];
+            break;
+        case 4: if (deltaY == 16)
+                    sumsBase = integral[10];
+                else
+                    sumsBase = integral[11];
+            break;
+        default: sumsBase = integral[11];
+            break;
+    }
+
+    if (partEnum == LUMA_64x64 || partEnum == LUMA_32x32 || partEnum == LUMA_16x16 ||
+        partEnum == LUMA_32x64 || partEnum == LUMA_16x32 || partEnum == LUMA_8x16 ||
+        partEnum == LUMA_4x8 || partEnum == LUMA_12x16 || partEnum == LUMA_4x16 ||
+        partEnum == LUMA_24x32 || partEnum == LUMA_8x32 || partEnum == LUMA_48x64 ||
+        partEnum == LUMA_16x64)
+        deltaY *= (int)stride;
+
+    if (verticalRect)
+        encDC[1] = encDC[2];
+
+    if (horizontalRect)
+        deltaY = deltaX;
+
+    /* ADS and SAD */
+    MV tmv;
+    for (tmv.y = minY; tmv.y <= maxY; tmv.y++)
+    {
+        int i, xn;
+        int ycost = p_cost_mvy[tmv.y] << 2;
+        if (bcost <= ycost)
+            continue;
+        bcost -= ycost;
+
+        /* ADS_4 for 16x16, 32x32, 64x64, 24x32, 32x24, 48x64, 64x48, 32x8, 8x32, 64x16, 16x64 partitions
+         * ADS_1 for 4x4, 8x8, 16x4, 4x16, 16x12, 12x16 partitions
+         * ADS_2 for all other rectangular partitions */
+        xn = ads(encDC,
+                sumsBase + minX + tmv.y * stride,
+                deltaY,
+                fpelCostMvX + minX,
+                meScratchBuffer,
+                meRangeWidth,
+                bcost);
+
+        for (i = 0; i < xn - 2; i += 3)
+            COST_MV_X3_ABS(minX + meScratchBuffer[i], tmv.y,
+                         minX + meScratchBuffer[i + 1], tmv.y,
+                         minX + meScratchBuffer[i + 2], tmv.y);
+
+        bcost += ycost;
+        for (; i < xn; i++)
+            COST_MV(minX + meScratchBuffer[i], tmv.y);
+    }
+    if (meScratchBuffer)
+        x265_free(meScratchBuffer);
+}
+
+#if HIGH_BIT_DEPTH
+/* Called by lookahead for the 8-bit lowres planes of --lowres-8bit */
+void MotionEstimate::setSourcePU(uint8_t *fencY, intptr_t stride, intptr_t offset, int pwidth, int pheight, const int method, const int searchL0, const int searchL1, const int refine)
+{
+    X265_CHECK(pwidth == 8 && pheight == 8, "8-bit lowres blocks are 8x8\n");
+    (void)pheight;
+    partEnum = LUMA_8x8;
+
+    blockwidth = pwidth;
+    blockOffset = offset;
+    absPartIdx = ctuAddr = -1;
+
+    /* Search params */
+    searchMethod = method;
+    searchMethodL0 = searchL0;
+    searchMethodL1 = searchL1;
+    subpelRefine = refine;
+
+    /* copy PU block into cache */
+    lowresPrimitives8.copy_pp(fenc8, FENC_STRIDE, fencY + offset, stride);
+    X265_CHECK(!bChromaSATD, "chroma distortion measurements impossible in this code path\n");
+}
+
+int MotionEstimate::motionEstimate(ReferencePlanes *ref,
+                                   const MV &       mvmin,
+                                   const MV &       mvmax,
+                                   const MV &       qmvp,
+                                   int              numCandidates,
+                                   const MV *       mvc,
+                                   int              merange,
+                                   MV &             outQMv,
+                                   uint32_t         maxSlices,
+                                   uint8_t *        srcReferencePlane)
+{
+    bool hme = srcReferencePlane == ref->lowerResPlane8[0];
+    return motionSearch(ref, mvmin, mvmax, qmvp, numCandidates, mvc, merange, outQMv, maxSlices, srcReferencePlane, hme);
+}
+
+void MotionEstimate::searchPrimitives(const uint8_t*& fenc, LowresPrims8::cmp_t& sadf, LowresPrims8::cmp_x3_t& sadf_x3, LowresPrims8::cmp_x4_t& sadf_x4, LowresPrims8::cmp_t& satdf)
+{
+    fenc = fenc8;
+    sadf = lowresPrimitives8.sad;
+    sadf_x3 = lowresPrimitives8.sad_x3;
+    sadf_x4 = lowresPrimitives8.sad_x4;
+    satdf = lowresPrimitives8.satd;
+}
+
+/* the 8-bit planes are lowres only, there is no interpolated full-res subpel */
+int MotionEstimate::subpelCost(ReferencePlanes *ref, const MV& qmv, LowresPrims8::cmp_t cmp, bool hme)
+{
+    return ref->lowresQPelCost(fenc8, blockOffset, qmv, cmp, hme);
+}
+#endif
+
+template<typename T>
+int MotionEstimate::motionSearch(ReferencePlanes *ref,
+                                 const MV &       mvmin,
+                                 const MV &       mvmax,
+                                 const MV &       qmvp,
+                                 int              numCandidates,
+                                 const MV *       mvc,
+                                 int              merange,
+                                 MV &             outQMv,
+                                 uint32_t         maxSlices,
+                                 T *              refPlane,
+                                 bool             hme)
+{
+    ALIGN_VAR_16(int, costs[16]);
     if (ctuAddr >= 0)
         blockOffset = ref->reconPic->getLumaAddr(ctuAddr, absPartIdx) - ref->reconPic->getLumaAddr(0);
     intptr_t stride = hme ? ref->lumaStride / 2 : ref->lumaStride;
-    pixel* fenc = fencPUYuv.m_buf[0];
-    pixel* fref = srcReferencePlane == 0 ? ref->fpelPlane[0] + blockOffset : srcReferencePlane + blockOffset;
+    T* fref = refPlane + blockOffset;
+
+    /* search primitives of the sample type of the reference planes */
+    const T* fenc;
+    typename LowresPrimitives<T>::cmp_t    sadf, satdf;
+    typename LowresPrimitives<T>::cmp_x3_t sadf_x3;
+    typename LowresPrimitives<T>::cmp_x4_t sadf_x4;
+    searchPrimitives(fenc, sadf, sadf_x3, sadf_x4, satdf);
 
     setMVP(qmvp);
 
@@ -773,20 +1024,20 @@ int MotionEstimate::motionEstimate(ReferencePlanes *ref,
     int bprecost;
 
     if (ref->isLowres)
-        bprecost = ref->lowresQPelCost(fenc, blockOffset, pmv, sad, hme);
+        bprecost = ref->lowresQPelCost(fenc, blockOffset, pmv, sadf, hme);
     else
-        bprecost = subpelCompare(ref, pmv, sad);
+        bprecost = subpelCost(ref, pmv, sadf, hme);
 
     /* re-measure full pel rounded MVP with SAD as search start point */
     MV bmv = pmv.roundToFPel();
     int bcost = bprecost;
     if (pmv.isSubpel())
-        bcost = sad(fenc, FENC_STRIDE, fref + bmv.x + bmv.y * stride, stride) + mvcost(bmv << 2);
+        bcost = sadf(fenc, FENC_STRIDE, fref + bmv.x + bmv.y * stride, stride) + mvcost(bmv << 2);
 
     // measure SAD cost at MV(0) if MVP is not zero
     if (pmv.notZero())
     {
-        int cost = sad(fenc, FENC_STRIDE, fref, stride) + mvcost(MV(0, 0));
+        int cost = sadf(fenc, FENC_STRIDE, fref, stride) + mvcost(MV(0, 0));
         if (cost < bcost)
         {
             bcost = cost;
@@ -802,7 +1053,7 @@ int MotionEstimate::motionEstimate(ReferencePlanes *ref,
         MV m = mvc[i].clipped(qmvmin, qmvmax);
         if (m.notZero() & (m != pmv ? 1 : 0) & (m != bestpre ? 1 : 0)) // check already measured
         {
-            int cost = subpelCompare(ref, m, sad) + mvcost(m);
+            int cost = subpelCost(ref, m, sadf, hme) + mvcost(m);
             if (cost < bprecost)
             {
                 bprecost = cost;
@@ -1064,10 +1315,10 @@ me_hex2:
             else
             {
                 int16_t dir = 0;
-                pixel *fref_base = fref + omv.x + (omv.y - 4 * i) * stride;
+                T *fref_base = fref + omv.x + (omv.y - 4 * i) * stride;
                 size_t dy = (size_t)i * stride;
 #define SADS(k, x0, y0, x1, y1, x2, y2, x3, y3) \
-    sad_x4(fenc, \
+    sadf_x4(fenc, \
            fref_base x0 * i + (y0 - 2 * k + 4) * dy, \
            fref_base x1 * i + (y1 - 2 * k + 4) * dy, \
            fref_base x2 * i + (y2 - 2 * k + 4) * dy, \
@@ -1135,7 +1386,7 @@ me_hex2:
         int bDistance = 0;
 
         const int EarlyExitIters = 3;
-        StarPatternSearch(ref, mvmin, mvmax, bmv, bcost, bPointNr, bDistance, EarlyExitIters, merange, hme);
+        StarPatternSearch(fenc, fref, stride, sadf, sadf_x4, mvmin, mvmax, bmv, bcost, bPointNr, bDistance, EarlyExitIters, merange);
         if (bDistance == 1)
         {
             // if best distance was only 1, check two missing points.  If no new point is found, stop
@@ -1177,8 +1428,8 @@ me_hex2:
                 {
                     if (tmv.x + (RasterDistance * 3) <= mvmax.x)
                     {
-                        pixel *pix_base = fref + tmv.y * stride + tmv.x;
-                        sad_x4(fenc,
+                        T *pix_base = fref + tmv.y * stride + tmv.x;
+                        sadf_x4(fenc,
                                pix_base,
                                pix_base + RasterDistance,
                                pix_base + RasterDistance * 2,
@@ -1208,7 +1459,7 @@ me_hex2:
             bDistance = 0;
             bPointNr = 0;
             const int MaxIters = 32;
-            StarPatternSearch(ref, mvmin, mvmax, bmv, bcost, bPointNr, bDistance, MaxIters, merange, hme);
+            StarPatternSearch(fenc, fref, stride, sadf, sadf_x4, mvmin, mvmax, bmv, bcost, bPointNr, bDistance, MaxIters, merange);
 
             if (bDistance == 1)
             {
@@ -1241,156 +1492,7 @@ me_hex2:
 
     case X265_SEA:
     {
-        // Successive Elimination Algorithm
-        const int32_t minX = X265_MAX(omv.x - (int32_t)merange, mvmin.x);
-        const int32_t minY = X265_MAX(omv.y - (int32_t)merange, mvmin.y);
-        const int32_t maxX = X265_MIN(omv.x + (int32_t)merange, mvmax.x);
-        const int32_t maxY = X265_MIN(omv.y + (int32_t)merange, mvmax.y);
-        const uint16_t *p_cost_mvx = m_cost_mvx - qmvp.x;
-        const uint16_t *p_cost_mvy = m_cost_mvy - qmvp.y;
-        int16_t* meScratchBuffer = NULL;
-        int scratchSize = merange * 2 + 4;
-        if (scratchSize)
-        {
-            meScratchBuffer = X265_MALLOC(int16_t, scratchSize);
-            memset(meScratchBuffer, 0, sizeof(int16_t)* scratchSize);
-        }
-
-        /* SEA is fastest in multiples of 4 */
-        int meRangeWidth = (maxX - minX + 3) & ~3;
-        int w = 0, h = 0;                    // Width and height of the PU
-        ALIGN_VAR_32(pixel, zero[64 * FENC_STRIDE]) = { 0 };
-        ALIGN_VAR_32(int, encDC[4]);
-        uint16_t *fpelCostMvX = m_fpelMvCosts[-qmvp.x & 3] + (-qmvp.x >> 2);
-        sizesFromPartition(partEnum, &w, &h);
-        int deltaX = (w <= 8) ? (w) : (w >> 1);
-        int deltaY = (h <= 8) ? (h) : (h >> 1);
-
-        /* Check if very small rectangular blocks which cannot be sub-divided anymore */
-        bool smallRectPartition = partEnum == LUMA_4x4 || partEnum == LUMA_16x12 ||
-            partEnum == LUMA_12x16 || partEnum == LUMA_16x4 || partEnum == LUMA_4x16;
-        /* Check if vertical partition */
-        bool verticalRect = partEnum == LUMA_32x64 || partEnum == LUMA_16x32 || partEnum == LUMA_8x16 ||
-            partEnum == LUMA_4x8;
-        /* Check if horizontal partition */
-        bool horizontalRect = partEnum == LUMA_64x32 || partEnum == LUMA_32x16 || partEnum == LUMA_16x8 ||
-            partEnum == LUMA_8x4;
-        /* Check if assymetric vertical partition */
-        bool assymetricVertical = partEnum == LUMA_12x16 || partEnum == LUMA_4x16 || partEnum == LUMA_24x32 ||
-            partEnum == LUMA_8x32 || partEnum == LUMA_48x64 || partEnum == LUMA_16x64;
-        /* Check if assymetric horizontal partition */
-        bool assymetricHorizontal = partEnum == LUMA_16x12 || partEnum == LUMA_16x4 || partEnum == LUMA_32x24 ||
-            partEnum == LUMA_32x8 || partEnum == LUMA_64x48 || partEnum == LUMA_64x16;
-
-        int tempPartEnum = 0;
-
-        /* If a vertical rectangular partition, it is horizontally split into two, for ads_x2() */
-        if (verticalRect)
-            tempPartEnum = partitionFromSizes(w, h >> 1);
-        /* If a horizontal rectangular partition, it is vertically split into two, for ads_x2() */
-        else if (horizontalRect)
-            tempPartEnum = partitionFromSizes(w >> 1, h);
-        /* We have integral planes introduced to account for assymetric partitions.
-         * Hence all assymetric partitions except those which cannot be split into legal sizes,
-         * are split into four for ads_x4() */
-        else if (assymetricVertical || assymetricHorizontal)
-            tempPartEnum = smallRectPartition ? partEnum : partitionFromSizes(w >> 1, h >> 1);
-        /* General case: Square partitions. All partitions with width > 8 are split into four
-         * for ads_x4(), for 4x4 and 8x8 we do ads_x1() */
-        else
-            tempPartEnum = (w <= 8) ? partEnum : partitionFromSizes(w >> 1, h >> 1);
-
-        /* Successive elimination by comparing DC before a full SAD,
-         * because sum(abs(diff)) >= abs(diff(sum)). */
-        primitives.pu[tempPartEnum].sad_x4(zero,
-                         fenc,
-                         fenc + deltaX,
-                         fenc + deltaY * FENC_STRIDE,
-                         fenc + deltaX + deltaY * FENC_STRIDE,
-                         FENC_STRIDE,
-                         encDC);
-
-        /* Assigning appropriate integral plane */
-        uint32_t *sumsBase = NULL;
-        switch (deltaX)
-        {
-            case 32: if (deltaY % 24 == 0)
-                         sumsBase = integral[1];
-                     else if (deltaY == 8)
-                         sumsBase = integral[2];
-                     else
-                         sumsBase = integral[0];
-               break;
-            case 24: sumsBase = integral[3];
-               break;
-            case 16: if (deltaY % 12 == 0)
-                         sumsBase = integral[5];
-                     else if (deltaY == 4)
-                         sumsBase = integral[6];
-                     else
-                         sumsBase = integral[4];
-               break;
-            case 12: sumsBase = integral[7];
-                break;
-            case 8: if (deltaY == 32)
-                        sumsBase = integral[8];
-                    else
-                        sumsBase = integral[9];
-                break;
-            case 4: if (deltaY == 16)
-                        sumsBase = integral[10];
-                    else
-                        sumsBase = integral[11];
-                break;
-            default: sumsBase = integral[11];
-                break;
-        }
-
-        if (partEnum == LUMA_64x64 || partEnum == LUMA_32x32 || partEnum == LUMA_16x16 ||
-            partEnum == LUMA_32x64 || partEnum == LUMA_16x32 || partEnum == LUMA_8x16 ||
-            partEnum == LUMA_4x8 || partEnum == LUMA_12x16 || partEnum == LUMA_4x16 ||
-            partEnum == LUMA_24x32 || partEnum == LUMA_8x32 || partEnum == LUMA_48x64 ||
-            partEnum == LUMA_16x64)
-            deltaY *= (int)stride;
-
-        if (verticalRect)
-            encDC[1] = encDC[2];
-
-        if (horizontalRect)
-            deltaY = deltaX;
-
-        /* ADS and SAD */
-        MV tmv;
-        for (tmv.y = minY; tmv.y <= maxY; tmv.y++)
-        {
-            int i, xn;
-            int ycost = p_cost_mvy[tmv.y] << 2;
-            if (bcost <= ycost)
-                continue;
-            bcost -= ycost;
-
-            /* ADS_4 for 16x16, 32x32, 64x64, 24x32, 32x24, 48x64, 64x48, 32x8, 8x32, 64x16, 16x64 partitions
-             * ADS_1 for 4x4, 8x8, 16x4, 4x16, 16x12, 12x16 partitions
-             * ADS_2 for all other rectangular partitions */
-            xn = ads(encDC,
-                    sumsBase + minX + tmv.y * stride,
-                    deltaY,
-                    fpelCostMvX + minX,
-                    meScratchBuffer,
-                    meRangeWidth,
-                    bcost);
-
-            for (i = 0; i < xn - 2; i += 3)
-                COST_MV_X3_ABS(minX + meScratchBuffer[i], tmv.y,
-                             minX + meScratchBuffer[i + 1], tmv.y,
-                             minX + meScratchBuffer[i + 2], tmv.y);
-
-            bcost += ycost;
-            for (; i < xn; i++)
-                COST_MV(minX + meScratchBuffer[i], tmv.y);
-        }
-        if (meScratchBuffer)
-            x265_free(meScratchBuffer);
+        successiveElimination(fenc, fref, stride, omv, mvmin, mvmax, qmvp, merange, bmv, bcost);
         break;
     }
 
@@ -1413,8 +1515,8 @@ me_hex2:
             {
                 if (tmv.x + 3 <= mvmax_x)
                 {
-                    pixel *pix_base = fref + tmv.y * stride + tmv.x;
-                    sad_x4(fenc,
+                    T *pix_base = fref + tmv.y * stride + tmv.x;
+                    sadf_x4(fenc,
                            pix_base,
                            pix_base + 1,
                            pix_base + 2,
@@ -1459,7 +1561,7 @@ me_hex2:
     if ((maxSlices > 1) & ((bmv.y < qmvmin.y) | (bmv.y > qmvmax.y)))
     {
         bmv.y = x265_min(x265_max(bmv.y, qmvmin.y), qmvmax.y);
-        bcost = subpelCompare(ref, bmv, satd) + mvcost(bmv);
+        bcost = subpelCost(ref, bmv, satdf, hme) + mvcost(bmv);
     }
 
     if (!bcost)
@@ -1479,12 +1581,12 @@ me_hex2:
             if ((qmv.y < qmvmin.y) | (qmv.y > qmvmax.y))
                 continue;
 
-            int cost = ref->lowresQPelCost(fenc, blockOffset, qmv, sad, hme) + mvcost(qmv);
+            int cost = ref->lowresQPelCost(fenc, blockOffset, qmv, sadf, hme) + mvcost(qmv);
             COPY2_IF_LT(bcost, cost, bdir, i);
         }
 
         bmv += square1[bdir] * 2;
-        bcost = ref->lowresQPelCost(fenc, blockOffset, bmv, satd, hme) + mvcost(bmv);
+        bcost = ref->lowresQPelCost(fenc, blockOffset, bmv, satdf, hme) + mvcost(bmv);
 
         bdir = 0;
         for (int i = 1; i <= wl.qpel_dirs; i++)
@@ -1495,7 +1597,7 @@ me_hex2:
             if ((qmv.y < qmvmin.y) | (qmv.y > qmvmax.y))
                 continue;
 
-            int cost = ref->lowresQPelCost(fenc, blockOffset, qmv, satd, hme) + mvcost(qmv);
+            int cost = ref->lowresQPelCost(fenc, blockOffset, qmv, satdf, hme) + mvcost(qmv);
             COPY2_IF_LT(bcost, cost, bdir, i);
         }
 
@@ -1503,15 +1605,15 @@ me_hex2:
     }
     else
     {
-        pixelcmp_t hpelcomp;
+        typename LowresPrimitives<T>::cmp_t hpelcomp;
 
         if (wl.hpel_satd)
         {
-            bcost = subpelCompare(ref, bmv, satd) + mvcost(bmv);
-            hpelcomp = satd;
+            bcost = subpelCost(ref, bmv, satdf, hme) + mvcost(bmv);
+            hpelcomp = satdf;
         }
         else
-            hpelcomp = sad;
+            hpelcomp = sadf;
 
         for (int iter = 0; iter < wl.hpel_iters; iter++)
         {
@@ -1524,7 +1626,7 @@ me_hex2:
                 if ((qmv.y < qmvmin.y) | (qmv.y > qmvmax.y))
                     continue;
 
-                int cost = subpelCompare(ref, qmv, hpelcomp) + mvcost(qmv);
+                int cost = subpelCost(ref, qmv, hpelcomp, hme) + mvcost(qmv);
                 COPY2_IF_LT(bcost, cost, bdir, i);
             }
 
@@ -1536,7 +1638,7 @@ me_hex2:
 
         /* if HPEL search used SAD, remeasure with SATD before QPEL */
         if (!wl.hpel_satd)
-            bcost = subpelCompare(ref, bmv, satd) + mvcost(bmv);
+            bcost = subpelCost(ref, bmv, satdf, hme) + mvcost(bmv);
 
         for (int iter = 0; iter < wl.qpel_iters; iter++)
         {
@@ -1549,7 +1651,7 @@ me_hex2:
                 if ((qmv.y < qmvmin.y) | (qmv.y > qmvmax.y))
                     continue;
 
-                int cost = subpelCompare(ref, qmv, satd) + mvcost(qmv);
+                int cost = subpelCost(ref, qmv, satdf, hme) + mvcost(qmv);
                 COPY2_IF_LT(bcost, cost, bdir, i);
             }
 
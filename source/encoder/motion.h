@@ -58,6 +58,10 @@ protected:
     pixelcmp_t satd;
     pixelcmp_t chromaSatd;
 
+#if HIGH_BIT_DEPTH
+    uint8_t fenc8[8 * FENC_STRIDE]; // 8x8 lowres block of --lowres-8bit
+#endif
+
     MotionEstimate& operator =(const MotionEstimate&);
 
 public:
@@ -79,6 +83,9 @@ public:
     /* Methods called at slice setup */
 
     void setSourcePU(pixel *fencY, intptr_t stride, intptr_t offset, int pwidth, int pheight, const int searchMethod, const int searchL0, const int searchL1, const int subpelRefine);
+#if HIGH_BIT_DEPTH
+    void setSourcePU(uint8_t *fencY, intptr_t stride, intptr_t offset, int pwidth, int pheight, const int searchMethod, const int searchL0, const int searchL1, const int subpelRefine);
+#endif
     void setSourcePU(const Yuv& srcFencYuv, int ctuAddr, int cuPartIdx, int puPartIdx, int pwidth, int pheight, const int searchMethod, const int subpelRefine, bool bChroma);
 
     /* buf*() and motionEstimate() methods all use cached fenc pixels and thus
@@ -87,6 +94,9 @@ public:
     inline int bufSAD(const pixel* fref, intptr_t stride)  { return sad(fencPUYuv.m_buf[0], FENC_STRIDE, fref, stride); }
 
     inline int bufSATD(const pixel* fref, intptr_t stride) { return satd(fencPUYuv.m_buf[0], FENC_STRIDE, fref, stride); }
+#if HIGH_BIT_DEPTH
+    inline int bufSATD(const uint8_t* fref, intptr_t stride) { return lowresPrimitives8.satd(fenc8, FENC_STRIDE, fref, stride); }
+#endif
 
     inline int bufChromaSATD(const Yuv& refYuv, int puPartIdx)
     {
@@ -96,21 +106,46 @@ public:
 
     void refineMV(ReferencePlanes* ref, const MV& mvmin, const MV& mvmax, const MV& qmvp, MV& outQMv);
     int motionEstimate(ReferencePlanes* ref, const MV & mvmin, const MV & mvmax, const MV & qmvp, int numCandidates, const MV * mvc, int merange, MV & outQMv, uint32_t maxSlices, pixel *srcReferencePlane = 0);
+#if HIGH_BIT_DEPTH
+    int motionEstimate(ReferencePlanes* ref, const MV & mvmin, const MV & mvmax, const MV & qmvp, int numCandidates, const MV * mvc, int merange, MV & outQMv, uint32_t maxSlices, uint8_t *srcReferencePlane);
+#endif
 
     int subpelCompare(ReferencePlanes* ref, const MV &qmv, pixelcmp_t);
 
 protected:
 
-    inline void StarPatternSearch(ReferencePlanes *ref,
-                                  const MV &       mvmin,
-                                  const MV &       mvmax,
-                                  MV &             bmv,
-                                  int &            bcost,
-                                  int &            bPointNr,
-                                  int &            bDistance,
-                                  int              earlyExitIters,
-                                  int              merange,
-                                  int              hme);
+    /* the search of motionEstimate() on reference planes of sample type T,
+     * pixel or the uint8_t lowres planes of --lowres-8bit */
+    template<typename T>
+    int motionSearch(ReferencePlanes* ref, const MV & mvmin, const MV & mvmax, const MV & qmvp, int numCandidates, const MV * mvc, int merange, MV & outQMv, uint32_t maxSlices, T *refPlane, bool hme);
+
+    /* fenc block and full-pel cost primitives of each sample type */
+    void searchPrimitives(const pixel*& fenc, pixelcmp_t& sad, pixelcmp_x3_t& sad_x3, pixelcmp_x4_t& sad_x4, pixelcmp_t& satd);
+    int  subpelCost(ReferencePlanes* ref, const MV& qmv, pixelcmp_t cmp, bool hme);
+    void successiveElimination(const pixel* fenc, const pixel* fref, intptr_t stride, const MV& omv, const MV& mvmin, const MV& mvmax,
+                               const MV& qmvp, int merange, MV& bmv, int& bcost);
+#if HIGH_BIT_DEPTH
+    typedef LowresPrimitives<uint8_t> LowresPrims8;
+    void searchPrimitives(const uint8_t*& fenc, LowresPrims8::cmp_t& sad, LowresPrims8::cmp_x3_t& sad_x3, LowresPrims8::cmp_x4_t& sad_x4, LowresPrims8::cmp_t& satd);
+    int  subpelCost(ReferencePlanes* ref, const MV& qmv, LowresPrims8::cmp_t cmp, bool hme);
+    /* SEA needs the integral planes of a full-res reference, lowres keeps its search start */
+    void successiveElimination(const uint8_t*, const uint8_t*, intptr_t, const MV&, const MV&, const MV&, const MV&, int, MV&, int&) {}
+#endif
+
+    template<typename T>
+    void StarPatternSearch(const T *        fenc,
+                           const T *        fref,
+                           intptr_t         stride,
+                           typename LowresPrimitives<T>::cmp_t    sad,
+                           typename LowresPrimitives<T>::cmp_x4_t sad_x4,
+                           const MV &       mvmin,
+                           const MV &       mvmax,
+                           MV &             bmv,
+                           int &            bcost,
+                           int &            bPointNr,
+                           int &            bDistance,
+                           int              earlyExitIters,
+                           int              merange);
 };
 }
 
@@ -133,6 +133,48 @@ inline void copyRceData(RateControlEntry* rce, RateControlEntry* rce2Pass)
     rce->qRceq = rce2Pass->qRceq;
 }
 
+/* the record at offset of a mapped binary stats file, NULL if it is damaged */
+const StatsFrameRecord* statsRecord(const uint8_t* map, size_t size, uint64_t offset)
+{
+    if (offset % sizeof(uint64_t) || offset > size || size - offset < sizeof(StatsFrameRecord))
+        return NULL;
+    const StatsFrameRecord* rec = (const StatsFrameRecord*)(map + offset);
+    if ((size - offset - sizeof(StatsFrameRecord)) / sizeof(uint16_t) < rec->numQpOffsets)
+        return NULL;
+    return rec;
+}
+
+/* the first pass stats of one chunk of a title, for x265_stats_merge() */
+struct StatsChunk
+{
+    uint8_t* map;
+    size_t   size;
+    int      warmup;   /* frames encoded before the chunk, to be discarded */
+    int      start;    /* title position of the first frame of the chunk */
+};
+
+/* check the header of a mapped binary stats file, whose magic matched */
+bool checkStatsHeader(x265_param* param, const uint8_t* map, size_t size)
+{
+    const StatsFileHeader* header = (const StatsFileHeader*)map;
+    if (header->version != X265_STATS_VERSION || header->headerSize != sizeof(StatsFileHeader))
+    {
+        x265_log(param, X265_LOG_ERROR, "unsupported stats file version %u\n", header->version);
+        return false;
+    }
+    uint64_t optionsEnd = (uint64_t)header->headerSize + header->optionsSize;
+    if (!header->optionsSize || optionsEnd > size || map[optionsEnd - 1] ||
+        header->indexOffset % sizeof(uint64_t) || header->indexOffset < optionsEnd ||
+        header->indexOffset > size || (size - header->indexOffset) / sizeof(uint64_t) < header->numFrames ||
+        (header->planOffset && (header->planOffset % sizeof(uint64_t) || header->planOffset < header->indexOffset ||
+         header->planOffset > size || (size - header->planOffset) / sizeof(StatsPlanEntry) < header->numFrames)))
+    {
+        x265_log(param, X265_LOG_ERROR, "Malformed stats file\n");
+        return false;
+    }
+    return true;
+}
+
 }  // end anonymous namespace
 /* Returns the zone for the current frame */
 x265_zone* RateControl::getZone()
@@ -153,6 +195,7 @@ RateControl::RateControl(x265_param& p, Encoder *top)
     int lowresCuWidth = ((m_param->sourceWidth / 2) + X265_LOWRES_CU_SIZE - 1) >> X265_LOWRES_CU_BITS;
     int lowresCuHeight = ((m_param->sourceHeight / 2) + X265_LOWRES_CU_SIZE - 1) >> X265_LOWRES_CU_BITS;
     m_ncu = lowresCuWidth * lowresCuHeight;
+    m_lowresCostShift = m_param->bLowres8bit ? 0 : X265_DEPTH - 8;
 
     m_qCompress = (m_param->rc.cuTree && !m_param->rc.hevcAq) ? 1 : m_param->rc.qCompress;
 
@@ -168,6 +211,8 @@ RateControl::RateControl(x265_param& p, Encoder *top)
     m_startEndOrder.set(0);
     m_bTerminated = false;
     m_finalFrameCount = 0;
+    m_startEndSlots = 0;
+    memset(m_skippedSlot, 0, sizeof(m_skippedSlot));
     m_numEntries = 0;
     m_isSceneTransition = false;
     m_lastPredictorReset = 0;
@@ -209,8 +254,15 @@ RateControl::RateControl(x265_param& p, Encoder *top)
     m_lastAbrResetPoc = -1;
     m_statFileOut = NULL;
     m_cutreeStatFileOut = m_cutreeStatFileIn = NULL;
+    m_statsMap = NULL;
+    m_statsMapSize = 0;
+    m_statsIndex = NULL;
+    m_statsOutIndex = NULL;
+    m_statsOutFrames = m_statsOutAlloc = 0;
+    m_statsOutBytes = 0;
     m_rce2Pass = NULL;
     m_encOrder = NULL;
+    m_planStart = 0;
     m_lastBsliceSatdCost = 0;
     m_movingAvgSum = 0.0;
     m_isNextGop = false;
@@ -422,12 +474,49 @@ bool RateControl::init(const SPS& sps)
         if (m_param->rc.bStatRead)
         {
             m_expectedBitsSum = 0;
-            char *p, *statsIn, *statsBuf;
-            /* read 1st pass stats */
-            statsIn = statsBuf = x265_slurp_file(fileName);
-            if (!statsBuf)
+            char *p, *opts, *statsIn = NULL, *statsBuf = NULL;
+            /* read 1st pass stats: a binary file is used in place, from a
+             * mapping, a text file is read whole */
+            m_statsMap = (uint8_t*)x265_map_file(fileName, &m_statsMapSize);
+            if (!m_statsMap)
                 return false;
-            if (m_param->rc.cuTree)
+            const StatsFileHeader* header = (const StatsFileHeader*)m_statsMap;
+            if (m_statsMapSize < sizeof(StatsFileHeader) || memcmp(header->magic, X265_STATS_MAGIC, sizeof(header->magic)))
+            {
+                x265_unmap_file(m_statsMap, m_statsMapSize);
+                m_statsMap = NULL;
+                m_statsMapSize = 0;
+            }
+            if (m_statsMap)
+            {
+                if (!checkStatsHeader(m_param, m_statsMap, m_statsMapSize))
+                    return false;
+                opts = (char*)m_statsMap + header->headerSize;
+                m_statsIndex = (const uint64_t*)(m_statsMap + header->indexOffset);
+            }
+            else
+            {
+                statsIn = statsBuf = x265_slurp_file(fileName);
+                if (!statsBuf)
+                    return false;
+
+                /* check whether 1st pass options were compatible with current options */
+                if (strncmp(statsBuf, "#options:", 9))
+                {
+                    x265_log(m_param, X265_LOG_ERROR,"options list in stats file not valid\n");
+                    return false;
+                }
+                opts = statsBuf;
+                statsIn = strchr(statsBuf, '\n');
+                if (!statsIn)
+                {
+                    x265_log(m_param, X265_LOG_ERROR, "Malformed stats file\n");
+                    return false;
+                }
+                *statsIn = '\0';
+                statsIn++;
+            }
+            if (m_param->rc.cuTree && !m_statsMap)
             {
                 char *tmpFile = strcatFilename(fileName, ".cutree");
                 if (!tmpFile)
@@ -441,25 +530,10 @@ bool RateControl::init(const SPS& sps)
                 }
             }
 
-            /* check whether 1st pass options were compatible with current options */
-            if (strncmp(statsBuf, "#options:", 9))
-            {
-                x265_log(m_param, X265_LOG_ERROR,"options list in stats file not valid\n");
-                return false;
-            }
             {
                 int i, j, m;
                 uint32_t k , l;
                 bool bErr = false;
-                char *opts = statsBuf;
-                statsIn = strchr(statsBuf, '\n');
-                if (!statsIn)
-                {
-                    x265_log(m_param, X265_LOG_ERROR, "Malformed stats file\n");
-                    return false;
-                }
-                *statsIn = '\0';
-                statsIn++;
                 if ((p = strstr(opts, " input-res=")) == 0 || sscanf(p, " input-res=%dx%d", &i, &j) != 2)
                 {
                     x265_log(m_param, X265_LOG_ERROR, "Resolution specified in stats file not valid\n");
@@ -533,10 +607,15 @@ bool RateControl::init(const SPS& sps)
                     m_param->lookaheadDepth = i;
             }
             /* find number of pics */
-            p = statsIn;
             int numEntries;
-            for (numEntries = -1; p; numEntries++)
-                p = strchr(p + 1, ';');
+            if (m_statsMap)
+                numEntries = (int)header->numFrames;
+            else
+            {
+                p = statsIn;
+                for (numEntries = -1; p; numEntries++)
+                    p = strchr(p + 1, ';');
+            }
             if (!numEntries)
             {
                 x265_log(m_param, X265_LOG_ERROR, "empty stats file\n");
@@ -544,15 +623,19 @@ bool RateControl::init(const SPS& sps)
             }
             m_numEntries = numEntries;
 
-            if (m_param->totalFrames < m_numEntries && m_param->totalFrames > 0)
+            /* a chunk is encoded up to its chunk-end */
+            int totalFrames = m_param->totalFrames;
+            if (m_param->chunkEnd && totalFrames > m_param->chunkEnd)
+                totalFrames = m_param->chunkEnd;
+            if (totalFrames < m_numEntries && totalFrames > 0)
             {
                 x265_log(m_param, X265_LOG_WARNING, "2nd pass has fewer frames than 1st pass (%d vs %d)\n",
-                         m_param->totalFrames, m_numEntries);
+                         totalFrames, m_numEntries);
             }
-            if (m_param->totalFrames > m_numEntries && !m_param->bEnableFrameDuplication)
+            if (totalFrames > m_numEntries && !m_param->bEnableFrameDuplication)
             {
                 x265_log(m_param, X265_LOG_ERROR, "2nd pass has more frames than 1st pass (%d vs %d)\n",
-                         m_param->totalFrames, m_numEntries);
+                         totalFrames, m_numEntries);
                 return false;
             }
 
@@ -589,40 +672,94 @@ bool RateControl::init(const SPS& sps)
                 int e;
                 char *next;
                 double qpRc, qpAq, qNoVbv, qRceq;
-                next = strstr(p, ";");
-                if (next)
-                    *next++ = 0;
-                e = sscanf(p, " in:%d out:%d", &frameNumber, &encodeOrder);
-                if (frameNumber < 0 || frameNumber >= m_numEntries)
+                if (m_statsMap)
                 {
-                    x265_log(m_param, X265_LOG_ERROR, "bad frame number (%d) at stats line %d\n", frameNumber, i);
-                    return false;
-                }
-                rce = &m_rce2Pass[encodeOrder];
-                rcePocOrder = &m_rce2Pass[frameNumber];
-                m_encOrder[frameNumber] = encodeOrder;
-                if (!m_param->bMultiPassOptRPS)
-                {
-                    int scenecut = 0;
-                    e += sscanf(p, " in:%*d out:%*d type:%c q:%lf q-aq:%lf q-noVbv:%lf q-Rceq:%lf tex:%d mv:%d misc:%d icu:%lf pcu:%lf scu:%lf sc:%d",
-                        &picType, &qpRc, &qpAq, &qNoVbv, &qRceq, &rce->coeffBits,
-                        &rce->mvBits, &rce->miscBits, &rce->iCuCount, &rce->pCuCount,
-                        &rce->skipCuCount, &scenecut);
-                    rcePocOrder->scenecut = scenecut != 0;
+                    /* the index is in encode order */
+                    const StatsFrameRecord* rec = statsFrame(i);
+                    if (!rec || rec->encodeOrder != i)
+                    {
+                        x265_log(m_param, X265_LOG_ERROR, "statistics are damaged at frame %d\n", i);
+                        return false;
+                    }
+                    frameNumber = rec->poc;
+                    encodeOrder = rec->encodeOrder;
+                    if (frameNumber < 0 || frameNumber >= m_numEntries)
+                    {
+                        x265_log(m_param, X265_LOG_ERROR, "bad frame number (%d) at stats frame %d\n", frameNumber, i);
+                        return false;
+                    }
+                    rce = &m_rce2Pass[encodeOrder];
+                    rcePocOrder = &m_rce2Pass[frameNumber];
+                    m_encOrder[frameNumber] = encodeOrder;
+                    picType = rec->type;
+                    qpRc = rec->qpRc;
+                    qpAq = rec->qpAq;
+                    qNoVbv = rec->qpNoVbv;
+                    qRceq = rec->qRceq;
+                    rce->coeffBits = rec->coeffBits;
+                    rce->mvBits = rec->mvBits;
+                    rce->miscBits = rec->miscBits;
+                    rce->iCuCount = rec->iCuCount;
+                    rce->pCuCount = rec->pCuCount;
+                    rce->skipCuCount = rec->skipCuCount;
+                    rcePocOrder->scenecut = rec->scenecut != 0;
+                    if (m_param->bMultiPassOptRPS)
+                    {
+                        if (rec->numberOfPictures > MAX_NUM_REF_PICS)
+                        {
+                            x265_log(m_param, X265_LOG_ERROR, "statistics are damaged at frame %d\n", i);
+                            return false;
+                        }
+                        rce->rpsData.numberOfPictures = rec->numberOfPictures;
+                        rce->rpsData.numberOfNegativePictures = rec->numberOfNegativePictures;
+                        rce->rpsData.numberOfPositivePictures = rec->numberOfPositivePictures;
+                        for (int j = 0; j < rec->numberOfPictures; j++)
+                        {
+                            rce->rpsData.deltaPOC[j] = rec->deltaPOC[j];
+                            rce->rpsData.bUsed[j] = !!(rec->usedMask & (1 << j));
+                        }
+                        rce->rpsIdx = -1;
+                    }
+                    e = 14; /* all the fields of a text line */
                 }
                 else
                 {
-                    char deltaPOC[128];
-                    char bUsed[40];
-                    memset(deltaPOC, 0, sizeof(deltaPOC));
-                    memset(bUsed, 0, sizeof(bUsed));
-                    e += sscanf(p, " in:%*d out:%*d type:%c q:%lf q-aq:%lf q-noVbv:%lf q-Rceq:%lf tex:%d mv:%d misc:%d icu:%lf pcu:%lf scu:%lf nump:%d numnegp:%d numposp:%d deltapoc:%s bused:%s",
-                        &picType, &qpRc, &qpAq, &qNoVbv, &qRceq, &rce->coeffBits,
-                        &rce->mvBits, &rce->miscBits, &rce->iCuCount, &rce->pCuCount,
-                        &rce->skipCuCount, &rce->rpsData.numberOfPictures, &rce->rpsData.numberOfNegativePictures, &rce->rpsData.numberOfPositivePictures, deltaPOC, bUsed);
-                    splitdeltaPOC(deltaPOC, rce);
-                    splitbUsed(bUsed, rce);
-                    rce->rpsIdx = -1;
+                    next = strstr(p, ";");
+                    if (next)
+                        *next++ = 0;
+                    e = sscanf(p, " in:%d out:%d", &frameNumber, &encodeOrder);
+                    if (frameNumber < 0 || frameNumber >= m_numEntries)
+                    {
+                        x265_log(m_param, X265_LOG_ERROR, "bad frame number (%d) at stats line %d\n", frameNumber, i);
+                        return false;
+                    }
+                    rce = &m_rce2Pass[encodeOrder];
+                    rcePocOrder = &m_rce2Pass[frameNumber];
+                    m_encOrder[frameNumber] = encodeOrder;
+                    if (!m_param->bMultiPassOptRPS)
+                    {
+                        int scenecut = 0;
+                        e += sscanf(p, " in:%*d out:%*d type:%c q:%lf q-aq:%lf q-noVbv:%lf q-Rceq:%lf tex:%d mv:%d misc:%d icu:%lf pcu:%lf scu:%lf sc:%d",
+                            &picType, &qpRc, &qpAq, &qNoVbv, &qRceq, &rce->coeffBits,
+                            &rce->mvBits, &rce->miscBits, &rce->iCuCount, &rce->pCuCount,
+                            &rce->skipCuCount, &scenecut);
+                        rcePocOrder->scenecut = scenecut != 0;
+                    }
+                    else
+                    {
+                        char deltaPOC[128];
+                        char bUsed[40];
+                        memset(deltaPOC, 0, sizeof(deltaPOC));
+                        memset(bUsed, 0, sizeof(bUsed));
+                        e += sscanf(p, " in:%*d out:%*d type:%c q:%lf q-aq:%lf q-noVbv:%lf q-Rceq:%lf tex:%d mv:%d misc:%d icu:%lf pcu:%lf scu:%lf nump:%d numnegp:%d numposp:%d deltapoc:%s bused:%s",
+                            &picType, &qpRc, &qpAq, &qNoVbv, &qRceq, &rce->coeffBits,
+                            &rce->mvBits, &rce->miscBits, &rce->iCuCount, &rce->pCuCount,
+                            &rce->skipCuCount, &rce->rpsData.numberOfPictures, &rce->rpsData.numberOfNegativePictures, &rce->rpsData.numberOfPositivePictures, deltaPOC, bUsed);
+                        splitdeltaPOC(deltaPOC, rce);
+                        splitbUsed(bUsed, rce);
+                        rce->rpsIdx = -1;
+                    }
+                    p = next;
                 }
                 rce->keptAsRef = true;
                 rce->isIdr = false;
@@ -649,10 +786,15 @@ bool RateControl::init(const SPS& sps)
                 rce->qpaRc = qpRc;
                 rce->qpAq = qpAq;
                 rce->qRceq = qRceq;
-                p = next;
             }
             X265_FREE(statsBuf);
-            if (m_param->rc.rateControlMode != X265_RC_CQP)
+            if (m_statsMap && header->planOffset)
+            {
+                /* the bits were planned for the whole title, by x265_stats_merge() */
+                if (!readStatsPlan(*header))
+                    return false;
+            }
+            else if (m_param->rc.rateControlMode != X265_RC_CQP)
             {
                 m_start = 0;
                 m_isQpModified = true;
@@ -677,10 +819,34 @@ bool RateControl::init(const SPS& sps)
                 return false;
             }
             p = x265_param2string(m_param, sps.conformanceWindow.rightOffset, sps.conformanceWindow.bottomOffset);
-            if (p)
+            if (m_param->statsFormat == X265_STATS_BINARY)
+            {
+                /* numFrames and indexOffset are known when the file is closed */
+                StatsFileHeader& header = m_statsOutHeader;
+                static const uint8_t zeros[8] = { 0 };
+                size_t optionsLen = p ? strlen(p) + 1 : 1;
+                memset(&header, 0, sizeof(header));
+                memcpy(header.magic, X265_STATS_MAGIC, sizeof(header.magic));
+                header.version = X265_STATS_VERSION;
+                header.headerSize = sizeof(StatsFileHeader);
+                header.optionsSize = (uint32_t)((optionsLen + 7) & ~7);
+                bool bError = fwrite(&header, sizeof(header), 1, m_statFileOut) < 1;
+                bError |= fwrite(p ? p : "", 1, optionsLen, m_statFileOut) < optionsLen;
+                bError |= fwrite(zeros, 1, header.optionsSize - optionsLen, m_statFileOut) < header.optionsSize - optionsLen;
+                m_statsOutBytes = header.headerSize + header.optionsSize;
+                if (bError)
+                {
+                    x265_log_file(m_param, X265_LOG_ERROR, "can't write stats file %s.temp\n", fileName);
+                    X265_FREE(p);
+                    return false;
+                }
+            }
+            else if (p)
                 fprintf(m_statFileOut, "#options: %s\n", p);
             X265_FREE(p);
-            if (m_param->rc.cuTree && !m_param->rc.bStatRead)
+            /* the binary stats hold the cutree offsets, the text stats of a
+             * later pass reuse the .cutree file of the first */
+            if (m_param->rc.cuTree && m_param->statsFormat == X265_STATS_TEXT && (!m_param->rc.bStatRead || m_statsMap))
             {
                 statFileTmpname = strcatFilename(fileName, ".cutree.temp");
                 if (!statFileTmpname)
@@ -1123,6 +1289,280 @@ bool RateControl::initPass2()
     return true;
 }
 
+/* Use the slice of a title wide plan written by x265_stats_merge() into the
+ * stats of a chunk, in place of a plan of the chunk alone */
+bool RateControl::readStatsPlan(const StatsFileHeader& header)
+{
+    int planStart = m_param->chunkStart > 1 ? m_param->chunkStart - 1 : 0;
+    if (m_param->rc.rateControlMode != X265_RC_ABR)
+    {
+        x265_log(m_param, X265_LOG_ERROR, "merged stats require a target bitrate\n");
+        return false;
+    }
+    if ((int)header.planStart != planStart || planStart >= m_numEntries)
+    {
+        x265_log(m_param, X265_LOG_ERROR, "stats were merged for a chunk starting at frame %u\n", header.planStart + 1);
+        return false;
+    }
+    const StatsPlanEntry* plan = (const StatsPlanEntry*)(m_statsMap + header.planOffset);
+    for (int i = 0; i < m_numEntries; i++)
+    {
+        RateControlEntry *rce = &m_rce2Pass[i];
+        if (i < planStart)
+        {
+            /* warm-up frames keep the quantizer of the first pass, they
+             * are not in the bitstream and don't use the budget */
+            rce->expectedBits = 0;
+            rce->expectedVbv = header.planBufferFill;
+            continue;
+        }
+        if (!(plan[i].qScale > 0))
+        {
+            x265_log(m_param, X265_LOG_ERROR, "merged stats are damaged at frame %d\n", i);
+            return false;
+        }
+        rce->newQScale = plan[i].qScale;
+        rce->expectedBits = plan[i].expectedBits;
+        rce->expectedVbv = plan[i].expectedVbv;
+        if (rce->sliceType != B_SLICE)
+            m_lastNonBPictType = rce->sliceType;
+    }
+    if (m_isVbv)
+    {
+        /* the chunk starts with the buffer the previous chunk was planned to leave */
+        m_bufferFillFinal = x265_clip3(0.0, m_bufferSize, header.planBufferFill);
+        m_bufferFillActual = m_bufferFillFinal;
+    }
+    m_planStart = planStart;
+    return true;
+}
+
+/* Plan the second pass of a title which was cut into chunks, from the binary
+ * first pass stats of the chunks, in title order. The frames of all chunks
+ * are planned together, as a second pass of the whole title would, and the
+ * slice of the plan of each chunk is appended to its stats file */
+bool RateControl::mergeChunkStats(x265_param& param, const char* const* statsFiles, int numFiles)
+{
+    StatsChunk* chunks = X265_MALLOC(StatsChunk, numFiles);
+    if (!chunks)
+    {
+        x265_log(&param, X265_LOG_ERROR, "stats merge: memory allocation failure\n");
+        return false;
+    }
+    memset(chunks, 0, numFiles * sizeof(StatsChunk));
+
+    bool bOk = param.rc.rateControlMode == X265_RC_ABR;
+    if (!bOk)
+        x265_log(&param, X265_LOG_ERROR, "stats merge requires a target bitrate\n");
+    int numEntries = 0, width = 0, height = 0, bframes = 0;
+    uint32_t fpsNum = 0, fpsDenom = 0;
+    for (int i = 0; i < numFiles && bOk; i++)
+    {
+        StatsChunk& chunk = chunks[i];
+        chunk.map = (uint8_t*)x265_map_file(statsFiles[i], &chunk.size);
+        const StatsFileHeader* header = (const StatsFileHeader*)chunk.map;
+        if (!chunk.map || chunk.size < sizeof(StatsFileHeader) || memcmp(header->magic, X265_STATS_MAGIC, sizeof(header->magic)))
+        {
+            x265_log_file(&param, X265_LOG_ERROR, "stats merge: %s is not a binary stats file\n", statsFiles[i]);
+            bOk = false;
+            break;
+        }
+        if (!checkStatsHeader(&param, chunk.map, chunk.size))
+        {
+            bOk = false;
+            break;
+        }
+
+        /* the chunks must come from first passes of the same title */
+        const char* opts = (const char*)chunk.map + header->headerSize;
+        const char* p;
+        int w, h, b, chunkStart = 0;
+        uint32_t k, l;
+        if ((p = strstr(opts, " input-res=")) == 0 || sscanf(p, " input-res=%dx%d", &w, &h) != 2 ||
+            (p = strstr(opts, " fps=")) == 0 || sscanf(p, " fps=%u/%u", &k, &l) != 2 ||
+            (p = strstr(opts, " bframes=")) == 0 || sscanf(p, " bframes=%d", &b) != 1)
+        {
+            x265_log_file(&param, X265_LOG_ERROR, "stats merge: options of %s not valid\n", statsFiles[i]);
+            bOk = false;
+            break;
+        }
+        if ((p = strstr(opts, " chunk-start=")) != 0)
+            sscanf(p, " chunk-start=%d", &chunkStart);
+        if (!i)
+        {
+            width = w;
+            height = h;
+            fpsNum = k;
+            fpsDenom = l;
+            bframes = b;
+        }
+        else if (w != width || h != height || k != fpsNum || l != fpsDenom || b != bframes)
+        {
+            x265_log_file(&param, X265_LOG_ERROR, "stats merge: %s is not a chunk of the title of %s\n", statsFiles[i], statsFiles[0]);
+            bOk = false;
+            break;
+        }
+
+        /* the chunk starts with a keyframe, encoded after all the frames
+         * which precede it in display order */
+        chunk.warmup = chunkStart > 1 ? chunkStart - 1 : 0;
+        chunk.start = numEntries;
+        const uint64_t* index = (const uint64_t*)(chunk.map + header->indexOffset);
+        for (int j = 0; j < (int)header->numFrames; j++)
+        {
+            const StatsFrameRecord* rec = statsRecord(chunk.map, chunk.size, index[j]);
+            if (!rec || rec->encodeOrder != j || (rec->poc < chunk.warmup) != (j < chunk.warmup) ||
+                (j == chunk.warmup && chunk.warmup && rec->type != 'I'))
+            {
+                x265_log_file(&param, X265_LOG_ERROR, "stats merge: %s is damaged at frame %d\n", statsFiles[i], j);
+                bOk = false;
+                break;
+            }
+        }
+        if (bOk && (int)header->numFrames <= chunk.warmup)
+        {
+            x265_log_file(&param, X265_LOG_ERROR, "stats merge: %s holds no frame of its chunk\n", statsFiles[i]);
+            bOk = false;
+        }
+        numEntries += (int)header->numFrames - chunk.warmup;
+    }
+
+    char** tmpFileNames = bOk ? X265_MALLOC(char*, numFiles) : NULL;
+    if (tmpFileNames)
+        memset(tmpFileNames, 0, numFiles * sizeof(char*));
+    else
+        bOk = false;
+    if (bOk)
+    {
+        /* plan with the rate control options of the second pass, and the
+         * frame size and rate of the first */
+        param.sourceWidth = (width + param.minCUSize - 1) & ~(param.minCUSize - 1);
+        param.sourceHeight = (height + param.minCUSize - 1) & ~(param.minCUSize - 1);
+        param.fpsNum = fpsNum;
+        param.fpsDenom = fpsDenom;
+        param.bframes = bframes;
+        param.totalFrames = numEntries;
+        param.rc.bStatRead = param.rc.bStatWrite = 0;
+
+        RateControl rc(param, NULL);
+        SPS sps;
+        sps.vuiParameters.timingInfo.numUnitsInTick = fpsDenom;
+        sps.vuiParameters.timingInfo.timeScale = fpsNum;
+        if (param.bEmitHRDSEI)
+            rc.initHRD(sps);
+        bOk = rc.init(sps);
+        rc.m_isAbr = false;
+        rc.m_2pass = true;
+        rc.m_numEntries = numEntries;
+        rc.m_rce2Pass = bOk ? X265_MALLOC(RateControlEntry, numEntries) : NULL;
+        bOk = rc.m_rce2Pass != NULL;
+        for (int i = 0; i < numFiles && bOk; i++)
+        {
+            const StatsFileHeader* header = (const StatsFileHeader*)chunks[i].map;
+            const uint64_t* index = (const uint64_t*)(chunks[i].map + header->indexOffset);
+            for (int j = chunks[i].warmup; j < (int)header->numFrames; j++)
+            {
+                const StatsFrameRecord* rec = statsRecord(chunks[i].map, chunks[i].size, index[j]);
+                RateControlEntry* rce = &rc.m_rce2Pass[chunks[i].start + j - chunks[i].warmup];
+                rce->coeffBits = rec->coeffBits;
+                rce->mvBits = rec->mvBits;
+                rce->miscBits = rec->miscBits;
+                rce->iCuCount = rec->iCuCount;
+                rce->pCuCount = rec->pCuCount;
+                rce->skipCuCount = rec->skipCuCount;
+                rce->keptAsRef = rec->type != 'b' && rec->type != 'p';
+                rce->isIdr = rec->type == 'I';
+                rce->sliceType = rec->type == 'I' || rec->type == 'i' ? I_SLICE : rec->type == 'B' || rec->type == 'b' ? B_SLICE : P_SLICE;
+                rce->qScale = rce->newQScale = x265_qp2qScale(rec->qpRc);
+                rce->qpNoVbv = rec->qpNoVbv;
+                rce->qpaRc = rec->qpRc;
+                rce->qpAq = rec->qpAq;
+                rce->qRceq = rec->qRceq;
+                rce->newQp = 0;
+            }
+        }
+        if (bOk)
+        {
+            rc.m_start = 0;
+            rc.m_isQpModified = true;
+            bOk = rc.initPass2();
+        }
+        uint64_t titleBits = 0;
+        if (bOk)
+        {
+            RateControlEntry* last = &rc.m_rce2Pass[numEntries - 1];
+            titleBits = last->expectedBits + (uint64_t)qScale2bits(last, last->newQScale);
+        }
+
+        /* write the plan of each chunk after its index, in a copy of its stats */
+        for (int i = 0; i < numFiles && bOk; i++)
+        {
+            StatsChunk& chunk = chunks[i];
+            StatsFileHeader header = *(const StatsFileHeader*)chunk.map;
+            int numFrames = (int)header.numFrames;
+            header.planOffset = header.indexOffset + numFrames * sizeof(uint64_t);
+            header.planStart = chunk.warmup;
+            header.planBufferFill = 0;
+            if (rc.m_isVbv)
+                header.planBufferFill = chunk.start ? rc.m_rce2Pass[chunk.start - 1].expectedVbv : rc.m_bufferSize * param.rc.vbvBufferInit;
+            uint64_t startBits = rc.m_rce2Pass[chunk.start].expectedBits;
+            uint64_t endBits = i + 1 < numFiles ? rc.m_rce2Pass[chunks[i + 1].start].expectedBits : titleBits;
+
+            tmpFileNames[i] = strcatFilename(statsFiles[i], ".temp");
+            FILE* out = tmpFileNames[i] ? x265_fopen(tmpFileNames[i], "wb") : NULL;
+            bOk = out && fwrite(&header, sizeof(header), 1, out) == 1 &&
+                  fwrite(chunk.map + header.headerSize, 1, (size_t)(header.planOffset - header.headerSize), out) == header.planOffset - header.headerSize;
+            for (int j = 0; j < numFrames && bOk; j++)
+            {
+                StatsPlanEntry entry;
+                memset(&entry, 0, sizeof(entry));
+                if (j >= chunk.warmup)
+                {
+                    const RateControlEntry& rce = rc.m_rce2Pass[chunk.start + j - chunk.warmup];
+                    entry.qScale = rce.newQScale;
+                    entry.expectedVbv = rce.expectedVbv;
+                    entry.expectedBits = rce.expectedBits - startBits;
+                }
+                bOk = fwrite(&entry, sizeof(entry), 1, out) == 1;
+            }
+            if (out)
+                fclose(out);
+            if (!bOk)
+                x265_log_file(&param, X265_LOG_ERROR, "stats merge: can't write %s.temp\n", statsFiles[i]);
+            else
+                x265_log_file(&param, X265_LOG_INFO, "stats merge: %s, frames %d-%d of the title, %.2f kbit/s planned, VBV fill %.0f%% at start\n",
+                              statsFiles[i], chunk.start + 1, chunk.start + numFrames - chunk.warmup,
+                              (endBits - startBits) * rc.m_fps / ((numFrames - chunk.warmup) * 1000.),
+                              rc.m_isVbv ? 100. * header.planBufferFill / rc.m_bufferSize : 0.);
+        }
+        rc.destroy();
+    }
+
+    for (int i = 0; i < numFiles; i++)
+        x265_unmap_file(chunks[i].map, chunks[i].size);
+    X265_FREE(chunks);
+
+    /* replace the stats once they are all planned and unmapped */
+    bool bRenamed = bOk;
+    for (int i = 0; tmpFileNames && i < numFiles; i++)
+    {
+        if (bOk)
+        {
+            x265_unlink(statsFiles[i]);
+            if (x265_rename(tmpFileNames[i], statsFiles[i]))
+            {
+                x265_log_file(&param, X265_LOG_ERROR, "failed to rename output stats file to \"%s\"\n", statsFiles[i]);
+                bRenamed = false;
+            }
+        }
+        else if (tmpFileNames[i])
+            x265_unlink(tmpFileNames[i]);
+        X265_FREE(tmpFileNames[i]);
+    }
+    X265_FREE(tmpFileNames);
+    return bRenamed;
+}
+
 bool RateControl::vbv2Pass(uint64_t allAvailableBits, int endPos, int startPos)
 {
     /* for each interval of bufferFull .. underflow, uniformly increase the qp of all
@@ -1188,6 +1628,9 @@ int RateControl::rateControlSliceType(int frameNum)
 {
     if (m_param->rc.bStatRead)
     {
+        /* the keyframe ending a chunk is not encoded, the lookahead decides it */
+        if (m_param->chunkEnd && frameNum >= m_param->chunkEnd)
+            return X265_TYPE_AUTO;
         if (frameNum >= m_numEntries)
         {
             /* We could try to initialize everything required for ABR and
@@ -1250,7 +1693,7 @@ void RateControl::initFramePredictors()
 int RateControl::rateControlStart(Frame* curFrame, RateControlEntry* rce, Encoder* enc)
 {
     int orderValue = m_startEndOrder.get();
-    int startOrdinal = rce->encodeOrder * 2;
+    int startOrdinal = rce->startEndSlot * 2;
 
     while (orderValue < startOrdinal && !m_bTerminated)
         orderValue = m_startEndOrder.waitForChange(orderValue);
@@ -1258,7 +1701,7 @@ int RateControl::rateControlStart(Frame* curFrame, RateControlEntry* rce, Encode
     if (!curFrame)
     {
         // faked rateControlStart calls when the encoder is flushing
-        m_startEndOrder.incr();
+        advanceStartEndOrder();
         return 0;
     }
 
@@ -1406,7 +1849,7 @@ int RateControl::rateControlStart(Frame* curFrame, RateControlEntry* rce, Encode
     {
         if (m_isAbr || m_isVbv)
         {
-            m_currentSatd = curFrame->m_lowres.satdCost >> (X265_DEPTH - 8);
+            m_currentSatd = curFrame->m_lowres.satdCost >> m_lowresCostShift;
             /* Update rce for use in rate control VBV later */
             rce->lastSatd = m_currentSatd;
             X265_CHECK(rce->lastSatd, "satdcost cannot be zero\n");
@@ -1637,6 +2080,9 @@ bool RateControl::fixUnderflow(int t0, int t1, double adjustment, double qscaleM
 
 bool RateControl::cuTreeReadFor2Pass(Frame* frame)
 {
+    /* the keyframe ending a chunk is not encoded, nor in the stats */
+    if (m_param->chunkEnd && frame->m_poc >= m_param->chunkEnd)
+        return true;
     int index = m_encOrder[frame->m_poc];
     uint8_t sliceTypeActual = (uint8_t)m_rce2Pass[index].sliceType;
     int ncu;
@@ -1644,7 +2090,17 @@ bool RateControl::cuTreeReadFor2Pass(Frame* frame)
         ncu = m_ncu * 4;
     else
         ncu = m_ncu;
-    if (m_rce2Pass[index].keptAsRef)
+    if (m_rce2Pass[index].keptAsRef && m_statsMap)
+    {
+        /* the binary stats hold the offsets of each frame, read in place */
+        const StatsFrameRecord* rec = statsFrame(index);
+        if (!rec || rec->numQpOffsets != (uint32_t)ncu)
+            goto fail;
+        primitives.fix8Unpack(frame->m_lowres.qpCuTreeOffset, (uint16_t*)(rec + 1), ncu);
+        for (int i = 0; i < ncu; i++)
+            frame->m_lowres.invQscaleFactor[i] = x265_exp2fix8(frame->m_lowres.qpCuTreeOffset[i]);
+    }
+    else if (m_rce2Pass[index].keptAsRef)
     {
         /* TODO: We don't need pre-lookahead to measure AQ offsets, but there is currently
          * no way to signal this */
@@ -1680,6 +2136,14 @@ fail:
     return false;
 }
 
+/* record of a frame of the binary stats, in encode order; NULL if the index
+ * points outside the file */
+const StatsFrameRecord* RateControl::statsFrame(int encodeOrder) const
+{
+    X265_CHECK(m_statsMap && encodeOrder >= 0 && encodeOrder < m_numEntries, "stats frame out of range\n");
+    return statsRecord(m_statsMap, m_statsMapSize, m_statsIndex[encodeOrder]);
+}
+
 double RateControl::tuneAbrQScaleFromFeedback(double qScale)
 {
     double abrBuffer = 2 * m_rateTolerance * m_bitrate;
@@ -1935,8 +2399,9 @@ double RateControl::rateEstimateQscale(Frame* curFrame, RateControlEntry *rce)
             if (!m_isVbv)
             {
                 m_predictedBits = m_totalBits;
-                if (rce->encodeOrder < m_param->frameNumThreads)
-                    m_predictedBits += (int64_t)(rce->encodeOrder * m_bitrate / m_fps);
+                int framesEncoded = X265_MAX(rce->encodeOrder - m_planStart, 0);
+                if (framesEncoded < m_param->frameNumThreads)
+                    m_predictedBits += (int64_t)(framesEncoded * m_bitrate / m_fps);
                 else
                     m_predictedBits += (int64_t)(m_param->frameNumThreads * m_bitrate / m_fps);
             }
@@ -2238,16 +2703,14 @@ void RateControl::rateControlUpdateStats(RateControlEntry* rce)
         rce->rowCplxrSum = rce->rowTotalBits * x265_qp2qScale(rce->qpaRc) / (rce->qRceq * fabs(m_param->rc.pbFactor));
 
     m_cplxrSum += rce->rowCplxrSum;
-    m_totalBits += rce->rowTotalBits;
+    if (rce->encodeOrder >= m_planStart)
+        m_totalBits += rce->rowTotalBits;
 
     /* do not allow the next frame to enter rateControlStart() until this
      * frame has updated its mid-frame statistics */
     if (m_param->rc.rateControlMode == X265_RC_ABR || m_isVbv)
     {
-        m_startEndOrder.incr();
-
-        if (rce->encodeOrder < m_param->frameNumThreads - 1)
-            m_startEndOrder.incr(); // faked rateControlEnd calls for negative frames
+        advanceStartEndOrder();
     }
 }
 
@@ -2359,7 +2822,7 @@ double RateControl::clipQscale(Frame* curFrame, RateControlEntry* rce, double q)
                     double wantedFrameSize = m_vbvMaxRate * m_frameDuration;
                     if (bufferFillCur + wantedFrameSize <= m_bufferSize)
                         bufferFillCur += wantedFrameSize;
-                    int64_t satd = curFrame->m_lowres.plannedSatd[j] >> (X265_DEPTH - 8);
+                    int64_t satd = curFrame->m_lowres.plannedSatd[j] >> m_lowresCostShift;
                     type = IS_X265_TYPE_I(type) ? I_SLICE : IS_X265_TYPE_B(type) ? B_SLICE : P_SLICE;
                     int predType = getPredictorType(curFrame->m_lowres.plannedType[j], type);
                     curBits = predictSize(&m_pred[predType], frameQ[type], (double)satd);
@@ -2480,97 +2943,132 @@ double RateControl::clipQscale(Frame* curFrame, RateControlEntry* rce, double q)
     return x265_clip3(lmin, lmax, q);
 }
 
-double RateControl::predictRowsSizeSum(Frame* curFrame, RateControlEntry* rce, double qpVbv, int32_t& encodedBitsSoFar)
+/* copy the VBV accumulators of a row, which may be updated meanwhile by the
+ * thread encoding it, see RCStatRow::beginUpdate() */
+static void readRowStat(const FrameData::RCStatRow& src, FrameData::RCStatRow& dst)
 {
-    uint32_t rowSatdCostSoFar = 0, totalSatdBits = 0;
-    encodedBitsSoFar = 0;
+    for (;;)
+    {
+        uint32_t seq = src.seq;
+        MEMORY_BARRIER();
+        dst.numEncodedCUs = src.numEncodedCUs;
+        dst.encodedBits = src.encodedBits;
+        dst.rowSatd = src.rowSatd;
+        dst.rowIntraSatd = src.rowIntraSatd;
+        dst.refSatdLeft = src.refSatdLeft;
+        dst.refBitsLeft = src.refBitsLeft;
+        MEMORY_BARRIER();
+        if (!(seq & 1) && seq == src.seq)
+            return;
+        SPIN_PAUSE();
+    }
+}
 
-    double qScale = x265_qp2qScale(qpVbv);
+void RateControl::estimateRowsSize(Frame* curFrame, RateControlEntry* rce, RowSizeEstimate& est)
+{
     FrameData& curEncData = *curFrame->m_encData;
     int picType = curEncData.m_slice->m_sliceType;
     Frame* refFrame = curEncData.m_slice->m_refFrameList[0][0];
-
     uint32_t maxRows = curEncData.m_slice->m_sps->numCuInHeight;
-    uint32_t maxCols = curEncData.m_slice->m_sps->numCuInWidth;
+    bool bUseRef = picType != I_SLICE && !m_param->rc.bEnableConstVbv;
+
+    est.pred[0] = *rce->rowPred[0];
+    est.pred[1] = *rce->rowPred[1];
+    est.encodedBits = 0;
+    est.numRows = 0;
 
     for (uint32_t row = 0; row < maxRows; row++)
     {
-        encodedBitsSoFar += curEncData.m_rowStat[row].encodedBits;
-        rowSatdCostSoFar = curEncData.m_rowStat[row].rowSatd;
-        uint32_t satdCostForPendingCus = curEncData.m_rowStat[row].satdForVbv - rowSatdCostSoFar;
-        satdCostForPendingCus >>= X265_DEPTH - 8;
-        if (satdCostForPendingCus  > 0)
-        {
-            double pred_s = predictSize(rce->rowPred[0], qScale, satdCostForPendingCus);
-            uint32_t refRowSatdCost = 0, refRowBits = 0, intraCostForPendingCus = 0;
-            double refQScale = 0;
+        FrameData::RCStatRow rowStat;
+        readRowStat(curEncData.m_rowStat[row], rowStat);
+        est.encodedBits += rowStat.encodedBits;
 
-            if (picType != I_SLICE && !m_param->rc.bEnableConstVbv)
-            {
-                FrameData& refEncData = *refFrame->m_encData;
-                uint32_t endCuAddr = maxCols * (row + 1);
-                uint32_t startCuAddr = curEncData.m_rowStat[row].numEncodedCUs;
-                if (startCuAddr)
-                {
-                    for (uint32_t cuAddr = startCuAddr + 1 ; cuAddr < endCuAddr; cuAddr++)
-                    {
-                        refRowSatdCost += refEncData.m_cuStat[cuAddr].vbvCost;
-                        refRowBits += refEncData.m_cuStat[cuAddr].totalBits;
-                    }
-                }
-                else
-                {
-                    refRowBits = refEncData.m_rowStat[row].encodedBits;
-                    refRowSatdCost = refEncData.m_rowStat[row].satdForVbv;
-                }
+        uint32_t satdCostForPendingCus = curEncData.m_rowStat[row].satdForVbv - rowStat.rowSatd;
+        satdCostForPendingCus >>= m_lowresCostShift;
+        if (!satdCostForPendingCus)
+            continue;
 
-                refRowSatdCost >>= X265_DEPTH - 8;
-                refQScale = refEncData.m_rowStat[row].rowQpScale;
-            }
+        RowSizeEstimate::Row& pending = est.rows[est.numRows++];
+        uint32_t intraCostForPendingCus = curEncData.m_rowStat[row].intraSatdForVbv - rowStat.rowIntraSatd;
+        pending.satd = satdCostForPendingCus;
+        pending.intraSatd = intraCostForPendingCus >> m_lowresCostShift;
+        pending.refQScale = 0;
+        pending.refBits = 0;
+        pending.bBlend = false;
 
-            if (picType == I_SLICE || qScale >= refQScale)
+        if (bUseRef)
+        {
+            /* the row of the reference is complete, the costs and bits of its
+             * CTUs not encoded yet in this row are kept up to date by the
+             * thread encoding this row */
+            FrameData& refEncData = *refFrame->m_encData;
+            uint32_t refRowSatdCost, refRowBits;
+            if (rowStat.numEncodedCUs)
             {
-                if (picType == P_SLICE 
-                    && refFrame 
-                    && refFrame->m_encData->m_slice->m_sliceType == picType
-                    && refQScale > 0
-                    && refRowBits > 0
-                    && !m_param->rc.bEnableConstVbv)
-                {
-                    if (abs((int32_t)(refRowSatdCost - satdCostForPendingCus)) < (int32_t)satdCostForPendingCus / 2)
-                    {
-                        double predTotal = refRowBits * satdCostForPendingCus / refRowSatdCost * refQScale / qScale;
-                        totalSatdBits += (int32_t)((pred_s + predTotal) * 0.5);
-                        continue;
-                    }
-                }
-                totalSatdBits += (int32_t)pred_s;
+                refRowSatdCost = rowStat.refSatdLeft;
+                refRowBits = rowStat.refBitsLeft;
             }
-            else if (picType == P_SLICE)
+            else
+            {
+                refRowBits = refEncData.m_rowStat[row].encodedBits;
+                refRowSatdCost = refEncData.m_rowStat[row].satdForVbv;
+            }
+
+            refRowSatdCost >>= m_lowresCostShift;
+            pending.refQScale = refEncData.m_rowStat[row].rowQpScale;
+
+            if (picType == P_SLICE
+                && refEncData.m_slice->m_sliceType == picType
+                && pending.refQScale > 0
+                && refRowBits > 0
+                && abs((int32_t)(refRowSatdCost - satdCostForPendingCus)) < (int32_t)satdCostForPendingCus / 2)
             {
-                intraCostForPendingCus = curEncData.m_rowStat[row].intraSatdForVbv - curEncData.m_rowStat[row].rowIntraSatd;
-                intraCostForPendingCus >>= X265_DEPTH - 8;
-                /* Our QP is lower than the reference! */
-                double pred_intra = predictSize(rce->rowPred[1], qScale, intraCostForPendingCus);
-                /* Sum: better to overestimate than underestimate by using only one of the two predictors. */
-                totalSatdBits += (int32_t)(pred_intra + pred_s);
+                pending.bBlend = true;
+                pending.refBits = refRowBits * satdCostForPendingCus / refRowSatdCost * pending.refQScale;
             }
+        }
+    }
+}
+
+double RateControl::predictRowsSizeSum(RowSizeEstimate& est, int picType, double qpVbv)
+{
+    uint32_t totalSatdBits = 0;
+    double qScale = x265_qp2qScale(qpVbv);
+
+    for (uint32_t i = 0; i < est.numRows; i++)
+    {
+        const RowSizeEstimate::Row& pending = est.rows[i];
+        double pred_s = predictSize(&est.pred[0], qScale, pending.satd);
+
+        if (picType == I_SLICE || qScale >= pending.refQScale)
+        {
+            if (pending.bBlend)
+                totalSatdBits += (int32_t)((pred_s + pending.refBits / qScale) * 0.5);
             else
                 totalSatdBits += (int32_t)pred_s;
         }
+        else if (picType == P_SLICE)
+        {
+            /* Our QP is lower than the reference! */
+            double pred_intra = predictSize(&est.pred[1], qScale, pending.intraSatd);
+            /* Sum: better to overestimate than underestimate by using only one of the two predictors. */
+            totalSatdBits += (int32_t)(pred_intra + pred_s);
+        }
+        else
+            totalSatdBits += (int32_t)pred_s;
     }
 
-    return totalSatdBits + encodedBitsSoFar;
+    return totalSatdBits + est.encodedBits;
 }
 
-int RateControl::rowVbvRateControl(Frame* curFrame, uint32_t row, RateControlEntry* rce, double& qpVbv, uint32_t* m_sliceBaseRow, uint32_t sliceId)
+int RateControl::rowVbvRateControl(Frame* curFrame, uint32_t row, RateControlEntry* rce, double& qpVbv, uint32_t* m_sliceBaseRow, uint32_t sliceId, RowSizeEstimate::Row* rowScratch)
 {
     FrameData& curEncData = *curFrame->m_encData;
     double qScaleVbv = x265_qp2qScale(qpVbv);
     uint64_t rowSatdCost = curEncData.m_rowStat[row].rowSatd;
     double encodedBits = curEncData.m_rowStat[row].encodedBits;
 
-    rowSatdCost >>= X265_DEPTH - 8;
+    rowSatdCost >>= m_lowresCostShift;
     updatePredictor(rce->rowPred[0], qScaleVbv, (double)rowSatdCost, encodedBits);
     if (curEncData.m_slice->m_sliceType != I_SLICE && !m_param->rc.bEnableConstVbv)
     {
@@ -2578,7 +3076,7 @@ int RateControl::rowVbvRateControl(Frame* curFrame, uint32_t row, RateControlEnt
         if (qpVbv < refFrame->m_encData->m_rowStat[row].rowQp)
         {
             uint64_t intraRowSatdCost = curEncData.m_rowStat[row].rowIntraSatd;
-            intraRowSatdCost >>= X265_DEPTH - 8;
+            intraRowSatdCost >>= m_lowresCostShift;
             updatePredictor(rce->rowPred[1], qScaleVbv, (double)intraRowSatdCost, encodedBits);
         }
     }
@@ -2606,8 +3104,12 @@ int RateControl::rowVbvRateControl(Frame* curFrame, uint32_t row, RateControlEnt
     {
         /* More threads means we have to be more cautious in letting ratecontrol use up extra bits. */
         double rcTol = bufferLeftPlanned / m_param->frameNumThreads * m_rateTolerance;
-        int32_t encodedBitsSoFar = 0;
-        double accFrameBits = predictRowsSizeSum(curFrame, rce, qpVbv, encodedBitsSoFar);
+        RowSizeEstimate est;
+        est.rows = rowScratch;
+        estimateRowsSize(curFrame, rce, est);
+        int32_t encodedBitsSoFar = est.encodedBits;
+        int picType = curEncData.m_slice->m_sliceType;
+        double accFrameBits = predictRowsSizeSum(est, picType, qpVbv);
         double vbvEndBias = 0.95;
 
         /* * Don't increase the row QPs until a sufficent amount of the bits of
@@ -2635,7 +3137,7 @@ int RateControl::rowVbvRateControl(Frame* curFrame, uint32_t row, RateControlEnt
                    && (!m_param->rc.bStrictCbr ? 1 : abrOvershoot > 0.1)))
         {
             qpVbv += stepSize;
-            accFrameBits = predictRowsSizeSum(curFrame, rce, qpVbv, encodedBitsSoFar);
+            accFrameBits = predictRowsSizeSum(est, picType, qpVbv);
             abrOvershoot = (accFrameBits + m_totalBits - m_wantedBitsWindow) / totalBitsNeeded;
         }
 
@@ -2647,7 +3149,7 @@ int RateControl::rowVbvRateControl(Frame* curFrame, uint32_t row, RateControlEnt
                    && (!m_param->rc.bStrictCbr ? 1 : abrOvershoot < 0)))
         {
             qpVbv -= stepSize;
-            accFrameBits = predictRowsSizeSum(curFrame, rce, qpVbv, encodedBitsSoFar);
+            accFrameBits = predictRowsSizeSum(est, picType, qpVbv);
             abrOvershoot = (accFrameBits + m_totalBits - m_wantedBitsWindow) / totalBitsNeeded;
         }
 
@@ -2658,14 +3160,14 @@ int RateControl::rowVbvRateControl(Frame* curFrame, uint32_t row, RateControlEnt
                    (timeDone > 0.75 && abrOvershoot > 0))
             {
                 qpVbv += stepSize;
-                accFrameBits = predictRowsSizeSum(curFrame, rce, qpVbv, encodedBitsSoFar);
+                accFrameBits = predictRowsSizeSum(est, picType, qpVbv);
                 abrOvershoot = (accFrameBits + m_totalBits - m_wantedBitsWindow) / totalBitsNeeded;
             }
             if (qpVbv > curEncData.m_rowStat[0].rowQp &&
                 abrOvershoot < -0.1 && timeDone > 0.5 && accFrameBits < rce->frameSizePlanned - rcTol)
             {
                 qpVbv -= stepSize;
-                accFrameBits = predictRowsSizeSum(curFrame, rce, qpVbv, encodedBitsSoFar);
+                accFrameBits = predictRowsSizeSum(est, picType, qpVbv);
             }
         }
 
@@ -2675,7 +3177,7 @@ int RateControl::rowVbvRateControl(Frame* curFrame, uint32_t row, RateControlEnt
                    (rce->frameSizeMaximum - accFrameBits < rce->frameSizeMaximum * maxFrameError)))
         {
             qpVbv += stepSize;
-            accFrameBits = predictRowsSizeSum(curFrame, rce, qpVbv, encodedBitsSoFar);
+            accFrameBits = predictRowsSizeSum(est, picType, qpVbv);
         }
 
         rce->frameSizeEstimated = accFrameBits;
@@ -2699,8 +3201,10 @@ int RateControl::rowVbvRateControl(Frame* curFrame, uint32_t row, RateControlEnt
     }
     else
     {
-        int32_t encodedBitsSoFar = 0;
-        rce->frameSizeEstimated = predictRowsSizeSum(curFrame, rce, qpVbv, encodedBitsSoFar);
+        RowSizeEstimate est;
+        est.rows = rowScratch;
+        estimateRowsSize(curFrame, rce, est);
+        rce->frameSizeEstimated = predictRowsSizeSum(est, curEncData.m_slice->m_sliceType, qpVbv);
 
         /* Last-ditch attempt: if the last row of the frame underflowed the VBV,
          * try again. */
@@ -2770,7 +3274,8 @@ int RateControl::updateVbv(int64_t bits, RateControlEntry* rce)
     predType = rce->sliceType == B_SLICE && rce->keptAsRef ? 3 : predType;
     if (rce->lastSatd >= m_ncu && rce->encodeOrder >= m_lastPredictorReset)
         updatePredictor(&m_pred[predType], x265_qp2qScale(rce->qpaRc), (double)rce->lastSatd, (double)bits);
-    if (!m_isVbv)
+    /* the warm-up frames of a planned chunk are discarded, they don't fill the buffer */
+    if (!m_isVbv || rce->encodeOrder < m_planStart)
         return 0;
 
     m_bufferFillFinal -= bits;
@@ -2810,7 +3315,7 @@ int RateControl::updateVbv(int64_t bits, RateControlEntry* rce)
 int RateControl::rateControlEnd(Frame* curFrame, int64_t bits, RateControlEntry* rce, int *filler)
 {
     int orderValue = m_startEndOrder.get();
-    int endOrdinal = (rce->encodeOrder + m_param->frameNumThreads) * 2 - 1;
+    int endOrdinal = (rce->startEndSlot + m_param->frameNumThreads) * 2 - 1;
     while (orderValue < endOrdinal && !m_bTerminated)
     {
         /* no more frames are being encoded, so fake the start event if we would
@@ -2935,7 +3440,7 @@ int RateControl::rateControlEnd(Frame* curFrame, int64_t bits, RateControlEntry*
         curFrame->m_rcData->encodedBits = m_encodedBits;
     }
 
-    if (m_2pass)
+    if (m_2pass && rce->encodeOrder >= m_planStart)
     {
         m_expectedBitsSum += qScale2bits(rce, x265_qp2qScale(rce->newQp));
         m_totalBits += bits - rce->rowTotalBits;
@@ -2957,9 +3462,9 @@ int RateControl::rateControlEnd(Frame* curFrame, int64_t bits, RateControlEntry*
             const VUI *vui = &curEncData.m_slice->m_sps->vuiParameters;
             const HRDInfo *hrd = &vui->hrdParameters;
             const TimingInfo *time = &vui->timingInfo;
-            if (!curFrame->m_poc)
+            if (!curFrame->m_poc || curFrame->m_poc == m_planStart)
             {
-                // first access unit initializes the HRD
+                // first access unit (of the chunk) initializes the HRD
                 rce->hrdTiming->cpbInitialAT = 0;
                 rce->hrdTiming->cpbRemovalTime = m_nominalRemovalTime = (double)m_bufPeriodSEI.m_initialCpbRemovalDelay / 90000;
             }
@@ -2980,7 +3485,7 @@ int RateControl::rateControlEnd(Frame* curFrame, int64_t bits, RateControlEntry*
     }
     rce->isActive = false;
     // Allow rateControlStart of next frame only when rateControlEnd of previous frame is over
-    m_startEndOrder.incr();
+    advanceStartEndOrder();
     return 0;
 }
 
@@ -2993,7 +3498,69 @@ int RateControl::writeRateControlFrameStats(Frame* curFrame, RateControlEntry* r
         : rce->sliceType == P_SLICE ? 'P'
         : IS_REFERENCED(curFrame) ? 'B' : 'b';
     
-    if (!curEncData.m_param->bMultiPassOptRPS)
+    if (m_param->statsFormat == X265_STATS_BINARY)
+    {
+        RPS* rps = &curFrame->m_encData->m_slice->m_rps;
+        StatsFrameRecord rec;
+        static const uint8_t zeros[8] = { 0 };
+        memset(&rec, 0, sizeof(rec));
+        rec.poc = rce->poc;
+        rec.encodeOrder = rce->encodeOrder;
+        rec.coeffBits = curEncData.m_frameStats.coeffBits;
+        rec.mvBits = curEncData.m_frameStats.mvBits;
+        rec.miscBits = curEncData.m_frameStats.miscBits;
+        rec.qpRc = curEncData.m_avgQpRc;
+        rec.qpAq = curEncData.m_avgQpAq;
+        rec.qpNoVbv = rce->qpNoVbv;
+        rec.qRceq = rce->qRceq;
+        rec.iCuCount = curEncData.m_frameStats.percent8x8Intra * m_ncu;
+        rec.pCuCount = curEncData.m_frameStats.percent8x8Inter * m_ncu;
+        rec.skipCuCount = curEncData.m_frameStats.percent8x8Skip * m_ncu;
+        rec.numberOfPictures = (uint8_t)rps->numberOfPictures;
+        rec.numberOfNegativePictures = (uint8_t)rps->numberOfNegativePictures;
+        rec.numberOfPositivePictures = (uint8_t)rps->numberOfPositivePictures;
+        for (int i = 0; i < rps->numberOfPictures; i++)
+        {
+            rec.deltaPOC[i] = rps->deltaPOC[i];
+            rec.usedMask |= (uint16_t)(rps->bUsed[i] << i);
+        }
+        rec.type = cType;
+        rec.scenecut = curFrame->m_lowres.bScenecut;
+        /* a later pass writes back the offsets it has read */
+        if (m_param->rc.cuTree && IS_REFERENCED(curFrame))
+            rec.numQpOffsets = ncu;
+
+        if (rce->encodeOrder >= m_statsOutAlloc)
+        {
+            int alloc = X265_MAX(2 * m_statsOutAlloc, rce->encodeOrder + 1024);
+            uint64_t* index = X265_MALLOC(uint64_t, alloc);
+            if (!index)
+                goto writeFailure;
+            memset(index, 0, alloc * sizeof(uint64_t));
+            if (m_statsOutIndex)
+                memcpy(index, m_statsOutIndex, m_statsOutAlloc * sizeof(uint64_t));
+            X265_FREE(m_statsOutIndex);
+            m_statsOutIndex = index;
+            m_statsOutAlloc = alloc;
+        }
+        m_statsOutIndex[rce->encodeOrder] = m_statsOutBytes;
+        m_statsOutFrames = X265_MAX(m_statsOutFrames, rce->encodeOrder + 1);
+
+        if (fwrite(&rec, sizeof(rec), 1, m_statFileOut) < 1)
+            goto writeFailure;
+        m_statsOutBytes += sizeof(rec);
+        if (rec.numQpOffsets)
+        {
+            size_t pad = (8 - ncu * sizeof(uint16_t) % 8) % 8;
+            primitives.fix8Pack(m_cuTreeStats.qpBuffer[0], curFrame->m_lowres.qpCuTreeOffset, ncu);
+            if (fwrite(m_cuTreeStats.qpBuffer[0], sizeof(uint16_t), ncu, m_statFileOut) < (size_t)ncu ||
+                fwrite(zeros, 1, pad, m_statFileOut) < pad)
+                goto writeFailure;
+            m_statsOutBytes += ncu * sizeof(uint16_t) + pad;
+        }
+        return 0;
+    }
+    else if (!curEncData.m_param->bMultiPassOptRPS)
     {
         if (fprintf(m_statFileOut,
             "in:%d out:%d type:%c q:%.2f q-aq:%.2f q-noVbv:%.2f q-Rceq:%.2f tex:%d mv:%d misc:%d icu:%.2f pcu:%.2f scu:%.2f sc:%d ;\n",
@@ -3044,7 +3611,7 @@ int RateControl::writeRateControlFrameStats(Frame* curFrame, RateControlEntry* r
             goto writeFailure;
     }
     /* Don't re-write the data in multi-pass mode. */
-    if (m_param->rc.cuTree && IS_REFERENCED(curFrame) && !m_param->rc.bStatRead)
+    if (m_param->rc.cuTree && IS_REFERENCED(curFrame) && m_cutreeStatFileOut)
     {
         uint8_t sliceType = (uint8_t)rce->sliceType;
         primitives.fix8Pack(m_cuTreeStats.qpBuffer[0], curFrame->m_lowres.qpCuTreeOffset, ncu);
@@ -3072,6 +3639,55 @@ void RateControl::setFinalFrameCount(int count)
     m_startEndOrder.poke();
 }
 
+#define SKIPPED_SLOT(slot) m_skippedSlot[(slot) % (2 * X265_MAX_FRAME_THREADS)]
+
+/* called by the API thread for each frame encoder it visits, in visit order */
+int RateControl::allocStartEndSlot(bool bSkipped)
+{
+    ScopedLock lock(m_startEndLock);
+    int slot = m_startEndSlots++;
+    SKIPPED_SLOT(slot) = bSkipped;
+
+    /* if the preceding event has already completed, start the skipped slot here */
+    if (bSkipped && m_startEndOrder.get() == slot * 2)
+        incrStartEndOrder();
+    return slot;
+}
+
+void RateControl::advanceStartEndOrder()
+{
+    ScopedLock lock(m_startEndLock);
+    incrStartEndOrder();
+}
+
+/* Completes the current event of m_startEndOrder, then any events which
+ * follow it and belong to skipped slots or to the negative slots preceding
+ * the first frame, which have no frame encoder to perform them. Must be
+ * called with m_startEndLock held */
+void RateControl::incrStartEndOrder()
+{
+    m_startEndOrder.incr();
+    int next = m_startEndOrder.get();
+    for (;;)
+    {
+        if (next & 1)
+        {
+            /* end event of slot, performed after the start of slot + frameNumThreads - 1 */
+            int slot = (next + 1) / 2 - m_param->frameNumThreads;
+            if (slot >= m_startEndSlots || (slot >= 0 && !SKIPPED_SLOT(slot)))
+                break;
+        }
+        else
+        {
+            int slot = next / 2;
+            if (slot >= m_startEndSlots || !SKIPPED_SLOT(slot))
+                break;
+        }
+        m_startEndOrder.incr();
+        next++;
+    }
+}
+
 /* called when the encoder is closing, and no more frames will be output.
  * all blocked functions must finish so the frame encoder threads can be
  * closed */
@@ -3088,8 +3704,22 @@ void RateControl::destroy()
     if (!fileName)
         fileName = s_defaultStatFileName;
 
+    /* unmapped first, the output may replace it */
+    x265_unmap_file(m_statsMap, m_statsMapSize);
+    m_statsMap = NULL;
+
     if (m_statFileOut)
     {
+        if (m_param->statsFormat == X265_STATS_BINARY)
+        {
+            /* append the index, then complete the header */
+            StatsFileHeader& header = m_statsOutHeader;
+            header.numFrames = m_statsOutFrames;
+            header.indexOffset = m_statsOutBytes;
+            if ((m_statsOutFrames && fwrite(m_statsOutIndex, sizeof(uint64_t), m_statsOutFrames, m_statFileOut) < (size_t)m_statsOutFrames) ||
+                fseek(m_statFileOut, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, m_statFileOut) < 1)
+                x265_log(m_param, X265_LOG_ERROR, "stats file write failure\n");
+        }
         fclose(m_statFileOut);
         char *tmpFileName = strcatFilename(fileName, ".temp");
         int bError = 1;
@@ -3127,6 +3757,7 @@ void RateControl::destroy()
     if (m_cutreeStatFileIn)
         fclose(m_cutreeStatFileIn);
 
+    X265_FREE(m_statsOutIndex);
     X265_FREE(m_rce2Pass);
     X265_FREE(m_encOrder);
     for (int i = 0; i < 2; i++)
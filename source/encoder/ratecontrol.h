@@ -60,6 +60,26 @@ struct Predictor
     double offset;
 };
 
+/* Prediction of the bits of the CTU rows of a frame which are not encoded yet,
+ * taken once per rowVbvRateControl() call so that its QP search evaluates the
+ * frame size at each QP step without reading the rows of the other threads */
+struct RowSizeEstimate
+{
+    struct Row
+    {
+        double satd;       /* lowres cost of the pending CTUs */
+        double intraSatd;  /* lowres intra cost of the pending CTUs */
+        double refQScale;  /* qscale of the same row of the L0 reference, 0 if unused */
+        double refBits;    /* bits of the reference row scaled to satd, times refQScale */
+        bool   bBlend;     /* average the predictor with refBits (P slices) */
+    };
+
+    Predictor pred[2];     /* row predictors of the frame when taken */
+    int32_t   encodedBits; /* bits of the CTUs already encoded */
+    uint32_t  numRows;
+    Row*      rows;        /* numCuInHeight entries, owned by the caller */
+};
+
 struct HRDTiming
 {
     double cpbInitialAT;
@@ -68,6 +88,62 @@ struct HRDTiming
     double cpbRemovalTime;
 };
 
+/* Binary multi-pass stats file (--stats-format binary), in native byte order:
+ * the header, the NUL terminated options string (padded to 8 bytes), one
+ * StatsFrameRecord per frame followed by its fix8 cuTree offsets (padded to 8
+ * bytes), and at indexOffset the file offsets of the records, in encode order.
+ * numFrames and indexOffset are written when the file is closed.
+ * x265_stats_merge() appends at planOffset one StatsPlanEntry per frame, the
+ * slice of the rate control plan of a whole title for the chunk of the file */
+#define X265_STATS_MAGIC   "x265stat"
+#define X265_STATS_VERSION 2
+
+struct StatsFileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;     /* sizeof(StatsFileHeader), the options follow */
+    uint32_t optionsSize;    /* padded size of the options string */
+    uint32_t numFrames;
+    uint64_t indexOffset;
+    uint64_t planOffset;     /* 0 if the file holds no plan */
+    uint32_t planStart;      /* encode order of the first frame of the chunk */
+    uint32_t reserved;
+    double   planBufferFill; /* planned VBV fill in bits before planStart */
+};
+
+struct StatsPlanEntry
+{
+    double   qScale;         /* 0 for the warm-up frames before planStart */
+    double   expectedVbv;
+    uint64_t expectedBits;   /* from planStart */
+};
+
+struct StatsFrameRecord
+{
+    int32_t  poc;
+    int32_t  encodeOrder;
+    int32_t  coeffBits;
+    int32_t  mvBits;
+    int32_t  miscBits;
+    uint32_t numQpOffsets;   /* cuTree offsets following the record, 0 if none */
+    double   qpRc;
+    double   qpAq;
+    double   qpNoVbv;
+    double   qRceq;
+    double   iCuCount;
+    double   pCuCount;
+    double   skipCuCount;
+    int32_t  deltaPOC[MAX_NUM_REF_PICS];
+    uint16_t usedMask;       /* bUsed of the RPS pictures, bit i for picture i */
+    uint8_t  numberOfPictures;
+    uint8_t  numberOfNegativePictures;
+    uint8_t  numberOfPositivePictures;
+    char     type;           /* I i P B b, as in the text stats */
+    uint8_t  scenecut;
+    uint8_t  reserved;
+};
+
 struct RateControlEntry
 {
     Predictor  rowPreds[3][2];
@@ -97,6 +173,7 @@ struct RateControlEntry
     int     bframes;
     int     poc;
     int     encodeOrder;
+    int     startEndSlot;      /* position in m_startEndOrder; encodeOrder plus slots of parked frame encoders */
     bool    bLastMiniGopBFrame;
     bool    isActive;
     double  amortizeFrames;
@@ -132,6 +209,7 @@ public:
     SliceType   m_sliceType;     /* Current frame type */
     int         m_ncu;           /* number of CUs in a frame */
     int         m_qp;            /* updated qp for current frame */
+    int         m_lowresCostShift; /* to 8-bit scale, the lowres costs of --lowres-8bit already are */
 
     /*Zone reconfiguration*/
     double*     m_relativeComplexity;
@@ -219,9 +297,18 @@ public:
      * rceUpdate 12
      * rceEnd    11 */
     ThreadSafeInteger m_startEndOrder;
-    int     m_finalFrameCount;   /* set when encoder begins flushing */
+    int     m_finalFrameCount;   /* set when encoder begins flushing, counted in slots */
     bool    m_bTerminated;       /* set true when encoder is closing */
 
+    /* Every frame encoder visit of the API thread takes a slot of m_startEndOrder.
+     * Frame encoders parked by --adaptive-frame-threads take skipped slots, whose
+     * start and end events are performed by the event preceding them, so every
+     * frame keeps waiting on the same number of slots. Flags are kept for two
+     * rounds of frame encoders */
+    Lock    m_startEndLock;
+    int     m_startEndSlots;
+    bool    m_skippedSlot[2 * X265_MAX_FRAME_THREADS];
+
     /* hrd stuff */
     SEIBufferingPeriod m_bufPeriodSEI;
     double  m_nominalRemovalTime;
@@ -234,9 +321,21 @@ public:
     int     m_numEntries;
     int     m_start;
     int     m_reencode;
+    int     m_planStart;     /* first frame of a chunk planned by x265_stats_merge(), the frames before are not accounted */
     FILE*   m_statFileOut;
     FILE*   m_cutreeStatFileOut;
     FILE*   m_cutreeStatFileIn;
+
+    /* binary stats: the mapped input file and its record index, and the
+     * record offsets of the output file, written when it is closed */
+    uint8_t*        m_statsMap;
+    size_t          m_statsMapSize;
+    const uint64_t* m_statsIndex;
+    StatsFileHeader m_statsOutHeader;
+    uint64_t*       m_statsOutIndex;
+    int             m_statsOutFrames;
+    int             m_statsOutAlloc;
+    uint64_t        m_statsOutBytes;
     double  m_lastAccumPNorm;
     double  m_expectedBitsSum;   /* sum of qscale2bits after rceq, ratefactor, and overflow, only includes finished frames */
     int64_t m_predictedBits;
@@ -257,6 +356,8 @@ public:
     void reconfigureRC();
 
     void setFinalFrameCount(int count);
+    int  allocStartEndSlot(bool bSkipped);
+    void advanceStartEndOrder(); /* complete the current start or end event */
     void terminate();          /* un-block all waiting functions so encoder may close */
     void destroy();
 
@@ -264,13 +365,16 @@ public:
     int  rateControlStart(Frame* curFrame, RateControlEntry* rce, Encoder* enc);
     void rateControlUpdateStats(RateControlEntry* rce);
     int  rateControlEnd(Frame* curFrame, int64_t bits, RateControlEntry* rce, int *filler);
-    int  rowVbvRateControl(Frame* curFrame, uint32_t row, RateControlEntry* rce, double& qpVbv, uint32_t* m_sliceBaseRow, uint32_t sliceId);
+    int  rowVbvRateControl(Frame* curFrame, uint32_t row, RateControlEntry* rce, double& qpVbv, uint32_t* m_sliceBaseRow, uint32_t sliceId, RowSizeEstimate::Row* rowScratch);
     int  rateControlSliceType(int frameNum);
     bool cuTreeReadFor2Pass(Frame* curFrame);
+    const StatsFrameRecord* statsFrame(int encodeOrder) const;
     void hrdFullness(SEIBufferingPeriod* sei);
     int writeRateControlFrameStats(Frame* curFrame, RateControlEntry* rce);
     bool   initPass2();
 
+    static bool mergeChunkStats(x265_param& param, const char* const* statsFiles, int numFiles);
+
     double forwardMasking(Frame* curFrame, double q);
     double backwardMasking(Frame* curFrame, double q);
 
@@ -287,6 +391,7 @@ protected:
     int    m_partialResidualCost;
 
     x265_zone* getZone();
+    void incrStartEndOrder();
     double getQScale(RateControlEntry *rce, double rateFactor);
     double rateEstimateQscale(Frame* pic, RateControlEntry *rce); // main logic for calculating QP based on ABR
     double tuneAbrQScaleFromFeedback(double qScale);
@@ -300,8 +405,10 @@ protected:
     void   updateVbvPlan(Encoder* enc);
     double predictSize(Predictor *p, double q, double var);
     void   checkAndResetABR(RateControlEntry* rce, bool isFrameDone);
-    double predictRowsSizeSum(Frame* pic, RateControlEntry* rce, double qpm, int32_t& encodedBits);
+    void   estimateRowsSize(Frame* pic, RateControlEntry* rce, RowSizeEstimate& est);
+    double predictRowsSizeSum(RowSizeEstimate& est, int sliceType, double qpm);
     bool   analyseABR2Pass(uint64_t allAvailableBits);
+    bool   readStatsPlan(const StatsFileHeader& header);
     void   initFramePredictors();
     double getDiffLimitedQScale(RateControlEntry *rce, double q);
     double countExpectedBits(int startPos, int framesCount);
@@ -43,9 +43,9 @@ MotionReference::MotionReference()
 MotionReference::~MotionReference()
 {
     X265_FREE(numSliceWeightedRows);
-    X265_FREE(weightBuffer[0]);
-    X265_FREE(weightBuffer[1]);
-    X265_FREE(weightBuffer[2]);
+    X265_FREE_PAGES(weightBuffer[0]);
+    X265_FREE_PAGES(weightBuffer[1]);
+    X265_FREE_PAGES(weightBuffer[2]);
 }
 
 int MotionReference::init(PicYuv* recPic, WeightParam *wp, const x265_param& p)
@@ -94,7 +94,7 @@ int MotionReference::init(PicYuv* recPic, WeightParam *wp, const x265_param& p)
                 if (!weightBuffer[c])
                 {
                     size_t padheight = (numCUinHeight * cuHeight) + marginY * 2;
-                    weightBuffer[c] = X265_MALLOC(pixel, stride * padheight);
+                    weightBuffer[c] = (pixel*)x265_malloc_pages(sizeof(pixel) * stride * padheight, !!p.bHugePages);
                     if (!weightBuffer[c])
                         return -1;
                 }
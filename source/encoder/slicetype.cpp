@@ -89,69 +89,21 @@ namespace X265_NS {
 
 bool computeEdge(pixel* edgePic, pixel* refPic, pixel* edgeTheta, intptr_t stride, int height, int width, bool bcalcTheta, pixel whitePixel)
 {
-    intptr_t rowOne = 0, rowTwo = 0, rowThree = 0, colOne = 0, colTwo = 0, colThree = 0;
-    intptr_t middle = 0, topLeft = 0, topRight = 0, bottomLeft = 0, bottomRight = 0;
-
-    const int startIndex = 1;
-
     if (!edgePic || !refPic || (!edgeTheta && bcalcTheta))
-    {
         return false;
-    }
-    else
+
+    //Applying Sobel filter expect for border pixels
+    for (int rowNum = 1; rowNum < height - 1; rowNum++)
     {
-        float gradientH = 0, gradientV = 0, radians = 0, theta = 0;
-        float gradientMagnitude = 0;
-        pixel blackPixel = 0;
-
-        //Applying Sobel filter expect for border pixels
-        height = height - startIndex;
-        width = width - startIndex;
-        for (int rowNum = startIndex; rowNum < height; rowNum++)
-        {
-            rowTwo = rowNum * stride;
-            rowOne = rowTwo - stride;
-            rowThree = rowTwo + stride;
-
-            for (int colNum = startIndex; colNum < width; colNum++)
-            {
-
-                 /*  Horizontal and vertical gradients
-                     [ -3   0   3 ]        [-3   -10  -3 ]
-                 gH =[ -10  0   10]   gV = [ 0    0    0 ]
-                     [ -3   0   3 ]        [ 3    10   3 ] */
-
-                colTwo = colNum;
-                colOne = colTwo - startIndex;
-                colThree = colTwo + startIndex;
-                middle = rowTwo + colTwo;
-                topLeft = rowOne + colOne;
-                topRight = rowOne + colThree;
-                bottomLeft = rowThree + colOne;
-                bottomRight = rowThree + colThree;
-                gradientH = (float)(-3 * refPic[topLeft] + 3 * refPic[topRight] - 10 * refPic[rowTwo + colOne] + 10 * refPic[rowTwo + colThree] - 3 * refPic[bottomLeft] + 3 * refPic[bottomRight]);
-                gradientV = (float)(-3 * refPic[topLeft] - 10 * refPic[rowOne + colTwo] - 3 * refPic[topRight] + 3 * refPic[bottomLeft] + 10 * refPic[rowThree + colTwo] + 3 * refPic[bottomRight]);
-                gradientMagnitude = sqrtf(gradientH * gradientH + gradientV * gradientV);
-                if(bcalcTheta) 
-                {
-                    edgeTheta[middle] = 0;
-                    radians = atan2(gradientV, gradientH);
-                    theta = (float)((radians * 180) / PI);
-                    if (theta < 0)
-                       theta = 180 + theta;
-                    edgeTheta[middle] = (pixel)theta;
-                }
-                edgePic[middle] = (pixel)(gradientMagnitude >= EDGE_THRESHOLD ? whitePixel : blackPixel);
-            }
-        }
-        return true;
+        intptr_t offset = rowNum * stride + 1;
+        primitives.edgeSobel(edgePic + offset, bcalcTheta ? edgeTheta + offset : NULL, refPic + offset, stride, width - 2, whitePixel);
     }
+    return true;
 }
 
-void edgeFilter(Frame *curFrame, x265_param* param)
+void edgeFilter(Frame *curFrame, x265_param* param, ThreadPool* pool)
 {
     int height = curFrame->m_fencPic->m_picHeight;
-    int width = curFrame->m_fencPic->m_picWidth;
     intptr_t stride = curFrame->m_fencPic->m_stride;
     uint32_t numCuInHeight = (height + param->maxCUSize - 1) / param->maxCUSize;
     int maxHeight = numCuInHeight * param->maxCUSize;
@@ -160,58 +112,67 @@ void edgeFilter(Frame *curFrame, x265_param* param)
     memset(curFrame->m_gaussianPic, 0, stride * (maxHeight + (curFrame->m_fencPic->m_lumaMarginY * 2)) * sizeof(pixel));
     memset(curFrame->m_thetaPic, 0, stride * (maxHeight + (curFrame->m_fencPic->m_lumaMarginY * 2)) * sizeof(pixel));
 
-    pixel *src = (pixel*)curFrame->m_fencPic->m_picOrg[0];
-    pixel *edgePic = curFrame->m_edgePic + curFrame->m_fencPic->m_lumaMarginY * stride + curFrame->m_fencPic->m_lumaMarginX;
-    pixel *refPic = curFrame->m_gaussianPic + curFrame->m_fencPic->m_lumaMarginY * stride + curFrame->m_fencPic->m_lumaMarginX;
-    pixel *edgeTheta = curFrame->m_thetaPic + curFrame->m_fencPic->m_lumaMarginY * stride + curFrame->m_fencPic->m_lumaMarginX;
+    EdgeFilterGroup group(curFrame);
+    group.m_jobTotal = (height + EdgeFilterGroup::BAND_ROWS - 1) / EdgeFilterGroup::BAND_ROWS;
 
-    for (int i = 0; i < height; i++)
+    /* the Gaussian blur of every band must complete before the Sobel pass reads
+     * the rows above and below its own */
+    for (int pass = 0; pass < 2; pass++)
     {
-        memcpy(edgePic, src, width * sizeof(pixel));
-        memcpy(refPic, src, width * sizeof(pixel));
-        src += stride;
-        edgePic += stride;
-        refPic += stride;
+        group.m_bSobel = !!pass;
+        group.m_jobAcquired = 0;
+        if (pool && group.m_jobTotal > 1)
+            group.tryBondPeers(*pool, group.m_jobTotal - 1);
+        group.processTasks(-1);
+        group.waitForExit();
     }
+}
 
-    //Applying Gaussian filter on the picture
-    src = (pixel*)curFrame->m_fencPic->m_picOrg[0];
-    refPic = curFrame->m_gaussianPic + curFrame->m_fencPic->m_lumaMarginY * stride + curFrame->m_fencPic->m_lumaMarginX;
-    edgePic = curFrame->m_edgePic + curFrame->m_fencPic->m_lumaMarginY * stride + curFrame->m_fencPic->m_lumaMarginX;
-    pixel pixelValue = 0;
+void EdgeFilterGroup::processTasks(int /*workerThreadID*/)
+{
+    PicYuv* fencPic = m_frame->m_fencPic;
+    int height = fencPic->m_picHeight;
+    int width = fencPic->m_picWidth;
+    intptr_t stride = fencPic->m_stride;
+    intptr_t marginOffset = fencPic->m_lumaMarginY * stride + fencPic->m_lumaMarginX;
+    pixel* src = fencPic->m_picOrg[0];
+    pixel* edgePic = m_frame->m_edgePic + marginOffset;
+    pixel* refPic = m_frame->m_gaussianPic + marginOffset;
+    pixel* edgeTheta = m_frame->m_thetaPic + marginOffset;
 
-    for (int rowNum = 0; rowNum < height; rowNum++)
+    m_lock.acquire();
+    while (m_jobAcquired < m_jobTotal)
     {
-        for (int colNum = 0; colNum < width; colNum++)
+        int band = m_jobAcquired++;
+        m_lock.release();
+
+        int rowStart = band * BAND_ROWS;
+        int rowEnd = X265_MIN(rowStart + BAND_ROWS, height);
+        for (int rowNum = rowStart; rowNum < rowEnd; rowNum++)
         {
-            if ((rowNum >= 2) && (colNum >= 2) && (rowNum != height - 2) && (colNum != width - 2)) //Ignoring the border pixels of the picture
+            intptr_t offset = rowNum * stride;
+            if (m_bSobel)
             {
-                /*  5x5 Gaussian filter
-                    [2   4   5   4   2]
-                 1  [4   9   12  9   4]
-                --- [5   12  15  12  5]
-                159 [4   9   12  9   4]
-                    [2   4   5   4   2]*/
+                //Applying Sobel filter expect for border pixels
+                if (rowNum >= 1 && rowNum < height - 1)
+                    primitives.edgeSobel(edgePic + offset + 1, edgeTheta + offset + 1, refPic + offset + 1, stride, width - 2, (pixel)EDGE_THRESHOLD);
+                continue;
+            }
 
-                const intptr_t rowOne = (rowNum - 2)*stride, colOne = colNum - 2;
-                const intptr_t rowTwo = (rowNum - 1)*stride, colTwo = colNum - 1;
-                const intptr_t rowThree = rowNum * stride, colThree = colNum;
-                const intptr_t rowFour = (rowNum + 1)*stride, colFour = colNum + 1;
-                const intptr_t rowFive = (rowNum + 2)*stride, colFive = colNum + 2;
-                const intptr_t index = (rowNum*stride) + colNum;
+            memcpy(edgePic + offset, src + offset, width * sizeof(pixel));
+            memcpy(refPic + offset, src + offset, width * sizeof(pixel));
 
-                pixelValue = ((2 * src[rowOne + colOne] + 4 * src[rowOne + colTwo] + 5 * src[rowOne + colThree] + 4 * src[rowOne + colFour] + 2 * src[rowOne + colFive] +
-                    4 * src[rowTwo + colOne] + 9 * src[rowTwo + colTwo] + 12 * src[rowTwo + colThree] + 9 * src[rowTwo + colFour] + 4 * src[rowTwo + colFive] +
-                    5 * src[rowThree + colOne] + 12 * src[rowThree + colTwo] + 15 * src[rowThree + colThree] + 12 * src[rowThree + colFour] + 5 * src[rowThree + colFive] +
-                    4 * src[rowFour + colOne] + 9 * src[rowFour + colTwo] + 12 * src[rowFour + colThree] + 9 * src[rowFour + colFour] + 4 * src[rowFour + colFive] +
-                    2 * src[rowFive + colOne] + 4 * src[rowFive + colTwo] + 5 * src[rowFive + colThree] + 4 * src[rowFive + colFour] + 2 * src[rowFive + colFive]) / 159);
-                refPic[index] = pixelValue;
+            //Applying Gaussian filter on the picture, ignoring the border pixels
+            if (rowNum >= 2 && rowNum != height - 2)
+            {
+                primitives.edgeGaussian(refPic + offset + 2, src + offset + 2, stride, width - 4);
+                primitives.edgeGaussian(refPic + offset + width - 1, src + offset + width - 1, stride, 1);
             }
         }
-    }
 
-    if(!computeEdge(edgePic, refPic, edgeTheta, stride, height, width, true))
-        x265_log(NULL, X265_LOG_ERROR, "Failed edge computation!");
+        m_lock.acquire();
+    }
+    m_lock.release();
 }
 
 //Find the angle of a block by averaging the pixel angles 
@@ -274,6 +235,106 @@ uint32_t LookaheadTLD::acEnergyCu(Frame* curFrame, uint32_t blockX, uint32_t blo
     return var;
 }
 
+/* Find the AC energy of the blocks of full resolution rows [firstRow, lastRow)
+ * into energyCache[], in the raster order of calcAdaptiveQuantFrame() */
+void LookaheadTLD::cacheEnergyRows(Frame* curFrame, x265_param* param, int firstRow, int lastRow)
+{
+    int maxCol = curFrame->m_fencPic->m_picWidth;
+    int loopIncr = param->rc.qgSize == 8 ? 8 : 16;
+    int blocksInRow = (maxCol + loopIncr - 1) / loopIncr;
+
+    for (int blockY = firstRow; blockY < lastRow; blockY += loopIncr)
+    {
+        uint32_t* rowEnergy = energyCache + (blockY / loopIncr) * blocksInRow;
+        for (int blockX = 0, i = 0; blockX < maxCol; blockX += loopIncr, i++)
+            rowEnergy[i] = acEnergyCu(curFrame, blockX, blockY, param->internalCsp, param->rc.qgSize);
+    }
+}
+
+/* One pass of acEnergyCu() over every block of the frame: returns the energy
+ * of each block and accumulates the weighted prediction statistics. The
+ * energies are measured once per frame, normally by initLowres() */
+const uint32_t* LookaheadTLD::frameEnergy(Frame* curFrame, x265_param* param)
+{
+    Lowres& lowres = curFrame->m_lowres;
+    if (!bEnergyCached)
+    {
+        uint64_t sum[3], ssd[3];
+        for (int i = 0; i < 3; i++)
+        {
+            sum[i] = lowres.wp_sum[i];
+            ssd[i] = lowres.wp_ssd[i];
+            lowres.wp_sum[i] = lowres.wp_ssd[i] = 0;
+        }
+        cacheEnergyRows(curFrame, param, 0, curFrame->m_fencPic->m_picHeight);
+        for (int i = 0; i < 3; i++)
+        {
+            energySum[i] = lowres.wp_sum[i];
+            energySsd[i] = lowres.wp_ssd[i];
+            lowres.wp_sum[i] = sum[i];
+            lowres.wp_ssd[i] = ssd[i];
+        }
+        bEnergyCached = true;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        lowres.wp_sum[i] += energySum[i];
+        lowres.wp_ssd[i] += energySsd[i];
+    }
+    return energyCache;
+}
+
+/* true if calcAdaptiveQuantFrame() will make a pass of acEnergyCu() over the frame */
+static bool needsFrameEnergy(Frame* curFrame, x265_param* param)
+{
+    bool bWeighted = param->bEnableWeightedPred || param->bEnableWeightedBiPred;
+
+    if (param->bDynamicRefine || param->bEnableFades)
+        return true;
+    if (param->rc.bStatRead && param->rc.cuTree && IS_REFERENCED(curFrame))
+        return bWeighted;
+    if (param->rc.aqMode == X265_AQ_NONE || param->rc.aqStrength == 0)
+        return bWeighted;
+    return !param->rc.hevcAq;
+}
+
+/* Lowres init of a frame, measuring the AC energy of the blocks which will be
+ * needed by calcAdaptiveQuantFrame() in the same sweep. Each row of lowres CUs
+ * is downscaled from 2 * X265_LOWRES_CU_SIZE source rows, whose blocks are
+ * measured while those rows are still in cache */
+void LookaheadTLD::initLowres(Frame* curFrame, x265_param* param, bool bAdaptiveQuant)
+{
+    Lowres& lowres = curFrame->m_lowres;
+    PicYuv* fenc = curFrame->m_fencPic;
+
+    bEnergyCached = false;
+    if (!bAdaptiveQuant || !energyCache || !needsFrameEnergy(curFrame, param))
+    {
+        lowres.init(fenc, curFrame->m_poc);
+        return;
+    }
+
+    lowres.initState(fenc, curFrame->m_poc);
+    for (int i = 0; i < 3; i++)
+        lowres.wp_sum[i] = lowres.wp_ssd[i] = 0;
+
+    int maxRow = fenc->m_picHeight;
+    for (int row = 0; row < lowres.lines; row += X265_LOWRES_CU_SIZE)
+    {
+        lowres.initRows(fenc, row, X265_LOWRES_CU_SIZE);
+        cacheEnergyRows(curFrame, param, 2 * row, X265_MIN(2 * (row + X265_LOWRES_CU_SIZE), maxRow));
+    }
+    lowres.finishInit(fenc);
+
+    for (int i = 0; i < 3; i++)
+    {
+        energySum[i] = lowres.wp_sum[i];
+        energySsd[i] = lowres.wp_ssd[i];
+    }
+    bEnergyCached = true;
+}
+
 /* Find the sum of pixels of each block for luma plane */
 uint32_t LookaheadTLD::lumaSumCu(Frame* curFrame, uint32_t blockX, uint32_t blockY, uint32_t qgSize)
 {
@@ -441,7 +502,7 @@ void LookaheadTLD::xPreanalyze(Frame* curFrame)
     }
 }
 
-void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
+void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param, ThreadPool* pool)
 {
     /* Actual adaptive quantization */
     int maxCol = curFrame->m_fencPic->m_picWidth;
@@ -496,11 +557,7 @@ void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
 
             /* Need variance data for weighted prediction and dynamic refinement*/
             if (param->bEnableWeightedPred || param->bEnableWeightedBiPred)
-            {
-                for (int blockY = 0; blockY < maxRow; blockY += loopIncr)
-                    for (int blockX = 0; blockX < maxCol; blockX += loopIncr)
-                        acEnergyCu(curFrame, blockX, blockY, param->internalCsp, param->rc.qgSize);
-            }
+                frameEnergy(curFrame, param);
         }
         else
         {
@@ -517,7 +574,7 @@ void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
                 double strength = 0.f;
 
                 if (param->rc.aqMode == X265_AQ_EDGE)
-                    edgeFilter(curFrame, param);
+                    edgeFilter(curFrame, param, pool);
 
                 if (param->rc.aqMode == X265_AQ_EDGE && !param->bHistBasedSceneCut && param->recursionSkipMode == EDGE_BASED_RSKIP)
                 {
@@ -529,12 +586,13 @@ void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
                 if (param->rc.aqMode == X265_AQ_AUTO_VARIANCE || param->rc.aqMode == X265_AQ_AUTO_VARIANCE_BIASED || param->rc.aqMode == X265_AQ_EDGE)
                 {
                     double bit_depth_correction = 1.f / (1 << (2 * (X265_DEPTH - 8)));
+                    const uint32_t* blockEnergy = frameEnergy(curFrame, param);
                     for (int blockY = 0; blockY < maxRow; blockY += loopIncr)
                     {
                         for (int blockX = 0; blockX < maxCol; blockX += loopIncr)
                         {
                             uint32_t energy, edgeDensity, avgAngle;
-                            energy = acEnergyCu(curFrame, blockX, blockY, param->internalCsp, param->rc.qgSize);
+                            energy = blockEnergy[blockXY];
                             if (param->rc.aqMode == X265_AQ_EDGE)
                             {
                                 edgeDensity = edgeDensityCu(curFrame, avgAngle, blockX, blockY, param->rc.qgSize);
@@ -570,6 +628,7 @@ void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
                 else
                     strength = param->rc.aqStrength * 1.0397f;
 
+                const uint32_t* varianceEnergy = param->rc.aqMode == X265_AQ_VARIANCE ? frameEnergy(curFrame, param) : NULL;
                 blockXY = 0;
                 for (int blockY = 0; blockY < maxRow; blockY += loopIncr)
                 {
@@ -596,7 +655,7 @@ void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
                         }
                         else
                         {
-                            uint32_t energy = acEnergyCu(curFrame, blockX, blockY, param->internalCsp, param->rc.qgSize);
+                            uint32_t energy = varianceEnergy[blockXY];
                             qp_adj = strength * (X265_LOG2(X265_MAX(energy, 1)) - (modeOneConst + 2 * (X265_DEPTH - 8)));
                         }
 
@@ -653,11 +712,7 @@ void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
     if (param->bEnableWeightedPred || param->bEnableWeightedBiPred)
     {
         if (param->rc.bStatRead && param->rc.cuTree && IS_REFERENCED(curFrame))
-        {
-            for (int blockY = 0; blockY < maxRow; blockY += loopIncr)
-                for (int blockX = 0; blockX < maxCol; blockX += loopIncr)
-                    acEnergyCu(curFrame, blockX, blockY, param->internalCsp, param->rc.qgSize);
-        }
+            frameEnergy(curFrame, param);
 
         int hShift = CHROMA_H_SHIFT(param->internalCsp);
         int vShift = CHROMA_V_SHIFT(param->internalCsp);
@@ -677,13 +732,14 @@ void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
 
     if (param->bDynamicRefine || param->bEnableFades)
     {
+        const uint32_t* blockEnergy = frameEnergy(curFrame, param);
         uint64_t blockXY = 0, rowVariance = 0;
         curFrame->m_lowres.frameVariance = 0;
         for (int blockY = 0; blockY < maxRow; blockY += loopIncr)
         {
             for (int blockX = 0; blockX < maxCol; blockX += loopIncr)
             {
-                curFrame->m_lowres.blockVariance[blockXY] = acEnergyCu(curFrame, blockX, blockY, param->internalCsp, param->rc.qgSize);
+                curFrame->m_lowres.blockVariance[blockXY] = blockEnergy[blockXY];
                 rowVariance += curFrame->m_lowres.blockVariance[blockXY];
                 blockXY++;
             }
@@ -695,10 +751,24 @@ void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
 
 void LookaheadTLD::lowresIntraEstimate(Lowres& fenc, uint32_t qgSize)
 {
-    ALIGN_VAR_32(pixel, prediction[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
-    pixel fencIntra[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE];
-    pixel neighbours[2][X265_LOWRES_CU_SIZE * 4 + 1];
-    pixel* samples = neighbours[0], *filtered = neighbours[1];
+#if HIGH_BIT_DEPTH
+    if (fenc.bLowres8bit)
+    {
+        intraEstimate<uint8_t>(fenc, qgSize);
+        return;
+    }
+#endif
+    intraEstimate<pixel>(fenc, qgSize);
+}
+
+template<typename T>
+void LookaheadTLD::intraEstimate(Lowres& fenc, uint32_t qgSize)
+{
+    const LowresPrimitives<T>& lp = getLowresPrimitives<T>();
+    ALIGN_VAR_32(T, prediction[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
+    T fencIntra[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE];
+    T neighbours[2][X265_LOWRES_CU_SIZE * 4 + 1];
+    T* samples = neighbours[0], *filtered = neighbours[1];
 
     const int lookAheadLambda = (int)x265_lambda_tab[X265_LOOKAHEAD_QP];
     const int intraPenalty = 5 * lookAheadLambda;
@@ -706,13 +776,16 @@ void LookaheadTLD::lowresIntraEstimate(Lowres& fenc, uint32_t qgSize)
 
     const int cuSize  = X265_LOWRES_CU_SIZE;
     const int cuSize2 = cuSize << 1;
-    const int sizeIdx = X265_LOWRES_CU_BITS - 2;
 
-    pixelcmp_t satd = primitives.pu[sizeIdx].satd;
+    typename LowresPrimitives<T>::cmp_t satd = lp.satd;
     int planar = !!(cuSize >= 8);
 
     int costEst = 0, costEstAq = 0;
 
+    /* on failure the intra cost is left unestimated */
+    if (!fenc.allocCosts(0, 0))
+        return;
+
     for (int cuY = 0; cuY < heightInCU; cuY++)
     {
         fenc.rowSatds[0][0][cuY] = 0;
@@ -721,28 +794,28 @@ void LookaheadTLD::lowresIntraEstimate(Lowres& fenc, uint32_t qgSize)
         {
             const int cuXY = cuX + cuY * widthInCU;
             const intptr_t pelOffset = cuSize * cuX + cuSize * cuY * fenc.lumaStride;
-            pixel *pixCur = fenc.lowresPlane[0] + pelOffset;
+            T *pixCur = fenc.planes<T>(false)[0] + pelOffset;
 
             /* copy fenc pixels */
-            primitives.cu[sizeIdx].copy_pp(fencIntra, cuSize, pixCur, fenc.lumaStride);
+            lp.copy_pp(fencIntra, cuSize, pixCur, fenc.lumaStride);
 
             /* collect reference sample pixels */
             pixCur -= fenc.lumaStride + 1;
-            memcpy(samples, pixCur, (2 * cuSize + 1) * sizeof(pixel)); /* top */
+            memcpy(samples, pixCur, (2 * cuSize + 1) * sizeof(T));     /* top */
             for (int i = 1; i <= 2 * cuSize; i++)
                 samples[cuSize2 + i] = pixCur[i * fenc.lumaStride];    /* left */
 
-            primitives.cu[sizeIdx].intra_filter(samples, filtered);
+            lp.intra_filter(samples, filtered);
 
             int cost, icost = me.COST_MAX;
             uint32_t ilowmode = 0;
 
             /* DC and planar */
-            primitives.cu[sizeIdx].intra_pred[DC_IDX](prediction, cuSize, samples, 0, cuSize <= 16);
+            lp.intra_pred[DC_IDX](prediction, cuSize, samples, 0, cuSize <= 16);
             cost = satd(fencIntra, cuSize, prediction, cuSize);
             COPY2_IF_LT(icost, cost, ilowmode, DC_IDX);
 
-            primitives.cu[sizeIdx].intra_pred[PLANAR_IDX](prediction, cuSize, neighbours[planar], 0, 0);
+            lp.intra_pred[PLANAR_IDX](prediction, cuSize, neighbours[planar], 0, 0);
             cost = satd(fencIntra, cuSize, prediction, cuSize);
             COPY2_IF_LT(icost, cost, ilowmode, PLANAR_IDX);
 
@@ -752,7 +825,7 @@ void LookaheadTLD::lowresIntraEstimate(Lowres& fenc, uint32_t qgSize)
             for (mode = 5; mode < 35; mode += 5)
             {
                 filter = !!(g_intraFilterFlags[mode] & cuSize);
-                primitives.cu[sizeIdx].intra_pred[mode](prediction, cuSize, neighbours[filter], mode, cuSize <= 16);
+                lp.intra_pred[mode](prediction, cuSize, neighbours[filter], mode, cuSize <= 16);
                 cost = satd(fencIntra, cuSize, prediction, cuSize);
                 COPY2_IF_LT(acost, cost, alowmode, mode);
             }
@@ -763,13 +836,13 @@ void LookaheadTLD::lowresIntraEstimate(Lowres& fenc, uint32_t qgSize)
 
                 mode = minusmode;
                 filter = !!(g_intraFilterFlags[mode] & cuSize);
-                primitives.cu[sizeIdx].intra_pred[mode](prediction, cuSize, neighbours[filter], mode, cuSize <= 16);
+                lp.intra_pred[mode](prediction, cuSize, neighbours[filter], mode, cuSize <= 16);
                 cost = satd(fencIntra, cuSize, prediction, cuSize);
                 COPY2_IF_LT(acost, cost, alowmode, mode);
 
                 mode = plusmode;
                 filter = !!(g_intraFilterFlags[mode] & cuSize);
-                primitives.cu[sizeIdx].intra_pred[mode](prediction, cuSize, neighbours[filter], mode, cuSize <= 16);
+                lp.intra_pred[mode](prediction, cuSize, neighbours[filter], mode, cuSize <= 16);
                 cost = satd(fencIntra, cuSize, prediction, cuSize);
                 COPY2_IF_LT(acost, cost, alowmode, mode);
             }
@@ -804,23 +877,24 @@ void LookaheadTLD::lowresIntraEstimate(Lowres& fenc, uint32_t qgSize)
     fenc.costEstAq[0][0] = costEstAq;
 }
 
+template<typename T>
 uint32_t LookaheadTLD::weightCostLuma(Lowres& fenc, Lowres& ref, WeightParam& wp)
 {
-    pixel *src = ref.fpelPlane[0];
+    T *src = ref.planes<T>(false)[0];
     intptr_t stride = fenc.lumaStride;
 
     if (wp.wtPresent)
     {
-        int offset = wp.inputOffset << (X265_DEPTH - 8);
+        int offset = wp.inputOffset << (SampleDepth<T>::value - 8);
         int scale = wp.inputWeight;
         int denom = wp.log2WeightDenom;
         int round = denom ? 1 << (denom - 1) : 0;
-        int correction = IF_INTERNAL_PREC - X265_DEPTH; // intermediate interpolation depth
+        int correction = IF_INTERNAL_PREC - SampleDepth<T>::value; // intermediate interpolation depth
         int widthHeight = (int)stride;
 
-        primitives.weight_pp(ref.buffer[0], wbuffer[0], stride, widthHeight, paddedLines,
+        getLowresPrimitives<T>().weight_pp(ref.buffers<T>()[0], weightBuffers<T>()[0], stride, widthHeight, paddedLines,
             scale, round << correction, denom + correction, offset);
-        src = fenc.weightedRef[fenc.frameNum - ref.frameNum].fpelPlane[0];
+        src = fenc.weightedRef[fenc.frameNum - ref.frameNum].planes<T>(false)[0];
     }
 
     uint32_t cost = 0;
@@ -831,7 +905,7 @@ uint32_t LookaheadTLD::weightCostLuma(Lowres& fenc, Lowres& ref, WeightParam& wp
     {
         for (int x = 0; x < fenc.width; x += 8, mb++, pixoff += 8)
         {
-            int satd = primitives.pu[LUMA_8x8].satd(src + pixoff, stride, fenc.fpelPlane[0] + pixoff, stride);
+            int satd = getLowresPrimitives<T>().satd(src + pixoff, stride, fenc.planes<T>(false)[0] + pixoff, stride);
             cost += X265_MIN(satd, fenc.intraCost[mb]);
         }
     }
@@ -839,17 +913,20 @@ uint32_t LookaheadTLD::weightCostLuma(Lowres& fenc, Lowres& ref, WeightParam& wp
     return cost;
 }
 
+template<typename T>
 bool LookaheadTLD::allocWeightedRef(Lowres& fenc)
 {
-    intptr_t planesize = fenc.buffer[1] - fenc.buffer[0];
+    T** buffer = fenc.buffers<T>();
+    T** wbuf = weightBuffers<T>();
+    intptr_t planesize = buffer[1] - buffer[0];
     paddedLines = (int)(planesize / fenc.lumaStride);
 
-    wbuffer[0] = X265_MALLOC(pixel, 4 * planesize);
-    if (wbuffer[0])
+    wbuf[0] = X265_MALLOC(T, 4 * planesize);
+    if (wbuf[0])
     {
-        wbuffer[1] = wbuffer[0] + planesize;
-        wbuffer[2] = wbuffer[1] + planesize;
-        wbuffer[3] = wbuffer[2] + planesize;
+        wbuf[1] = wbuf[0] + planesize;
+        wbuf[2] = wbuf[1] + planesize;
+        wbuf[3] = wbuf[2] + planesize;
     }
     else
         return false;
@@ -858,6 +935,19 @@ bool LookaheadTLD::allocWeightedRef(Lowres& fenc)
 }
 
 void LookaheadTLD::weightsAnalyse(Lowres& fenc, Lowres& ref)
+{
+#if HIGH_BIT_DEPTH
+    if (fenc.bLowres8bit)
+    {
+        weightsSearch<uint8_t>(fenc, ref);
+        return;
+    }
+#endif
+    weightsSearch<pixel>(fenc, ref);
+}
+
+template<typename T>
+void LookaheadTLD::weightsSearch(Lowres& fenc, Lowres& ref)
 {
     static const float epsilon = 1.f / 128.f;
     int deltaIndex = fenc.frameNum - ref.frameNum;
@@ -865,16 +955,17 @@ void LookaheadTLD::weightsAnalyse(Lowres& fenc, Lowres& ref)
     WeightParam wp;
     wp.wtPresent = 0;
 
-    if (!wbuffer[0])
+    T** wbuf = weightBuffers<T>();
+    if (!wbuf[0])
     {
-        if (!allocWeightedRef(fenc))
+        if (!allocWeightedRef<T>(fenc))
             return;
     }
 
     ReferencePlanes& weightedRef = fenc.weightedRef[deltaIndex];
-    intptr_t padoffset = fenc.lowresPlane[0] - fenc.buffer[0];
+    intptr_t padoffset = fenc.planes<T>(false)[0] - fenc.buffers<T>()[0];
     for (int i = 0; i < 4; i++)
-        weightedRef.lowresPlane[i] = wbuffer[i] + padoffset;
+        weightedRef.planes<T>(false)[i] = wbuf[i] + padoffset;
 
     weightedRef.fpelPlane[0] = weightedRef.lowresPlane[0];
     weightedRef.lumaStride = fenc.lumaStride;
@@ -904,7 +995,7 @@ void LookaheadTLD::weightsAnalyse(Lowres& fenc, Lowres& ref)
     mindenom = wp.log2WeightDenom;
     minscale = wp.inputWeight;
 
-    origscore = minscore = weightCostLuma(fenc, ref, wp);
+    origscore = minscore = weightCostLuma<T>(fenc, ref, wp);
 
     if (!minscore)
         return;
@@ -922,7 +1013,7 @@ void LookaheadTLD::weightsAnalyse(Lowres& fenc, Lowres& ref)
         curScale = x265_clip3(0, 127, curScale);
     }
     SET_WEIGHT(wp, true, curScale, mindenom, curOffset);
-    s = weightCostLuma(fenc, ref, wp);
+    s = weightCostLuma<T>(fenc, ref, wp);
     COPY4_IF_LT(minscore, s, minscale, curScale, minoff, curOffset, found, 1);
 
     /* Use a smaller denominator if possible */
@@ -944,16 +1035,16 @@ void LookaheadTLD::weightsAnalyse(Lowres& fenc, Lowres& ref)
         // set weighted delta cost
         fenc.weightedCostDelta[deltaIndex] = minscore / origscore;
 
-        int offset = wp.inputOffset << (X265_DEPTH - 8);
+        int offset = wp.inputOffset << (SampleDepth<T>::value - 8);
         int scale = wp.inputWeight;
         int denom = wp.log2WeightDenom;
         int round = denom ? 1 << (denom - 1) : 0;
-        int correction = IF_INTERNAL_PREC - X265_DEPTH; // intermediate interpolation depth
+        int correction = IF_INTERNAL_PREC - SampleDepth<T>::value; // intermediate interpolation depth
         intptr_t stride = ref.lumaStride;
         int widthHeight = (int)stride;
 
         for (int i = 0; i < 4; i++)
-            primitives.weight_pp(ref.buffer[i], wbuffer[i], stride, widthHeight, paddedLines,
+            getLowresPrimitives<T>().weight_pp(ref.buffers<T>()[i], wbuf[i], stride, widthHeight, paddedLines,
             scale, round << correction, denom + correction, offset);
 
         weightedRef.isWeighted = true;
@@ -964,15 +1055,20 @@ Lookahead::Lookahead(x265_param *param, ThreadPool* pool)
 {
     m_param = param;
     m_pool  = pool;
+    m_taskType = WORKER_TASK_LOOKAHEAD;
 
     m_lastNonB = NULL;
     m_isSceneTransition = false;
     m_scratch  = NULL;
+    m_propagateAccum = NULL;
+    m_numAccumSlots = 0;
+    m_taskGraph = NULL;
     m_tld      = NULL;
     m_filled   = false;
     m_outputSignalRequired = false;
     m_isActive = true;
     m_inputCount = 0;
+    m_queuedFrames = 0;
     m_extendGopBoundary = false;
     m_8x8Height = ((m_param->sourceHeight / 2) + X265_LOWRES_CU_SIZE - 1) >> X265_LOWRES_CU_BITS;
     m_8x8Width = ((m_param->sourceWidth / 2) + X265_LOWRES_CU_SIZE - 1) >> X265_LOWRES_CU_BITS;
@@ -990,7 +1086,17 @@ Lookahead::Lookahead(x265_param *param, ThreadPool* pool)
 
     m_lastKeyframe = -m_param->keyframeMax;
     m_sliceTypeBusy = false;
-    m_fullQueueSize = X265_MAX(1, m_param->lookaheadDepth);
+
+    /* the latency budget in pictures, at the nominal frame rate */
+    m_latencyFrames = 0;
+    if (m_param->lookaheadLatency && m_param->lookaheadDepth && !(m_param->analysisLoad && m_param->bDisableLookahead))
+    {
+        int64_t budget = (int64_t)m_param->lookaheadLatency * m_param->fpsNum / ((int64_t)m_param->fpsDenom * 1000);
+        m_latencyFrames = (int)x265_clip3((int64_t)1, (int64_t)m_param->lookaheadDepth, budget);
+    }
+    m_bStreaming = m_latencyFrames > 0;
+    m_arrivals = 0;
+    m_fullQueueSize = X265_MAX(1, m_bStreaming ? m_latencyFrames : m_param->lookaheadDepth);
     m_bAdaptiveQuant = m_param->rc.aqMode ||
                        m_param->bEnableWeightedPred ||
                        m_param->bEnableWeightedBiPred ||
@@ -1049,8 +1155,28 @@ Lookahead::Lookahead(x265_param *param, ThreadPool* pool)
     m_countSlicetypeDecide = 0;
     m_countPreLookahead = 0;
 #endif
+    m_decideElapsedTime = 0;
+    m_decidedFrames = 0;
+    m_numLowresEstimates = 0;
+    m_numLowerResEstimates = 0;
 
     memset(m_histogram, 0, sizeof(m_histogram));
+
+    /* The histograms are computed on the API thread only when it needs the
+     * decision itself: frame duplication drops pictures before they are
+     * queued, and analysis load may read the histograms from the file */
+    m_bHistInPreLookahead = m_param->bHistBasedSceneCut && !m_param->bEnableFrameDuplication && !m_param->analysisLoad;
+    memset(m_prevEdgeHist, 0, sizeof(m_prevEdgeHist));
+    memset(m_prevYUVHist, 0, sizeof(m_prevYUVHist));
+
+    m_bReuseFirstPass = !!m_param->bFastSecondPass;
+    for (int i = 0; i < 3; i++)
+        m_planeSizes[i] = (m_param->sourceWidth >> x265_cli_csps[m_param->internalCsp].width[i]) *
+                          (m_param->sourceHeight >> x265_cli_csps[m_param->internalCsp].height[i]);
+    m_edgeHistThreshold = m_param->edgeTransitionThreshold;
+    m_chromaHistThreshold = x265_min(m_edgeHistThreshold * 10.0, MAX_SCENECUT_THRESHOLD);
+    m_scaledEdgeThreshold = x265_min(m_edgeHistThreshold * SCENECUT_STRENGTH_FACTOR, MAX_SCENECUT_THRESHOLD);
+    m_scaledChromaThreshold = x265_min(m_chromaHistThreshold * SCENECUT_STRENGTH_FACTOR, MAX_SCENECUT_THRESHOLD);
 }
 
 #if DETAILED_CU_STATS
@@ -1075,14 +1201,58 @@ bool Lookahead::create()
     m_tld = new LookaheadTLD[numTLD];
     for (int i = 0; i < numTLD; i++)
         m_tld[i].init(m_8x8Width, m_8x8Height, m_8x8Blocks);
-    m_scratch = X265_MALLOC(int, m_tld[0].widthInCU);
+    m_scratch = X265_MALLOC(int, m_tld[0].widthInCU * numTLD);
+    if (!m_tld || !m_scratch)
+        return false;
+    if (m_bAdaptiveQuant)
+    {
+        int blockSize = m_param->rc.qgSize == 8 ? 8 : 16;
+        int numBlocks = ((m_param->sourceWidth + blockSize - 1) / blockSize) * ((m_param->sourceHeight + blockSize - 1) / blockSize);
+        for (int i = 0; i < numTLD; i++)
+        {
+            m_tld[i].energyCache = X265_MALLOC(uint32_t, numBlocks);
+            if (!m_tld[i].energyCache)
+                return false;
+        }
+    }
+
+    /* the lookahead never holds more than its depth plus a mini-gop of
+     * pictures, so these rings are not expected to fill */
+    uint32_t ringSize = 2 * (X265_LOOKAHEAD_MAX + X265_BFRAME_MAX + 4);
+    if (!m_inputRing.create(ringSize) || !m_outputQueue.create(ringSize))
+        return false;
+
+    if (m_pool)
+    {
+        /* size the task graph for the larger of the slicetypeAnalyse() batch
+         * (one motion search and bframes+1 cost estimates per reference
+         * distance per frame) and the cutree cost estimates and propagation
+         * of the full window */
+        int maxSearch = X265_MIN(m_param->lookaheadDepth, X265_LOOKAHEAD_MAX) + 1;
+        int analyseNodes = maxSearch * (m_param->bframes + 1) * (m_param->bframes + 2);
+        int cuTreeNodes = maxSearch * (LookaheadTaskGraph::MAX_PROPAGATE_BANDS + m_numCoopSlices + 3);
+        int cuTreeEdges = maxSearch * (LookaheadTaskGraph::MAX_PROPAGATE_BANDS * 7 + m_numCoopSlices + 2);
+
+        m_taskGraph = new LookaheadTaskGraph(*this);
+        if (!m_taskGraph->create(X265_MAX(analyseNodes, cuTreeNodes), X265_MAX(analyseNodes * 2, cuTreeEdges)))
+            return false;
+
+        if (m_param->rc.cuTree && m_param->lookaheadDepth)
+        {
+            m_numAccumSlots = X265_MIN(maxSearch + 1, (int)LookaheadTaskGraph::MAX_ACCUM_SLOTS);
+            m_propagateAccum = X265_MALLOC(int32_t, m_numAccumSlots * m_cuCount);
+            if (!m_propagateAccum)
+                return false;
+            memset(m_propagateAccum, 0, m_numAccumSlots * m_cuCount * sizeof(int32_t));
+        }
+    }
 
-    return m_tld && m_scratch;
+    return true;
 }
 
 void Lookahead::stopJobs()
 {
-    if (m_pool && !m_inputQueue.empty())
+    if (m_pool && m_queuedFrames)
     {
         m_inputLock.acquire();
         m_isActive = false;
@@ -1100,7 +1270,8 @@ void Lookahead::stopJobs()
 }
 void Lookahead::destroy()
 {
-    // these two queues will be empty unless the encode was aborted
+    // these queues will be empty unless the encode was aborted
+    drainInputRing();
     while (!m_inputQueue.empty())
     {
         Frame* curFrame = m_inputQueue.popFront();
@@ -1108,20 +1279,27 @@ void Lookahead::destroy()
         delete curFrame;
     }
 
-    while (!m_outputQueue.empty())
+    Frame* curFrame;
+    while ((curFrame = m_outputQueue.pop()) != NULL)
     {
-        Frame* curFrame = m_outputQueue.popFront();
         curFrame->destroy();
         delete curFrame;
     }
+    m_inputRing.destroy();
+    m_outputQueue.destroy();
 
     X265_FREE(m_scratch);
+    X265_FREE(m_propagateAccum);
+    delete m_taskGraph;
     delete [] m_tld;
     if (m_param->lookaheadThreads > 0)
         delete [] m_pool;
 }
 /* The synchronization of slicetypeDecide is managed here.  The findJob() method
- * polls the occupancy of the input queue. If the queue is
+ * polls the occupancy of the input queue. Pictures are handed over between the
+ * API thread and slicetypeDecide() through single-producer single-consumer
+ * rings, so neither addPicture() nor the common case of getDecidedPicture()
+ * takes a lock. If the queue is
  * full, it will run slicetypeDecide() and output a mini-gop of frames to the
  * output queue. If the flush() method has been called (implying no new pictures
  * will be received) then the input queue is considered full if it has even one
@@ -1142,9 +1320,8 @@ void Lookahead::addPicture(Frame& curFrame, int sliceType)
     {
         if (!m_filled)
             m_filled = true;
-        m_outputLock.acquire();
-        m_outputQueue.pushBack(curFrame);
-        m_outputLock.release();
+        while (!m_outputQueue.push(curFrame))
+            GIVE_UP_TIME();
         m_inputCount++;
     }
     else
@@ -1157,10 +1334,45 @@ void Lookahead::addPicture(Frame& curFrame, int sliceType)
 
 void Lookahead::addPicture(Frame& curFrame)
 {
-    m_inputLock.acquire();
-    m_inputQueue.pushBack(curFrame);
-    m_inputLock.release();
+    curFrame.m_lowres.pool = &m_lowresPool;
+    if (!m_inputRing.push(curFrame))
+    {
+        /* the ring is full; become its consumer for a moment */
+        ScopedLock lock(m_inputLock);
+        drainInputRing();
+        m_inputQueue.pushBack(curFrame);
+    }
+    ATOMIC_INC(&m_queuedFrames);
     m_inputCount++;
+
+    if (m_bStreaming)
+    {
+        /* have the picture pre-analysed now, rather than once the latency
+         * budget of pictures is queued */
+        ATOMIC_INC(&m_arrivals);
+        if (m_pool)
+            tryWakeOne();
+        else
+            findJob(-1);
+    }
+}
+
+/* Moves pictures handed over by addPicture() to the end of the input queue.
+ * The caller must hold m_inputLock, which makes it the only consumer of
+ * m_inputRing */
+void Lookahead::drainInputRing()
+{
+    Frame* curFrame;
+    while ((curFrame = m_inputRing.pop()) != NULL)
+        m_inputQueue.pushBack(*curFrame);
+}
+
+/* Called by API thread */
+Frame* Lookahead::getInputPOC(int poc)
+{
+    ScopedLock lock(m_inputLock);
+    drainInputRing();
+    return m_inputQueue.getPOC(poc);
 }
 
 void Lookahead::checkLookaheadQueue(int &frameCnt)
@@ -1171,14 +1383,12 @@ void Lookahead::checkLookaheadQueue(int &frameCnt)
     {
         if (!m_param->bframes & !m_param->lookaheadDepth)
             m_filled = true; /* zero-latency */
-        else if (frameCnt >= m_param->lookaheadDepth + 2 + m_param->bframes)
+        else if (frameCnt >= (m_bStreaming ? m_latencyFrames : m_param->lookaheadDepth) + 2 + m_param->bframes)
             m_filled = true; /* full capacity plus mini-gop lag */
     }
 
-    m_inputLock.acquire();
-    if (m_pool && m_inputQueue.size() >= m_fullQueueSize)
+    if (m_pool && m_queuedFrames >= m_fullQueueSize)
         tryWakeOne();
-    m_inputLock.release();
 }
 
 /* Called by API thread */
@@ -1192,27 +1402,52 @@ void Lookahead::flush()
 void Lookahead::setLookaheadQueue()
 {
     m_filled = false;
-    m_fullQueueSize = X265_MAX(1, m_param->lookaheadDepth);
+    m_fullQueueSize = X265_MAX(1, m_bStreaming ? m_latencyFrames : m_param->lookaheadDepth);
 }
 
 void Lookahead::findJob(int /*workerThreadID*/)
 {
-    bool doDecide;
+    bool doDecide, doArrivals = false;
 
     m_inputLock.acquire();
-    if (m_inputQueue.size() >= m_fullQueueSize && !m_sliceTypeBusy && m_isActive)
+    if (m_queuedFrames >= m_fullQueueSize && !m_sliceTypeBusy && m_isActive)
         doDecide = m_sliceTypeBusy = true;
+    else if (m_arrivals && !m_sliceTypeBusy && m_isActive)
+        doDecide = false, doArrivals = m_sliceTypeBusy = true;
     else
+    {
         doDecide = m_helpWanted = false;
+
+        /* addPicture() does not take m_inputLock, so a picture may have
+         * arrived (and asked for help) since the count was read above */
+        MEMORY_BARRIER();
+        if ((m_queuedFrames >= m_fullQueueSize || m_arrivals) && !m_sliceTypeBusy && m_isActive)
+            m_helpWanted = true;
+    }
     m_inputLock.release();
 
-    if (!doDecide)
-        return;
+    if (doArrivals)
+    {
+        analyseArrivals();
+
+        /* the budget may have been reached meanwhile; m_sliceTypeBusy is
+         * still held, so the decision can follow directly */
+        m_inputLock.acquire();
+        doDecide = m_queuedFrames >= m_fullQueueSize && m_isActive;
+        m_inputLock.release();
+    }
 
-    ProfileLookaheadTime(m_slicetypeDecideElapsedTime, m_countSlicetypeDecide);
-    ProfileScopeEvent(slicetypeDecideEV);
+    if (doDecide)
+    {
+        ProfileLookaheadTime(m_slicetypeDecideElapsedTime, m_countSlicetypeDecide);
+        ProfileScopeEvent(slicetypeDecideEV);
 
-    slicetypeDecide();
+        int64_t startTime = x265_mdate();
+        slicetypeDecide();
+        m_decideElapsedTime += x265_mdate() - startTime;
+    }
+    else if (!doArrivals)
+        return;
 
     m_inputLock.acquire();
     if (m_outputSignalRequired)
@@ -1229,9 +1464,7 @@ Frame* Lookahead::getDecidedPicture()
 {
     if (m_filled)
     {
-        m_outputLock.acquire();
-        Frame *out = m_outputQueue.popFront();
-        m_outputLock.release();
+        Frame *out = m_outputQueue.pop();
 
         if (out)
         {
@@ -1251,7 +1484,7 @@ Frame* Lookahead::getDecidedPicture()
         if (wait)
             m_outputSignal.wait();
 
-        out = m_outputQueue.popFront();
+        out = m_outputQueue.pop();
         if (out)
             m_inputCount--;
         return out;
@@ -1265,6 +1498,10 @@ Frame* Lookahead::getDecidedPicture()
  * picture and all the references are established */
 void Lookahead::getEstimatedPictureCost(Frame *curFrame)
 {
+    /* no cost was estimated, and the second pass would not read it */
+    if (m_bReuseFirstPass)
+        return;
+
     Lowres *frames[X265_LOOKAHEAD_MAX];
 
     // POC distances to each reference
@@ -1377,6 +1614,150 @@ void Lookahead::getEstimatedPictureCost(Frame *curFrame)
     }
 }
 
+static void accumulateHistogram(int32_t* hist, const pixel* src, intptr_t stride, int width, int height)
+{
+    /* consecutive pixels of equal value would serialize on the increment of
+     * a single bin, so alternate between four partial histograms */
+    int32_t part[4][HISTOGRAM_BINS];
+    memset(part, 0, sizeof(part));
+
+    for (int y = 0; y < height; y++, src += stride)
+    {
+        int x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            part[0][src[x]]++;
+            part[1][src[x + 1]]++;
+            part[2][src[x + 2]]++;
+            part[3][src[x + 3]]++;
+        }
+        for (; x < width; x++)
+            part[0][src[x]]++;
+    }
+
+    for (int i = 0; i < HISTOGRAM_BINS; i++)
+        hist[i] = part[0][i] + part[1][i] + part[2][i] + part[3][i];
+}
+
+void Lookahead::computeHistograms(Frame* curFrame)
+{
+    PicYuv* fenc = curFrame->m_fencPic;
+    int width = fenc->m_picWidth;
+    int height = fenc->m_picHeight;
+    intptr_t stride = fenc->m_stride;
+    const pixel* src = fenc->m_picOrg[0];
+
+    /* Sobel edges of all but the border pixels, kept in the edge bit plane for
+     * --rskip 2 and otherwise only counted, a few pixels at a time */
+    pixel* edgePic = m_param->recursionSkipMode == EDGE_BASED_RSKIP ? curFrame->m_edgeBitPic : NULL;
+    if (edgePic)
+    {
+        memset(edgePic, 0, width * sizeof(pixel));
+        memset(edgePic + (height - 1) * stride, 0, width * sizeof(pixel));
+    }
+
+    pixel edgeRow[64];
+    int32_t edgeCount = 0;
+    for (int y = 1; y < height - 1; y++)
+    {
+        if (edgePic)
+            edgePic[y * stride] = edgePic[y * stride + width - 1] = 0;
+        for (int x = 1; x < width - 1; x += 64)
+        {
+            int count = X265_MIN(64, width - 1 - x);
+            pixel* edge = edgePic ? edgePic + y * stride + x : edgeRow;
+            primitives.edgeSobel(edge, NULL, src + y * stride + x, stride, count, 1);
+            for (int i = 0; i < count; i++)
+                edgeCount += edge[i];
+        }
+    }
+    curFrame->m_edgeHist[0] = (int32_t)m_planeSizes[0] - edgeCount;
+    curFrame->m_edgeHist[1] = edgeCount;
+
+    accumulateHistogram(curFrame->m_yuvHist[0], src, stride, width, height);
+    if (m_param->internalCsp != X265_CSP_I400)
+    {
+        int widthC = width >> CHROMA_H_SHIFT(m_param->internalCsp);
+        int heightC = height >> CHROMA_V_SHIFT(m_param->internalCsp);
+        accumulateHistogram(curFrame->m_yuvHist[1], fenc->m_picOrg[1], fenc->m_strideC, widthC, heightC);
+        accumulateHistogram(curFrame->m_yuvHist[2], fenc->m_picOrg[2], fenc->m_strideC, widthC, heightC);
+    }
+    else
+        memset(curFrame->m_yuvHist[1], 0, 2 * sizeof(curFrame->m_yuvHist[1]));
+
+    if (m_param->analysisSave)
+    {
+        memcpy(curFrame->m_analysisData.edgeHist, curFrame->m_edgeHist, sizeof(curFrame->m_edgeHist));
+        for (int i = 0; i < x265_cli_csps[m_param->internalCsp].planes; i++)
+            memcpy(curFrame->m_analysisData.yuvHist[i], curFrame->m_yuvHist[i], sizeof(curFrame->m_yuvHist[i]));
+    }
+}
+
+static double normalizeRange(int32_t value, int32_t minValue, int32_t maxValue, double rangeStart, double rangeEnd)
+{
+    return (double)(value - minValue) * (rangeEnd - rangeStart) / (maxValue - minValue) + rangeStart;
+}
+
+bool Lookahead::histSceneCut(const int32_t* edgeHist, const int32_t yuvHist[][HISTOGRAM_BINS], bool bFirst,
+                             bool& bDup, bool& isMaxThres, bool& isHardSC)
+{
+    bool bScenecut = false;
+
+    if (bFirst)
+    {
+        /* first frame is scenecut by default no sad computation for the same. */
+        bDup = false;
+    }
+    else
+    {
+        /* compute sum of absolute differences of histogram bins of chroma and luma edge response between the current and prev pictures. */
+        int32_t edgeHistSad = 0;
+        int32_t uHistSad = 0;
+        int32_t vHistSad = 0;
+
+        for (int j = 0; j < HISTOGRAM_BINS; j++)
+        {
+            if (j < 2)
+                edgeHistSad += abs(edgeHist[j] - m_prevEdgeHist[j]);
+            uHistSad += abs(yuvHist[1][j] - m_prevYUVHist[1][j]);
+            vHistSad += abs(yuvHist[2][j] - m_prevYUVHist[2][j]);
+        }
+        double edgeSad = normalizeRange(edgeHistSad, 0, 2 * m_planeSizes[0], 0.0, 1.0);
+        double normalizedUSad = normalizeRange(uHistSad, 0, 2 * m_planeSizes[1], 0.0, 1.0);
+        double normalizedVSad = normalizeRange(vHistSad, 0, 2 * m_planeSizes[2], 0.0, 1.0);
+        double maxUVSad = x265_max(normalizedUSad, normalizedVSad);
+
+        double minEdgeT = m_edgeHistThreshold * MIN_EDGE_FACTOR;
+        double minChromaT = minEdgeT * SCENECUT_CHROMA_FACTOR;
+        double maxEdgeT = m_edgeHistThreshold * MAX_EDGE_FACTOR;
+        double maxChromaT = maxEdgeT * SCENECUT_CHROMA_FACTOR;
+
+        if (edgeSad == 0.0 && maxUVSad == 0.0)
+            bDup = true;
+        else if (edgeSad < minEdgeT && maxUVSad < minChromaT)
+            bScenecut = false;
+        else if (edgeSad > maxEdgeT && maxUVSad > maxChromaT)
+        {
+            bScenecut = true;
+            isMaxThres = true;
+            isHardSC = true;
+        }
+        else if (edgeSad > m_scaledEdgeThreshold || maxUVSad >= m_scaledChromaThreshold
+                 || (edgeSad > m_edgeHistThreshold && maxUVSad >= m_chromaHistThreshold))
+        {
+            bScenecut = true;
+            bDup = false;
+            if (edgeSad > m_scaledEdgeThreshold || maxUVSad >= m_scaledChromaThreshold)
+                isHardSC = true;
+        }
+    }
+
+    /* store histograms of previous frame for reference */
+    memcpy(m_prevEdgeHist, edgeHist, sizeof(m_prevEdgeHist));
+    memcpy(m_prevYUVHist, yuvHist, sizeof(m_prevYUVHist));
+    return bScenecut;
+}
+
 void PreLookaheadGroup::processTasks(int workerThreadID)
 {
     if (workerThreadID < 0)
@@ -1390,9 +1771,21 @@ void PreLookaheadGroup::processTasks(int workerThreadID)
         ProfileLookaheadTime(m_lookahead.m_preLookaheadElapsedTime, m_lookahead.m_countPreLookahead);
         ProfileScopeEvent(prelookahead);
         m_lock.release();
-        preFrame->m_lowres.init(preFrame->m_fencPic, preFrame->m_poc);
+        tld.initLowres(preFrame, m_lookahead.m_param, m_lookahead.m_bAdaptiveQuant);
+        if (m_lookahead.m_bHistInPreLookahead)
+            m_lookahead.computeHistograms(preFrame);
         if (m_lookahead.m_bAdaptiveQuant)
-            tld.calcAdaptiveQuantFrame(preFrame, m_lookahead.m_param);
+            tld.calcAdaptiveQuantFrame(preFrame, m_lookahead.m_param, m_lookahead.m_pool);
+        if (preFrame->m_loadedCuTreeOffsets && m_lookahead.m_param->rc.cuTree && IS_REFERENCED(preFrame))
+        {
+            /* cuTree() will not run; use the offsets it produced when the decisions
+             * were saved, before any frame cost is estimated, in the same way as a
+             * multi-pass encode reads them */
+            int ncu = m_lookahead.m_param->rc.qgSize == 8 ? m_lookahead.m_cuCount * 4 : m_lookahead.m_cuCount;
+            primitives.fix8Unpack(preFrame->m_lowres.qpCuTreeOffset, (uint16_t*)preFrame->m_loadedCuTreeOffsets, ncu);
+            for (int i = 0; i < ncu; i++)
+                preFrame->m_lowres.invQscaleFactor[i] = x265_exp2fix8(preFrame->m_lowres.qpCuTreeOffset[i]);
+        }
         tld.lowresIntraEstimate(preFrame->m_lowres, m_lookahead.m_param->rc.qgSize);
         preFrame->m_lowresInit = true;
 
@@ -1401,6 +1794,79 @@ void PreLookaheadGroup::processTasks(int workerThreadID)
     m_lock.release();
 }
 
+/* perform the pre-analysis of the pictures gathered in pre, using a bonded
+ * task group */
+void Lookahead::preAnalyse(PreLookaheadGroup& pre)
+{
+    if (m_pool)
+        pre.tryBondPeers(*m_pool, pre.m_jobTotal);
+    pre.processTasks(-1);
+    pre.waitForExit();
+
+    /* the histograms are compared in input order, once all are computed */
+    if (m_bHistInPreLookahead)
+    {
+        for (int i = 0; i < pre.m_jobTotal; i++)
+        {
+            Frame* f = pre.m_preframes[i];
+            bool bDup = false, isMaxThres = false, isHardSC = false;
+            f->m_lowres.bScenecut = histSceneCut(f->m_edgeHist, f->m_yuvHist, f->m_poc == 0, bDup, isMaxThres, isHardSC);
+        }
+    }
+}
+
+/* Streaming mode: pre-analyse the pictures which arrived since the last call
+ * and estimate their cost against the previous picture, which every slice
+ * type analysis needs, so that little is left to do once the latency budget
+ * of pictures is queued. Called with m_sliceTypeBusy held */
+void Lookahead::analyseArrivals()
+{
+    PreLookaheadGroup pre(*this);
+    Lowres* frames[X265_LOOKAHEAD_MAX + 2];
+    int newIdx[X265_LOOKAHEAD_MAX];
+    int maxSearch = X265_MAX(1, X265_MIN(m_param->lookaheadDepth, X265_LOOKAHEAD_MAX));
+    int arrivals = m_arrivals;
+
+    {
+        ScopedLock lock(m_inputLock);
+        drainInputRing();
+
+        Frame *curFrame = m_inputQueue.first();
+        frames[0] = m_lastNonB;
+        for (int j = 0; j < maxSearch && curFrame; j++)
+        {
+            frames[j + 1] = &curFrame->m_lowres;
+            if (!curFrame->m_lowresInit)
+            {
+                newIdx[pre.m_jobTotal] = j + 1;
+                pre.m_preframes[pre.m_jobTotal++] = curFrame;
+            }
+            curFrame = curFrame->m_next;
+        }
+    }
+    ATOMIC_ADD(&m_arrivals, -arrivals);
+
+    if (!pre.m_jobTotal)
+        return;
+
+    preAnalyse(pre);
+
+    /* the same estimates slicetypeAnalyse() starts from, so the results are
+     * unchanged by having made them early */
+    if (!m_param->rc.bStatRead && !m_param->lookaheadLoad &&
+        ((m_param->bFrameAdaptive && m_param->bframes) || m_param->rc.cuTree || m_param->scenecutThreshold ||
+         m_param->bHistBasedSceneCut || m_param->rc.vbvBufferSize))
+    {
+        CostEstimateGroup estGroup(*this, frames);
+        for (int i = 0; i < pre.m_jobTotal; i++)
+        {
+            int b = newIdx[i];
+            if (frames[b - 1])
+                estGroup.singleCost(b - 1, b, b);
+        }
+    }
+}
+
 /* called by API thread or worker thread with inputQueueLock acquired */
 void Lookahead::slicetypeDecide()
 {
@@ -1414,6 +1880,7 @@ void Lookahead::slicetypeDecide()
 
     {
         ScopedLock lock(m_inputLock);
+        drainInputRing();
 
         Frame *curFrame = m_inputQueue.first();
         int j;
@@ -1440,14 +1907,9 @@ void Lookahead::slicetypeDecide()
         maxSearch = j;
     }
 
-    /* perform pre-analysis on frames which need it, using a bonded task group */
+    /* perform pre-analysis on frames which need it */
     if (pre.m_jobTotal)
-    {
-        if (m_pool)
-            pre.tryBondPeers(*m_pool, pre.m_jobTotal);
-        pre.processTasks(-1);
-        pre.waitForExit();
-    }
+        preAnalyse(pre);
 
     if(m_param->bEnableFades)
     {
@@ -1502,7 +1964,7 @@ void Lookahead::slicetypeDecide()
          m_param->rc.cuTree || m_param->scenecutThreshold || m_param->bHistBasedSceneCut ||
          (m_param->lookaheadDepth && m_param->rc.vbvBufferSize)))
     {
-        if(!m_param->rc.bStatRead)
+        if (!m_param->rc.bStatRead && !m_param->lookaheadLoad)
             slicetypeAnalyse(frames, false);
         bool bIsVbv = m_param->rc.vbvBufferSize > 0 && m_param->rc.vbvMaxBitrate > 0;
         if ((m_param->analysisLoad && m_param->scaleFactor && bIsVbv) || m_param->bliveVBV2pass)
@@ -1662,7 +2124,7 @@ void Lookahead::slicetypeDecide()
         brefs++;
     }
     /* calculate the frame costs ahead of time for estimateFrameCost while we still have lowres */
-    if (m_param->rc.rateControlMode != X265_RC_CQP)
+    if (m_param->rc.rateControlMode != X265_RC_CQP && !m_bReuseFirstPass)
     {
         int p0, p1, b;
         /* For zero latency tuning, calculate frame cost to be used later in RC */
@@ -1678,7 +2140,7 @@ void Lookahead::slicetypeDecide()
 
         CostEstimateGroup estGroup(*this, frames);
 
-        estGroup.singleCost(p0, p1, b);
+        frames[b]->decidedCost = estGroup.singleCost(p0, p1, b);
 
         if (bframes)
         {
@@ -1696,7 +2158,7 @@ void Lookahead::slicetypeDecide()
                 else
                     p1 = bframes + 1;
 
-                estGroup.singleCost(p0, p1, b);
+                frames[b]->decidedCost = estGroup.singleCost(p0, p1, b);
 
                 if (frames[b]->sliceType == X265_TYPE_BREF)
                 {
@@ -1720,12 +2182,20 @@ void Lookahead::slicetypeDecide()
         maxSearch--;
     }
     m_inputLock.release();
+    ATOMIC_ADD(&m_queuedFrames, -(bframes + 1));
+
+    m_decidedFrames += bframes + 1;
+
+    /* the decided pictures are collected here in encode order and only
+     * published to the output queue once the keyframe analysis below has
+     * finished with them */
+    Frame* decided[X265_BFRAME_MAX + 1];
+    int numDecided = 0;
 
-    m_outputLock.acquire();
     /* add non-B to output queue */
     int idx = 0;
     list[bframes]->m_reorderedPts = pts[idx++];
-    m_outputQueue.pushBack(*list[bframes]);
+    decided[numDecided++] = list[bframes];
     /* Add B-ref frame next to P frame in output queue, the B-ref encode before non B-ref frame */
     if (brefs)
     {
@@ -1734,7 +2204,7 @@ void Lookahead::slicetypeDecide()
             if (list[i]->m_lowres.sliceType == X265_TYPE_BREF)
             {
                 list[i]->m_reorderedPts = pts[idx++];
-                m_outputQueue.pushBack(*list[i]);
+                decided[numDecided++] = list[i];
             }
         }
     }
@@ -1746,7 +2216,7 @@ void Lookahead::slicetypeDecide()
         if (list[i]->m_lowres.sliceType != X265_TYPE_BREF)
         {
             list[i]->m_reorderedPts = pts[idx++];
-            m_outputQueue.pushBack(*list[i]);
+            decided[numDecided++] = list[i];
         }
     }
 
@@ -1765,7 +2235,7 @@ void Lookahead::slicetypeDecide()
         m_inputLock.release();
 
         frames[j + 1] = NULL;
-        if (!m_param->rc.bStatRead)
+        if (!m_param->rc.bStatRead && !m_param->lookaheadLoad)
             slicetypeAnalyse(frames, true);
         bool bIsVbv = m_param->rc.vbvBufferSize > 0 && m_param->rc.vbvMaxBitrate > 0;
         if ((m_param->analysisLoad && m_param->scaleFactor && bIsVbv) || m_param->bliveVBV2pass)
@@ -1780,7 +2250,12 @@ void Lookahead::slicetypeDecide()
             vbvLookahead(frames, numFrames, true);
         }
     }
-    m_outputLock.release();
+
+    for (int i = 0; i < numDecided; i++)
+    {
+        while (!m_outputQueue.push(*decided[i]))
+            GIVE_UP_TIME();
+    }
 }
 
 void Lookahead::vbvLookahead(Lowres **frames, int numFrames, int keyframe)
@@ -1876,6 +2351,20 @@ int64_t Lookahead::vbvFrameCost(Lowres **frames, int p0, int p1, int b)
     return cost;
 }
 
+/* motion search and cost estimate state of reference distances, on the HME
+ * level when bLowerRes (--hme-path-costs) */
+static bool isSearched(Lowres* frame, int list, int dist, bool bLowerRes)
+{
+    if (bLowerRes)
+        return frame->lowresMvs[list][dist] != &Lowres::s_unsearchedMvs && frame->lowerResMvs[list][dist][0].x != 0x7FFF;
+    return frame->lowresMvs[list][dist][0].x != 0x7FFF;
+}
+
+static bool isEstimated(Lowres* frame, int p0Dist, int p1Dist, bool bLowerRes)
+{
+    return (bLowerRes ? frame->lowerResCostEst[p0Dist][p1Dist] : frame->costEst[p0Dist][p1Dist]) >= 0;
+}
+
 void Lookahead::slicetypeAnalyse(Lowres **frames, bool bKeyframe)
 {
     int numFrames, origNumFrames, keyintLimit, framecnt;
@@ -1939,47 +2428,132 @@ void Lookahead::slicetypeAnalyse(Lowres **frames, bool bKeyframe)
         return;
     }
 
-    if (m_bBatchMotionSearch)
+    /* with --hme-path-costs the cost matrix of the B-path decision is
+     * measured on the HME level */
+    bool bLowerRes = !!m_param->bHMEPathCosts;
+
+    if (m_bBatchMotionSearch && m_taskGraph && m_bBatchFrameCosts)
     {
-        /* pre-calculate all motion searches, using many worker threads */
-        CostEstimateGroup estGroup(*this, frames);
+        /* pre-calculate all motion searches and frame cost estimates as one
+         * dependency graph; each cost estimate starts as soon as the motion
+         * searches it needs are complete rather than after the whole motion
+         * search batch. The selection of work is identical to the batches
+         * below */
+        LookaheadTaskGraph& graph = *m_taskGraph;
+        graph.reset(frames);
+        graph.m_bLowerRes = bLowerRes;
         for (int b = 2; b < numFrames; b++)
         {
             for (int i = 1; i <= m_param->bframes + 1; i++)
             {
+                graph.m_searchNode[0][b][i] = graph.m_searchNode[1][b][i] = -1;
+
                 int p0 = b - i;
                 if (p0 < 0)
                     continue;
 
                 /* Skip search if already done */
-                if (frames[b]->lowresMvs[0][i][0].x != 0x7FFF)
+                if (isSearched(frames[b], 0, i, bLowerRes))
                     continue;
 
                 /* perform search to p1 at same distance, if possible */
                 int p1 = b + i;
-                if (p1 >= numFrames || frames[b]->lowresMvs[1][i][0].x != 0x7FFF)
+                if (p1 >= numFrames || isSearched(frames[b], 1, i, bLowerRes))
                     p1 = b;
 
-                estGroup.add(p0, p1, b);
+                int node = graph.addCostEstimate(p0, p1, b);
+                graph.m_searchNode[0][b][i] = node;
+                if (p1 > b)
+                    graph.m_searchNode[1][b][i] = node;
             }
         }
         /* auto-disable after the first batch if pool is small */
         m_bBatchMotionSearch &= m_pool->m_numWorkers >= 4;
-        estGroup.finishBatch();
 
-        if (m_bBatchFrameCosts)
+        for (int b = 2; b < numFrames; b++)
         {
-            /* pre-calculate all frame cost estimates, using many worker threads */
-            for (int b = 2; b < numFrames; b++)
+            for (int i = 1; i <= m_param->bframes + 1; i++)
             {
-                for (int i = 1; i <= m_param->bframes + 1; i++)
-                {
-                    if (b < i)
-                        continue;
+                if (b < i)
+                    continue;
 
-                    /* only measure frame cost in this pass if motion searches
+                /* only measure frame cost if motion searches are done */
+                int search0 = graph.m_searchNode[0][b][i];
+                if (search0 < 0 && !isSearched(frames[b], 0, i, bLowerRes))
+                    continue;
+
+                int p0 = b - i;
+
+                for (int j = 0; j <= m_param->bframes; j++)
+                {
+                    int p1 = b + j;
+                    if (p1 >= numFrames)
+                        break;
+
+                    /* ensure P1 search is done */
+                    int search1 = j ? graph.m_searchNode[1][b][j] : -1;
+                    if (j && search1 < 0 && !isSearched(frames[b], 1, j, bLowerRes))
+                        continue;
+
+                    /* ensure frame cost is not done, nor measured by the search */
+                    if (isEstimated(frames[b], i, j, bLowerRes) || (search0 >= 0 && graph.m_nodes[search0].p1 == p1))
+                        continue;
+
+                    int node = graph.addCostEstimate(p0, p1, b);
+                    if (search0 >= 0)
+                        graph.addDependency(search0, node);
+                    if (search1 >= 0 && search1 != search0)
+                        graph.addDependency(search1, node);
+                }
+            }
+        }
+
+        /* auto-disable after the first batch if the pool is not large */
+        m_bBatchFrameCosts &= m_pool->m_numWorkers > 12;
+        graph.run();
+    }
+    else if (m_bBatchMotionSearch)
+    {
+        /* pre-calculate all motion searches, using many worker threads */
+        CostEstimateGroup estGroup(*this, frames);
+        estGroup.m_bLowerRes = bLowerRes;
+        for (int b = 2; b < numFrames; b++)
+        {
+            for (int i = 1; i <= m_param->bframes + 1; i++)
+            {
+                int p0 = b - i;
+                if (p0 < 0)
+                    continue;
+
+                /* Skip search if already done */
+                if (isSearched(frames[b], 0, i, bLowerRes))
+                    continue;
+
+                /* perform search to p1 at same distance, if possible */
+                int p1 = b + i;
+                if (p1 >= numFrames || isSearched(frames[b], 1, i, bLowerRes))
+                    p1 = b;
+
+                estGroup.add(p0, p1, b);
+            }
+        }
+        /* auto-disable after the first batch if pool is small */
+        m_bBatchMotionSearch &= m_pool->m_numWorkers >= 4;
+        estGroup.finishBatch();
+
+        if (m_bBatchFrameCosts)
+        {
+            /* pre-calculate all frame cost estimates, using many worker threads */
+            for (int b = 2; b < numFrames; b++)
+            {
+                for (int i = 1; i <= m_param->bframes + 1; i++)
+                {
+                    if (b < i)
+                        continue;
+
+                    /* only measure frame cost in this pass if motion searches
                      * are already done */
-                    if (frames[b]->lowresMvs[0][i][0].x == 0x7FFF)
+                    if (!isSearched(frames[b], 0, i, bLowerRes))
                         continue;
 
                     int p0 = b - i;
@@ -1991,11 +2565,11 @@ void Lookahead::slicetypeAnalyse(Lowres **frames, bool bKeyframe)
                             break;
 
                         /* ensure P1 search is done */
-                        if (j && frames[b]->lowresMvs[1][j][0].x == 0x7FFF)
+                        if (j && !isSearched(frames[b], 1, j, bLowerRes))
                             continue;
 
                         /* ensure frame cost is not done */
-                        if (frames[b]->costEst[i][j] >= 0)
+                        if (isEstimated(frames[b], i, j, bLowerRes))
                             continue;
 
                         estGroup.add(p0, p1, b);
@@ -2416,6 +2990,7 @@ int64_t Lookahead::slicetypePathCost(Lowres **frames, char *path, int64_t thresh
     int cur_p = 0;
 
     CostEstimateGroup estGroup(*this, frames);
+    estGroup.m_bLowerRes = !!m_param->bHMEPathCosts;
 
     path--; /* Since the 1st path element is really the second frame */
     while (path[loc])
@@ -2586,6 +3161,29 @@ void Lookahead::cuTree(Lowres **frames, int numframes, bool bIntra)
 
     CostEstimateGroup estGroup(*this, frames);
 
+    /* With a lookahead window the frame cost estimates and propagation passes
+     * are gathered into a task graph; each pass then only waits on the cost
+     * estimate of its own frame and on the passes which feed its propagate
+     * costs, so the estimates of the whole window run in parallel */
+    LookaheadTaskGraph* graph = m_propagateAccum && m_param->lookaheadDepth ? m_taskGraph : NULL;
+    if (graph)
+    {
+        graph->reset(frames);
+        graph->m_averageDuration = averageDuration;
+    }
+
+#define COST(p0, p1, b) \
+    if (graph) \
+        graph->addFrameCost(p0, p1, b); \
+    else \
+        estGroup.singleCost(p0, p1, b);
+
+#define PROPAGATE(p0, p1, b, referenced) \
+    if (graph) \
+        graph->addPropagate(p0, p1, b, referenced); \
+    else \
+        estimateCUPropagate(frames, averageDuration, p0, p1, b, referenced);
+
     while (i-- > idx)
     {
         curnonb = i;
@@ -2595,14 +3193,14 @@ void Lookahead::cuTree(Lowres **frames, int numframes, bool bIntra)
         if (curnonb < idx)
             break;
 
-        estGroup.singleCost(curnonb, lastnonb, lastnonb);
+        COST(curnonb, lastnonb, lastnonb);
 
         memset(frames[curnonb]->propagateCost, 0, m_cuCount * sizeof(uint16_t));
         bframes = lastnonb - curnonb - 1;
         if (m_param->bBPyramid && bframes > 1)
         {
             int middle = (bframes + 1) / 2 + curnonb;
-            estGroup.singleCost(curnonb, lastnonb, middle);
+            COST(curnonb, lastnonb, middle);
             memset(frames[middle]->propagateCost, 0, m_cuCount * sizeof(uint16_t));
             while (i > curnonb)
             {
@@ -2610,26 +3208,31 @@ void Lookahead::cuTree(Lowres **frames, int numframes, bool bIntra)
                 int p1 = i < middle ? middle : lastnonb;
                 if (i != middle)
                 {
-                    estGroup.singleCost(p0, p1, i);
-                    estimateCUPropagate(frames, averageDuration, p0, p1, i, 0);
+                    COST(p0, p1, i);
+                    PROPAGATE(p0, p1, i, 0);
                 }
                 i--;
             }
 
-            estimateCUPropagate(frames, averageDuration, curnonb, lastnonb, middle, 1);
+            PROPAGATE(curnonb, lastnonb, middle, 1);
         }
         else
         {
             while (i > curnonb)
             {
-                estGroup.singleCost(curnonb, lastnonb, i);
-                estimateCUPropagate(frames, averageDuration, curnonb, lastnonb, i, 0);
+                COST(curnonb, lastnonb, i);
+                PROPAGATE(curnonb, lastnonb, i, 0);
                 i--;
             }
         }
-        estimateCUPropagate(frames, averageDuration, curnonb, lastnonb, lastnonb, 1);
+        PROPAGATE(curnonb, lastnonb, lastnonb, 1);
         lastnonb = curnonb;
     }
+#undef COST
+#undef PROPAGATE
+
+    if (graph)
+        graph->run();
 
     if (!m_param->lookaheadDepth)
     {
@@ -2644,6 +3247,26 @@ void Lookahead::cuTree(Lowres **frames, int numframes, bool bIntra)
 }
 
 void Lookahead::estimateCUPropagate(Lowres **frames, double averageDuration, int p0, int p1, int b, int referenced)
+{
+    memset(m_scratch, 0, m_8x8Width * sizeof(int));
+
+    /* For non-referred frames the source costs are always zero, so just memset one row and re-use it. */
+    if (!referenced)
+        memset(frames[b]->propagateCost, 0, m_8x8Width * sizeof(uint16_t));
+
+    estimateCUPropagateRows(frames, averageDuration, p0, p1, b, referenced, 0, m_8x8Height, m_scratch, NULL);
+
+    if (m_param->rc.vbvBufferSize && m_param->lookaheadDepth && referenced)
+        cuTreeFinish(frames[b], averageDuration, b == p1 ? b - p0 : 0);
+}
+
+/* Propagate the costs of rows [firstRow, lastRow) of frame b into its
+ * references. With accum, the amounts are atomically added to 32bit
+ * accumulators of the references (see LookaheadTaskGraph) instead of being
+ * clipped into their propagate costs; since all amounts are positive, the
+ * saturated sum does not depend on the order in which they are added */
+void Lookahead::estimateCUPropagateRows(Lowres **frames, double averageDuration, int p0, int p1, int b, int referenced,
+                                        int firstRow, int lastRow, int32_t *scratch, int32_t **accum)
 {
     uint16_t *refCosts[2] = { frames[p0]->propagateCost, frames[p1]->propagateCost };
     int32_t distScaleFactor = (((b - p0) << 8) + ((p1 - p0) >> 1)) / (p1 - p0);
@@ -2651,27 +3274,23 @@ void Lookahead::estimateCUPropagate(Lowres **frames, double averageDuration, int
     int32_t bipredWeights[2] = { bipredWeight, 64 - bipredWeight };
     int listDist[2] = { b - p0, p1 - b };
 
-    memset(m_scratch, 0, m_8x8Width * sizeof(int));
-
     uint16_t *propagateCost = frames[b]->propagateCost;
+    if (referenced)
+        propagateCost += firstRow * m_8x8Width;
 
     x265_emms();
     double fpsFactor = CLIP_DURATION((double)m_param->fpsDenom / m_param->fpsNum) / CLIP_DURATION(averageDuration);
 
-    /* For non-referred frames the source costs are always zero, so just memset one row and re-use it. */
-    if (!referenced)
-        memset(frames[b]->propagateCost, 0, m_8x8Width * sizeof(uint16_t));
-
     int32_t strideInCU = m_8x8Width;
-    for (uint16_t blocky = 0; blocky < m_8x8Height; blocky++)
+    for (uint16_t blocky = (uint16_t)firstRow; blocky < lastRow; blocky++)
     {
         int cuIndex = blocky * strideInCU;
         if (m_param->rc.qgSize == 8)
-            primitives.propagateCost(m_scratch, propagateCost,
+            primitives.propagateCost(scratch, propagateCost,
                        frames[b]->intraCost + cuIndex, frames[b]->lowresCosts[b - p0][p1 - b] + cuIndex,
                        frames[b]->invQscaleFactor8x8 + cuIndex, &fpsFactor, m_8x8Width);
         else
-            primitives.propagateCost(m_scratch, propagateCost,
+            primitives.propagateCost(scratch, propagateCost,
                        frames[b]->intraCost + cuIndex, frames[b]->lowresCosts[b - p0][p1 - b] + cuIndex,
                        frames[b]->invQscaleFactor + cuIndex, &fpsFactor, m_8x8Width);
 
@@ -2680,7 +3299,7 @@ void Lookahead::estimateCUPropagate(Lowres **frames, double averageDuration, int
 
         for (uint16_t blockx = 0; blockx < m_8x8Width; blockx++, cuIndex++)
         {
-            int32_t propagate_amount = m_scratch[blockx];
+            int32_t propagate_amount = scratch[blockx];
             /* Don't propagate for an intra block. */
             if (propagate_amount > 0)
             {
@@ -2692,6 +3311,16 @@ void Lookahead::estimateCUPropagate(Lowres **frames, double averageDuration, int
                     if ((lists_used >> list) & 1)
                     {
 #define CLIP_ADD(s, x) (s) = (uint16_t)X265_MIN((s) + (x), (1 << 16) - 1)
+#define PROPAGATE_ADD(idx, x) \
+    { \
+        if (accum) \
+        { \
+            if (accum[list][idx] < (1 << 16) - 1) \
+                ATOMIC_ADD(&accum[list][idx], x); \
+        } \
+        else \
+            CLIP_ADD(refCosts[list][idx], x); \
+    }
                         int32_t listamount = propagate_amount;
                         /* Apply bipred weighting. */
                         if (lists_used == 3)
@@ -2702,7 +3331,7 @@ void Lookahead::estimateCUPropagate(Lowres **frames, double averageDuration, int
                         /* Early termination for simple case of mv0. */
                         if (!mvs[cuIndex].word)
                         {
-                            CLIP_ADD(refCosts[list][cuIndex], listamount);
+                            PROPAGATE_ADD(cuIndex, listamount);
                             continue;
                         }
 
@@ -2725,30 +3354,29 @@ void Lookahead::estimateCUPropagate(Lowres **frames, double averageDuration, int
                          * be counted. */
                         if (cux < m_8x8Width - 1 && cuy < m_8x8Height - 1 && cux >= 0 && cuy >= 0)
                         {
-                            CLIP_ADD(refCosts[list][idx0], (listamount * idx0weight + 512) >> 10);
-                            CLIP_ADD(refCosts[list][idx1], (listamount * idx1weight + 512) >> 10);
-                            CLIP_ADD(refCosts[list][idx2], (listamount * idx2weight + 512) >> 10);
-                            CLIP_ADD(refCosts[list][idx3], (listamount * idx3weight + 512) >> 10);
+                            PROPAGATE_ADD(idx0, (listamount * idx0weight + 512) >> 10);
+                            PROPAGATE_ADD(idx1, (listamount * idx1weight + 512) >> 10);
+                            PROPAGATE_ADD(idx2, (listamount * idx2weight + 512) >> 10);
+                            PROPAGATE_ADD(idx3, (listamount * idx3weight + 512) >> 10);
                         }
                         else /* Check offsets individually */
                         {
                             if (cux < m_8x8Width && cuy < m_8x8Height && cux >= 0 && cuy >= 0)
-                                CLIP_ADD(refCosts[list][idx0], (listamount * idx0weight + 512) >> 10);
+                                PROPAGATE_ADD(idx0, (listamount * idx0weight + 512) >> 10);
                             if (cux + 1 < m_8x8Width && cuy < m_8x8Height && cux + 1 >= 0 && cuy >= 0)
-                                CLIP_ADD(refCosts[list][idx1], (listamount * idx1weight + 512) >> 10);
+                                PROPAGATE_ADD(idx1, (listamount * idx1weight + 512) >> 10);
                             if (cux < m_8x8Width && cuy + 1 < m_8x8Height && cux >= 0 && cuy + 1 >= 0)
-                                CLIP_ADD(refCosts[list][idx2], (listamount * idx2weight + 512) >> 10);
+                                PROPAGATE_ADD(idx2, (listamount * idx2weight + 512) >> 10);
                             if (cux + 1 < m_8x8Width && cuy + 1 < m_8x8Height && cux + 1 >= 0 && cuy + 1 >= 0)
-                                CLIP_ADD(refCosts[list][idx3], (listamount * idx3weight + 512) >> 10);
+                                PROPAGATE_ADD(idx3, (listamount * idx3weight + 512) >> 10);
                         }
+#undef PROPAGATE_ADD
+#undef CLIP_ADD
                     }
                 }
             }
         }
     }
-
-    if (m_param->rc.vbvBufferSize && m_param->lookaheadDepth && referenced)
-        cuTreeFinish(frames[b], averageDuration, b == p1 ? b - p0 : 0);
 }
 
 void Lookahead::computeCUTreeQpOffset(Lowres *frame, double averageDuration, int ref0Distance)
@@ -3081,35 +3709,7 @@ void CostEstimateGroup::processTasks(int workerThreadID)
 
             X265_CHECK(i < MAX_COOP_SLICES, "impossible number of coop slices\n");
 
-            int firstY, lastY;
-            bool lastRow;
-            if (m_lookahead.m_param->bEnableHME)
-            {
-                int numRowsPerSlice = m_lookahead.m_4x4Height / m_lookahead.m_param->lookaheadSlices;
-                numRowsPerSlice = X265_MIN(X265_MAX(numRowsPerSlice, 5), m_lookahead.m_4x4Height);
-                firstY = numRowsPerSlice * i;
-                lastY = (i == m_jobTotal - 1) ? m_lookahead.m_4x4Height - 1 : numRowsPerSlice * (i + 1) - 1;
-                lastRow = true;
-                for (int cuY = lastY; cuY >= firstY; cuY--)
-                {
-                    for (int cuX = m_lookahead.m_4x4Width - 1; cuX >= 0; cuX--)
-                        estimateCUCost(tld, cuX, cuY, m_coop.p0, m_coop.p1, m_coop.b, m_coop.bDoSearch, lastRow, i, 1);
-                    lastRow = false;
-                }
-            }
-
-            firstY = m_lookahead.m_numRowsPerSlice * i;
-            lastY = (i == m_jobTotal - 1) ? m_lookahead.m_8x8Height - 1 : m_lookahead.m_numRowsPerSlice * (i + 1) - 1;
-            lastRow = true;
-            for (int cuY = lastY; cuY >= firstY; cuY--)
-            {
-                m_frames[m_coop.b]->rowSatds[m_coop.b - m_coop.p0][m_coop.p1 - m_coop.b][cuY] = 0;
-
-                for (int cuX = m_lookahead.m_8x8Width - 1; cuX >= 0; cuX--)
-                    estimateCUCost(tld, cuX, cuY, m_coop.p0, m_coop.p1, m_coop.b, m_coop.bDoSearch, lastRow, i, 0);
-
-                lastRow = false;
-            }
+            estimateSliceCost(tld, m_coop.p0, m_coop.p1, m_coop.b, m_coop.bDoSearch, i, m_jobTotal, m_slice[i]);
         }
 
         m_lock.acquire();
@@ -3119,31 +3719,19 @@ void CostEstimateGroup::processTasks(int workerThreadID)
 
 int64_t CostEstimateGroup::estimateFrameCost(LookaheadTLD& tld, int p0, int p1, int b, bool bIntraPenalty)
 {
+    if (m_bLowerRes)
+        return estimateLowerResCost(tld, p0, p1, b, bIntraPenalty);
+
     Lowres*     fenc  = m_frames[b];
-    x265_param* param = m_lookahead.m_param;
     int64_t     score = 0;
 
-    if (fenc->costEst[b - p0][p1 - b] >= 0 && fenc->rowSatds[b - p0][p1 - b][0] != -1)
+    if (isCostMeasured(p0, p1, b))
         score = fenc->costEst[b - p0][p1 - b];
     else
     {
         bool bDoSearch[2];
-        bDoSearch[0] = fenc->lowresMvs[0][b - p0][0].x == 0x7FFF;
-        bDoSearch[1] = p1 > b && fenc->lowresMvs[1][p1 - b][0].x == 0x7FFF;
-
-#if CHECKED_BUILD
-        X265_CHECK(!(p0 < b && fenc->lowresMvs[0][b - p0][0].x == 0x7FFE), "motion search batch duplication L0\n");
-        X265_CHECK(!(p1 > b && fenc->lowresMvs[1][p1 - b][0].x == 0x7FFE), "motion search batch duplication L1\n");
-        if (bDoSearch[0]) fenc->lowresMvs[0][b - p0][0].x = 0x7FFE;
-        if (bDoSearch[1]) fenc->lowresMvs[1][p1 - b][0].x = 0x7FFE;
-#endif
-
-        fenc->weightedRef[b - p0].isWeighted = false;
-        if (param->bEnableWeightedPred && bDoSearch[0])
-            tld.weightsAnalyse(*m_frames[b], *m_frames[p0]);
-
-        fenc->costEst[b - p0][p1 - b] = 0;
-        fenc->costEstAq[b - p0][p1 - b] = 0;
+        if (!startFrameCost(tld, p0, p1, b, bDoSearch))
+            return 0;
 
         if (!m_batchMode && m_lookahead.m_numCoopSlices > 1 && ((p1 > b) || bDoSearch[0] || bDoSearch[1]))
         {
@@ -3181,13 +3769,13 @@ int64_t CostEstimateGroup::estimateFrameCost(LookaheadTLD& tld, int p0, int p1,
         {
             /* Calculate MVs for 1/16th resolution*/
             bool lastRow;
-            if (param->bEnableHME)
+            if (m_lookahead.m_param->bEnableHME)
             {
                 lastRow = true;
                 for (int cuY = m_lookahead.m_4x4Height - 1; cuY >= 0; cuY--)
                 {
                     for (int cuX = m_lookahead.m_4x4Width - 1; cuX >= 0; cuX--)
-                        estimateCUCost(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, -1, 1);
+                        estimateCUCost(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, NULL, 1);
                     lastRow = false;
                 }
             }
@@ -3197,28 +3785,268 @@ int64_t CostEstimateGroup::estimateFrameCost(LookaheadTLD& tld, int p0, int p1,
                 fenc->rowSatds[b - p0][p1 - b][cuY] = 0;
 
                 for (int cuX = m_lookahead.m_8x8Width - 1; cuX >= 0; cuX--)
-                    estimateCUCost(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, -1, 0);
+                    estimateCUCost(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, NULL, 0);
 
                 lastRow = false;
             }
         }
 
-        score = fenc->costEst[b - p0][p1 - b];
+        score = finishFrameCost(p0, p1, b);
+    }
+
+    if (bIntraPenalty)
+        // arbitrary penalty for I-blocks after B-frames
+        score += score * fenc->intraMbs[b - p0] / (tld.ncu * 8);
+
+    return score;
+}
+
+bool CostEstimateGroup::isCostMeasured(int p0, int p1, int b)
+{
+    Lowres* fenc = m_frames[b];
+    return fenc->costEst[b - p0][p1 - b] >= 0 && fenc->rowSatds[b - p0][p1 - b] && fenc->rowSatds[b - p0][p1 - b][0] != -1;
+}
+
+/* Prepare frame b for the measurement of its (p0, p1) cost: allocate its cost
+ * and motion arrays, decide which motion searches are needed and analyse the
+ * weights of its reference. Returns false if the arrays are not available */
+bool CostEstimateGroup::startFrameCost(LookaheadTLD& tld, int p0, int p1, int b, bool bDoSearch[2])
+{
+    Lowres*     fenc  = m_frames[b];
+    x265_param* param = m_lookahead.m_param;
+
+    bDoSearch[0] = fenc->lowresMvs[0][b - p0][0].x == 0x7FFF;
+    bDoSearch[1] = p1 > b && fenc->lowresMvs[1][p1 - b][0].x == 0x7FFF;
+
+    if (!fenc->allocCosts(b - p0, p1 - b) ||
+        (bDoSearch[0] && !fenc->allocMvs(0, b - p0)) ||
+        (bDoSearch[1] && !fenc->allocMvs(1, p1 - b)))
+    {
+        x265_log(param, X265_LOG_ERROR, "unable to allocate lookahead cost arrays\n");
+        return false;
+    }
+
+#if CHECKED_BUILD
+    X265_CHECK(!(p0 < b && fenc->lowresMvs[0][b - p0][0].x == 0x7FFE), "motion search batch duplication L0\n");
+    X265_CHECK(!(p1 > b && fenc->lowresMvs[1][p1 - b][0].x == 0x7FFE), "motion search batch duplication L1\n");
+    if (bDoSearch[0]) fenc->lowresMvs[0][b - p0][0].x = 0x7FFE;
+    if (bDoSearch[1]) fenc->lowresMvs[1][p1 - b][0].x = 0x7FFE;
+#endif
+
+    fenc->weightedRef[b - p0].isWeighted = false;
+    if (param->bEnableWeightedPred && bDoSearch[0])
+        tld.weightsAnalyse(*m_frames[b], *m_frames[p0]);
+
+    fenc->costEst[b - p0][p1 - b] = 0;
+    fenc->costEstAq[b - p0][p1 - b] = 0;
+    return true;
+}
 
+/* Measure the rows of one cooperative slice of frame b, summing its costs
+ * into sum */
+void CostEstimateGroup::estimateSliceCost(LookaheadTLD& tld, int p0, int p1, int b, bool bDoSearch[2], int slice, int numSlices, Slice& sum)
+{
+    int firstY, lastY;
+    bool lastRow;
+    if (m_lookahead.m_param->bEnableHME)
+    {
+        int numRowsPerSlice = m_lookahead.m_4x4Height / m_lookahead.m_param->lookaheadSlices;
+        numRowsPerSlice = X265_MIN(X265_MAX(numRowsPerSlice, 5), m_lookahead.m_4x4Height);
+        firstY = numRowsPerSlice * slice;
+        lastY = (slice == numSlices - 1) ? m_lookahead.m_4x4Height - 1 : numRowsPerSlice * (slice + 1) - 1;
+        lastRow = true;
+        for (int cuY = lastY; cuY >= firstY; cuY--)
+        {
+            for (int cuX = m_lookahead.m_4x4Width - 1; cuX >= 0; cuX--)
+                estimateCUCost(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, &sum, 1);
+            lastRow = false;
+        }
+    }
+
+    firstY = m_lookahead.m_numRowsPerSlice * slice;
+    lastY = (slice == numSlices - 1) ? m_lookahead.m_8x8Height - 1 : m_lookahead.m_numRowsPerSlice * (slice + 1) - 1;
+    lastRow = true;
+    for (int cuY = lastY; cuY >= firstY; cuY--)
+    {
+        m_frames[b]->rowSatds[b - p0][p1 - b][cuY] = 0;
+
+        for (int cuX = m_lookahead.m_8x8Width - 1; cuX >= 0; cuX--)
+            estimateCUCost(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, &sum, 0);
+
+        lastRow = false;
+    }
+}
+
+/* Scale the summed (p0, p1) cost of frame b into its final score */
+int64_t CostEstimateGroup::finishFrameCost(int p0, int p1, int b)
+{
+    Lowres* fenc = m_frames[b];
+    int64_t score = fenc->costEst[b - p0][p1 - b];
+
+    if (b != p1)
+        score = score * 100 / (130 + m_lookahead.m_param->bFrameBias);
+
+    fenc->costEst[b - p0][p1 - b] = score;
+    ATOMIC_INC(&m_lookahead.m_numLowresEstimates);
+    return score;
+}
+
+/* Estimate the (p0, p1) cost of frame b for the B-path decision on the HME
+ * level, which has a quarter of the blocks of the lowres picture. The motion
+ * searches are those of the HME pass of estimateFrameCost(), so the MVs are
+ * reused as predictors if the chosen path is later estimated at lowres. The
+ * costs are kept apart from the lowres costs (which rate control and cutree
+ * use) and are scaled to the lowres block count */
+int64_t CostEstimateGroup::estimateLowerResCost(LookaheadTLD& tld, int p0, int p1, int b, bool bIntraPenalty)
+{
+    Lowres* fenc = m_frames[b];
+    int64_t score;
+
+    if (fenc->lowerResCostEst[b - p0][p1 - b] >= 0)
+        score = fenc->lowerResCostEst[b - p0][p1 - b];
+    else
+    {
+        if (!fenc->allocMvs(0, b - p0) || (p1 > b && !fenc->allocMvs(1, p1 - b)))
+        {
+            x265_log(m_lookahead.m_param, X265_LOG_ERROR, "unable to allocate lookahead cost arrays\n");
+            return 0;
+        }
+
+        bool bDoSearch[2];
+        bDoSearch[0] = fenc->lowerResMvs[0][b - p0][0].x == 0x7FFF;
+        bDoSearch[1] = p1 > b && fenc->lowerResMvs[1][p1 - b][0].x == 0x7FFF;
+
+        Slice sum;
+        memset(&sum, 0, sizeof(sum));
+
+        bool lastRow = true;
+        for (int cuY = m_lookahead.m_4x4Height - 1; cuY >= 0; cuY--)
+        {
+            for (int cuX = m_lookahead.m_4x4Width - 1; cuX >= 0; cuX--)
+                estimateLowerResCUCost(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, sum);
+            lastRow = false;
+        }
+
+        /* each HME block covers four lowres blocks */
+        score = (int64_t)sum.costEst * 4;
         if (b != p1)
-            score = score * 100 / (130 + param->bFrameBias);
+            score = score * 100 / (130 + m_lookahead.m_param->bFrameBias);
+        else
+            fenc->lowerResIntraMbs[b - p0] = sum.intraMbs * 4;
 
-        fenc->costEst[b - p0][p1 - b] = score;
+        fenc->lowerResCostEst[b - p0][p1 - b] = score;
+        ATOMIC_INC(&m_lookahead.m_numLowerResEstimates);
     }
 
     if (bIntraPenalty)
         // arbitrary penalty for I-blocks after B-frames
-        score += score * fenc->intraMbs[b - p0] / (tld.ncu * 8);
+        score += score * fenc->lowerResIntraMbs[b - p0] / (tld.ncu * 8);
 
     return score;
 }
 
-void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int p0, int p1, int b, bool bDoSearch[2], bool lastRow, int slice, bool hme)
+void CostEstimateGroup::estimateLowerResCUCost(LookaheadTLD& tld, int cuX, int cuY, int p0, int p1, int b, bool bDoSearch[2], bool lastRow, Slice& sum)
+{
+#if HIGH_BIT_DEPTH
+    if (m_lookahead.m_param->bLowres8bit)
+    {
+        lowerResCUCost<uint8_t>(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, sum);
+        return;
+    }
+#endif
+    lowerResCUCost<pixel>(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, sum);
+}
+
+template<typename T>
+void CostEstimateGroup::lowerResCUCost(LookaheadTLD& tld, int cuX, int cuY, int p0, int p1, int b, bool bDoSearch[2], bool lastRow, Slice& sum)
+{
+    /* motion search of the HME level, which also sets the source block of
+     * tld.me whenever it is needed below */
+    lowresCUCost<T>(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, NULL, 1);
+
+    Lowres *fref0 = m_frames[p0];
+    Lowres *fref1 = m_frames[p1];
+    Lowres *fenc  = m_frames[b];
+
+    const int widthInCU = m_lookahead.m_4x4Width;
+    const int heightInCU = m_lookahead.m_4x4Height;
+    const int bBidir = (b < p1);
+    const int cuXY = cuX + cuY * widthInCU;
+    const intptr_t pelOffset = X265_LOWRES_CU_SIZE * cuX + X265_LOWRES_CU_SIZE * cuY * (fenc->lumaStride / 2);
+    int listDist[2] = { b - p0, p1 - b };
+    int lowresPenalty = 4;
+
+    int bcost = fenc->lowerResMvCosts[0][listDist[0]][cuXY];
+    int listused = 1;
+
+    if (bBidir)
+    {
+        COPY2_IF_LT(bcost, fenc->lowerResMvCosts[1][listDist[1]][cuXY], listused, 2);
+
+        ALIGN_VAR_32(T, subpelbuf0[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
+        ALIGN_VAR_32(T, subpelbuf1[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
+        intptr_t stride0 = X265_LOWRES_CU_SIZE, stride1 = X265_LOWRES_CU_SIZE;
+        T *src0 = fref0->lowresMC(pelOffset, fenc->lowerResMvs[0][listDist[0]][cuXY], subpelbuf0, stride0, 1);
+        T *src1 = fref1->lowresMC(pelOffset, fenc->lowerResMvs[1][listDist[1]][cuXY], subpelbuf1, stride1, 1);
+        ALIGN_VAR_32(T, ref[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
+        getLowresPrimitives<T>().pixelavg_pp[NONALIGNED](ref, X265_LOWRES_CU_SIZE, src0, stride0, src1, stride1, 32);
+        int bicost = tld.me.bufSATD(ref, X265_LOWRES_CU_SIZE);
+        COPY2_IF_LT(bcost, bicost, listused, 3);
+        /* coloc candidate */
+        src0 = fref0->planes<T>(true)[0] + pelOffset;
+        src1 = fref1->planes<T>(true)[0] + pelOffset;
+        getLowresPrimitives<T>().pixelavg_pp[NONALIGNED](ref, X265_LOWRES_CU_SIZE, src0, fref0->lumaStride / 2, src1, fref1->lumaStride / 2, 32);
+        bicost = tld.me.bufSATD(ref, X265_LOWRES_CU_SIZE);
+        COPY2_IF_LT(bcost, bicost, listused, 3);
+        bcost += lowresPenalty;
+    }
+    else
+    {
+        bcost += lowresPenalty;
+
+        /* there is no intra estimate on the HME level, use the mean intra
+         * cost of the lowres blocks this block covers */
+        int intraCost = 0, count = 0;
+        for (int y = cuY * 2; y < X265_MIN(cuY * 2 + 2, m_lookahead.m_8x8Height); y++)
+        {
+            for (int x = cuX * 2; x < X265_MIN(cuX * 2 + 2, m_lookahead.m_8x8Width); x++)
+            {
+                intraCost += fenc->intraCost[x + y * m_lookahead.m_8x8Width];
+                count++;
+            }
+        }
+        if (count && intraCost / count < bcost)
+        {
+            bcost = intraCost / count;
+            listused = 0;
+        }
+    }
+
+    /* do not include edge blocks in the frame cost estimates, they are not very accurate */
+    const bool bFrameScoreCU = (cuX > 0 && cuX < widthInCU - 1 &&
+                                cuY > 0 && cuY < heightInCU - 1) || widthInCU <= 2 || heightInCU <= 2;
+    if (bFrameScoreCU)
+    {
+        sum.costEst += bcost;
+        if (!listused && !bBidir)
+            sum.intraMbs++;
+    }
+}
+
+void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int p0, int p1, int b, bool bDoSearch[2], bool lastRow, Slice* slice, bool hme)
+{
+#if HIGH_BIT_DEPTH
+    if (m_lookahead.m_param->bLowres8bit)
+    {
+        lowresCUCost<uint8_t>(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, slice, hme);
+        return;
+    }
+#endif
+    lowresCUCost<pixel>(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, slice, hme);
+}
+
+template<typename T>
+void CostEstimateGroup::lowresCUCost(LookaheadTLD& tld, int cuX, int cuY, int p0, int p1, int b, bool bDoSearch[2], bool lastRow, Slice* slice, bool hme)
 {
     Lowres *fref0 = m_frames[p0];
     Lowres *fref1 = m_frames[p1];
@@ -3235,9 +4063,9 @@ void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int
     const intptr_t pelOffset = cuSize * cuX + cuSize * cuY * (hme ? fenc->lumaStride/2 : fenc->lumaStride);
 
     if ((bBidir || bDoSearch[0] || bDoSearch[1]) && hme)
-        tld.me.setSourcePU(fenc->lowerResPlane[0], fenc->lumaStride / 2, pelOffset, cuSize, cuSize, X265_HEX_SEARCH, m_lookahead.m_param->hmeSearchMethod[0], m_lookahead.m_param->hmeSearchMethod[1], 1);
+        tld.me.setSourcePU(fenc->planes<T>(true)[0], fenc->lumaStride / 2, pelOffset, cuSize, cuSize, X265_HEX_SEARCH, m_lookahead.m_param->hmeSearchMethod[0], m_lookahead.m_param->hmeSearchMethod[1], 1);
     else if((bBidir || bDoSearch[0] || bDoSearch[1]) && !hme)
-        tld.me.setSourcePU(fenc->lowresPlane[0], fenc->lumaStride, pelOffset, cuSize, cuSize, X265_HEX_SEARCH, m_lookahead.m_param->hmeSearchMethod[0], m_lookahead.m_param->hmeSearchMethod[1], 1);
+        tld.me.setSourcePU(fenc->planes<T>(false)[0], fenc->lumaStride, pelOffset, cuSize, cuSize, X265_HEX_SEARCH, m_lookahead.m_param->hmeSearchMethod[0], m_lookahead.m_param->hmeSearchMethod[1], 1);
 
 
     /* A small, arbitrary bias to avoid VBV problems caused by zero-residual lookahead blocks. */
@@ -3283,7 +4111,7 @@ void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int
             if (cuX < widthInCU - 1)
                 MVC(fencMV[widthInCU + 1]);
         }
-        if (fenc->lowerResMvs[0][0] && !hme && fenc->lowerResMvCosts[i][listDist[i]][cuXY_4x4] > 0)
+        if (fenc->bEnableHME && !hme && fenc->lowerResMvCosts[i][listDist[i]][cuXY_4x4] > 0)
         {
             MVC((fenc->lowerResMvs[i][listDist[i]][cuXY_4x4]) * 2);
         }
@@ -3293,7 +4121,7 @@ void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int
             mvp = 0;
         else
         {
-            ALIGN_VAR_32(pixel, subpelbuf[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
+            ALIGN_VAR_32(T, subpelbuf[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
             int mvpcost = MotionEstimate::COST_MAX;
 
             /* measure SATD cost of each neighbor MV (estimating merge analysis)
@@ -3302,7 +4130,7 @@ void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int
             for (int idx = 0; idx < numc; idx++)
             {
                 intptr_t stride = X265_LOWRES_CU_SIZE;
-                pixel *src = fref->lowresMC(pelOffset, mvc[idx], subpelbuf, stride, hme);
+                T *src = fref->lowresMC(pelOffset, mvc[idx], subpelbuf, stride, hme);
                 int cost = tld.me.bufSATD(src, stride);
                 COPY2_IF_LT(mvpcost, cost, mvp, mvc[idx]);
                 /* Except for mv0 case, everyting else is likely to have enough residual to not trigger the skip. */
@@ -3314,10 +4142,7 @@ void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int
         int searchRange = m_lookahead.m_param->bEnableHME ? (hme ? m_lookahead.m_param->hmeRange[0] : m_lookahead.m_param->hmeRange[1]) : s_merange;
         /* ME will never return a cost larger than the cost @MVP, so we do not
          * have to check that ME cost is more than the estimated merge cost */
-        if(!hme)
-            fencCost = tld.me.motionEstimate(fref, mvmin, mvmax, mvp, 0, NULL, searchRange, *fencMV, m_lookahead.m_param->maxSlices);
-        else
-            fencCost = tld.me.motionEstimate(fref, mvmin, mvmax, mvp, 0, NULL, searchRange, *fencMV, m_lookahead.m_param->maxSlices, fref->lowerResPlane[0]);
+        fencCost = tld.me.motionEstimate(fref, mvmin, mvmax, mvp, 0, NULL, searchRange, *fencMV, m_lookahead.m_param->maxSlices, fref->planes<T>(hme)[0]);
         if (skipCost < 64 && skipCost < fencCost && bBidir)
         {
             fencCost = skipCost;
@@ -3333,19 +4158,19 @@ void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int
         /* NOTE: the wfref0 (weightp) is not used for BIDIR */
 
         /* avg(l0-mv, l1-mv) candidate */
-        ALIGN_VAR_32(pixel, subpelbuf0[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
-        ALIGN_VAR_32(pixel, subpelbuf1[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
+        ALIGN_VAR_32(T, subpelbuf0[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
+        ALIGN_VAR_32(T, subpelbuf1[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
         intptr_t stride0 = X265_LOWRES_CU_SIZE, stride1 = X265_LOWRES_CU_SIZE;
-        pixel *src0 = fref0->lowresMC(pelOffset, fenc->lowresMvs[0][listDist[0]][cuXY], subpelbuf0, stride0, 0);
-        pixel *src1 = fref1->lowresMC(pelOffset, fenc->lowresMvs[1][listDist[1]][cuXY], subpelbuf1, stride1, 0);
-        ALIGN_VAR_32(pixel, ref[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
-        primitives.pu[LUMA_8x8].pixelavg_pp[NONALIGNED](ref, X265_LOWRES_CU_SIZE, src0, stride0, src1, stride1, 32);
+        T *src0 = fref0->lowresMC(pelOffset, fenc->lowresMvs[0][listDist[0]][cuXY], subpelbuf0, stride0, 0);
+        T *src1 = fref1->lowresMC(pelOffset, fenc->lowresMvs[1][listDist[1]][cuXY], subpelbuf1, stride1, 0);
+        ALIGN_VAR_32(T, ref[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
+        getLowresPrimitives<T>().pixelavg_pp[NONALIGNED](ref, X265_LOWRES_CU_SIZE, src0, stride0, src1, stride1, 32);
         int bicost = tld.me.bufSATD(ref, X265_LOWRES_CU_SIZE);
         COPY2_IF_LT(bcost, bicost, listused, 3);
         /* coloc candidate */
-        src0 = fref0->lowresPlane[0] + pelOffset;
-        src1 = fref1->lowresPlane[0] + pelOffset;
-        primitives.pu[LUMA_8x8].pixelavg_pp[NONALIGNED](ref, X265_LOWRES_CU_SIZE, src0, fref0->lumaStride, src1, fref1->lumaStride, 32);
+        src0 = fref0->planes<T>(false)[0] + pelOffset;
+        src1 = fref1->planes<T>(false)[0] + pelOffset;
+        getLowresPrimitives<T>().pixelavg_pp[NONALIGNED](ref, X265_LOWRES_CU_SIZE, src0, fref0->lumaStride, src1, fref1->lumaStride, 32);
         bicost = tld.me.bufSATD(ref, X265_LOWRES_CU_SIZE);
         COPY2_IF_LT(bcost, bicost, listused, 3);
         bcost += lowresPenalty;
@@ -3372,7 +4197,7 @@ void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int
 
     if (bFrameScoreCU)
     {
-        if (slice < 0)
+        if (!slice)
         {
             fenc->costEst[b - p0][p1 - b] += bcost;
             fenc->costEstAq[b - p0][p1 - b] += bcostAq;
@@ -3381,10 +4206,10 @@ void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int
         }
         else
         {
-            m_slice[slice].costEst += bcost;
-            m_slice[slice].costEstAq += bcostAq;
+            slice->costEst += bcost;
+            slice->costEstAq += bcostAq;
             if (!listused && !bBidir)
-                m_slice[slice].intraMbs++;
+                slice->intraMbs++;
         }
     }
 
@@ -3392,4 +4217,326 @@ void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int
     fenc->lowresCosts[b - p0][p1 - b][cuXY] = (uint16_t)(X265_MIN(bcost, LOWRES_COST_MASK) | (listused << LOWRES_COST_SHIFT));
 }
 
+LookaheadTaskGraph::LookaheadTaskGraph(Lookahead& l)
+    : CostEstimateGroup(l, NULL)
+{
+    m_nodes = NULL;
+    m_edges = NULL;
+    m_ready = NULL;
+    m_maxNodes = m_maxEdges = 0;
+    m_averageDuration = 0;
+    m_numBands = X265_MIN(X265_MAX(l.m_8x8Height / 4, 1), (int)MAX_PROPAGATE_BANDS);
+    reset(NULL);
+}
+
+LookaheadTaskGraph::~LookaheadTaskGraph()
+{
+    waitForExit();
+    X265_FREE(m_nodes);
+    X265_FREE(m_edges);
+    X265_FREE(m_ready);
+}
+
+bool LookaheadTaskGraph::create(int maxNodes, int maxEdges)
+{
+    m_maxNodes = maxNodes;
+    m_maxEdges = maxEdges;
+    CHECKED_MALLOC(m_nodes, Node, maxNodes);
+    CHECKED_MALLOC(m_edges, Edge, maxEdges);
+    CHECKED_MALLOC(m_ready, int, maxNodes);
+    return true;
+
+fail:
+    return false;
+}
+
+void LookaheadTaskGraph::reset(Lowres** frames)
+{
+    m_frames = frames;
+    m_batchMode = true;
+    m_bLowerRes = false;
+    m_jobTotal = m_jobAcquired = 0;
+    m_numNodes = m_numEdges = 0;
+    m_readyHead = m_readyTail = 0;
+    m_numDone = 0;
+    m_numTargets = 0;
+    for (int i = 0; i < X265_LOOKAHEAD_MAX + 2; i++)
+        m_costNode[i] = m_finishNode[i] = m_targetSlot[i] = m_slotWait[i] = -1;
+    for (int i = 0; i < MAX_ACCUM_SLOTS; i++)
+        m_slotOwner[i] = -1;
+}
+
+int LookaheadTaskGraph::addNode(int type, int p0, int p1, int b)
+{
+    X265_CHECK(m_numNodes < m_maxNodes, "lookahead task graph node overflow\n");
+
+    Node& node = m_nodes[m_numNodes];
+    node.type = type;
+    node.p0 = p0;
+    node.p1 = p1;
+    node.b = b;
+    node.firstRow = node.lastRow = 0;
+    node.arg = 0;
+    node.slot[0] = node.slot[1] = -1;
+    node.pending = 0;
+    node.firstEdge = -1;
+    return m_numNodes++;
+}
+
+void LookaheadTaskGraph::addDependency(int from, int to)
+{
+    X265_CHECK(m_numEdges < m_maxEdges, "lookahead task graph edge overflow\n");
+
+    Edge& edge = m_edges[m_numEdges];
+    edge.to = to;
+    edge.next = m_nodes[from].firstEdge;
+    m_nodes[from].firstEdge = m_numEdges++;
+    m_nodes[to].pending++;
+}
+
+int LookaheadTaskGraph::addCostEstimate(int p0, int p1, int b)
+{
+    return addNode(NODE_COST_ESTIMATE, p0, p1, b);
+}
+
+/* Adds the (p0, p1) cost estimate of frame b, unless it is already measured,
+ * and returns the node which completes it (or -1). Estimates which would have
+ * been measured cooperatively are split into one node per slice, which
+ * measures exactly what the cooperative slice would have, so the costs do
+ * not depend on whether the estimate is made here or by singleCost() */
+int LookaheadTaskGraph::addFrameCost(int p0, int p1, int b)
+{
+    Lookahead& l = m_lookahead;
+
+    if (isCostMeasured(p0, p1, b))
+        return -1;
+
+    bool bDoSearch[2];
+    bDoSearch[0] = m_frames[b]->lowresMvs[0][b - p0][0].x == 0x7FFF;
+    bDoSearch[1] = p1 > b && m_frames[b]->lowresMvs[1][p1 - b][0].x == 0x7FFF;
+
+    int node;
+    if (l.m_numCoopSlices > 1 && ((p1 > b) || bDoSearch[0] || bDoSearch[1]))
+    {
+        LookaheadTLD& tld = l.m_tld[l.m_pool ? l.m_pool->m_numWorkers : 0];
+        if (!startFrameCost(tld, p0, p1, b, bDoSearch))
+            return -1;
+
+        node = addNode(NODE_COST_FINISH, p0, p1, b);
+        m_nodes[node].firstRow = m_numNodes;
+        for (int i = 0; i < l.m_numCoopSlices; i++)
+        {
+            int slice = addNode(NODE_COST_SLICE, p0, p1, b);
+            m_nodes[slice].arg = i;
+            m_nodes[slice].bDoSearch[0] = bDoSearch[0];
+            m_nodes[slice].bDoSearch[1] = bDoSearch[1];
+            memset(&m_nodes[slice].sum, 0, sizeof(Slice));
+            addDependency(slice, node);
+        }
+        m_nodes[node].lastRow = m_numNodes;
+    }
+    else
+        node = addCostEstimate(p0, p1, b);
+
+    m_costNode[b] = node;
+    return node;
+}
+
+/* Returns the accumulator slot of a frame receiving propagated costs,
+ * allocating its finish node on first use. A slot may only be reused once the
+ * finish node of its previous frame has consumed (and cleared) it */
+int LookaheadTaskGraph::propagateTarget(int frame)
+{
+    if (m_finishNode[frame] < 0)
+    {
+        int slot = m_numTargets++ % m_lookahead.m_numAccumSlots;
+        int node = addNode(NODE_PROPAGATE_FINISH, frame, frame, frame);
+        m_nodes[node].slot[0] = slot;
+        m_finishNode[frame] = node;
+        m_targetSlot[frame] = slot;
+        m_slotWait[frame] = m_slotOwner[slot];
+        m_slotOwner[slot] = node;
+    }
+    return m_targetSlot[frame];
+}
+
+void LookaheadTaskGraph::addPropagate(int p0, int p1, int b, int referenced)
+{
+    Lookahead& l = m_lookahead;
+
+    /* For non-referred frames the source costs are always zero, so just memset one row and re-use it. */
+    if (!referenced)
+        memset(m_frames[b]->propagateCost, 0, l.m_8x8Width * sizeof(uint16_t));
+
+    int slot[2];
+    slot[0] = propagateTarget(p0);
+    slot[1] = p1 > b ? propagateTarget(p1) : -1;
+
+    int finish = -1;
+    if (l.m_param->rc.vbvBufferSize && l.m_param->lookaheadDepth && referenced)
+    {
+        finish = addNode(NODE_CUTREE_FINISH, p0, p1, b);
+        m_nodes[finish].arg = b == p1 ? b - p0 : 0;
+    }
+
+    for (int band = 0; band < m_numBands; band++)
+    {
+        int node = addNode(NODE_PROPAGATE, p0, p1, b);
+        m_nodes[node].firstRow = band * l.m_8x8Height / m_numBands;
+        m_nodes[node].lastRow = (band + 1) * l.m_8x8Height / m_numBands;
+        m_nodes[node].arg = referenced;
+        m_nodes[node].slot[0] = slot[0];
+        m_nodes[node].slot[1] = slot[1];
+
+        /* the propagate costs of a referenced frame must be final before they are passed on */
+        if (referenced && m_finishNode[b] >= 0)
+            addDependency(m_finishNode[b], node);
+        if (m_costNode[b] >= 0)
+            addDependency(m_costNode[b], node);
+
+        for (int list = 0; list < 2; list++)
+        {
+            int ref = list ? p1 : p0;
+            if (slot[list] < 0)
+                continue;
+            if (m_slotWait[ref] >= 0)
+                addDependency(m_slotWait[ref], node);
+            addDependency(node, m_finishNode[ref]);
+        }
+
+        if (finish >= 0)
+            addDependency(node, finish);
+    }
+}
+
+void LookaheadTaskGraph::run()
+{
+    if (!m_numNodes)
+        return;
+
+    ThreadPool* pool = m_lookahead.m_pool;
+
+    m_lock.acquire();
+    for (int i = 0; i < m_numNodes; i++)
+    {
+        if (!m_nodes[i].pending)
+            m_ready[m_readyTail++] = i;
+    }
+    if (pool && m_readyTail > 1)
+        tryBondPeers(*pool, m_readyTail - 1);
+    m_lock.release();
+
+    processTasks(-1);
+
+    /* nodes may still be in progress on bonded workers */
+    m_allDone.wait();
+    waitForExit();
+}
+
+void LookaheadTaskGraph::processTasks(int workerThreadID)
+{
+    ThreadPool* pool = m_lookahead.m_pool;
+    int id = workerThreadID;
+    if (workerThreadID < 0)
+        id = pool ? pool->m_numWorkers : 0;
+    LookaheadTLD& tld = m_lookahead.m_tld[id];
+    int32_t* scratch = m_lookahead.m_scratch + id * m_lookahead.m_8x8Width;
+
+    m_lock.acquire();
+    while (m_readyHead < m_readyTail)
+    {
+        int n = m_ready[m_readyHead++];
+        m_lock.release();
+
+        processNode(tld, scratch, m_nodes[n]);
+
+        m_lock.acquire();
+        int newReady = 0;
+        for (int e = m_nodes[n].firstEdge; e >= 0; e = m_edges[e].next)
+        {
+            int to = m_edges[e].to;
+            if (!--m_nodes[to].pending)
+            {
+                m_ready[m_readyTail++] = to;
+                newReady++;
+            }
+        }
+
+        /* this thread continues with one of the released nodes */
+        if (pool && newReady > 1)
+            tryBondPeers(*pool, newReady - 1);
+
+        if (++m_numDone == m_numNodes)
+            m_allDone.trigger();
+    }
+    m_lock.release();
+}
+
+void LookaheadTaskGraph::processNode(LookaheadTLD& tld, int32_t* scratch, Node& node)
+{
+    Lookahead& l = m_lookahead;
+
+    switch (node.type)
+    {
+    case NODE_COST_ESTIMATE:
+    {
+        ProfileLookaheadTime(tld.batchElapsedTime, tld.countBatches);
+        ProfileScopeEvent(estCostSingle);
+
+        estimateFrameCost(tld, node.p0, node.p1, node.b, false);
+        break;
+    }
+
+    case NODE_COST_SLICE:
+    {
+        ProfileLookaheadTime(tld.coopSliceElapsedTime, tld.countCoopSlices);
+        ProfileScopeEvent(estCostCoop);
+
+        estimateSliceCost(tld, node.p0, node.p1, node.b, node.bDoSearch, node.arg, l.m_numCoopSlices, node.sum);
+        break;
+    }
+
+    case NODE_COST_FINISH:
+    {
+        Lowres* fenc = m_frames[node.b];
+        int p0 = node.p0, p1 = node.p1, b = node.b;
+        for (int i = node.firstRow; i < node.lastRow; i++)
+        {
+            fenc->costEst[b - p0][p1 - b] += m_nodes[i].sum.costEst;
+            fenc->costEstAq[b - p0][p1 - b] += m_nodes[i].sum.costEstAq;
+            if (p1 == b)
+                fenc->intraMbs[b - p0] += m_nodes[i].sum.intraMbs;
+        }
+        finishFrameCost(p0, p1, b);
+        break;
+    }
+
+    case NODE_PROPAGATE:
+    {
+        int32_t* accum[2];
+        accum[0] = l.m_propagateAccum + node.slot[0] * l.m_cuCount;
+        accum[1] = node.slot[1] >= 0 ? l.m_propagateAccum + node.slot[1] * l.m_cuCount : NULL;
+        l.estimateCUPropagateRows(m_frames, m_averageDuration, node.p0, node.p1, node.b, node.arg,
+                                  node.firstRow, node.lastRow, scratch, accum);
+        break;
+    }
+
+    case NODE_PROPAGATE_FINISH:
+    {
+        uint16_t* propagateCost = m_frames[node.b]->propagateCost;
+        int32_t* accum = l.m_propagateAccum + node.slot[0] * l.m_cuCount;
+        for (int i = 0; i < l.m_cuCount; i++)
+        {
+            propagateCost[i] = (uint16_t)X265_MIN(accum[i], (1 << 16) - 1);
+            accum[i] = 0;
+        }
+        break;
+    }
+
+    case NODE_CUTREE_FINISH:
+        l.cuTreeFinish(m_frames[node.b], m_averageDuration, node.arg);
+        break;
+    }
+}
+
 }
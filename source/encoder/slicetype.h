@@ -37,6 +37,8 @@ namespace X265_NS {
 struct Lowres;
 class Frame;
 class Lookahead;
+class LookaheadTaskGraph;
+class PreLookaheadGroup;
 
 #define LOWRES_COST_MASK  ((1 << 14) - 1)
 #define LOWRES_COST_SHIFT 14
@@ -51,16 +53,33 @@ class Lookahead;
 #endif
 #define PI 3.14159265
 
+/* histogram based scene-cut thresholds */
+#define MAX_SCENECUT_THRESHOLD 1.0
+#define SCENECUT_STRENGTH_FACTOR 2.0
+#define MIN_EDGE_FACTOR 0.5
+#define MAX_EDGE_FACTOR 1.5
+#define SCENECUT_CHROMA_FACTOR 10.0
+
 /* Thread local data for lookahead tasks */
 struct LookaheadTLD
 {
     MotionEstimate  me;
     pixel*          wbuffer[4];
+#if HIGH_BIT_DEPTH
+    uint8_t*        wbuffer8[4];  // weighted lowres planes of --lowres-8bit
+#endif
     int             widthInCU;
     int             heightInCU;
     int             ncu;
     int             paddedLines;
 
+    /* AC energy of each AQ block of the frame being pre-analysed, measured
+     * by initLowres() in the same sweep as the lowres downscale */
+    uint32_t*       energyCache;
+    uint64_t        energySum[3];
+    uint64_t        energySsd[3];
+    bool            bEnergyCached;
+
 #if DETAILED_CU_STATS
     int64_t         batchElapsedTime;
     int64_t         coopSliceElapsedTime;
@@ -74,7 +93,13 @@ struct LookaheadTLD
         me.setQP(X265_LOOKAHEAD_QP);
         for (int i = 0; i < 4; i++)
             wbuffer[i] = NULL;
+#if HIGH_BIT_DEPTH
+        for (int i = 0; i < 4; i++)
+            wbuffer8[i] = NULL;
+#endif
         widthInCU = heightInCU = ncu = paddedLines = 0;
+        energyCache = NULL;
+        bEnergyCached = false;
 
 #if DETAILED_CU_STATS
         batchElapsedTime = 0;
@@ -91,9 +116,17 @@ struct LookaheadTLD
         ncu = n;
     }
 
-    ~LookaheadTLD() { X265_FREE(wbuffer[0]); }
+    ~LookaheadTLD()
+    {
+        X265_FREE(wbuffer[0]);
+#if HIGH_BIT_DEPTH
+        X265_FREE(wbuffer8[0]);
+#endif
+        X265_FREE(energyCache);
+    }
 
-    void calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param);
+    void initLowres(Frame *curFrame, x265_param* param, bool bAdaptiveQuant);
+    void calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param, ThreadPool* pool);
     void lowresIntraEstimate(Lowres& fenc, uint32_t qgSize);
 
     void weightsAnalyse(Lowres& fenc, Lowres& ref);
@@ -102,25 +135,50 @@ struct LookaheadTLD
 protected:
 
     uint32_t acEnergyCu(Frame* curFrame, uint32_t blockX, uint32_t blockY, int csp, uint32_t qgSize);
+    void     cacheEnergyRows(Frame* curFrame, x265_param* param, int firstRow, int lastRow);
+    const uint32_t* frameEnergy(Frame* curFrame, x265_param* param);
     uint32_t edgeDensityCu(Frame* curFrame, uint32_t &avgAngle, uint32_t blockX, uint32_t blockY, uint32_t qgSize);
     uint32_t lumaSumCu(Frame* curFrame, uint32_t blockX, uint32_t blockY, uint32_t qgSize);
+
+    /* the lowres estimates on planes of sample type T, pixel or the
+     * uint8_t planes of --lowres-8bit */
+    template<typename T>
+    void     intraEstimate(Lowres& fenc, uint32_t qgSize);
+    template<typename T>
+    void     weightsSearch(Lowres& fenc, Lowres& ref);
+    template<typename T>
     uint32_t weightCostLuma(Lowres& fenc, Lowres& ref, WeightParam& wp);
+    template<typename T>
     bool     allocWeightedRef(Lowres& fenc);
+    template<typename T>
+    T**      weightBuffers();
 };
 
+template<>
+inline pixel** LookaheadTLD::weightBuffers<pixel>() { return wbuffer; }
+#if HIGH_BIT_DEPTH
+template<>
+inline uint8_t** LookaheadTLD::weightBuffers<uint8_t>() { return wbuffer8; }
+#endif
+
 class Lookahead : public JobProvider
 {
 public:
 
-    PicList       m_inputQueue;      // input pictures in order received
-    PicList       m_outputQueue;     // pictures to be encoded, in encode order
-    Lock          m_inputLock;
-    Lock          m_outputLock;
+    PicList       m_inputQueue;      // input pictures in order received, owned by slicetypeDecide
+    PicQueue      m_inputRing;       // pictures handed over by the API thread, not yet in m_inputQueue
+    PicQueue      m_outputQueue;     // pictures to be encoded, in encode order
+    Lock          m_inputLock;       // held by whichever thread moves pictures from m_inputRing
     Event         m_outputSignal;
+    volatile int  m_queuedFrames;    // pictures received but not yet decided
     LookaheadTLD* m_tld;
     x265_param*   m_param;
     Lowres*       m_lastNonB;
-    int*          m_scratch;         // temp buffer for cutree propagate
+    int*          m_scratch;         // temp buffers for cutree propagate, one row per TLD
+    int32_t*      m_propagateAccum;  // cutree task graph propagate cost accumulators
+    int           m_numAccumSlots;   // count of m_cuCount sized accumulators
+    LookaheadTaskGraph* m_taskGraph; // dependency graph of lookahead work, when a pool is available
+    LowresPool    m_lowresPool;      // motion vector and cost arrays of the lowres pictures
 
     /* pre-lookahead */
     int           m_fullQueueSize;
@@ -153,6 +211,37 @@ public:
     bool          m_isFadeIn;
     uint64_t      m_fadeCount;
     int           m_fadeStart;
+
+    /* histogram based scene-cut (--hist-scenecut). The histograms of each
+     * picture are computed by the pre-lookahead when m_bHistInPreLookahead,
+     * else by the API thread before the picture is queued */
+    bool          m_bHistInPreLookahead;
+
+    /* --fast-secondpass: the slice types and cuTree offsets are read from
+     * the first-pass stats and rate control reads no lowres cost, so no frame
+     * cost (nor lowres motion search) is estimated for the decided pictures */
+    bool          m_bReuseFirstPass;
+    int32_t       m_prevEdgeHist[EDGE_BINS];
+    int32_t       m_prevYUVHist[3][HISTOGRAM_BINS];
+    uint32_t      m_planeSizes[3];
+    double        m_edgeHistThreshold;
+    double        m_chromaHistThreshold;
+    double        m_scaledEdgeThreshold;
+    double        m_scaledChromaThreshold;
+
+    /* streaming slice type decisions (--lookahead-latency): pictures are
+     * pre-analysed as they arrive, and m_fullQueueSize is the latency budget
+     * in pictures rather than the lookahead depth */
+    bool          m_bStreaming;
+    int           m_latencyFrames;
+    volatile int  m_arrivals;        // pictures queued since the last pre-analysis
+
+    /* lookahead throughput, reported in the encode summary */
+    int64_t       m_decideElapsedTime;
+    int           m_decidedFrames;
+    volatile int  m_numLowresEstimates;   // frame cost estimates made at lowres
+    volatile int  m_numLowerResEstimates; // path cost estimates made on the HME level
+
     Lookahead(x265_param *param, ThreadPool *pool);
 #if DETAILED_CU_STATS
     int64_t       m_slicetypeDecideElapsedTime;
@@ -174,11 +263,24 @@ public:
 
     void    getEstimatedPictureCost(Frame *pic);
     void    setLookaheadQueue();
+    Frame*  getInputPOC(int poc);
+
+    /* edge, luma and chroma histograms of a picture for --hist-scenecut */
+    void    computeHistograms(Frame* curFrame);
+    /* compare the histograms of a picture with those of the previous picture,
+     * returns true if it is a scene cut. Called in input order */
+    bool    histSceneCut(const int32_t* edgeHist, const int32_t yuvHist[][HISTOGRAM_BINS], bool bFirst,
+                         bool& bDup, bool& isMaxThres, bool& isHardSC);
 
 protected:
 
+    friend class LookaheadTaskGraph;
+
     void    findJob(int workerThreadID);
+    void    drainInputRing();
     void    slicetypeDecide();
+    void    preAnalyse(PreLookaheadGroup& pre);
+    void    analyseArrivals();
     void    slicetypeAnalyse(Lowres **frames, bool bKeyframe);
 
     /* called by slicetypeAnalyse() to make slice decisions */
@@ -194,6 +296,8 @@ protected:
      * quant offsets */
     void    cuTree(Lowres **frames, int numframes, bool bintra);
     void    estimateCUPropagate(Lowres **frames, double average_duration, int p0, int p1, int b, int referenced);
+    void    estimateCUPropagateRows(Lowres **frames, double averageDuration, int p0, int p1, int b, int referenced,
+                                    int firstRow, int lastRow, int32_t *scratch, int32_t **accum);
     void    cuTreeFinish(Lowres *frame, double averageDuration, int ref0Distance);
     void    computeCUTreeQpOffset(Lowres *frame, double averageDuration, int ref0Distance);
 
@@ -208,7 +312,7 @@ public:
     Frame* m_preframes[X265_LOOKAHEAD_MAX];
     Lookahead& m_lookahead;
 
-    PreLookaheadGroup(Lookahead& l) : m_lookahead(l) {}
+    PreLookaheadGroup(Lookahead& l) : BondedTaskGroup(WORKER_TASK_LOOKAHEAD), m_lookahead(l) {}
 
     void processTasks(int workerThreadID);
 
@@ -217,6 +321,26 @@ protected:
     PreLookaheadGroup& operator=(const PreLookaheadGroup&);
 };
 
+/* Edge detection of one picture for aq-mode 4, in bands of rows. The pre-lookahead
+ * runs it twice: first the Gaussian blur, then the Sobel gradients */
+class EdgeFilterGroup : public BondedTaskGroup
+{
+public:
+
+    enum { BAND_ROWS = 32 };
+
+    Frame* m_frame;
+    bool   m_bSobel;
+
+    EdgeFilterGroup(Frame* f) : BondedTaskGroup(WORKER_TASK_LOOKAHEAD), m_frame(f), m_bSobel(false) {}
+
+    void processTasks(int workerThreadID);
+
+protected:
+
+    EdgeFilterGroup& operator=(const EdgeFilterGroup&);
+};
+
 class CostEstimateGroup : public BondedTaskGroup
 {
 public:
@@ -224,8 +348,9 @@ public:
     Lookahead& m_lookahead;
     Lowres**   m_frames;
     bool       m_batchMode;
+    bool       m_bLowerRes; // estimate B-path decision costs on the HME level
 
-    CostEstimateGroup(Lookahead& l, Lowres** f) : m_lookahead(l), m_frames(f), m_batchMode(false) {}
+    CostEstimateGroup(Lookahead& l, Lowres** f) : BondedTaskGroup(WORKER_TASK_LOOKAHEAD), m_lookahead(l), m_frames(f), m_batchMode(false), m_bLowerRes(false) {}
 
     /* Cooperative cost estimate using multiple slices of downscaled frame */
     struct Coop
@@ -261,11 +386,111 @@ protected:
     void    processTasks(int workerThreadID);
 
     int64_t estimateFrameCost(LookaheadTLD& tld, int p0, int p1, int b, bool intraPenalty);
-    void    estimateCUCost(LookaheadTLD& tld, int cux, int cuy, int p0, int p1, int b, bool bDoSearch[2], bool lastRow, int slice, bool hme);
+    bool    isCostMeasured(int p0, int p1, int b);
+    bool    startFrameCost(LookaheadTLD& tld, int p0, int p1, int b, bool bDoSearch[2]);
+    void    estimateSliceCost(LookaheadTLD& tld, int p0, int p1, int b, bool bDoSearch[2], int slice, int numSlices, Slice& sum);
+    int64_t finishFrameCost(int p0, int p1, int b);
+    void    estimateCUCost(LookaheadTLD& tld, int cux, int cuy, int p0, int p1, int b, bool bDoSearch[2], bool lastRow, Slice* slice, bool hme);
+    template<typename T>
+    void    lowresCUCost(LookaheadTLD& tld, int cux, int cuy, int p0, int p1, int b, bool bDoSearch[2], bool lastRow, Slice* slice, bool hme);
+    int64_t estimateLowerResCost(LookaheadTLD& tld, int p0, int p1, int b, bool intraPenalty);
+    void    estimateLowerResCUCost(LookaheadTLD& tld, int cux, int cuy, int p0, int p1, int b, bool bDoSearch[2], bool lastRow, Slice& sum);
+    template<typename T>
+    void    lowerResCUCost(LookaheadTLD& tld, int cux, int cuy, int p0, int p1, int b, bool bDoSearch[2], bool lastRow, Slice& sum);
 
     CostEstimateGroup& operator=(const CostEstimateGroup&);
 };
 
+/* Dependency graph of lookahead work items. Each node is handed to the thread
+ * pool as soon as all of the nodes it depends on have completed, instead of
+ * running the lookahead as a sequence of batches separated by barriers. The
+ * graph is built by the thread running slicetypeDecide(), which then works on
+ * it alongside bonded worker threads until every node is complete */
+class LookaheadTaskGraph : public CostEstimateGroup
+{
+public:
+
+    enum NodeType
+    {
+        NODE_COST_ESTIMATE,    // estimateFrameCost() of one whole lowres frame
+        NODE_COST_SLICE,       // one cooperative slice of a frame cost estimate
+        NODE_COST_FINISH,      // sum the slices of a frame cost estimate
+        NODE_PROPAGATE,        // cutree propagation of a band of rows of frame b
+        NODE_PROPAGATE_FINISH, // saturate the propagate costs accumulated for frame b
+        NODE_CUTREE_FINISH     // cuTreeFinish() of a referenced frame (VBV lookahead)
+    };
+
+    enum { MAX_PROPAGATE_BANDS = 8 };
+    enum { MAX_ACCUM_SLOTS = 16 };
+
+    struct Node
+    {
+        int  type;
+        int  p0, p1, b;
+        int  firstRow, lastRow; // row band of NODE_PROPAGATE, slice nodes of NODE_COST_FINISH
+        int  arg;               // referenced flag, ref0 distance of NODE_CUTREE_FINISH, or slice index
+        bool bDoSearch[2];      // motion searches of NODE_COST_SLICE
+        Slice sum;              // costs measured by NODE_COST_SLICE
+        int  slot[2];           // accumulator slots of the propagate targets
+        int  pending;           // count of incomplete nodes this node depends on
+        int  firstEdge;         // head of the list of dependent nodes
+    };
+
+    struct Edge
+    {
+        int  to;
+        int  next;
+    };
+
+    Node*    m_nodes;
+    Edge*    m_edges;
+    int*     m_ready;           // FIFO of nodes with no pending dependencies
+    int      m_maxNodes;
+    int      m_maxEdges;
+    int      m_numNodes;
+    int      m_numEdges;
+    int      m_readyHead;
+    int      m_readyTail;
+    int      m_numDone;
+    Event    m_allDone;
+
+    /* motion search owners, [list][b][distance], -1 if not searched by this graph */
+    int      m_searchNode[2][X265_LOOKAHEAD_MAX + 2][X265_BFRAME_MAX + 2];
+
+    /* cutree propagate state, indexed by frame */
+    double   m_averageDuration;
+    int      m_numBands;
+    int      m_numTargets;
+    int      m_costNode[X265_LOOKAHEAD_MAX + 2];   // node completing the cost estimate of the frame
+    int      m_finishNode[X265_LOOKAHEAD_MAX + 2];
+    int      m_targetSlot[X265_LOOKAHEAD_MAX + 2];
+    int      m_slotWait[X265_LOOKAHEAD_MAX + 2]; // finish node of the previous user of the slot
+    int      m_slotOwner[MAX_ACCUM_SLOTS];
+
+    LookaheadTaskGraph(Lookahead& l);
+    virtual ~LookaheadTaskGraph();
+
+    bool create(int maxNodes, int maxEdges);
+    void reset(Lowres** frames);
+
+    int  addCostEstimate(int p0, int p1, int b);
+    int  addFrameCost(int p0, int p1, int b);
+    void addPropagate(int p0, int p1, int b, int referenced);
+    void addDependency(int from, int to);
+
+    /* process every node of the graph, returns once all are complete */
+    void run();
+
+protected:
+
+    void processTasks(int workerThreadID);
+    void processNode(LookaheadTLD& tld, int32_t* scratch, Node& node);
+    int  addNode(int type, int p0, int p1, int b);
+    int  propagateTarget(int frame);
+
+    LookaheadTaskGraph& operator=(const LookaheadTaskGraph&);
+};
+
 bool computeEdge(pixel* edgePic, pixel* refPic, pixel* edgeTheta, intptr_t stride, int height, int width, bool bcalcTheta, pixel whitePixel = EDGE_THRESHOLD);
 }
 #endif // ifndef X265_SLICETYPE_H
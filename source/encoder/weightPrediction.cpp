@@ -57,7 +57,8 @@ int sliceHeaderCost(WeightParam *w, int lambda, int bChroma)
 
 /* make a motion compensated copy of lowres ref into mcout with the same stride.
  * The borders of mcout are not extended */
-void mcLuma(pixel* mcout, Lowres& ref, const MV * mvs)
+template<typename T>
+void mcLuma(T* mcout, Lowres& ref, const MV * mvs)
 {
     intptr_t stride = ref.lumaStride;
     const int mvshift = 1 << 2;
@@ -74,7 +75,7 @@ void mcLuma(pixel* mcout, Lowres& ref, const MV * mvs)
 
         for (int x = 0; x < ref.width; x += cuSize, pixoff += cuSize, cu++)
         {
-            ALIGN_VAR_16(pixel, buf8x8[8 * 8]);
+            ALIGN_VAR_16(T, buf8x8[8 * 8]);
             intptr_t bstride = 8;
             mvmin.x = (int32_t)((-x - 8) * mvshift);
             mvmax.x = (int32_t)((ref.width - x - 1 + 8) * mvshift);
@@ -82,8 +83,8 @@ void mcLuma(pixel* mcout, Lowres& ref, const MV * mvs)
             /* clip MV to available pixels */
             MV mv = mvs[cu];
             mv = mv.clipped(mvmin, mvmax);
-            pixel *tmp = ref.lowresMC(pixoff, mv, buf8x8, bstride, 0);
-            primitives.cu[BLOCK_8x8].copy_pp(mcout + pixoff, stride, tmp, bstride);
+            T *tmp = ref.lowresMC(pixoff, mv, buf8x8, bstride, 0);
+            getLowresPrimitives<T>().copy_pp(mcout + pixoff, stride, tmp, bstride);
         }
     }
 }
@@ -162,13 +163,40 @@ void mcChroma(pixel *      mcout,
     }
 }
 
+/* satd cost of the full resolution chroma planes */
+uint32_t chromaCost(const pixel* f, const pixel* r, intptr_t stride, const Cache& cache, int width, int height)
+{
+    uint32_t cost = 0;
+
+    if (cache.csp == X265_CSP_I444)
+        for (int y = 0; y < height; y += 16, r += 16 * stride, f += 16 * stride)
+            for (int x = 0; x < width; x += 16)
+                cost += primitives.pu[LUMA_16x16].satd(r + x, stride, f + x, stride);
+    else
+        for (int y = 0; y < height; y += 8, r += 8 * stride, f += 8 * stride)
+            for (int x = 0; x < width; x += 8)
+                cost += primitives.pu[LUMA_8x8].satd(r + x, stride, f + x, stride);
+
+    return cost;
+}
+
+#if HIGH_BIT_DEPTH
+/* only the luma planes of --lowres-8bit are 8 bits, chroma is analysed at full resolution */
+uint32_t chromaCost(const uint8_t*, const uint8_t*, intptr_t, const Cache&, int, int)
+{
+    X265_CHECK(0, "8-bit chroma weight analysis\n");
+    return 0;
+}
+#endif
+
 /* Measure sum of 8x8 satd costs between source frame and reference
  * frame (potentially weighted, potentially motion compensated). We
  * always use source images for this analysis since reference recon
  * pixels have unreliable availability */
-uint32_t weightCost(pixel *         fenc,
-                    pixel *         ref,
-                    pixel *         weightTemp,
+template<typename T>
+uint32_t weightCost(T *             fenc,
+                    T *             ref,
+                    T *             weightTemp,
                     intptr_t        stride,
                     const Cache &   cache,
                     int             width,
@@ -179,19 +207,19 @@ uint32_t weightCost(pixel *         fenc,
     if (w)
     {
         /* make a weighted copy of the reference plane */
-        int offset = w->inputOffset << (X265_DEPTH - 8);
+        int offset = w->inputOffset << (SampleDepth<T>::value - 8);
         int weight = w->inputWeight;
         int denom = w->log2WeightDenom;
         int round = denom ? 1 << (denom - 1) : 0;
-        int correction = IF_INTERNAL_PREC - X265_DEPTH; /* intermediate interpolation depth */
+        int correction = IF_INTERNAL_PREC - SampleDepth<T>::value; /* intermediate interpolation depth */
         int pwidth = ((width + 31) >> 5) << 5;
-        primitives.weight_pp(ref, weightTemp, stride, pwidth, height,
-                             weight, round << correction, denom + correction, offset);
+        getLowresPrimitives<T>().weight_pp(ref, weightTemp, stride, pwidth, height,
+                                           weight, round << correction, denom + correction, offset);
         ref = weightTemp;
     }
 
     uint32_t cost = 0;
-    pixel *f = fenc, *r = ref;
+    T *f = fenc, *r = ref;
 
     if (bLuma)
     {
@@ -200,22 +228,99 @@ uint32_t weightCost(pixel *         fenc,
         {
             for (int x = 0; x < width; x += 8, cu++)
             {
-                int cmp = primitives.pu[LUMA_8x8].satd(r + x, stride, f + x, stride);
+                int cmp = getLowresPrimitives<T>().satd(r + x, stride, f + x, stride);
                 cost += X265_MIN(cmp, cache.intraCost[cu]);
             }
         }
     }
-    else if (cache.csp == X265_CSP_I444)
-        for (int y = 0; y < height; y += 16, r += 16 * stride, f += 16 * stride)
-            for (int x = 0; x < width; x += 16)
-                cost += primitives.pu[LUMA_16x16].satd(r + x, stride, f + x, stride);
     else
-        for (int y = 0; y < height; y += 8, r += 8 * stride, f += 8 * stride)
-            for (int x = 0; x < width; x += 8)
-                cost += primitives.pu[LUMA_8x8].satd(r + x, stride, f + x, stride);
+        cost = chromaCost(f, r, stride, cache, width, height);
 
     return cost;
 }
+
+/* search the weight and offset of one plane around the estimate in weight */
+template<typename T>
+void searchWeight(WeightParam& weight, T* orig, T* fref, T* weightTemp, intptr_t stride, const Cache& cache,
+                  int width, int height, int plane, int list, int denom, int lambda, float fencMean, float refMean)
+{
+    int mindenom = weight.log2WeightDenom;
+    int minscale = weight.inputWeight;
+    int minoff = 0;
+
+    uint32_t origscore = weightCost(orig, fref, weightTemp, stride, cache, width, height, NULL, !plane);
+    if (!origscore)
+    {
+        SET_WEIGHT(weight, 0, 1 << denom, denom, 0);
+        return;
+    }
+
+    uint32_t minscore = origscore;
+    bool bFound = false;
+
+    /* x264 uses a table lookup here, selecting search range based on preset */
+    static const int scaleDist = 4;
+    static const int offsetDist = 2;
+
+    int startScale = x265_clip3(0, 127, minscale - scaleDist);
+    int endScale   = x265_clip3(0, 127, minscale + scaleDist);
+    for (int scale = startScale; scale <= endScale; scale++)
+    {
+        int deltaWeight = scale - (1 << mindenom);
+        if (deltaWeight > 127 || deltaWeight <= -128)
+            continue;
+
+        x265_emms();
+        int curScale = scale;
+        int curOffset = (int)(fencMean - refMean * curScale / (1 << mindenom) + 0.5f);
+        if (curOffset < -128 || curOffset > 127)
+        {
+            /* Rescale considering the constraints on curOffset. We do it in this order
+             * because scale has a much wider range than offset (because of denom), so
+             * it should almost never need to be clamped. */
+            curOffset = x265_clip3(-128, 127, curOffset);
+            curScale = (int)((1 << mindenom) * (fencMean - curOffset) / refMean + 0.5f);
+            curScale = x265_clip3(0, 127, curScale);
+        }
+
+        int startOffset = x265_clip3(-128, 127, curOffset - offsetDist);
+        int endOffset   = x265_clip3(-128, 127, curOffset + offsetDist);
+        for (int off = startOffset; off <= endOffset; off++)
+        {
+            WeightParam wsp;
+            SET_WEIGHT(wsp, true, curScale, mindenom, off);
+            uint32_t s = weightCost(orig, fref, weightTemp, stride, cache, width, height, &wsp, !plane) +
+                         sliceHeaderCost(&wsp, lambda, !!plane);
+            COPY4_IF_LT(minscore, s, minscale, curScale, minoff, off, bFound, true);
+
+            /* Don't check any more offsets if the previous one had a lower cost than the current one */
+            if (minoff == startOffset && off != startOffset)
+                break;
+        }
+    }
+
+    /* Use a smaller luma denominator if possible */
+    if (!(plane || list))
+    {
+        if (mindenom > 0 && !(minscale & 1))
+        {
+            unsigned long idx;
+            CTZ(idx, minscale);
+            int shift = X265_MIN((int)idx, mindenom);
+            mindenom -= shift;
+            minscale >>= shift;
+        }
+    }
+
+    if (!bFound || (minscale == (1 << mindenom) && minoff == 0) || (float)minscore / origscore > 0.998f)
+    {
+        SET_WEIGHT(weight, false, 1 << denom, denom, 0);
+    }
+    else
+    {
+        SET_WEIGHT(weight, true, minscale, mindenom, minoff);
+    }
+}
 }
 
 namespace X265_NS {
@@ -244,6 +349,20 @@ void weightAnalyse(Slice& slice, Frame& frame, x265_param& param)
         return;
     }
     pixel *weightTemp = mcbuf + fencPic->m_stride * fencPic->m_picHeight;
+#if HIGH_BIT_DEPTH
+    /* --lowres-8bit: the luma search runs on the uint8_t lowres planes */
+    uint8_t *mcbuf8 = NULL;
+    if (fenc.bLowres8bit)
+    {
+        mcbuf8 = X265_MALLOC(uint8_t, 2 * fenc.lumaStride * fenc.lines);
+        if (!mcbuf8)
+        {
+            X265_FREE(mcbuf);
+            slice.disableWeights();
+            return;
+        }
+    }
+#endif
 
     int lambda = (int)x265_lambda_tab[X265_LOOKAHEAD_QP];
     int curPoc = slice.m_poc;
@@ -316,10 +435,6 @@ void weightAnalyse(Slice& slice, Frame& frame, x265_param& param)
                 weights[plane].setFromWeightAndOffset((int)(guessScale[plane] * (1 << denom) + 0.5f), 0, denom, !list);
             }
 
-            int mindenom = weights[plane].log2WeightDenom;
-            int minscale = weights[plane].inputWeight;
-            int minoff = 0;
-
             if (!plane && diffPoc <= param.bframes + 1)
             {
                 mvs = fenc.lowresMvs[list][diffPoc];
@@ -351,6 +466,21 @@ void weightAnalyse(Slice& slice, Frame& frame, x265_param& param)
             switch (plane)
             {
             case 0:
+#if HIGH_BIT_DEPTH
+                if (fenc.bLowres8bit)
+                {
+                    uint8_t *orig8 = fenc.lowresPlane8[0];
+                    uint8_t *fref8 = refLowres.lowresPlane8[0];
+                    if (mvs)
+                    {
+                        mcLuma(mcbuf8, refLowres, mvs);
+                        fref8 = mcbuf8;
+                    }
+                    searchWeight(weights[plane], orig8, fref8, mcbuf8 + fenc.lumaStride * fenc.lines, fenc.lumaStride, cache,
+                                 fenc.width, fenc.lines, plane, list, denom, lambda, fencMean[plane], refMean[plane]);
+                    continue;
+                }
+#endif
                 orig = fenc.lowresPlane[0];
                 stride = fenc.lumaStride;
                 width = fenc.width;
@@ -399,81 +529,13 @@ void weightAnalyse(Slice& slice, Frame& frame, x265_param& param)
             default:
                 slice.disableWeights();
                 X265_FREE(mcbuf);
+#if HIGH_BIT_DEPTH
+                X265_FREE(mcbuf8);
+#endif
                 return;
             }
 
-            uint32_t origscore = weightCost(orig, fref, weightTemp, stride, cache, width, height, NULL, !plane);
-            if (!origscore)
-            {
-                SET_WEIGHT(weights[plane], 0, 1 << denom, denom, 0);
-                continue;
-            }
-
-            uint32_t minscore = origscore;
-            bool bFound = false;
-
-            /* x264 uses a table lookup here, selecting search range based on preset */
-            static const int scaleDist = 4;
-            static const int offsetDist = 2;
-
-            int startScale = x265_clip3(0, 127, minscale - scaleDist);
-            int endScale   = x265_clip3(0, 127, minscale + scaleDist);
-            for (int scale = startScale; scale <= endScale; scale++)
-            {
-                int deltaWeight = scale - (1 << mindenom);
-                if (deltaWeight > 127 || deltaWeight <= -128)
-                    continue;
-
-                x265_emms();
-                int curScale = scale;
-                int curOffset = (int)(fencMean[plane] - refMean[plane] * curScale / (1 << mindenom) + 0.5f);
-                if (curOffset < -128 || curOffset > 127)
-                {
-                    /* Rescale considering the constraints on curOffset. We do it in this order
-                     * because scale has a much wider range than offset (because of denom), so
-                     * it should almost never need to be clamped. */
-                    curOffset = x265_clip3(-128, 127, curOffset);
-                    curScale = (int)((1 << mindenom) * (fencMean[plane] - curOffset) / refMean[plane] + 0.5f);
-                    curScale = x265_clip3(0, 127, curScale);
-                }
-
-                int startOffset = x265_clip3(-128, 127, curOffset - offsetDist);
-                int endOffset   = x265_clip3(-128, 127, curOffset + offsetDist);
-                for (int off = startOffset; off <= endOffset; off++)
-                {
-                    WeightParam wsp;
-                    SET_WEIGHT(wsp, true, curScale, mindenom, off);
-                    uint32_t s = weightCost(orig, fref, weightTemp, stride, cache, width, height, &wsp, !plane) +
-                                 sliceHeaderCost(&wsp, lambda, !!plane);
-                    COPY4_IF_LT(minscore, s, minscale, curScale, minoff, off, bFound, true);
-
-                    /* Don't check any more offsets if the previous one had a lower cost than the current one */
-                    if (minoff == startOffset && off != startOffset)
-                        break;
-                }
-            }
-
-            /* Use a smaller luma denominator if possible */
-            if (!(plane || list))
-            {
-                if (mindenom > 0 && !(minscale & 1))
-                {
-                    unsigned long idx;
-                    CTZ(idx, minscale);
-                    int shift = X265_MIN((int)idx, mindenom);
-                    mindenom -= shift;
-                    minscale >>= shift;
-                }
-            }
-
-            if (!bFound || (minscale == (1 << mindenom) && minoff == 0) || (float)minscore / origscore > 0.998f)
-            {
-                SET_WEIGHT(weights[plane], false, 1 << denom, denom, 0);
-            }
-            else
-            {
-                SET_WEIGHT(weights[plane], true, minscale, mindenom, minoff);
-            }
+            searchWeight(weights[plane], orig, fref, weightTemp, stride, cache, width, height, plane, list, denom, lambda, fencMean[plane], refMean[plane]);
         }
 
         if (weights[0].wtPresent)
@@ -501,6 +563,9 @@ void weightAnalyse(Slice& slice, Frame& frame, x265_param& param)
     }
 
     X265_FREE(mcbuf);
+#if HIGH_BIT_DEPTH
+    X265_FREE(mcbuf8);
+#endif
 
     memcpy(slice.m_weightPredTable, wp, sizeof(WeightParam) * 2 * MAX_NUM_REF * 3);
 
@@ -25,6 +25,7 @@
 #include "pixelharness.h"
 #include "primitives.h"
 #include "entropy.h"
+#include "slicetype.h"   // PI
 
 using namespace X265_NS;
 
@@ -1651,6 +1652,172 @@ bool PixelHarness::check_cutree_fix8_unpack(cutree_fix8_unpack ref, cutree_fix8_
     return true;
 }
 
+bool PixelHarness::check_edgeGaussian(edge_gaussian_t ref, edge_gaussian_t opt)
+{
+    ALIGN_VAR_32(pixel, ref_dest[64 * 64]);
+    ALIGN_VAR_32(pixel, opt_dest[64 * 64]);
+
+    memset(ref_dest, 0xCD, sizeof(ref_dest));
+    memset(opt_dest, 0xCD, sizeof(opt_dest));
+
+    int j = 0;
+    intptr_t stride = STRIDE;
+
+    for (int i = 0; i < ITERS; i++)
+    {
+        int width = 1 + (i * 7) % (STRIDE - 4);
+        int index = i % TEST_CASES;
+        const pixel* src = (i & 1 ? pbuf1 : pixel_test_buff[index]) + j + 2 * stride + 2;
+        checked(opt, opt_dest + 2, src, stride, width);
+        ref(ref_dest + 2, src, stride, width);
+
+        if (memcmp(ref_dest, opt_dest, 64 * 64 * sizeof(pixel)))
+            return false;
+
+        reportfail();
+        j += INCR;
+    }
+
+    return true;
+}
+
+/* the gradient angle as computed before the edgeSobel primitives existed */
+static pixel edgeAngleAtan2(int gradientV, int gradientH)
+{
+    float radians = atan2((float)gradientV, (float)gradientH);
+    float theta = (float)((radians * 180) / PI);
+    if (theta < 0)
+        theta = 180 + theta;
+    return (pixel)theta;
+}
+
+bool PixelHarness::check_edgeSobel(edge_sobel_t ref, edge_sobel_t opt)
+{
+    ALIGN_VAR_32(pixel, ref_dest[64 * 64]);
+    ALIGN_VAR_32(pixel, opt_dest[64 * 64]);
+    ALIGN_VAR_32(pixel, ref_theta[64 * 64]);
+    ALIGN_VAR_32(pixel, opt_theta[64 * 64]);
+
+    memset(ref_dest, 0xCD, sizeof(ref_dest));
+    memset(opt_dest, 0xCD, sizeof(opt_dest));
+    memset(ref_theta, 0xCD, sizeof(ref_theta));
+    memset(opt_theta, 0xCD, sizeof(opt_theta));
+
+    int j = 0;
+    intptr_t stride = STRIDE;
+
+    for (int i = 0; i < ITERS; i++)
+    {
+        int width = 1 + (i * 7) % (STRIDE - 2);
+        int index = i % TEST_CASES;
+        bool bTheta = !!(i & 2);
+        pixel whitePixel = (i & 4) ? 1 : PIXEL_MAX;
+        const pixel* src = (i & 1 ? pbuf1 : pixel_test_buff[index]) + j + stride + 1;
+        checked(opt, opt_dest + 1, bTheta ? opt_theta + 1 : NULL, src, stride, width, whitePixel);
+        ref(ref_dest + 1, bTheta ? ref_theta + 1 : NULL, src, stride, width, whitePixel);
+
+        if (memcmp(ref_dest, opt_dest, 64 * 64 * sizeof(pixel)) || memcmp(ref_theta, opt_theta, 64 * 64 * sizeof(pixel)))
+            return false;
+
+        reportfail();
+        j += INCR;
+    }
+
+    /* linear ramps along the axes and the diagonals must give exact angles */
+    static const int ramps[4][3] = { { 1, 0, 0 }, { 0, 1, 90 }, { 1, 1, 45 }, { -1, 1, 135 } };
+    ALIGN_VAR_32(pixel, ramp[3 * 64]);
+    for (int r = 0; r < 4; r++)
+    {
+        for (int k = 1; k <= 3; k++)
+        {
+            for (int y = 0; y < 3; y++)
+                for (int x = 0; x < 64; x++)
+                    ramp[y * 64 + x] = (pixel)(k * (ramps[r][0] * x + ramps[r][1] * y) + (ramps[r][0] < 0 ? 63 * k : 0));
+
+            checked(opt, opt_dest, opt_theta, ramp + 64 + 1, 64, 62, PIXEL_MAX);
+            ref(ref_dest, ref_theta, ramp + 64 + 1, 64, 62, PIXEL_MAX);
+
+            for (int x = 0; x < 62; x++)
+                if (ref_theta[x] != ramps[r][2] || opt_theta[x] != ramps[r][2])
+                    return false;
+
+            reportfail();
+        }
+    }
+
+    /* Every gradient reachable from 8 bit pixels must give the angle of the old
+     * atan2() expression. gH = 3p + 10dH and gV = 3q + 10dV, where dH and dV
+     * are the differences of the middle left and right, top and bottom pixels
+     * and the corners give any p and q of equal parity with |p| + |q| <= 510.
+     * For each gradient and parity keep the p (or q) of least magnitude */
+    enum { MAX_GRAD = 16 * 255, NUM_GRAD = 2 * MAX_GRAD + 1, NEIGHBORS = 21 };
+    static int minPart[2][NUM_GRAD];
+    for (int par = 0; par < 2; par++)
+        for (int g = 0; g < NUM_GRAD; g++)
+            minPart[par][g] = 1 << 20;
+    for (int d = -255; d <= 255; d++)
+        for (int part = -510; part <= 510; part++)
+        {
+            int g = 3 * part + 10 * d + MAX_GRAD;
+            if (abs(part) < abs(minPart[part & 1][g]))
+                minPart[part & 1][g] = part;
+        }
+
+    int count = 0;
+    for (int i = 0; i <= NUM_GRAD * NUM_GRAD; i++)
+    {
+        if (i < NUM_GRAD * NUM_GRAD)
+        {
+            int gH = i % NUM_GRAD - MAX_GRAD, gV = i / NUM_GRAD - MAX_GRAD;
+            int par = 0;
+            while (par < 2 && abs(minPart[par][gH + MAX_GRAD]) + abs(minPart[par][gV + MAX_GRAD]) > 510)
+                par++;
+            if (par == 2)
+                continue;
+
+            /* one 3x3 neighborhood every third column */
+            int p = minPart[par][gH + MAX_GRAD], q = minPart[par][gV + MAX_GRAD];
+            int dH = (gH - 3 * p) / 10, dV = (gV - 3 * q) / 10;
+            int topLeft = X265_MAX(0, -(p + q) / 2), bottomLeft = X265_MAX(0, (q - p) / 2);
+            int topMid = X265_MAX(0, -dV), midLeft = X265_MAX(0, -dH);
+            pixel* n = ramp + 3 * count;
+            n[0] = (pixel)topLeft;
+            n[1] = (pixel)topMid;
+            n[2] = (pixel)(bottomLeft + (p - q) / 2);
+            n[64] = (pixel)midLeft;
+            n[65] = 0;
+            n[66] = (pixel)(midLeft + dH);
+            n[128] = (pixel)bottomLeft;
+            n[129] = (pixel)(topMid + dV);
+            n[130] = (pixel)(topLeft + (p + q) / 2);
+            if (++count < NEIGHBORS)
+                continue;
+        }
+        else if (!count)
+            break;
+
+        int width = 3 * count - 2;
+        checked(opt, opt_dest, opt_theta, ramp + 64 + 1, 64, width, PIXEL_MAX);
+        ref(ref_dest, ref_theta, ramp + 64 + 1, 64, width, PIXEL_MAX);
+
+        for (int x = 0; x < width; x++)
+        {
+            const pixel* above = ramp + x;
+            const pixel* below = ramp + 128 + x;
+            int gradientH = -3 * above[0] + 3 * above[2] - 10 * ramp[64 + x] + 10 * ramp[64 + x + 2] - 3 * below[0] + 3 * below[2];
+            int gradientV = -3 * above[0] - 10 * above[1] - 3 * above[2] + 3 * below[0] + 10 * below[1] + 3 * below[2];
+            pixel angle = edgeAngleAtan2(gradientV, gradientH);
+            if (ref_theta[x] != angle || opt_theta[x] != angle || ref_dest[x] != opt_dest[x])
+                return false;
+        }
+
+        reportfail();
+        count = 0;
+    }
+
+    return true;
+}
+
 bool PixelHarness::check_psyCost_pp(pixelcmp_t ref, pixelcmp_t opt)
 {
     int j = 0, index1, index2, optres, refres;
@@ -3012,6 +3179,24 @@ bool PixelHarness::testCorrectness(const EncoderPrimitives& ref, const EncoderPr
         }
     }
 
+    if (opt.edgeGaussian)
+    {
+        if (!check_edgeGaussian(ref.edgeGaussian, opt.edgeGaussian))
+        {
+            printf("edgeGaussian failed\n");
+            return false;
+        }
+    }
+
+    if (opt.edgeSobel)
+    {
+        if (!check_edgeSobel(ref.edgeSobel, opt.edgeSobel))
+        {
+            printf("edgeSobel failed\n");
+            return false;
+        }
+    }
+
     if (opt.scanPosLast)
     {
         if (!check_scanPosLast(ref.scanPosLast, opt.scanPosLast))
@@ -3649,6 +3834,18 @@ void PixelHarness::measureSpeed(const EncoderPrimitives& ref, const EncoderPrimi
         REPORT_SPEEDUP(opt.fix8Unpack, ref.fix8Unpack, double_test_buff[0], ushort_test_buff[0], 390);
     }
 
+    if (opt.edgeGaussian)
+    {
+        HEADER0("edgeGaussian");
+        REPORT_SPEEDUP(opt.edgeGaussian, ref.edgeGaussian, pbuf2, pbuf1 + 2 * STRIDE + 2, STRIDE, STRIDE - 4);
+    }
+
+    if (opt.edgeSobel)
+    {
+        HEADER0("edgeSobel");
+        REPORT_SPEEDUP(opt.edgeSobel, ref.edgeSobel, pbuf2, pbuf3, pbuf1 + STRIDE + 1, STRIDE, STRIDE - 2, PIXEL_MAX);
+    }
+
     if (opt.scanPosLast)
     {
         HEADER0("scanPosLast");
@@ -43,6 +43,11 @@ typedef struct x265_encoder x265_encoder;
  *      opaque handler for PicYuv */
 typedef struct x265_picyuv x265_picyuv;
 
+/* x265_thread_pools:
+ *      opaque handler for a set of worker thread pools which may be shared by
+ *      several encoders of one process, see x265_thread_pools_alloc() */
+typedef struct x265_thread_pools x265_thread_pools;
+
 /* Application developers planning to link against a shared library version of
  * libx265 from a Microsoft Visual Studio or similar development environment
  * will need to define X265_API_IMPORTS before including this header.
@@ -311,6 +316,9 @@ typedef struct x265_frame_stats
     double           vmafFrameScore;
     double           bufferFillFinal;
     double           unclippedBufferFillFinal;
+    int              refRowBlocks;
+    double           refRowBlockTime;
+    int              frameThreads;
 } x265_frame_stats;
 
 typedef struct x265_ctu_info_t
@@ -564,6 +572,10 @@ typedef enum
 
 #define X265_BFRAME_MAX         16
 #define X265_MAX_FRAME_THREADS  16
+#define X265_MAX_NUMA_NODES     16
+
+#define X265_SCHED_SLICETYPE        0
+#define X265_SCHED_CRITICAL_PATH    1
 
 #define X265_TYPE_AUTO          0x0000  /* Let x265 choose the right type */
 #define X265_TYPE_IDR           0x0001
@@ -581,6 +593,12 @@ typedef enum
 #define X265_AQ_AUTO_VARIANCE        2
 #define X265_AQ_AUTO_VARIANCE_BIASED 3
 #define X265_AQ_EDGE                 4
+
+#define X265_STATS_TEXT              0
+#define X265_STATS_BINARY            1
+
+#define X265_ANALYSIS_FORMAT_LEGACY  0
+#define X265_ANALYSIS_FORMAT_INDEXED 1
 #define x265_ADAPT_RD_STRENGTH   4
 #define X265_REFINE_INTER_LEVELS 3
 /* NOTE! For this release only X265_CSP_I420 and X265_CSP_I444 are supported */
@@ -651,6 +669,49 @@ typedef struct x265_sliceType_stats
     uint32_t      numPics;
 } x265_sliceType_stats;
 
+/* Thread pool telemetry, summed over the worker threads of all thread pools
+ * of an encoder (including dedicated lookahead pools) since it was opened.
+ * Times are in milliseconds */
+#define X265_THREAD_STATS_VERSION 2
+
+/* The counters of x265_thread_stats for a single worker thread */
+typedef struct x265_worker_stats
+{
+    int      pool;                /* index of the worker's thread pool, dedicated lookahead pools last */
+    int      numaNode;            /* NUMA node the pool is bound to, or -1 */
+    double   busyTime;
+    double   idleTime;
+    uint64_t sleepCount;
+    uint64_t wakeCount;
+    double   frameRowTime;
+    double   lookaheadTime;
+    double   pmodeTime;
+    double   weightAnalysisTime;
+} x265_worker_stats;
+
+typedef struct x265_thread_stats
+{
+    uint32_t version;             /* X265_THREAD_STATS_VERSION of the encoder which filled this */
+    uint32_t numWorkers;          /* worker threads accounted */
+    double   busyTime;            /* time spent performing any job */
+    double   idleTime;            /* time spent sleeping, waiting for work */
+    uint64_t sleepCount;          /* number of times a worker went to sleep */
+    uint64_t wakeCount;           /* number of times a sleeping worker was awakened */
+    uint64_t acquireFailures;     /* requests to wake a worker, or to bond more peers to a
+                                   * task group, which found none idle. Requests come from
+                                   * worker and non-worker threads alike, so this is only
+                                   * counted per pool, not per worker */
+    double   frameRowTime;        /* time spent encoding and filtering WPP rows */
+    double   lookaheadTime;       /* time spent in lookahead decisions and batches */
+    double   pmodeTime;           /* time spent in --pmode and --pme tasks */
+    double   weightAnalysisTime;  /* time spent in weighted prediction analysis */
+
+    /* version 2: the counters of each of the numWorkers worker threads. The
+     * array is owned by the encoder and remains valid until the next call to
+     * x265_encoder_get_stats() or x265_encoder_close() */
+    const x265_worker_stats* workers;
+} x265_thread_stats;
+
 /* Output statistics from encoder */
 typedef struct x265_stats
 {
@@ -671,8 +732,56 @@ typedef struct x265_stats
     x265_sliceType_stats  statsB;               /* statistics of B slice */
     uint16_t              maxCLL;               /* maximum content light level */
     uint16_t              maxFALL;              /* maximum frame average light level */
+
+    /* bytes of picture buffers (reconstructed, source and lowres planes)
+     * placed on each NUMA node. Only buffers allocated for thread pools bound
+     * to a single NUMA node (see --pools) are accounted */
+    uint64_t              numaNodeBytes[X265_MAX_NUMA_NODES];
+
+    /* thread pool utilization and wake-up telemetry */
+    x265_thread_stats     threadStats;
+
+    /* bytes of picture buffers (source, reconstructed and lowres planes)
+     * placed on explicit huge pages or advised for transparent huge pages,
+     * and on normal pages. Whether the kernel backs the advised buffers with
+     * huge pages depends on its THP settings. See --huge-pages */
+    uint64_t              hugePageAdvisedBytes;
+    uint64_t              normalPageBytes;
 } x265_stats;
 
+/* Decisions of the lookahead for one picture, returned in encode order by
+ * x265_lookahead_analyse(). The arrays and the serialized record are owned
+ * by the encoder and remain valid until its next call */
+typedef struct x265_lookahead_frame
+{
+    int             poc;
+    int             sliceType;      /* X265_TYPE_* decided by the lookahead */
+    int             bKeyframe;
+    int             bScenecut;
+    int64_t         pts;
+
+    /* lowres SATD cost estimate of the picture against the references chosen
+     * by the lookahead, -1 if no estimate was made (constant QP) */
+    int64_t         frameCost;
+
+    /* number of 8x8 lowres blocks (16x16 at full resolution), the length of
+     * intraCost and propagateCost */
+    uint32_t        numCUs;
+
+    /* length of qpCuTreeOffset: numCUs, or 4 * numCUs when qgSize is 8, or
+     * 0 when neither adaptive quant nor cuTree is enabled */
+    uint32_t        numQpOffsets;
+
+    const double*   qpCuTreeOffset; /* final cuTree QP offsets (AQ offsets for B frames) */
+    const int32_t*  intraCost;      /* lowres intra cost of each block */
+    const uint16_t* propagateCost;  /* cuTree propagate cost of each block */
+
+    /* the decisions above in a compact binary form; a file of these records
+     * concatenated may be given to a later encode with param.lookaheadLoad */
+    const uint8_t*  record;
+    uint32_t        recordSize;
+} x265_lookahead_frame;
+
 /* String values accepted by x265_param_parse() (and CLI) for various parameters */
 static const char * const x265_motion_est_names[] = { "dia", "hex", "umh", "star", "sea", "full", 0 };
 static const char * const x265_source_csp_names[] = { "i400", "i420", "i422", "i444", "nv12", "nv16", 0 };
@@ -688,6 +797,9 @@ static const char * const x265_sar_names[] = { "unknown", "1:1", "12:11", "10:11
                                                "32:11", "80:33", "18:11", "15:11", "64:33", "160:99", "4:3", "3:2", "2:1", 0 };
 static const char * const x265_interlace_names[] = { "prog", "tff", "bff", 0 };
 static const char * const x265_analysis_names[] = { "off", "save", "load", 0 };
+static const char * const x265_sched_policy_names[] = { "slicetype", "critical-path", 0 };
+static const char * const x265_stats_format_names[] = { "text", "binary", 0 };
+static const char * const x265_analysis_format_names[] = { "legacy", "indexed", 0 };
 
 struct x265_zone;
 struct x265_param;
@@ -1967,6 +2079,111 @@ typedef struct x265_param
     /* Flag to turn on/off traditional scenecut detection in histogram based scenecut detection.
      * When false, only spatial properties are used for scenecut detection. Default true */
     int      bEnableTradScdInHscd;
+
+    /* Policy used by idle worker threads to choose between the job providers
+     * (frame encoders and lookahead) of their thread pool. X265_SCHED_SLICETYPE
+     * prefers the provider encoding the lowest slice type. X265_SCHED_CRITICAL_PATH
+     * first prefers the provider whose reconstructed rows the most frame
+     * encoders are blocked on, then the lowest slice type, then the frame
+     * furthest upstream in encode order. Default X265_SCHED_SLICETYPE */
+    int      schedPolicy;
+
+    /* Thread pools shared with other encoders of this process, as returned by
+     * x265_thread_pools_alloc(). When set, the encoder attaches its frame
+     * encoders and lookahead to these pools instead of allocating its own, and
+     * numaPools only matters to the extent it disables pools ("none").
+     * --lookahead-threads is not supported with shared pools. The pools must
+     * outlive the encoder. Default NULL */
+    x265_thread_pools* threadPools;
+
+    /* Fair-share weight of this encoder on shared thread pools. While several
+     * encoders compete for workers, each is favored until it runs a share of
+     * the workers proportional to its weight. Has no effect on pools owned by
+     * the encoder. Range 1 to 1000, default 1 */
+    int      poolWeight;
+
+    /* Enable runtime adaptation of the number of concurrently encoded frames.
+     * frameNumThreads frame encoders are allocated and act as the upper bound;
+     * at each keyframe the encoder compares the time its frame encoders spent
+     * blocked on reference rows with the idle time of the worker pools, and
+     * activates or parks one frame encoder. The frame thread count used for
+     * each frame is reported in x265_frame_stats. Ignored when frameNumThreads
+     * is 1. Default disabled */
+    int      bAdaptiveFrameThreads;
+
+    /* Back large pixel buffers (source, reconstructed and lowres planes and
+     * weighted reference planes) with 2MB pages, to reduce TLB misses of
+     * motion search and distortion primitives. Explicit huge pages
+     * (MAP_HUGETLB) are used if the system has reserved some, else the buffers
+     * are advised for transparent huge pages, else normal pages are used.
+     * Linux only. The bytes placed on or advised for huge pages are reported
+     * in x265_stats.
+     * Default disabled */
+    int      bHugePages;
+
+    /* Read slice types and cuTree QP offsets from a file of concatenated
+     * x265_lookahead_frame records, as returned by x265_lookahead_analyse()
+     * for the same source and settings. Pictures are matched by POC, and the
+     * lookahead skips its own slice type and cuTree analysis, as in the second
+     * pass of a multi-pass encode. Default NULL */
+    const char* lookaheadLoad;
+
+    /* Streaming slice type decisions for live encodes: the latency budget of
+     * the lookahead in milliseconds. Pictures are pre-analysed as they arrive
+     * and a mini-GOP is decided as soon as the budget's worth of pictures (at
+     * the configured frame rate, at most lookaheadDepth) is queued, instead of
+     * a full lookaheadDepth of pictures. Pictures queued beyond the budget are
+     * still used by the analysis. Default 0, disabled */
+    int      lookaheadLatency;
+
+    /* Measure the frame costs of the B-adapt trellis path decision on the
+     * lower resolution level of hierarchical motion estimation, a quarter of
+     * the lowres picture, instead of on the lowres picture itself. Only the
+     * costs of the chosen path (for cutree, VBV and rate control) are then
+     * estimated at lowres. Requires bEnableHME and b-adapt 2. Default 0 */
+    int      bHMEPathCosts;
+
+    /* In the second pass of a multi-pass encode without VBV, skip the lowres
+     * motion searches and frame cost estimates of the decided pictures. The
+     * slice types and cuTree offsets are read from the stats file and rate
+     * control reads no lowres cost, but the main encode loses the lowres
+     * motion vectors it uses as search candidates. Default 0 */
+    int      bFastSecondPass;
+
+    /* Format of the multi-pass stats file written by a pass with bStatWrite:
+     * X265_STATS_BINARY, an indexed binary file holding the cuTree offsets,
+     * or X265_STATS_TEXT, the text file plus a separate .cutree file. A pass
+     * with bStatRead detects the format of the file it reads. Default
+     * X265_STATS_BINARY */
+    int      statsFormat;
+
+    /* Format of the file written by analysisSave: X265_ANALYSIS_FORMAT_INDEXED,
+     * aligned frame records with an index by POC which a load maps in memory
+     * and reads ahead on a background thread, or X265_ANALYSIS_FORMAT_LEGACY,
+     * the sequential records of earlier versions. A load detects the format of
+     * the file it reads. Default X265_ANALYSIS_FORMAT_INDEXED */
+    int      analysisSaveFormat;
+
+    /* Compress each frame record of an indexed analysis save file with a fast
+     * LZ77 coder. Records which do not shrink are stored as they are.
+     * Default 0 */
+    int      bAnalysisSaveCompress;
+
+    /* In analysis save mode without a file (bUseAnalysisFile 0), hand the
+     * buffers of the analysis data returned in pic_out over to the caller,
+     * which releases them with x265_free_analysis_data() once they have been
+     * used, in place of the encoder freeing them on the next call to
+     * x265_encoder_encode(). Lets an application share the analysis of one
+     * encode with others without copying it. Default 0 */
+    int      bAnalysisSaveDetach;
+
+    /* Main10 and Main12 only: keep the lowres planes of the lookahead in 8
+     * bits, downshifted from the source as they are generated, and run the
+     * lookahead motion search, intra, weight and cuTree cost estimates with
+     * 8-bit primitives. Halves the memory of the lowres planes; the frame
+     * costs are then in 8-bit scale. Ignored by 8-bit builds and disabled by
+     * analysis save/load and lookahead load. Default 0 */
+    int      bLowres8bit;
 } x265_param;
 
 /* x265_param_alloc:
@@ -2163,6 +2380,42 @@ void x265_encoder_log(x265_encoder *encoder, int argc, char **argv);
  *      close an encoder handler */
 void x265_encoder_close(x265_encoder *);
 
+/* x265_lookahead_open:
+ *      create an encoder which only runs the lookahead: slice type decisions,
+ *      lowres cost estimates and cuTree, without encoding any picture. Feed it
+ *      with x265_lookahead_analyse() and release it with x265_encoder_close().
+ *      Returns NULL on failure */
+x265_encoder* x265_lookahead_open(x265_param *);
+
+/* x265_lookahead_analyse:
+ *      send one picture to an encoder created by x265_lookahead_open(), or
+ *      NULL to flush. Returns 1 if the decisions of a picture were written to
+ *      lookahead_out, 0 if none are available yet (when flushing: none are
+ *      left), and -1 on error */
+int x265_lookahead_analyse(x265_encoder *encoder, x265_picture *pic_in, x265_lookahead_frame *lookahead_out);
+
+/* x265_stats_merge:
+ *      plan the second pass of a title encoded in chunks (chunkStart, chunkEnd)
+ *      from the binary first pass stats of the chunks, given in title order.
+ *      The bits are allocated over the whole title with the rate control
+ *      options of param (ABR, and VBV if set), and the slice of the plan of
+ *      each chunk is written into its stats file, which the second pass of
+ *      the chunk then follows. Returns 0 on success, -1 on error */
+int x265_stats_merge(x265_param *param, const char * const *statsFiles, int numFiles);
+
+/* x265_thread_pools_alloc:
+ *      create and start a set of worker thread pools which any number of
+ *      encoders of this process may share by setting param->threadPools.
+ *      Pools are laid out according to param->numaPools exactly as an encoder
+ *      would lay out its own pools; param->schedPolicy and param->logLevel
+ *      are also honored. Returns NULL if no pool could be created */
+x265_thread_pools* x265_thread_pools_alloc(x265_param *);
+
+/* x265_thread_pools_free:
+ *      stop and release shared thread pools. All encoders using them must
+ *      have been closed first */
+void x265_thread_pools_free(x265_thread_pools *);
+
 /* x265_encoder_intra_refresh:
  *      If an intra refresh is not in progress, begin one with the next P-frame.
  *      If an intra refresh is in progress, begin one as soon as the current one finishes.
@@ -2302,6 +2555,11 @@ typedef struct x265_api
     void          (*vmaf_encoder_log)(x265_encoder*, int, char**, x265_param *, x265_vmaf_data *);
 #endif
     int           (*zone_param_parse)(x265_param*, const char*, const char*);
+    x265_thread_pools* (*thread_pools_alloc)(x265_param*);
+    void          (*thread_pools_free)(x265_thread_pools*);
+    x265_encoder* (*lookahead_open)(x265_param*);
+    int           (*lookahead_analyse)(x265_encoder*, x265_picture*, x265_lookahead_frame*);
+    int           (*stats_merge)(x265_param*, const char * const *, int);
     /* add new pointers to the end, or increment X265_MAJOR_VERSION */
 } x265_api;
 
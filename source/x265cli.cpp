@@ -101,6 +101,10 @@ namespace X265_NS {
         H0("   --pools <integer,...>         Comma separated thread count per thread pool (pool per NUMA node)\n");
         H0("                                 '-' implies no threads on node, '+' implies one thread per core on node\n");
         H0("-F/--frame-threads <integer>     Number of concurrently encoded frames. 0: auto-determined by core count\n");
+        H1("   --sched-policy <string>       Worker job provider selection: slicetype, critical-path. Default %s\n", x265_sched_policy_names[param->schedPolicy]);
+        H1("   --pool-weight <integer>       Fair-share weight of this encode on thread pools shared by an ABR ladder. Default %d\n", param->poolWeight);
+        H1("   --[no-]adaptive-frame-threads Adapt the number of active frame threads (up to -F) between GOPs. Default %s\n", OPT(param->bAdaptiveFrameThreads));
+        H1("   --[no-]huge-pages             Back large pixel buffers with 2MB pages (Linux). Default %s\n", OPT(param->bHugePages));
         H0("   --[no-]wpp                    Enable Wavefront Parallel Processing. Default %s\n", OPT(param->bEnableWavefront));
         H0("   --[no-]slices <integer>       Enable Multiple Slices feature. Default %d\n", param->maxSlices);
         H0("   --[no-]pmode                  Parallel mode analysis. Default %s\n", OPT(param->bDistributeModeAnalysis));
@@ -158,6 +162,7 @@ namespace X265_NS {
         H1("   --[no-]hme                    Enable Hierarchical Motion Estimation. Default %s\n", OPT(param->bEnableHME));
         H1("   --hme-search <string>         Motion search-method for HME L0,L1 and L2. Default(L0,L1,L2) is %d,%d,%d\n", param->hmeSearchMethod[0], param->hmeSearchMethod[1], param->hmeSearchMethod[2]);
         H1("   --hme-range <int>,<int>,<int> Motion search-range for HME L0,L1 and L2. Default(L0,L1,L2) is %d,%d,%d\n", param->hmeRange[0], param->hmeRange[1], param->hmeRange[2]);
+        H1("   --[no-]hme-path-costs         Measure b-adapt 2 path costs on the HME lower resolution level. Default %s\n", OPT(param->bHMEPathCosts));
         H0("\nSpatial / intra options:\n");
         H0("   --[no-]strong-intra-smoothing Enable strong intra smoothing for 32x32 blocks. Default %s\n", OPT(param->bEnableStrongIntraSmoothing));
         H0("   --[no-]constrained-intra      Constrained intra prediction (use only intra coded reference pixels) Default %s\n", OPT(param->bEnableConstrainedIntra));
@@ -187,6 +192,8 @@ namespace X265_NS {
         H0("   --rc-lookahead <integer>      Number of frames for frame-type lookahead (determines encoder latency) Default %d\n", param->lookaheadDepth);
         H1("   --lookahead-slices <0..16>    Number of slices to use per lookahead cost estimate. Default %d\n", param->lookaheadSlices);
         H0("   --lookahead-threads <integer> Number of threads to be dedicated to perform lookahead only. Default %d\n", param->lookaheadThreads);
+        H0("   --lookahead-latency <integer> Decide slice types as soon as this many milliseconds of frames are queued. Default %d (disabled)\n", param->lookaheadLatency);
+        H1("   --[no-]lowres-8bit            Main10/Main12: keep the lookahead lowres planes in 8 bits. Default %s\n", OPT(param->bLowres8bit));
         H0("-b/--bframes <0..16>             Maximum number of consecutive b-frames. Default %d\n", param->bframes);
         H1("   --bframe-bias <integer>       Bias towards B frame decisions. Default %d\n", param->bFrameBias);
         H0("   --b-adapt <0..2>              0 - none, 1 - fast, 2 - full (trellis) adaptive B frame scheduling. Default %d\n", param->bFrameAdaptive);
@@ -226,15 +233,21 @@ namespace X265_NS {
         H0("   --[no-]multi-pass-opt-distortion Use distortion of CTU from pass 1 to refine qp in 2 pass\n");
         H0("   --[no-]vbv-live-multi-pass    Enable realtime VBV in rate control 2 pass.Default %s\n", OPT(param->bliveVBV2pass));
         H0("   --stats                       Filename for stats file in multipass pass rate control. Default x265_2pass.log\n");
+        H1("   --stats-format <string>       Format of the written stats file: text, binary. Default %s\n", x265_stats_format_names[param->statsFormat]);
+        H1("   --stats-merge <file,file,..>  Plan the second passes of the chunks of a title from their binary stats, then exit\n");
         H0("   --[no-]analyze-src-pics       Motion estimation uses source frame planes. Default disable\n");
         H0("   --[no-]slow-firstpass         Enable a slow first pass in a multipass rate control mode. Default %s\n", OPT(param->rc.bEnableSlowFirstPass));
+        H1("   --[no-]fast-secondpass        Skip the lowres motion searches of a multipass second pass without VBV. Default %s\n", OPT(param->bFastSecondPass));
         H0("   --[no-]strict-cbr             Enable stricter conditions and tolerance for bitrate deviations in CBR mode. Default %s\n", OPT(param->rc.bStrictCbr));
         H0("   --analysis-save <filename>    Dump analysis info into the specified file. Default Disabled\n");
         H0("   --analysis-load <filename>    Load analysis buffers from the file specified. Default Disabled\n");
+        H0("   --lookahead-load <filename>   Load slice types and cuTree offsets saved by x265_lookahead_analyse(). Default Disabled\n");
         H0("   --analysis-reuse-file <filename>    Specify file name used for either dumping or reading analysis data. Deault x265_analysis.dat\n");
         H0("   --analysis-reuse-level <1..10>      Level of analysis reuse indicates amount of info stored/reused in save/load mode, 1:least..10:most. Now deprecated. Default %d\n", param->analysisReuseLevel);
         H0("   --analysis-save-reuse-level <1..10> Indicates the amount of analysis info stored in save mode, 1:least..10:most. Default %d\n", param->analysisSaveReuseLevel);
         H0("   --analysis-load-reuse-level <1..10> Indicates the amount of analysis info reused in load mode, 1:least..10:most. Default %d\n", param->analysisLoadReuseLevel);
+        H1("   --analysis-save-format <string> Format of the analysis save file: legacy, indexed. Default %s\n", x265_analysis_format_names[param->analysisSaveFormat]);
+        H1("   --[no-]analysis-save-compress Compress the frame records of an indexed analysis save file. Default %s\n", OPT(param->bAnalysisSaveCompress));
         H0("   --refine-analysis-type <string>     Reuse anlaysis information received through API call. Supported options are avc and hevc. Default disabled - %d\n", param->bAnalysisType);
         H0("   --scale-factor <int>          Specify factor by which input video is scaled down for analysis save mode. Default %d\n", param->scaleFactor);
         H0("   --refine-intra <0..4>         Enable intra refinement for encode that uses analysis-load.\n"
@@ -570,6 +583,7 @@ namespace X265_NS {
         const char *inputfn = NULL;
         const char *reconfn = NULL;
         const char *outputfn = NULL;
+        const char *statsMerge = NULL;
         const char *preset = NULL;
         const char *tune = NULL;
         const char *profile = NULL;
@@ -708,6 +722,7 @@ namespace X265_NS {
                 OPT("no-progress") this->bProgress = false;
                 OPT("output") outputfn = optarg;
                 OPT("input") inputfn = optarg;
+                OPT("stats-merge") statsMerge = optarg;
                 OPT("recon") reconfn = optarg;
                 OPT("input-depth") inputBitDepth = (uint32_t)x265_atoi(optarg, bError);
                 OPT("dither") this->bDither = true;
@@ -759,6 +774,21 @@ namespace X265_NS {
             }
         }
 
+        if (statsMerge)
+        {
+            /* plan the second passes of a chunked encode, nothing is encoded */
+            char* list = new char[strlen(statsMerge) + 1];
+            strcpy(list, statsMerge);
+            int numFiles = 0;
+            const char** files = new const char*[strlen(statsMerge) / 2 + 1];
+            for (char* name = strtok(list, ","); name; name = strtok(NULL, ","))
+                files[numFiles++] = name;
+            int ret = api->stats_merge(param, files, numFiles);
+            delete[] files;
+            delete[] list;
+            exit(ret ? 1 : 0);
+        }
+
         if (optind < argc && !inputfn)
             inputfn = argv[optind++];
         if (optind < argc && !outputfn)
@@ -59,6 +59,12 @@ static const struct option long_options[] =
     { "preset",         required_argument, NULL, 'p' },
     { "tune",           required_argument, NULL, 't' },
     { "frame-threads",  required_argument, NULL, 'F' },
+    { "sched-policy",   required_argument, NULL, 0 },
+    { "pool-weight",    required_argument, NULL, 0 },
+    { "adaptive-frame-threads", no_argument, NULL, 0 },
+    { "no-adaptive-frame-threads", no_argument, NULL, 0 },
+    { "huge-pages",           no_argument, NULL, 0 },
+    { "no-huge-pages",        no_argument, NULL, 0 },
     { "no-pmode",             no_argument, NULL, 0 },
     { "pmode",                no_argument, NULL, 0 },
     { "no-pme",               no_argument, NULL, 0 },
@@ -155,7 +161,10 @@ static const struct option long_options[] =
     { "intra-refresh",        no_argument, NULL, 0 },
     { "rc-lookahead",   required_argument, NULL, 0 },
     { "lookahead-slices", required_argument, NULL, 0 },
+    { "lookahead-latency", required_argument, NULL, 0 },
     { "lookahead-threads", required_argument, NULL, 0 },
+    { "lowres-8bit",          no_argument, NULL, 0 },
+    { "no-lowres-8bit",       no_argument, NULL, 0 },
     { "bframes",        required_argument, NULL, 'b' },
     { "bframe-bias",    required_argument, NULL, 0 },
     { "b-adapt",        required_argument, NULL, 0 },
@@ -281,6 +290,8 @@ static const struct option long_options[] =
     { "nr-intra",       required_argument, NULL, 0 },
     { "nr-inter",       required_argument, NULL, 0 },
     { "stats",          required_argument, NULL, 0 },
+    { "stats-format",   required_argument, NULL, 0 },
+    { "stats-merge",    required_argument, NULL, 0 },
     { "pass",           required_argument, NULL, 0 },
     { "multi-pass-opt-analysis", no_argument, NULL, 0 },
     { "no-multi-pass-opt-analysis",    no_argument, NULL, 0 },
@@ -290,6 +301,8 @@ static const struct option long_options[] =
     { "no-vbv-live-multi-pass",        no_argument, NULL, 0 },
     { "slow-firstpass",       no_argument, NULL, 0 },
     { "no-slow-firstpass",    no_argument, NULL, 0 },
+    { "fast-secondpass",      no_argument, NULL, 0 },
+    { "no-fast-secondpass",   no_argument, NULL, 0 },
     { "multi-pass-opt-rps",   no_argument, NULL, 0 },
     { "no-multi-pass-opt-rps", no_argument, NULL, 0 },
     { "analysis-reuse-mode", required_argument, NULL, 0 }, /* DEPRECATED */
@@ -297,8 +310,12 @@ static const struct option long_options[] =
     { "analysis-reuse-level", required_argument, NULL, 0 }, /* DEPRECATED */
     { "analysis-save-reuse-level", required_argument, NULL, 0 },
     { "analysis-load-reuse-level", required_argument, NULL, 0 },
+    { "analysis-save-format", required_argument, NULL, 0 },
+    { "analysis-save-compress", no_argument, NULL, 0 },
+    { "no-analysis-save-compress", no_argument, NULL, 0 },
     { "analysis-save",  required_argument, NULL, 0 },
     { "analysis-load",  required_argument, NULL, 0 },
+    { "lookahead-load", required_argument, NULL, 0 },
     { "scale-factor",   required_argument, NULL, 0 },
     { "refine-intra",   required_argument, NULL, 0 },
     { "refine-inter",   required_argument, NULL, 0 },
@@ -377,6 +394,8 @@ static const struct option long_options[] =
     { "cll", no_argument, NULL, 0 },
     { "no-cll", no_argument, NULL, 0 },
     { "hme-range", required_argument, NULL, 0 },
+    { "hme-path-costs",       no_argument, NULL, 0 },
+    { "no-hme-path-costs",    no_argument, NULL, 0 },
     { "abr-ladder", required_argument, NULL, 0 },
     { "min-vbv-fullness", required_argument, NULL, 0 },
     { "max-vbv-fullness", required_argument, NULL, 0 },